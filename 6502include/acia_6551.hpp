@@ -0,0 +1,145 @@
+#ifndef __ACIA_6551_HPP__
+#define __ACIA_6551_HPP__
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <termios.h>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "replay.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+
+namespace acia_6551 {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct Ring;
+    struct ACIA;
+
+    // Register offsets, the chip only decodes the bottom two address lines
+    const Word REG_DATA = 0;
+    const Word REG_STATUS = 1;
+    const Word REG_COMMAND = 2;
+    const Word REG_CONTROL = 3;
+
+    // Status register bits
+    const Byte STATUS_RDRF = 0x08;  // Receiver data register full
+    const Byte STATUS_TDRE = 0x10;  // Transmitter data register empty
+    const Byte STATUS_IRQ = 0x80;
+
+    // Command register bits
+    const Byte COMMAND_DTR = 0x01;          // Data terminal ready, chip is off without it
+    const Byte COMMAND_RX_IRQ_OFF = 0x02;   // Receiver IRQ *disable*
+    const Byte COMMAND_TX_MASK = 0x0C;
+    const Byte COMMAND_TX_IRQ_ON = 0x04;    // Transmitter IRQ enable, RTS low
+}
+
+// Fixed size byte FIFO between the emulated chip and the host file descriptor
+struct acia_6551::Ring {
+    static const unsigned int SIZE = 4096;  // Must be a power of two
+
+    Byte Data[SIZE];
+    unsigned int Head = 0;  // Next slot to write
+    unsigned int Tail = 0;  // Next slot to read
+
+    unsigned int Count() const { return Head - Tail; }
+    unsigned int Space() const { return SIZE - Count(); }
+    bool Empty() const { return Head == Tail; }
+    bool Full() const { return Count() == SIZE; }
+
+    void Push(Byte b) { Data[Head++ & (SIZE - 1)] = b; }
+    Byte Pop() { return Data[Tail++ & (SIZE - 1)]; }
+
+    // Contiguous readable bytes starting at Tail, for handing to write()
+    unsigned int ContiguousCount() const;
+    const Byte *Front() const { return &Data[Tail & (SIZE - 1)]; }
+    void Drop(unsigned int n) { Tail += n; }
+};
+
+// 6551 style serial port. The host side is any pair of file descriptors
+// (stdin/stdout, a pty, a Unix socket), in non-blocking mode or polled before
+// writing, and only ever touched from a scheduler event, so a host that isn't
+// sending anything never holds up emulation. Output is collected in a ring and written out in
+// one go every FlushCycles, or sooner if the ring fills up.
+struct acia_6551::ACIA : mem_28c256::Device, state_6502::Stateful {
+    ACIA(cpu_6502::CPU &cpu, events_6502::Scheduler &events, cpu_6502::Byte irqLine);
+    ~ACIA();
+
+    // Host side. All of these replace whatever was attached before.
+    void AttachFds(int rxFd, int txFd);       // Doesn't take ownership
+    bool AttachStdio();
+    bool OpenPty(std::string &slaveName);      // slaveName is what to point `screen` at
+    bool ListenUnixSocket(const std::string &path);
+    void Detach();
+
+    // mem_28c256::Device
+    Byte Read(Word addr) override;
+    void Write(Word addr, Byte data) override;
+
+    // state_6502::Stateful. Bytes still buffered in either direction are
+    // part of the state, the host connection isn't.
+    void SaveState(state_6502::Packer &out) const override;
+    bool LoadState(state_6502::Unpacker &in) override;
+
+    // Push out anything still buffered, even if it's early
+    void Flush();
+
+    uint64_t PollCycles = 1000;     // How often to check the host for input
+    uint64_t FlushCycles = 10000;   // Longest output sits in the ring
+
+    // Chip state
+    Byte RxData = 0;
+    Byte Status = STATUS_TDRE;
+    Byte Command = 0;
+    Byte Control = 0;
+
+    Ring Rx;
+    Ring Tx;
+
+    // Host side state
+    int RxFd = -1;
+    int TxFd = -1;
+    int ListenFd = -1;  // Unix socket we accept connections on
+    int OwnedFd = -1;   // Closed by Detach()
+    int SlaveFd = -1;   // Pty slave, kept open so the master doesn't see EOF
+    int SavedStdinFlags = -1;
+    bool PollTx = false;    // TxFd is stdout, left blocking
+    bool RestoreTermios = false;
+    struct termios SavedTermios;
+    std::string SocketPath;
+
+    uint64_t LastFlush = 0;
+    unsigned int PollEvent = 0;
+
+    // Set to record host input into a journal, or to take it from one
+    // instead of the host. Either way the ring empties on every flush, so
+    // the firmware never sees how fast the host happened to be. Output the
+    // host can't take straight away waits in Unsent, up to MaxUnsent bytes;
+    // past that it's dropped and counted in BytesDropped.
+    replay_6502::Journal *Journal = nullptr;
+    std::string Unsent;
+    size_t MaxUnsent = 1 << 20;
+
+    // Stats, mostly to prove the batching works
+    uint64_t BytesIn = 0;
+    uint64_t BytesOut = 0;
+    uint64_t WriteCalls = 0;
+    uint64_t BytesDropped = 0;
+
+    cpu_6502::CPU &Cpu;
+    events_6502::Scheduler &Events;
+    cpu_6502::Byte IRQLine;
+
+    void Poll(uint64_t now);
+    void FillRx();
+    void DrainTx();
+    void WriteUnsent();
+    ssize_t WriteHost(const void *data, size_t size);
+    void LoadNextRxByte();
+    void UpdateIRQ();
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef __BLOCK_DEVICE_HPP__
+#define __BLOCK_DEVICE_HPP__
+
+#include <cstdint>
+#include <string>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+
+namespace block_device {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct BlockDevice;
+
+    const unsigned int SECTOR_SIZE = 512;
+
+    // Register offsets, the bottom four address lines are decoded
+    const Word REG_COMMAND = 0x0;   // Write: command, read: status
+    const Word REG_DATA = 0x1;      // PIO byte port
+    const Word REG_LBA0 = 0x2;      // Sector number, little endian
+    const Word REG_LBA1 = 0x3;
+    const Word REG_LBA2 = 0x4;
+    const Word REG_LBA3 = 0x5;
+    const Word REG_DMA_LO = 0x6;    // Where in memory DMA goes to/from
+    const Word REG_DMA_HI = 0x7;
+    const Word REG_COUNT = 0x8;     // Sectors per DMA transfer, 0 means 1
+    const Word REG_CONTROL = 0x9;
+
+    // Commands
+    const Byte CMD_READ = 0x01;         // Sector into the PIO buffer
+    const Byte CMD_WRITE = 0x02;        // PIO buffer out to the sector once it's full
+    const Byte CMD_DMA_READ = 0x03;     // Image -> memory
+    const Byte CMD_DMA_WRITE = 0x04;    // Memory -> image
+    const Byte CMD_FLUSH = 0x05;        // msync the image
+
+    // Status bits
+    const Byte STATUS_ERR = 0x01;
+    const Byte STATUS_DRQ = 0x08;   // DATA wants reading/writing
+    const Byte STATUS_IRQ = 0x20;
+    const Byte STATUS_READY = 0x40;
+    const Byte STATUS_BUSY = 0x80;
+
+    // Control bits
+    const Byte CONTROL_IRQ_ON = 0x01;   // Interrupt when a DMA transfer finishes
+}
+
+// Simple block storage controller backed by a host image file. The image is
+// mmap'd, so sectors move with a memcpy straight out of the page cache
+// rather than a read() per access.
+//
+// PIO transfers go a byte at a time through DATA and cost whatever the
+// firmware's loop costs. DMA transfers copy whole sectors straight into
+// Mem::Data and keep the device busy for CyclesPerSector each instead, which
+// is roughly what an SD card on a fast SPI link would take without having to
+// emulate the bit banging. DMA ignores device mappings, same as a real
+// controller talking to RAM behind the decoder's back.
+struct block_device::BlockDevice : mem_28c256::Device, state_6502::Stateful {
+    BlockDevice(cpu_6502::CPU &cpu, mem_28c256::Mem &mem, events_6502::Scheduler &events, cpu_6502::Byte irqLine);
+    ~BlockDevice();
+
+    // Host side. Open() replaces whatever was open before.
+    bool Open(const std::string &path, bool readOnly = false);
+    void Close();
+    bool IsOpen() const { return Image != nullptr; }
+
+    // mem_28c256::Device
+    Byte Read(Word addr) override;
+    void Write(Word addr, Byte data) override;
+
+    // state_6502::Stateful. The image itself is the host's business, only
+    // the controller (including a DMA transfer in flight) is saved.
+    void SaveState(state_6502::Packer &out) const override;
+    bool LoadState(state_6502::Unpacker &in) override;
+
+    uint64_t CyclesPerSector = 600;     // DMA cost per sector
+    uint64_t CommandCycles = 50;        // Fixed DMA setup cost
+
+    // Controller state
+    Byte Status = 0;
+    Byte Control = 0;
+    uint32_t LBA = 0;
+    Word DMAAddress = 0;
+    Byte Count = 0;
+
+    // PIO transfer in progress
+    Byte Buffer[SECTOR_SIZE];
+    unsigned int BufferPos = 0;
+    bool Writing = false;
+    uint32_t BufferLBA = 0;
+
+    // DMA transfer in progress
+    Byte PendingCommand = 0;
+    unsigned int DMAEvent = 0;
+    uint64_t DMADone = 0;       // Cycle the transfer finishes on
+
+    // Host side state
+    Byte *Image = nullptr;
+    uint64_t ImageSize = 0;
+    uint32_t Sectors = 0;
+    bool ReadOnly = false;
+    int Fd = -1;
+
+    // Stats
+    uint64_t SectorsRead = 0;
+    uint64_t SectorsWritten = 0;
+    uint64_t DMATransfers = 0;
+
+    cpu_6502::CPU &Cpu;
+    mem_28c256::Mem &Memory;
+    events_6502::Scheduler &Events;
+    cpu_6502::Byte IRQLine;
+
+    void StartCommand(Byte cmd);
+    void FinishDMA();
+    void Fail();
+    Byte *Sector(uint32_t lba) { return Image + uint64_t(lba) * SECTOR_SIZE; }
+    unsigned int TransferSectors() const { return Count ? Count : 1; }
+    void UpdateIRQ();
+};
+
+#endif
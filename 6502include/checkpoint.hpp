@@ -0,0 +1,101 @@
+#ifndef __CHECKPOINT_HPP__
+#define __CHECKPOINT_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "savestate.hpp"
+
+namespace checkpoint_6502 {
+    using Byte = uint8_t;
+
+    struct Snapshot;
+    struct Checkpointer;
+
+    // Checkpoint files already on disk for `base`, oldest first. Files are
+    // named base.000001, base.000002 and so on.
+    std::vector<std::string> List(const std::string &base);
+
+    // Load the newest checkpoint that checks out, skipping over any that
+    // don't. `path` (if given) gets the one that was used.
+    bool Resume(const std::string &base, cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+                const state_6502::Devices &devices = state_6502::Devices(), std::string *path = nullptr);
+}
+
+// What the emulator hands to the writer: registers, device blobs and only
+// the pages that changed since the last checkpoint
+struct checkpoint_6502::Snapshot {
+    cpu_6502::CPU Cpu;
+    std::vector<std::pair<std::string, std::string>> Devices;
+    std::vector<Byte> PageIndex;
+    std::vector<Byte> Pages;    // PAGE_SIZE bytes per entry in PageIndex
+    int Slot[NUM_PAGES];        // Where each page is in PageIndex, -1 if it isn't
+
+    Snapshot() { Clear(); }
+    void Clear();
+};
+
+// Periodic checkpoints that don't hold up the emulator. Take() copies the
+// dirty pages out (a few microseconds even if all 256 changed) and returns;
+// a background thread keeps a full copy of memory up to date from those,
+// compresses it and writes it out as a regular save state.
+//
+// Double buffered: the writer works on one snapshot while Take() fills the
+// other. If the writer falls behind, new snapshots merge into the one
+// that's waiting instead of queueing up, so a slow disk costs checkpoints
+// rather than emulation speed. Only the newest Keep files are kept.
+struct checkpoint_6502::Checkpointer {
+    Checkpointer(const std::string &base, unsigned int keep = 3);
+    ~Checkpointer();    // Writes out whatever is still waiting
+
+    // Emulator thread only
+    void Take(const cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+              const state_6502::Devices &devices = state_6502::Devices());
+
+    // Block until everything taken so far is on disk
+    void Flush();
+
+    std::string Base;
+    unsigned int Keep;
+
+    // Stats
+    uint64_t Taken = 0;
+    uint64_t Merged = 0;                // Taken while the previous one was still waiting
+    uint64_t TakeNs = 0;                // Emulator time spent in Take(), all of them
+    std::atomic<uint64_t> WriteNs{0};   // Writer time spent on files, written or failed
+    std::atomic<uint64_t> Written{0};
+    std::atomic<uint64_t> Failed{0};
+    std::atomic<uint64_t> Sequence{0};  // Number of the last file written
+
+    // Emulator side
+    uint64_t Mark = 0;      // Mem write generation at the last Take()
+    bool First = true;      // The first snapshot has to carry every page
+
+    // Shared, under Lock
+    std::mutex Lock;
+    std::condition_variable Wake;
+    std::condition_variable Idle;
+    Snapshot Pending;
+    bool HavePending = false;
+    bool Writing = false;
+    bool Quit = false;
+
+    // Writer side
+    Snapshot Working;
+    mem_28c256::Mem *Shadow;
+    std::thread Writer;
+
+    void WriterLoop();
+    void WriteOut();
+    void Prune();
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __COVERAGE_HPP__
+#define __COVERAGE_HPP__
+
+#include <cstdint>
+#include <ostream>
+
+namespace coverage_6502 {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct Coverage;
+
+    const unsigned int BITSET_WORDS = 65536 / 64;
+}
+
+namespace symbols_6502 {
+    struct Table;
+}
+
+// Which addresses the CPU executed, read and wrote, one bit each (three 8KB
+// bitsets), plus access counts per page for a heatmap. Hang one off
+// Mem::Coverage in the profiling build (cmake -DPROFILE=ON) and the memory
+// layer keeps it up to date. Opcode and operand fetches count as executed
+// rather than read, so the read set is just data.
+struct coverage_6502::Coverage {
+    uint64_t Executed[BITSET_WORDS];
+    uint64_t Read[BITSET_WORDS];
+    uint64_t Written[BITSET_WORDS];
+
+    // Per 256 byte page, for the heatmap
+    uint64_t Fetches[256];
+    uint64_t Reads[256];
+    uint64_t Writes[256];
+
+    Coverage() { Clear(); }
+    void Clear();
+
+    // Called by Mem
+    void OnFetch(Word addr) {
+        Executed[addr >> 6] |= uint64_t(1) << (addr & 63);
+        Fetches[addr >> 8]++;
+    }
+    void OnRead(Word addr) {
+        Read[addr >> 6] |= uint64_t(1) << (addr & 63);
+        Reads[addr >> 8]++;
+    }
+    void OnWrite(Word addr) {
+        Written[addr >> 6] |= uint64_t(1) << (addr & 63);
+        Writes[addr >> 8]++;
+    }
+
+    static bool Test(const uint64_t *bits, Word addr) { return bits[addr >> 6] >> (addr & 63) & 1; }
+    // Set bits from `first` to `last` inclusive
+    static unsigned int Count(const uint64_t *bits, Word first, Word last);
+
+    // Bytes executed, read and written per symbol, covering the whole of
+    // each symbol's range so routines that never ran show up as 0%. Without
+    // symbols it goes by page instead.
+    void Report(std::ostream &out, const symbols_6502::Table *symbols = nullptr) const;
+
+    // One row per page: the bytes of it executed, read and written and how
+    // many accesses of each kind it got
+    void WriteCSV(std::ostream &out) const;
+
+    // A 256x256 binary PPM, one pixel per address and one row per page.
+    // Red is written, green executed, blue read, each scaled by how busy the
+    // page was, so hot pages stand out and untouched memory stays black.
+    void WritePPM(std::ostream &out) const;
+};
+
+#endif
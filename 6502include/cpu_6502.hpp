@@ -7,6 +7,7 @@
 #include <iostream>
 
 #include "mem_28c256.hpp"
+#include "scheduler.hpp"
 
 namespace cpu_6502 {
     using Byte = uint8_t;
@@ -16,6 +17,16 @@ namespace cpu_6502 {
     struct StatusFlags;
 }
 
+namespace trace_6502 {
+    struct Record;
+    struct Tracer;
+}
+
+namespace profile_6502 {
+    struct Profile;
+    struct CallGraph;
+}
+
 struct cpu_6502::StatusFlags {
     // Processor status flags: only 1 bit long and are technically supposed to
     // be in a single byte. In order these flags are: the carry flag, the zero
@@ -52,6 +63,36 @@ struct cpu_6502::CPU {
         struct StatusFlags SF;
     };
 
+    uint64_t Cycles = 0;  // Cycles run since the last reset. 64 bits so that an
+                // idle OS left running for a few simulated days can't wrap it.
+    uint64_t Instructions = 0;  // Instructions run since the last reset, interrupts not
+                // included. Just a statistic, save states and hashes leave it out.
+    uint64_t Interrupts = 0;    // IRQs and NMIs taken, same deal
+
+    bool Waiting = false; // Set by WAI, cleared as soon as an interrupt line goes active
+    bool Stopped = false; // Set by STP, only a reset gets the CPU going again
+    uint64_t StoppedAt = 0; // Cycle count when the STP finished. The clock keeps
+                // going while stopped, so Cycles alone doesn't say how long the program ran.
+
+    cpu_6502::Byte IRQLines = 0; // One bit per device holding /IRQ low, see AssertIRQ
+    bool NMIPending = false;     // NMI is edge triggered, so it's latched until serviced
+
+    // Devices with timers put their deadlines in here. Optional, but without
+    // it a WAI can only sleep until the end of the Execute() call.
+    events_6502::Scheduler *Events = nullptr;
+
+    // Instruction trace capture, see trace.hpp. Off it costs one test per
+    // instruction.
+    trace_6502::Tracer *Trace = nullptr;
+
+#ifdef CPU_6502_PROFILE
+    // Profiling build only: execution counters and the shadow call stack,
+    // see profile.hpp
+    profile_6502::Profile *Profile = nullptr;
+    profile_6502::CallGraph *Calls = nullptr;
+    bool PagePenalty = false;   // This instruction took the page crossing cycle
+#endif
+
     // Read byte from memory, increment program counter and decrement nCycles
     cpu_6502::Byte FetchByte(mem_28c256::Mem &mem);
 
@@ -74,9 +115,41 @@ struct cpu_6502::CPU {
     // Write to register using value
     void WriteRegister(cpu_6502::Byte &reg, cpu_6502::Byte value);
 
-    // Execute instruction based on PC location
+    // Execute instructions from PC until at least nCycles have been used up.
+    // The last instruction is always allowed to finish, so this can overshoot
+    // by a few cycles; the Cycles counter has the exact total.
     void Execute(unsigned int nCycles, mem_28c256::Mem &mem);
 
+#ifdef CPU_6502_CYCLE_EXACT
+    // Cycle exact build only: called for every bus cycle the CPU makes, dummy
+    // reads and writes included, with Cycles as it was at the start of it.
+    std::function<void(uint64_t cycle, cpu_6502::Word addr, cpu_6502::Byte data, bool write)> BusCycle;
+#endif
+
+    // Every memory access goes through these. In the cycle exact build each
+    // one is a bus cycle and advances Cycles; in the fast build the whole
+    // instruction gets charged at the end instead.
+    cpu_6502::Byte BusRead(cpu_6502::Word addr, mem_28c256::Mem &mem);
+    cpu_6502::Byte BusFetch(cpu_6502::Word addr, mem_28c256::Mem &mem);   // Opcode and operand bytes
+    void BusWrite(cpu_6502::Word addr, cpu_6502::Byte data, mem_28c256::Mem &mem);
+
+    // Accesses the real chip makes and throws away the result of. They only
+    // show up on the bus in the cycle exact build, the fast build compiles
+    // them away and just charges the cycle.
+    void DummyRead(cpu_6502::Word addr, mem_28c256::Mem &mem);
+    void DummyWrite(cpu_6502::Word addr, cpu_6502::Byte data, mem_28c256::Mem &mem);
+
+    // Interrupt lines. Each device gets its own bit in IRQLines so that one
+    // device releasing /IRQ doesn't drop another one's request.
+    void AssertIRQ(cpu_6502::Byte line);
+    void ReleaseIRQ(cpu_6502::Byte line);
+    void TriggerNMI();
+
+    // Push PC and flags and jump through the given vector (0xFFFA for NMI,
+    // 0xFFFE for IRQ)
+    void Interrupt(cpu_6502::Word vector, mem_28c256::Mem &mem);
+    void TraceInterrupt(trace_6502::Record *traced, cpu_6502::Byte kind, cpu_6502::Word vector);
+
     // Reset everything to default status
     void Reset(mem_28c256::Mem &mem);
 
@@ -91,11 +164,21 @@ struct cpu_6502::CPU {
     cpu_6502::Byte AddressingZeroPageX(mem_28c256::Mem &mem);
     cpu_6502::Byte AddressingZeroPageY(mem_28c256::Mem &mem);
     cpu_6502::Word AddressingAbsolute(mem_28c256::Mem &mem);
-    cpu_6502::Word AddressingAbsoluteX(mem_28c256::Mem &mem);
-    cpu_6502::Word AddressingAbsoluteY(mem_28c256::Mem &mem);
+    // The indexed modes set PageCrossed when adding the index carried into
+    // the high byte, which costs reads an extra cycle. Pass write = true for
+    // stores and read-modify-write, which always take that cycle.
+    cpu_6502::Word AddressingAbsoluteX(mem_28c256::Mem &mem, bool write = false);
+    cpu_6502::Word AddressingAbsoluteY(mem_28c256::Mem &mem, bool write = false);
     cpu_6502::Word AddressingIndirect(mem_28c256::Mem &mem);
     cpu_6502::Word AddressingIndexedIndirect(mem_28c256::Mem &mem);
-    cpu_6502::Word AddressingIndirectIndexed(mem_28c256::Mem &mem);
+    cpu_6502::Word AddressingIndirectIndexed(mem_28c256::Mem &mem, bool write = false);
+    cpu_6502::Word IndexAddress(cpu_6502::Word base, cpu_6502::Byte index, bool write, mem_28c256::Mem &mem);
+
+    bool PageCrossed = false;
+
+    // Where the last addressing mode pointed. Only cleared per instruction
+    // while tracing, otherwise it's whatever the last one that had one was.
+    cpu_6502::Word EffectiveAddress = 0;
 
     // Stack operations
     cpu_6502::Word SPToAddr();
@@ -266,6 +349,10 @@ struct cpu_6502::CPU {
         INS_NOP = 0xEA,
         INS_RTI = 0x40,
 
+        // 65C02 only
+        INS_WAI = 0xCB,
+        INS_STP = 0xDB,
+
         INS_PHA = 0x48,
         INS_PHP = 0x08,
         INS_PLA = 0x68,
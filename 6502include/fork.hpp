@@ -0,0 +1,52 @@
+#ifndef __FORK_HPP__
+#define __FORK_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+
+namespace fork_6502 {
+    struct Result;
+    struct Forker;
+
+    // Runs in the child. Whatever it returns gets sent back to the parent.
+    using Body = std::function<std::string(unsigned int index, cpu_6502::CPU &cpu, mem_28c256::Mem &mem)>;
+}
+
+struct fork_6502::Result {
+    std::string Output;     // What the body returned
+    int ExitCode = -1;      // 0 if the body returned normally
+    int Signal = 0;         // Set if the child was killed (crash, abort...)
+
+    bool Ok() const { return ExitCode == 0 && Signal == 0; }
+};
+
+// Splits a running machine into N children that each carry on from the same
+// point, e.g. a boot that's already been done once, with different inputs.
+//
+// Each child is a fork() of this process, so the kernel shares every page
+// copy-on-write: starting a child costs the same whether it's just CPU and
+// Mem or a whole set of devices with their scheduler events and host file
+// descriptors, and whatever a child does can't leak back into the parent or
+// its siblings. Results come back over a pipe.
+//
+// fork() only takes the calling thread along, so don't call this while other
+// threads hold locks the body needs.
+struct fork_6502::Forker {
+    unsigned int MaxParallel = 0;   // Children alive at once, 0 = one per core
+
+    // Filled in by Run()
+    uint64_t ForkNs = 0;            // Total time the parent spent in fork()
+    unsigned int Forks = 0;
+    int Error = 0;                  // errno if waiting on the children failed and Run() gave up
+
+    // Run body(i, cpu, mem) in child i for i in [0, n). Results are in
+    // index order. `cpu` and `mem` are never touched in the parent.
+    std::vector<Result> Run(unsigned int n, cpu_6502::CPU &cpu, mem_28c256::Mem &mem, const Body &body);
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __HASH_HPP__
+#define __HASH_HPP__
+
+#include <cstdint>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "savestate.hpp"
+
+namespace hash_6502 {
+    using Byte = uint8_t;
+
+    struct Tracker;
+
+    // Hash of the whole machine: registers (cycle counter included), every
+    // page of memory and the saved state of each device. Two machines with
+    // the same hash are, for all practical purposes, in the same state.
+    //
+    // It's a sum of independent parts rather than one pass over everything,
+    // so a single page can be swapped out of it without rehashing the rest.
+    uint64_t Hash(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem,
+                  const state_6502::Devices &devices = state_6502::Devices());
+
+    // The parts
+    uint64_t CpuHash(const cpu_6502::CPU &cpu);
+    uint64_t PageHash(unsigned int page, const Byte *data);
+    uint64_t DevicesHash(const state_6502::Devices &devices);
+}
+
+// Keeps Hash() up to date without going over all 64K every time. Each page's
+// hash is remembered and only the pages Mem's write generations say have
+// changed get rehashed, so asking at every instruction boundary of a run
+// that sticks to a few pages costs a few pages. Comes out the same as
+// Hash() on the same machine.
+//
+// Good for comparing runs (two engines, a run against a golden log) every
+// N cycles and only digging in when the hashes differ. Anything that pokes
+// Mem::Data directly has to Touch() it, same as for checkpoints.
+struct hash_6502::Tracker {
+    uint64_t Hash(const cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+                  const state_6502::Devices &devices = state_6502::Devices());
+
+    // Forget everything, e.g. after switching to a different Mem
+    void Reset() { Primed = false; }
+
+    // Stats
+    uint64_t Queries = 0;
+    uint64_t PagesHashed = 0;
+
+    bool Primed = false;
+    uint64_t Mark = 0;
+    uint64_t MemSum = 0;
+    uint64_t Pages[NUM_PAGES];
+};
+
+#endif
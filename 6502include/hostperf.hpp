@@ -0,0 +1,59 @@
+#ifndef __HOSTPERF_HPP__
+#define __HOSTPERF_HPP__
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace hostperf_6502 {
+    struct Sample;
+    struct Counters;
+
+    // Which host counters there are, in Sample order
+    const unsigned int HOST_CYCLES = 0;
+    const unsigned int HOST_INSTRUCTIONS = 1;
+    const unsigned int BRANCH_MISSES = 2;
+    const unsigned int L1D_MISSES = 3;
+    const unsigned int NUM_COUNTERS = 4;
+}
+
+struct hostperf_6502::Sample {
+    uint64_t Ns = 0;
+    uint64_t Count[NUM_COUNTERS] = {};
+};
+
+// What the host spends running the emulator: wall clock time always, and
+// host cycles, instructions, branch misses and L1 data cache misses from
+// Linux perf events where the kernel lets us have them. Wrap Start()/Stop()
+// around Execute() slices (not single instructions, each pair is a few
+// syscalls) and the totals build up in Total.
+//
+// perf_event_open fails in plenty of places: containers, most VMs, or
+// kernel.perf_event_paranoid set high. Then Available() says which counters
+// did open, Why says what went wrong, and only the clock gets measured.
+struct hostperf_6502::Counters {
+    Counters();
+    ~Counters();
+
+    bool Available(unsigned int counter) const { return Fds[counter] >= 0; }
+    bool Hardware() const { return Leader >= 0; }
+    std::string Why;
+
+    void Start();
+    void Stop();
+    void Clear() { Total = Sample(); Slices = 0; }
+
+    Sample Total;
+    uint64_t Slices = 0;
+
+    // Emulated MIPS and MHz, then the host counters per emulated instruction
+    void Report(std::ostream &out, uint64_t instructions, uint64_t cycles) const;
+
+    // perf event fds, -1 where a counter couldn't be opened. The first one
+    // that opened leads the group, so they all start and stop together.
+    int Fds[NUM_COUNTERS];
+    int Leader = -1;
+    uint64_t StartNs = 0;
+};
+
+#endif
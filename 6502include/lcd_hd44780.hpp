@@ -0,0 +1,110 @@
+#ifndef __LCD_HD44780_HPP__
+#define __LCD_HD44780_HPP__
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "cpu_6502.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+#include "via_65c22.hpp"
+
+namespace lcd_hd44780 {
+    using Byte = uint8_t;
+
+    struct LCD;
+
+    // Ben Eater's wiring: data on port B, control lines on the top of port A
+    const Byte PIN_E = 0x80;
+    const Byte PIN_RW = 0x40;
+    const Byte PIN_RS = 0x20;
+
+    const Byte BUSY_FLAG = 0x80;
+}
+
+// HD44780 character LCD hanging off a VIA. Commands only take effect on the
+// falling edge of E, and the controller stays busy for as long as the real
+// one would (37 us for most things, 1.52 ms for clear/home), measured in CPU
+// cycles. Writes that arrive while it's busy are dropped like on hardware,
+// which is the bug firmware tests usually want to catch.
+//
+// Terminal output is optional. When enabled it only redraws if DDRAM or the
+// cursor actually changed, and at most once every RefreshCycles of emulated
+// time and MinRenderNs of wall time.
+struct lcd_hd44780::LCD : via_65c22::PortDevice, state_6502::Stateful {
+    LCD(cpu_6502::CPU &cpu);
+    ~LCD();
+
+    unsigned int Columns = 16;
+    unsigned int Rows = 2;
+    uint64_t ClockHz = 1000000;     // To turn datasheet microseconds into cycles
+
+    // Controller state
+    Byte DDRAM[0x80];
+    Byte CGRAM[0x40];
+    Byte AC = 0;                // Address counter
+    bool AddressingCGRAM = false;
+    bool Increment = true;      // Entry mode I/D
+    bool ShiftOnWrite = false;  // Entry mode S
+    bool DisplayOn = false;
+    bool CursorOn = false;
+    bool BlinkOn = false;
+    bool EightBit = true;
+    bool TwoLines = false;
+    unsigned int DisplayShift = 0;
+    uint64_t BusyUntil = 0;
+
+    // Pin state
+    bool PrevE = false;
+    bool ReadCycle = false;
+    bool SecondNibble = false;  // 4-bit mode: next transfer is the low nibble
+    Byte PendingHigh = 0;
+    Byte ReadLatch = 0;
+
+    // Counters for tests and the harness
+    uint64_t Commands = 0;
+    uint64_t DataWrites = 0;
+    uint64_t WritesWhileBusy = 0;
+
+    // Rendering
+    bool Dirty = true;
+    uint64_t RefreshCycles = 33333;     // ~30 Hz at 1 MHz
+    uint64_t MinRenderNs = 33000000;
+    uint64_t LastRenderNs = 0;
+    uint64_t Renders = 0;
+    std::ostream *Out = nullptr;
+    events_6502::Scheduler *Events = nullptr;
+    unsigned int RenderEvent = 0;
+
+    cpu_6502::CPU &Cpu;
+
+    // via_65c22::PortDevice
+    void PinsChanged(Byte portA, Byte portB) override;
+    Byte InputB() override;
+
+    // state_6502::Stateful
+    void SaveState(state_6502::Packer &out) const override;
+    bool LoadState(state_6502::Unpacker &in) override;
+
+    bool Busy() const { return Cpu.Cycles < BusyUntil; }
+
+    // What's on screen, one string per row, trailing spaces included
+    std::string Line(unsigned int row) const;
+    std::string Text() const;   // All rows joined with '\n'
+
+    // Start drawing the display to a terminal
+    void StartRendering(events_6502::Scheduler &events, std::ostream &out);
+    void Render();
+    void RenderTick(uint64_t when);
+
+    void Transfer(bool rs, Byte value);
+    void Command(Byte cmd);
+    void WriteData(Byte data);
+    Byte ReadValue(bool rs);
+    void AdvanceAC();
+    void SetBusy(uint64_t microseconds);
+    Byte LineAddress(unsigned int row) const;
+};
+
+#endif
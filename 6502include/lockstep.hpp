@@ -0,0 +1,85 @@
+#ifndef __LOCKSTEP_HPP__
+#define __LOCKSTEP_HPP__
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+
+namespace lockstep_6502 {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct Lockstep;
+
+    // Which operation the Logic() and Shift() kernels do
+    enum LogicOp { LOGIC_AND, LOGIC_ORA, LOGIC_EOR };
+    enum ShiftOp { SHIFT_ASL, SHIFT_LSR, SHIFT_ROL, SHIFT_ROR };
+}
+
+// Runs many copies of a machine side by side, for fuzzing and parameter
+// sweeps where the same program gets fed thousands of different inputs.
+//
+// Registers and the hot flags live in one array per register (struct of
+// arrays) instead of one CPU per lane. Every step picks the lanes sitting at
+// the lowest PC, which is where lanes that split up on a branch tend to meet
+// again, and runs that instruction for all of them at once. ADC, SBC, the
+// logic ops, shifts, compares and loads then work on 32 lanes per AVX2
+// instruction (or whatever the compiler makes of the plain loop without it).
+// Anything not handled here goes through CPU::Execute one lane at a time, so
+// the results always match running the lanes on their own.
+//
+// Each lane has its own memory. Timing follows the fast engine, dummy bus
+// cycles aren't made, and there are no interrupts or scheduler events.
+struct lockstep_6502::Lockstep {
+    explicit Lockstep(unsigned int lanes);
+
+    unsigned int Lanes;
+    unsigned int Padded;    // Lanes rounded up to a whole number of vectors
+
+    // Registers, one entry per lane
+    std::vector<Byte> A, X, Y, SP;
+    std::vector<Word> PC;
+    std::vector<Byte> C, Z, V, N;   // 0 or 1
+    std::vector<Byte> Cold;         // The rest of the status byte, as in CPU::PSF
+    std::vector<uint64_t> Cycles;
+    std::vector<Byte> Stopped;      // Hit STP (or WAI, there's nothing to wake it)
+
+    std::vector<mem_28c256::Mem *> Memory;  // Not owned
+
+    // Stats
+    uint64_t Steps = 0;         // Instructions issued, however many lanes ran them
+    uint64_t VectorLanes = 0;   // Lane-instructions done in lockstep
+    uint64_t ScalarLanes = 0;   // Lane-instructions handed to CPU::Execute
+
+    // Copy a lane in from / out to an ordinary CPU
+    void Load(unsigned int lane, const cpu_6502::CPU &cpu, mem_28c256::Mem &mem);
+    void Store(unsigned int lane, cpu_6502::CPU &cpu) const;
+
+    // Run one instruction for the lanes at the lowest PC that haven't
+    // stopped or used up `limit` cycles. False when there's nothing left.
+    bool Step(uint64_t limit);
+
+    // Step until every lane has stopped or used `limit` cycles
+    void Run(uint64_t limit);
+
+    // Scratch space for Step()
+    std::vector<Byte> Mask;         // 0xFF for lanes in this step's group
+    std::vector<Byte> Operand;      // Value read by the instruction, per lane
+    std::vector<Word> Address;      // Where a store goes, per lane
+    std::vector<unsigned int> Group;
+    cpu_6502::CPU Scalar;
+
+    void RunScalar(unsigned int lane);
+
+    // Kernels. Each one works on every lane and keeps the result where Mask
+    // is set.
+    void LoadRegister(std::vector<Byte> &reg);
+    void Logic(LogicOp op);
+    void Add(bool subtract);
+    void Compare(const std::vector<Byte> &reg);
+    void Shift(ShiftOp op);
+};
+
+#endif
@@ -6,21 +6,113 @@
 #include <cstdint>
 #include <iostream>
 
+#include "usdt.hpp"
+
+#ifdef CPU_6502_PROFILE
+#include "coverage.hpp"
+#endif
 
 namespace mem_28c256 {
     using Byte = uint8_t;
     using Word = uint16_t; 
 
+    struct Device;
     struct Mem;
 }
 
 const static unsigned int MAX_MEM = 1024 * 64;
+const static unsigned int PAGE_SIZE = 256;
+const static unsigned int NUM_PAGES = MAX_MEM / PAGE_SIZE;
+
+// Anything that sits on the bus in place of RAM/ROM. Devices get the full
+// address and are expected to mirror their registers across whatever they're
+// mapped to, same as a real chip with partial address decoding.
+struct mem_28c256::Device {
+    virtual ~Device() {}
+    virtual Byte Read(Word addr) = 0;
+    virtual void Write(Word addr, Byte data) = 0;
+};
 
 struct mem_28c256::Mem {
     Byte Data[MAX_MEM];
 
+    // Which device (if any) owns each 256 byte page
+    Device *IO[NUM_PAGES] = {};
+
+    // Write generations, for anything that wants to know which pages changed
+    // since it last looked. Every write through Write() stamps its page with
+    // WriteGen. Take a mark with NextGeneration(); a page has changed since
+    // then if ChangedSince() says so. Several watchers can each keep their
+    // own mark. operator[] doesn't stamp anything, so whoever pokes Data
+    // directly has to call Touch() afterwards.
+    uint64_t WriteGen = 1;
+    uint64_t PageGen[NUM_PAGES] = {};
+
+    uint64_t NextGeneration() { return WriteGen++; }
+    bool ChangedSince(unsigned int page, uint64_t mark) const { return PageGen[page] > mark; }
+    void Touch(Word first, Word last);
+
+    // Accesses that went to a device rather than memory
+    uint64_t DeviceReads = 0;
+    uint64_t DeviceWrites = 0;
+
     void Init();
-    void LoadMem(std::string filename);
+
+    // Hand the pages from `first` to `last` (inclusive) over to a device.
+    // Pass NULL to turn them back into plain memory.
+    void Map(Word first, Word last, Device *dev);
+
+#ifdef CPU_6502_PROFILE
+    // Profiling build only: which addresses the CPU touched, see coverage.hpp
+    coverage_6502::Coverage *Coverage = nullptr;
+#endif
+
+    // What the CPU sees: goes to the device if the page is mapped. operator[]
+    // below always hits the backing array, which is what tests and loaders
+    // want.
+    Byte Read(Word addr) {
+#ifdef CPU_6502_PROFILE
+        if (Coverage)
+            Coverage->OnRead(addr);
+#endif
+        Device *dev = IO[addr >> 8];
+        return dev ? ReadDevice(dev, addr) : Data[addr];
+    }
+
+    // Same as Read(), for opcode and operand bytes
+    Byte Fetch(Word addr) {
+#ifdef CPU_6502_PROFILE
+        if (Coverage)
+            Coverage->OnFetch(addr);
+#endif
+        Device *dev = IO[addr >> 8];
+        return dev ? ReadDevice(dev, addr) : Data[addr];
+    }
+
+    // Either way, a device read has side effects and gets counted
+    Byte ReadDevice(Device *dev, Word addr) {
+        Byte data = dev->Read(addr);
+        DeviceReads++;
+        USDT_PROBE2(emu6502, device_read, addr, data);
+        return data;
+    }
+
+    void Write(Word addr, Byte data) {
+#ifdef CPU_6502_PROFILE
+        if (Coverage)
+            Coverage->OnWrite(addr);
+#endif
+        Device *dev = IO[addr >> 8];
+        if (dev) {
+            DeviceWrites++;
+            USDT_PROBE2(emu6502, device_write, addr, data);
+            dev->Write(addr, data);
+        } else {
+            Data[addr] = data;
+            PageGen[addr >> 8] = WriteGen;
+        }
+    }
+    bool LoadMem(std::string filename); // false if the file couldn't be opened
 
     // Read one byte
     Byte operator[] (unsigned int address)  const {
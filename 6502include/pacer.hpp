@@ -0,0 +1,58 @@
+#ifndef __PACER_HPP__
+#define __PACER_HPP__
+
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+
+namespace pace_6502 {
+    struct Pacer;
+}
+
+// Runs the CPU at a fixed emulated clock rate instead of flat out. Cycles are
+// run in batches at full speed and then we sleep until the wall clock catches
+// up. Deadlines are computed from the total number of cycles run since Run()
+// started, never from the previous sleep, so rounding and oversleeping don't
+// add up into drift.
+struct pace_6502::Pacer {
+    uint64_t TargetHz = 1000000;     // 1 MHz, same as the breadboard computer
+    uint64_t MaxJitterNs = 2000000;  // How far emulated time may run ahead of
+                                     // real time. Also sets the batch size.
+
+    // If we fall this far behind (host suspended, debugger attached...) stop
+    // trying to catch up and start pacing again from the current time.
+    uint64_t ResyncNs = 100000000;
+
+    // Called between batches, when the CPU is between instructions and no
+    // event is half way through, e.g. to take a checkpoint
+    std::function<void()> AfterBatch;
+
+    // Run() returns at the next batch boundary once this is set, e.g. from
+    // a signal handler
+    const volatile sig_atomic_t *Quit = nullptr;
+
+    // Filled in by Run()
+    uint64_t CyclesRun = 0;
+    uint64_t ElapsedNs = 0;
+    uint64_t Batches = 0;
+    uint64_t WorstLateNs = 0;        // Latest wake-up seen past a deadline
+    uint64_t Resyncs = 0;
+
+    // Cycles to run between sleeps
+    uint64_t BatchCycles() const;
+
+    // Run until nCycles have gone by (0 = no limit) or the CPU hits STP
+    void Run(cpu_6502::CPU &cpu, mem_28c256::Mem &mem, uint64_t nCycles);
+
+    // Clock rate we actually managed over the last Run()
+    double AchievedHz() const;
+
+    // Print target vs achieved frequency and jitter
+    void Report(std::ostream &out) const;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef __PROFILE_HPP__
+#define __PROFILE_HPP__
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace profile_6502 {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct Profile;
+    struct CallGraph;
+
+    // How a call frame got entered
+    const Byte ENTERED_JSR = 0;
+    const Byte ENTERED_IRQ = 1;
+    const Byte ENTERED_NMI = 2;
+    const Byte ENTERED_BRK = 3;
+
+    // More nested calls than this aren't followed. Each one takes at least
+    // two bytes of the 6502's stack, so only runaway code gets near it.
+    const unsigned int MAX_CALL_DEPTH = 256;
+
+    // "LDA_ABX" and so on, the same names as the CPU's INS_ constants.
+    // Null for opcodes the emulator doesn't implement.
+    const char *OpcodeName(Byte opcode);
+}
+
+namespace symbols_6502 {
+    struct Table;
+}
+
+// Execution counters: what ran, where, and for how many cycles. The CPU only
+// fills them in when built with CPU_6502_PROFILE (cmake -DPROFILE=ON); in the
+// normal build the hooks aren't compiled at all, so they cost nothing.
+//
+// About 2MB, so put it on the heap.
+struct profile_6502::Profile {
+    // Per opcode
+    uint64_t Instructions[256];
+    uint64_t Cycles[256];
+    uint64_t PagePenalties[256];    // Extra cycles for an index or a branch crossing a page
+
+    // Per address, counted against the first byte of the instruction
+    uint64_t Hits[65536];
+    uint64_t PCCycles[65536];
+
+    // Per branch instruction
+    uint64_t Taken[65536];
+    uint64_t NotTaken[65536];
+
+    uint64_t Interrupts = 0;
+
+    Profile() { Clear(); }
+    void Clear();
+
+    // Called by the CPU
+    void Instruction(Word pc, Byte opcode, unsigned int cycles, bool pagePenalty) {
+        Instructions[opcode]++;
+        Cycles[opcode] += cycles;
+        PagePenalties[opcode] += pagePenalty;
+        Hits[pc]++;
+        PCCycles[pc] += cycles;
+    }
+    void Branch(Word pc, bool taken) {
+        (taken ? Taken : NotTaken)[pc]++;
+    }
+
+    uint64_t TotalInstructions() const;
+    uint64_t TotalCycles() const;
+
+    // The `top` hottest opcodes and addresses by cycles, and the busiest
+    // branches. Addresses get names too if there are symbols.
+    void Report(std::ostream &out, unsigned int top = 20, const symbols_6502::Table *symbols = nullptr) const;
+};
+
+// Shadow call stack. Follows JSR/RTS, BRK, interrupts and RTI and charges
+// every instruction's cycles to the call path it ran under, so time can be
+// put down to subroutines: exclusive (in the routine itself) and inclusive
+// (everything it called too). WriteFolded() gives the "a;b;c cycles" lines
+// flamegraph.pl and speedscope read.
+//
+// Frames are matched up by the stack pointer rather than by counting
+// returns. A frame ends once SP is back above its return address, however
+// that happened: RTS, RTI, PLA PLA, or TXS. An RTS that doesn't unwind
+// anything (pushing an address and "returning" to it as a jump table
+// trick) just counts as a jump inside the current routine.
+struct profile_6502::CallGraph {
+    // A routine at a place in the call tree
+    struct Node {
+        Word Address;           // Where it was entered
+        Byte Entered;           // ENTERED_*
+        uint32_t Parent;
+        uint64_t Calls = 0;
+        uint64_t Self = 0;      // Cycles spent in it at this place
+    };
+
+    // Totals per routine over every place it appears
+    struct Function {
+        Word Address;
+        Byte Entered;
+        uint64_t Calls = 0;
+        uint64_t Inclusive = 0;     // Recursion only counted once
+        uint64_t Exclusive = 0;
+    };
+
+    CallGraph() { Clear(); }
+    void Clear();
+
+    // Called by the CPU after every instruction and every interrupt, with
+    // PC and SP as they are afterwards
+    void Instruction(Word pc, Byte opcode, unsigned int cycles, Word pcAfter, Byte spAfter);
+    void Interrupt(Byte entered, unsigned int cycles, Word pcAfter, Byte spAfter);
+
+    // Names to use instead of addresses, optional
+    const symbols_6502::Table *Symbols = nullptr;
+    std::string Name(Word addr, Byte entered = ENTERED_JSR) const;
+
+    void WriteFolded(std::ostream &out) const;
+    std::vector<Function> Functions() const;   // Most inclusive cycles first
+    void Report(std::ostream &out, unsigned int top = 20) const;
+
+    // Stats
+    uint64_t Overflows = 0;     // Calls not followed because the stack was full
+
+    struct Frame {
+        uint32_t Node;
+        unsigned int ReturnSP;  // SP once its return address is gone
+    };
+    std::vector<Node> Nodes;    // 0 is the root, whatever was running first
+    std::vector<Frame> Stack;
+    std::unordered_map<uint64_t, uint32_t> Children;   // Parent, entry and function to node
+    bool Started = false;
+
+    void Push(Word addr, Byte entered, unsigned int returnSP);
+    void Unwind(Byte sp);
+    std::string Path(uint32_t node) const;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef __REPLAY_HPP__
+#define __REPLAY_HPP__
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "cpu_6502.hpp"
+#include "scheduler.hpp"
+
+namespace replay_6502 {
+    using Byte = uint8_t;
+
+    struct Journal;
+    struct NmiButton;
+
+    // File layout: MAGIC, VERSION (u16), the cycle recording started on
+    // (varint), then records of
+    //     cycle delta (varint) | kind (u8) | kind specific
+    // INPUT carries a channel (u8), a count (varint) and the bytes, NMI
+    // nothing. Cycles only ever go forwards, so the deltas are small and
+    // most records come to a handful of bytes.
+    const uint32_t MAGIC = 0x4A523536;      // "65RJ"
+    const uint16_t VERSION = 1;
+
+    const Byte RECORD_INPUT = 1;    // Bytes a device took from the host
+    const Byte RECORD_NMI = 2;      // NMI from outside the machine
+
+    // Channels for RECORD_INPUT, one per host facing device
+    const Byte CHANNEL_ACIA = 0;
+}
+
+// Log of everything that comes into the machine from outside, stamped with
+// the cycle it arrived on. Devices ask the journal instead of the host while
+// it's replaying, so a run can be played back bit for bit without whoever
+// was typing at it.
+//
+// Only host inputs go in. Device interrupts aren't logged because every IRQ
+// line here is driven by an emulated device, and those replay on their own
+// once their inputs do. Everything has to be asked for on the same cycles
+// both times (devices poll on fixed schedules, so they do), and anything
+// asked for out of step marks the replay as diverged.
+struct replay_6502::Journal {
+    ~Journal();
+
+    // Start writing a new journal, or reading one back. `cycle` is where
+    // the machine is now; recording notes it, replaying skips any records
+    // from before it so a replay can start from a checkpoint.
+    bool Record(const std::string &path, uint64_t cycle);
+    bool Replay(const std::string &path, uint64_t cycle, std::string *error = nullptr);
+    void Close();
+
+    // Write out what's buffered of a recording, so a run that gets killed
+    // still leaves a journal that replays up to here
+    void Flush();
+
+    bool Recording() const { return Out != nullptr; }
+    bool Replaying() const { return In != nullptr; }
+
+    // Recording
+    void Input(uint64_t cycle, Byte channel, const Byte *data, size_t n);
+    void Nmi(uint64_t cycle);
+
+    // Replaying. What was recorded for this channel on this cycle, if
+    // anything; at most `max` bytes, the rest come back next time.
+    size_t TakeInput(uint64_t cycle, Byte channel, Byte *out, size_t max);
+    bool TakeNmi(uint64_t cycle);
+
+    // Done replaying up to `cycle`. A record from before it that nobody
+    // asked for is as much a divergence as asking on the wrong cycle.
+    bool Finish(uint64_t cycle);
+
+    // Replay state
+    bool Diverged = false;
+    uint64_t DivergedAt = 0;
+    bool Ended = false;         // Ran out of records
+
+    // Stats
+    uint64_t Records = 0;
+    uint64_t Bytes = 0;         // Input bytes recorded or replayed
+
+    FILE *Out = nullptr;
+    FILE *In = nullptr;
+    uint64_t LastCycle = 0;
+
+    // The next record, read ahead of time while replaying
+    bool HaveNext = false;
+    uint64_t NextCycle = 0;
+    Byte NextKind = 0;
+    Byte NextChannel = 0;
+    std::string NextData;
+    size_t NextUsed = 0;
+
+    void PutVarint(uint64_t v);
+    bool GetVarint(uint64_t &v);
+    void ReadNext();
+    bool Matches(uint64_t cycle, Byte kind);
+};
+
+// An NMI from outside the machine, e.g. a signal handler setting Pressed.
+// It's only looked at every PollCycles, on a fixed grid of cycles, so that
+// presses land on a cycle the journal can name and a replay from any
+// checkpoint polls on the same cycles the recording did.
+struct replay_6502::NmiButton {
+    NmiButton(cpu_6502::CPU &cpu, events_6502::Scheduler &events, Journal &journal);
+    ~NmiButton();
+
+    // Start polling from wherever the machine is now. A poll that was due
+    // right on this cycle may not have run yet, so start from the latest
+    // one that's due; going over it twice does no harm.
+    void Start();
+
+    volatile sig_atomic_t Pressed = 0;
+    uint64_t PollCycles = 1000;
+    uint64_t Presses = 0;
+
+    cpu_6502::CPU &Cpu;
+    events_6502::Scheduler &Events;
+    replay_6502::Journal &Journal;
+    unsigned int PollEvent = 0;
+
+    void Poll(uint64_t when);
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef __REWIND_HPP__
+#define __REWIND_HPP__
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+
+namespace rewind_6502 {
+    using Byte = uint8_t;
+
+    struct Snapshot;
+    struct Rewinder;
+}
+
+// One point in the rewind ring. Memory is stored backwards: Delta holds the
+// pages that changed since the snapshot before this one, XORed with what
+// they were then, so walking from the newest memory image back through the
+// deltas gets to any older snapshot. The oldest delta is never needed, so
+// dropping the oldest snapshot is just forgetting it.
+struct rewind_6502::Snapshot {
+    cpu_6502::CPU Cpu;
+    std::vector<events_6502::Scheduler::Event> Events;
+    std::vector<std::string> Devices;   // Same order as the Rewinder's devices
+    std::string Delta;      // page (u8) | size (u16) | LZ packed XOR, raw if size == PAGE_SIZE
+    size_t Bytes = 0;       // Roughly what this snapshot costs
+};
+
+// Time travel for debugging. Call Tick() between Execute() calls and it
+// keeps a bounded ring of snapshots every Interval cycles. Going back
+// restores the nearest snapshot at or before the target and runs forward
+// from there, one instruction at a time, so anything within the ring is at
+// most Interval cycles of emulation away.
+//
+// Running forward again has to come out the same as it did the first time,
+// so the machine's inputs need to be deterministic: a replaying journal, or
+// no host attached. Whatever's taken from the host during a re-run is
+// taken again. Scheduled events are snapshotted as they are, callbacks and
+// all, so the devices have to outlive the Rewinder.
+struct rewind_6502::Rewinder {
+    Rewinder(cpu_6502::CPU &cpu, mem_28c256::Mem &mem, events_6502::Scheduler &events,
+             const state_6502::Devices &devices = state_6502::Devices());
+
+    uint64_t Interval = 100000;     // Cycles between snapshots
+    size_t MaxBytes = 16 << 20;     // Ring budget, the oldest go first
+
+    // Take a snapshot if one's due. Emulator thread, between Execute() calls.
+    void Tick();
+    void Take();
+
+    // To the last instruction boundary at or before `cycle`. False if that's
+    // older than anything in the ring, in which case nothing moves. Mostly
+    // for going back, but forwards works too (it just runs).
+    bool SeekTo(uint64_t cycle);
+
+    // Undo the last instruction
+    bool StepBack();
+
+    // Back to the most recent instruction boundary before now at which
+    // `stop` holds, i.e. where a forward run would have stopped for it last.
+    // Searches one snapshot interval at a time, newest first.
+    bool ReverseContinue(const std::function<bool()> &stop);
+
+    // Oldest cycle that can still be gone back to
+    uint64_t Oldest() const { return Ring.empty() ? Cpu.Cycles : Ring.front().Cpu.Cycles; }
+
+    cpu_6502::CPU &Cpu;
+    mem_28c256::Mem &Mem;
+    events_6502::Scheduler &Events;
+    state_6502::Devices Devices;
+
+    // Stats
+    uint64_t Taken = 0;
+    uint64_t Dropped = 0;
+    uint64_t Restores = 0;
+    uint64_t StepsRun = 0;          // Instructions re-run going back
+    size_t Bytes = 0;
+
+    std::deque<Snapshot> Ring;
+    std::vector<Byte> Newest;       // Memory as of Ring.back()
+    uint64_t Mark = 0;              // Mem write generation at Ring.back()
+
+    // Memory as of snapshot `index`, in `image`
+    void Rebuild(size_t index, std::vector<Byte> &image) const;
+
+    // Put the machine back to snapshot `index`, keeping the ring as is.
+    // False if a device wouldn't take its state back, and then nothing moved.
+    bool Restore(size_t index, const std::vector<Byte> &image);
+
+    // Newest snapshot at or before `cycle`, -1 if there isn't one
+    long Find(uint64_t cycle) const;
+
+    // Drop the snapshots after `index`; the machine is at `index` and
+    // `image` is its memory
+    void Truncate(size_t index, const std::vector<Byte> &image);
+
+    void Evict();
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef __SAVESTATE_HPP__
+#define __SAVESTATE_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+
+namespace state_6502 {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct Packer;
+    struct Unpacker;
+    struct Stateful;
+
+    // Devices to save/restore alongside the CPU, by name. The names are what
+    // ties a saved chunk back to a device, so keep them stable.
+    using Devices = std::vector<std::pair<std::string, Stateful *>>;
+
+    // File layout: MAGIC, VERSION (u16), then chunks of
+    //     tag (u32) | length (u32) | payload | CRC-32 of payload (u32)
+    // ending with an END chunk. Everything is little endian. Unknown chunks
+    // are skipped, so newer files still load as long as the version matches.
+    const uint32_t MAGIC = 0x54533536;      // "65ST"
+    const uint16_t VERSION = 3;
+
+    const uint32_t CHUNK_CPU = 0x20555043;  // "CPU "
+    const uint32_t CHUNK_MEM = 0x204D454D;  // "MEM "
+    const uint32_t CHUNK_DEV = 0x20564544;  // "DEV "
+    const uint32_t CHUNK_END = 0x20444E45;  // "END "
+
+    // How a page is stored in the MEM chunk. Pages that are all zero aren't
+    // stored at all.
+    const Byte PAGE_RAW = 0;
+    const Byte PAGE_LZ = 1;
+
+    // Whole machine to/from a byte string. Load() decodes and checks the
+    // whole file before touching anything, then loads the devices through
+    // LoadDevices() and only once they've all taken their state does it set
+    // the CPU and memory. On failure the machine is left as it was and
+    // `error` (if given) says why.
+    std::string Save(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem, const Devices &devices = Devices());
+    bool Load(const std::string &data, cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+              const Devices &devices = Devices(), std::string *error = nullptr);
+
+    bool SaveFile(const std::string &path, const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem,
+                  const Devices &devices = Devices());
+    bool LoadFile(const std::string &path, cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+                  const Devices &devices = Devices(), std::string *error = nullptr);
+
+    // Each device's LoadState() on its chunk, all or nothing. Devices decode
+    // straight into themselves, so what they had is saved first and put back
+    // into every one already loaded (and the one that failed) if one fails.
+    bool LoadDevices(std::vector<std::pair<Stateful *, Unpacker>> &chunks);
+
+    // Building blocks, also used by the checkpoint writer
+    uint32_t Crc32(const void *data, size_t size, uint32_t crc = 0);
+
+    // Byte oriented LZ77 within one page. `out` needs PAGE_SIZE bytes; the
+    // return value is the compressed size, or PAGE_SIZE if it didn't shrink
+    // (in which case `out` is garbage and the page should go in raw).
+    unsigned int CompressPage(const Byte *page, Byte *out);
+    bool DecompressPage(const Byte *in, unsigned int size, Byte *page);
+
+    // Appends one encoded page (index, encoding, size, data) to `out`, or
+    // nothing if the page is all zero
+    void PackPage(unsigned int index, const Byte *page, std::string &out);
+}
+
+// Little endian writer for building chunk payloads
+struct state_6502::Packer {
+    std::string Data;
+
+    void U8(Byte v) { Data += char(v); }
+    void U16(Word v) { U8(v); U8(v >> 8); }
+    void U32(uint32_t v) { U16(v); U16(v >> 16); }
+    void U64(uint64_t v) { U32(v); U32(v >> 32); }
+    void Bytes(const void *p, size_t n) { Data.append((const char *)p, n); }
+};
+
+// Reader to match. Running off the end sets Bad and returns zeros instead of
+// reading past the buffer, so callers only need to check once at the end.
+struct state_6502::Unpacker {
+    const Byte *P;
+    size_t Left;
+    bool Bad = false;
+
+    Unpacker(const std::string &data) : P((const Byte *)data.data()), Left(data.size()) {}
+    Unpacker(const Byte *p, size_t n) : P(p), Left(n) {}
+
+    bool Take(void *out, size_t n) {
+        if (n > Left) {
+            Bad = true;
+            Left = 0;
+            memset(out, 0, n);
+            return false;
+        }
+        memcpy(out, P, n);
+        P += n;
+        Left -= n;
+        return true;
+    }
+    Byte U8() { Byte v; Take(&v, 1); return v; }
+    Word U16() { Word lo = U8(); return lo | Word(U8()) << 8; }
+    uint32_t U32() { uint32_t lo = U16(); return lo | uint32_t(U16()) << 16; }
+    uint64_t U64() { uint64_t lo = U32(); return lo | uint64_t(U32()) << 32; }
+};
+
+// A device with state worth keeping. Only the emulated chip's state goes in,
+// not host side things like file descriptors.
+struct state_6502::Stateful {
+    virtual ~Stateful() {}
+    virtual void SaveState(Packer &out) const = 0;
+    virtual bool LoadState(Unpacker &in) = 0;
+};
+
+#endif
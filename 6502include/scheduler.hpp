@@ -0,0 +1,62 @@
+#ifndef __SCHEDULER_HPP__
+#define __SCHEDULER_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace events_6502 {
+    // Callbacks get the cycle they were scheduled for, not the cycle they
+    // actually ran on (an instruction can overshoot the deadline by a few).
+    using Callback = std::function<void(uint64_t when)>;
+
+    const uint64_t NO_EVENT = UINT64_MAX;
+
+    struct Scheduler;
+}
+
+namespace state_6502 {
+    struct Stateful;
+}
+
+struct events_6502::Scheduler {
+    struct Event {
+        uint64_t When;
+        unsigned int Id;
+        events_6502::Callback Fn;
+        const state_6502::Stateful *Owner;
+    };
+
+    // Min-heap ordered on When, ties broken by Id so that two events due on
+    // the same cycle always fire in the order they were scheduled.
+    std::vector<Event> Queue;
+    unsigned int NextId = 1;
+
+    // Queue a callback to run once the CPU cycle counter reaches `when`.
+    // Returns an id that can be handed to Cancel(). A device whose
+    // LoadState() schedules the event again passes itself as `owner`.
+    unsigned int Schedule(uint64_t when, events_6502::Callback fn, const state_6502::Stateful *owner = nullptr);
+
+    // Drop a pending event. Does nothing if it already fired.
+    void Cancel(unsigned int id);
+
+    // Run every event due at or before `now`. Events scheduled from inside
+    // a callback that are also due get run in the same call.
+    void RunUntil(uint64_t now);
+
+    // Forget everything that's pending
+    void Clear();
+
+    // Go back to a queue saved earlier, ids and all, except for events one
+    // of `owners` owns: those are left as they are now, since loading the
+    // owner's state already put them back.
+    void Restore(const std::vector<Event> &saved, const std::vector<const state_6502::Stateful *> &owners);
+
+    // Cycle of the earliest pending event, NO_EVENT if nothing is queued.
+    // Called once per instruction so it has to stay cheap.
+    uint64_t NextEvent() const {
+        return Queue.empty() ? events_6502::NO_EVENT : Queue.front().When;
+    }
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __SYMBOLS_HPP__
+#define __SYMBOLS_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace symbols_6502 {
+    using Word = uint16_t;
+
+    struct Symbol;
+    struct Table;
+}
+
+struct symbols_6502::Symbol {
+    Word Address;
+    Word Size;          // 0 if the file didn't say, then it runs up to the next symbol
+    uint32_t Name;      // Offset into Table::Names
+};
+
+// Assembler symbols for putting names on addresses in profiles, traces and
+// the like. Load() understands:
+//
+//     al 00C000 .name                      ld65 -Ln, 64tass --vice-labels, VICE
+//     sym id=3,name="name",...,val=0xC000,size=12,...,type=lab    ld65 --dbgfile
+//     name = $C000                         64tass --labels
+//     name                  A:C000         vasm -L listing, "Symbols by name"
+//
+// and skips lines it doesn't recognise, so several files (or several kinds
+// of file) can be loaded into the same table. Only the debug file gives
+// sizes; everything else is taken to run up to the next symbol.
+//
+// Lookups are a binary search over a flat array of start addresses, with the
+// names all in one string, so symbolizing a few million samples is quick.
+struct symbols_6502::Table {
+    // How many symbols were read, -1 if the file couldn't be opened
+    int Load(const std::string &path);
+
+    // Add() as many as you like, then Build() before looking anything up.
+    // Load() does the Build() itself.
+    void Add(Word addr, const std::string &name, Word size = 0);
+    void Build();
+
+    // The symbol covering `addr`, null if none does
+    const Symbol *Find(Word addr) const;
+    // Only one that starts right at `addr`
+    const Symbol *Exact(Word addr) const;
+    const char *NameOf(const Symbol &s) const { return &Names[s.Name]; }
+
+    // "name", "name+3", or "$C003" if nothing covers it
+    std::string Format(Word addr) const;
+
+    size_t Size() const { return Symbols.size(); }
+    bool Empty() const { return Symbols.empty(); }
+
+    // Sorted by address, one per address. Starts mirrors Symbols' addresses
+    // so the search only touches two bytes per step.
+    std::vector<Word> Starts;
+    std::vector<Symbol> Symbols;
+    std::string Names;          // NUL separated
+};
+
+#endif
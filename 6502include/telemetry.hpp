@@ -0,0 +1,102 @@
+#ifndef __TELEMETRY_HPP__
+#define __TELEMETRY_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+
+namespace telemetry_6502 {
+    struct Counters;
+    struct Totals;
+    struct Exporter;
+}
+
+// One emulation thread's numbers. Only that thread writes them, so an
+// update is a relaxed load and store, no locked instruction, and the
+// exporter can read them whenever it likes. Begin()/End() around each
+// Execute() slice pick up what the CPU and memory counted themselves, so
+// nothing extra happens per instruction.
+struct telemetry_6502::Counters {
+    std::atomic<uint64_t> Instructions{0};
+    std::atomic<uint64_t> Cycles{0};
+    std::atomic<uint64_t> Interrupts{0};
+    std::atomic<uint64_t> DeviceReads{0};
+    std::atomic<uint64_t> DeviceWrites{0};
+    std::atomic<uint64_t> BusyNs{0};        // Between Begin() and End()
+
+    // Checkpoints: taking the snapshot on the emulator thread, and writing
+    // the file on the checkpoint writer's
+    std::atomic<uint64_t> Snapshots{0};
+    std::atomic<uint64_t> SnapshotNs{0};
+    std::atomic<uint64_t> Checkpoints{0};
+    std::atomic<uint64_t> CheckpointNs{0};
+
+    std::atomic<uint64_t> JobsDone{0};
+    std::atomic<uint64_t> JobsTimedOut{0};
+
+    static void Add(std::atomic<uint64_t> &counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void Set(std::atomic<uint64_t> &counter, uint64_t n) { counter.store(n, std::memory_order_relaxed); }
+
+    void Begin(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem);
+    void End(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem);
+
+    // Where Begin() found things, owning thread only
+    uint64_t StartInstructions = 0, StartCycles = 0, StartInterrupts = 0;
+    uint64_t StartDeviceReads = 0, StartDeviceWrites = 0, StartNs = 0;
+};
+
+// Every thread's counters added up
+struct telemetry_6502::Totals {
+    uint64_t Instructions = 0, Cycles = 0, Interrupts = 0, DeviceReads = 0, DeviceWrites = 0, BusyNs = 0;
+    uint64_t Snapshots = 0, SnapshotNs = 0, Checkpoints = 0, CheckpointNs = 0;
+    uint64_t JobsDone = 0, JobsTimedOut = 0;
+};
+
+// Writes the counters out in Prometheus' text format for node_exporter's
+// textfile collector, every Interval seconds from a thread of its own and
+// once more on Stop(). The file is written next to Path and renamed over
+// it, so the collector never reads half of one. No network involved.
+struct telemetry_6502::Exporter {
+    Exporter(const std::string &path, double interval = 10);
+    ~Exporter();    // Stop()s
+
+    // A fresh set of counters for one thread. Keep the reference, it stays
+    // put until the Exporter goes.
+    Counters &Thread();
+
+    void Start();
+    void Stop();
+
+    Totals Sum();
+    void Write(std::ostream &out);
+    bool WriteFile();
+
+    std::string Path;
+    double Interval;
+    std::string Labels;     // Put on every series, e.g. tool="6502em"
+    uint64_t Failed = 0;    // Writes that didn't make it to disk
+
+    // Rates over the time between writes
+    uint64_t LastNs = 0, LastCycles = 0, LastJobs = 0;
+
+    std::mutex Lock;        // Threads and the rates
+    std::deque<Counters> Threads;
+
+    std::mutex QuitLock;
+    std::condition_variable Wake;
+    bool Quit = false;
+    std::thread Writer;
+};
+
+#endif
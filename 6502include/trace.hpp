@@ -0,0 +1,197 @@
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace trace_6502 {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct Record;
+    struct BlockInfo;
+    struct Tracer;
+    struct Reader;
+    struct Divergence;
+
+    // File layout:
+    //     MAGIC | VERSION (u16) | BLOCK_RECORDS (u32)
+    //     blocks: BLOCK_MAGIC (u32) | BlockInfo minus Offset | packed data
+    //     index: BlockInfo per block
+    //     footer: index offset (u64) | block count (u64) | INDEX_MAGIC (u32)
+    // Everything is little endian. Each block is BLOCK_RECORDS records (the
+    // last one can be short), delta encoded against the record before and
+    // then LZ packed. Blocks don't depend on each other, so the index is
+    // enough to get to any cycle. If the index never got written (the
+    // emulator died) the block headers can still be walked.
+    const uint32_t MAGIC = 0x52543536;      // "65TR"
+    const uint16_t VERSION = 2;
+    const uint32_t BLOCK_MAGIC = 0x42543536;    // "65TB"
+    const uint32_t INDEX_MAGIC = 0x49543536;    // "65TI"
+    const uint32_t BLOCK_RECORDS = 4096;
+
+    // Record::Kind
+    const Byte KIND_INSTRUCTION = 0;
+    const Byte KIND_IRQ = 1;                // Interrupt taken, EA is the vector
+    const Byte KIND_NMI = 2;
+
+    // Block codec, exposed for tests and tools. Encode() appends `n`
+    // records to `out`; Decode() needs the count and fails on anything
+    // that doesn't add up.
+    void Encode(const Record *records, size_t n, std::string &out);
+    bool Decode(const Byte *data, size_t size, size_t n, std::vector<Record> &out);
+
+    // General purpose LZ77 for the encoded blocks
+    void Pack(const std::string &in, std::string &out);
+    bool Unpack(const Byte *in, size_t size, size_t unpacked, std::string &out);
+
+    // Everything in a trace file, for tools and tests. False if it isn't one.
+    bool ReadFile(const std::string &path, std::vector<Record> &records);
+
+    // Finds the first record where two traces differ. Blocks line up by
+    // record number and their hashes only depend on what's in them, so
+    // matching blocks are skipped straight from the index and only the
+    // first mismatching pair gets decoded. False if a block is damaged.
+    bool FirstDivergence(const Reader &a, const Reader &b, Divergence &out);
+}
+
+// One instruction. Registers are as they were before it ran; EA is the
+// address its operand came from or went to, 0 for modes without one.
+struct trace_6502::Record {
+    uint64_t Cycle;         // When it started
+    Word PC;
+    Word EA;
+    Byte Opcode;
+    Byte Operand[2];        // The bytes after the opcode, whether it uses them or not
+    Byte A, X, Y, SP, P;
+    Byte Kind;
+    Byte Pad[3];
+};
+
+// Where a block is and what's in it
+struct trace_6502::BlockInfo {
+    uint64_t FirstCycle = 0;
+    uint64_t FirstRecord = 0;   // Index of its first record in the whole trace
+    uint64_t Offset = 0;        // Of the packed data in the file
+    uint32_t Count = 0;
+    uint32_t Encoded = 0;       // Size before packing
+    uint32_t Packed = 0;
+    uint64_t Hash = 0;          // Of the encoded records. Same records, same hash.
+};
+
+// Instruction trace capture. The CPU fills records straight into a single
+// producer, single consumer ring and a writer thread drains it, encodes it
+// in blocks and writes it out, so the emulator never makes a system call or
+// packs anything itself. If the writer can't keep up the emulator waits
+// rather than dropping anything; Stalls counts how often.
+struct trace_6502::Tracer {
+    ~Tracer();
+
+    // Ring size in records, rounded up to a power of two
+    bool Open(const std::string &path, size_t capacity = 1 << 16);
+
+    // Write out what's left, the index, and stop the writer. Called by the
+    // destructor.
+    void Close();
+
+    // CPU side. Begin() hands out the next free slot, Commit() publishes it.
+    Record *Begin() {
+        if (Head - CachedTail == Capacity) {
+            CachedTail = Tail.load(std::memory_order_acquire);
+            while (Head - CachedTail == Capacity) {
+                Stalls++;
+                std::this_thread::yield();
+                CachedTail = Tail.load(std::memory_order_acquire);
+            }
+        }
+        return &Ring[Head & (Capacity - 1)];
+    }
+    void Commit() {
+        Head++;
+        PublishedHead.store(Head, std::memory_order_release);
+    }
+
+    // Stats
+    uint64_t Records() const { return Head; }
+    uint64_t Stalls = 0;
+    std::atomic<uint64_t> Blocks{0};
+    std::atomic<uint64_t> Bytes{0};         // Written to the file
+    std::atomic<bool> Failed{false};
+
+    // Producer owned. CachedTail is the last Tail we saw, so the full check
+    // only touches the shared counter when the ring looks full.
+    uint64_t Head = 0;
+    uint64_t CachedTail = 0;
+    std::vector<Record> Ring;
+    uint64_t Capacity = 0;
+
+    // Shared, padded onto their own cache lines so the two threads don't
+    // fight over them
+    char PadHead[64];
+    std::atomic<uint64_t> PublishedHead{0};
+    char PadTail[64];
+    std::atomic<uint64_t> Tail{0};
+    char PadEnd[64];
+    std::atomic<bool> Quit{false};
+
+    // Writer side
+    FILE *Out = nullptr;
+    std::thread Writer;
+    std::vector<Record> Block;
+    std::vector<BlockInfo> Index;
+    uint64_t Offset = 0;
+    uint64_t Written = 0;       // Records in blocks so far
+
+    void WriterLoop();
+    bool Drain();
+    void WriteBlock();
+    void Put(const std::string &data);
+};
+
+// Reads a trace file through mmap, so opening even a huge one only costs
+// reading its index, and jumping to a cycle decodes a single block
+struct trace_6502::Reader {
+    ~Reader();
+
+    bool Open(const std::string &path, std::string *error = nullptr);
+    void Close();
+
+    // Block holding the instruction running at `cycle` (the last one that
+    // started at or before it), -1 if the trace starts after it
+    long Find(uint64_t cycle) const;
+
+    bool DecodeBlock(size_t block, std::vector<Record> &out) const;
+
+    // The instruction running at `cycle`
+    bool At(uint64_t cycle, Record &out) const;
+
+    uint64_t Records() const;
+
+    // `count` records starting from record number `first`, fewer if the
+    // trace ends first
+    bool Get(uint64_t first, size_t count, std::vector<Record> &out) const;
+
+    std::vector<BlockInfo> Index;
+    bool Recovered = false;     // No index on disk, it was rebuilt by walking the blocks
+
+    const Byte *Map = nullptr;
+    size_t Size = 0;
+
+    bool ReadIndex();
+    void ScanBlocks();
+};
+
+struct trace_6502::Divergence {
+    bool Found = false;         // False if the traces are the same
+    uint64_t Record = 0;        // First one that differs, or that only one trace has
+
+    // Stats
+    uint64_t BlocksSkipped = 0; // Matched on their hashes
+    uint64_t BlocksDecoded = 0; // Pairs
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __USDT_HPP__
+#define __USDT_HPP__
+
+// Static tracepoints (USDT) that bpftrace, perf and SystemTap can attach to
+// without a rebuild:
+//
+//     bpftrace -e 'usdt:./6502batch:emu6502:interrupt { @[arg0] = count(); }'
+//
+// Each probe is a single nop in the code plus an entry in the binary's
+// .note.stapsdt section saying where the nop is and where its arguments
+// live. Nothing is called and nothing is tested, so an unattached probe
+// costs the nop and, at most, moving its arguments into registers. A tracer
+// that attaches swaps the nop for a breakpoint.
+//
+// This is the same note layout <sys/sdt.h> writes, cut down to what we use,
+// so there's no build dependency on systemtap-sdt-dev. Only x86-64 Linux
+// gets probes; elsewhere, or configured with -DUSDT=OFF, they compile to
+// nothing.
+//
+// Arguments go in as they are, never cast, so a member can be handed over
+// straight out of memory without a load. Up to 6 of them.
+
+#if defined(__linux__) && defined(__x86_64__) && !defined(CPU_6502_NO_USDT)
+
+#include <type_traits>
+
+#define CPU_6502_USDT 1
+
+// Size and register/memory/immediate operand of argument n. The note wants
+// "-4@%eax" for a signed 4 byte argument: %n prints the negated constant
+// without a '$', hence the sign flip.
+#define USDT_ARG_(n, x) \
+    [s##n] "n" ((std::is_signed<decltype(x)>::value ? 1 : -1) * int(sizeof(x))), [a##n] "nor" (x)
+
+#define USDT_NOTE_(provider, name, args)                                        \
+    "990: nop\n"                                                                \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                               \
+    ".balign 4\n"                                                               \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                          \
+    "991: .asciz \"stapsdt\"\n"                                                 \
+    "992: .balign 4\n"                                                          \
+    "993: .8byte 990b\n"                                                        \
+    ".8byte _.stapsdt.base\n"                                                   \
+    ".8byte 0\n"                                                                \
+    ".asciz \"" #provider "\"\n"                                                \
+    ".asciz \"" #name "\"\n"                                                    \
+    ".asciz \"" args "\"\n"                                                     \
+    "994: .balign 4\n"                                                          \
+    ".popsection\n"                                                             \
+    ".ifndef _.stapsdt.base\n"                                                  \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"     \
+    ".weak _.stapsdt.base\n"                                                    \
+    ".hidden _.stapsdt.base\n"                                                  \
+    "_.stapsdt.base: .space 1\n"                                                \
+    ".size _.stapsdt.base, 1\n"                                                 \
+    ".popsection\n"                                                             \
+    ".endif\n"
+
+#define USDT_A1_ "%n[s1]@%[a1]"
+#define USDT_A2_ USDT_A1_ " %n[s2]@%[a2]"
+#define USDT_A3_ USDT_A2_ " %n[s3]@%[a3]"
+#define USDT_A4_ USDT_A3_ " %n[s4]@%[a4]"
+#define USDT_A5_ USDT_A4_ " %n[s5]@%[a5]"
+#define USDT_A6_ USDT_A5_ " %n[s6]@%[a6]"
+
+#define USDT_PROBE0(provider, name) \
+    __asm__ __volatile__(USDT_NOTE_(provider, name, ""))
+#define USDT_PROBE1(provider, name, a1) \
+    __asm__ __volatile__(USDT_NOTE_(provider, name, USDT_A1_) :: USDT_ARG_(1, a1))
+#define USDT_PROBE2(provider, name, a1, a2) \
+    __asm__ __volatile__(USDT_NOTE_(provider, name, USDT_A2_) :: USDT_ARG_(1, a1), USDT_ARG_(2, a2))
+#define USDT_PROBE3(provider, name, a1, a2, a3) \
+    __asm__ __volatile__(USDT_NOTE_(provider, name, USDT_A3_) :: USDT_ARG_(1, a1), USDT_ARG_(2, a2), \
+                         USDT_ARG_(3, a3))
+#define USDT_PROBE4(provider, name, a1, a2, a3, a4) \
+    __asm__ __volatile__(USDT_NOTE_(provider, name, USDT_A4_) :: USDT_ARG_(1, a1), USDT_ARG_(2, a2), \
+                         USDT_ARG_(3, a3), USDT_ARG_(4, a4))
+#define USDT_PROBE5(provider, name, a1, a2, a3, a4, a5) \
+    __asm__ __volatile__(USDT_NOTE_(provider, name, USDT_A5_) :: USDT_ARG_(1, a1), USDT_ARG_(2, a2), \
+                         USDT_ARG_(3, a3), USDT_ARG_(4, a4), USDT_ARG_(5, a5))
+#define USDT_PROBE6(provider, name, a1, a2, a3, a4, a5, a6) \
+    __asm__ __volatile__(USDT_NOTE_(provider, name, USDT_A6_) :: USDT_ARG_(1, a1), USDT_ARG_(2, a2), \
+                         USDT_ARG_(3, a3), USDT_ARG_(4, a4), USDT_ARG_(5, a5), USDT_ARG_(6, a6))
+
+#else
+
+#define USDT_PROBE0(provider, name) do {} while (0)
+#define USDT_PROBE1(provider, name, a1) do {} while (0)
+#define USDT_PROBE2(provider, name, a1, a2) do {} while (0)
+#define USDT_PROBE3(provider, name, a1, a2, a3) do {} while (0)
+#define USDT_PROBE4(provider, name, a1, a2, a3, a4) do {} while (0)
+#define USDT_PROBE5(provider, name, a1, a2, a3, a4, a5) do {} while (0)
+#define USDT_PROBE6(provider, name, a1, a2, a3, a4, a5, a6) do {} while (0)
+
+#endif
+
+#endif
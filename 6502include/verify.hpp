@@ -0,0 +1,75 @@
+#ifndef __VERIFY_HPP__
+#define __VERIFY_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "replay.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+
+namespace verify_6502 {
+    struct Machine;
+    struct Segment;
+    struct Verifier;
+
+    // Builds a fresh machine with the same devices the recording had. Gets
+    // called from the worker threads, once or twice per segment.
+    using Factory = std::function<Machine *()>;
+}
+
+// A machine to replay one segment on. Subclasses add their devices to
+// Devices under the names they were saved with and point them at Journal.
+struct verify_6502::Machine {
+    cpu_6502::CPU Cpu;
+    mem_28c256::Mem Mem;
+    events_6502::Scheduler Events;
+    replay_6502::Journal Journal;
+    state_6502::Devices Devices;
+
+    Machine();
+    virtual ~Machine() {}
+
+    // Called once a checkpoint is loaded and the journal is open, to start
+    // anything that runs off the cycle counter
+    virtual void Resumed() {}
+};
+
+// The run between two checkpoints
+struct verify_6502::Segment {
+    std::string From;
+    std::string To;
+    uint64_t StartCycle = 0;
+    uint64_t EndCycle = 0;
+    uint64_t Expected = 0;      // State hash of To
+    uint64_t Got = 0;           // State hash after replaying From up to EndCycle
+    bool Ok = false;
+    std::string Error;          // Why it couldn't be replayed, or where the journal diverged
+};
+
+// Checks a recorded run replays the same without running it end to end.
+// Each pair of neighbouring checkpoints is a segment that can be replayed on
+// its own (the journal skips to wherever it starts), so they're handed out
+// to a pool of threads and only the state hashes at the ends get compared.
+//
+// Checkpoints have to be taken between Execute() calls, not from an event,
+// or the events due on the same cycle won't be in the same place.
+struct verify_6502::Verifier {
+    unsigned int Threads = 0;   // 0 = one per core
+
+    // Filled in by Run(), in checkpoint order
+    std::vector<Segment> Segments;
+    long FirstBad = -1;         // Index of the earliest segment that failed
+
+    // Verify every segment between `checkpoints` (oldest first) against the
+    // journal. True if they all came out the same.
+    bool Run(const std::vector<std::string> &checkpoints, const std::string &journal, const Factory &factory);
+
+    void Replay(Segment &segment, const std::string &journal, const Factory &factory);
+};
+
+#endif
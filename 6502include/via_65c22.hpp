@@ -0,0 +1,110 @@
+#ifndef __VIA_65C22_HPP__
+#define __VIA_65C22_HPP__
+
+#include <cstdint>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+
+namespace via_65c22 {
+    using Byte = uint8_t;
+    using Word = uint16_t;
+
+    struct PortDevice;
+    struct VIA;
+
+    // Register offsets, the chip decodes the bottom four address lines
+    const Word REG_ORB = 0x0;
+    const Word REG_ORA = 0x1;
+    const Word REG_DDRB = 0x2;
+    const Word REG_DDRA = 0x3;
+    const Word REG_T1CL = 0x4;      // Timer 1 counter; writes go to the latch
+    const Word REG_T1CH = 0x5;      // Writing this loads the counter and starts it
+    const Word REG_T1LL = 0x6;      // Timer 1 latch
+    const Word REG_T1LH = 0x7;
+    const Word REG_ACR = 0xB;
+    const Word REG_IFR = 0xD;
+    const Word REG_IER = 0xE;
+    const Word REG_ORA_NH = 0xF;    // Port A without handshake
+
+    // Auxiliary control register bits
+    const Byte ACR_T1_FREE_RUN = 0x40;  // Reload from the latch and go again
+
+    // Interrupt flag/enable register bits
+    const Byte IRQ_T1 = 0x40;
+    const Byte IRQ_ANY = 0x80;      // IFR: some enabled flag is set. IER: set, not clear
+}
+
+// Whatever is wired to the VIA's port pins
+struct via_65c22::PortDevice {
+    virtual ~PortDevice() {}
+
+    // The pins the VIA drives changed. Bits set as inputs in the DDR read as
+    // 1 here, like they would with the pull-ups.
+    virtual void PinsChanged(Byte portA, Byte portB) = 0;
+
+    // What the device is putting on the pins the VIA has as inputs
+    virtual Byte InputA() { return 0xFF; }
+    virtual Byte InputB() { return 0xFF; }
+};
+
+// 65C22 versatile interface adapter: the two parallel ports, and timer 1 in
+// one-shot and free-running mode with its interrupt. Timer 2, the shift
+// register, the handshake lines and PB7 output aren't emulated; their
+// registers just hold whatever gets written to them.
+struct via_65c22::VIA : mem_28c256::Device, state_6502::Stateful {
+    VIA(cpu_6502::CPU &cpu, cpu_6502::Byte irqLine);
+    ~VIA();
+
+    Byte ORA = 0;
+    Byte ORB = 0;
+    Byte DDRA = 0;
+    Byte DDRB = 0;
+    Byte ACR = 0;
+    Byte IFR = 0;           // IRQ_ANY is worked out when it's read
+    Byte IER = 0;
+    Byte Regs[16] = {};     // Timer 2, shift register, PCR
+
+    // Timer 1 doesn't tick every cycle. The counter held T1Start on cycle
+    // T1Base and counts down from there; CatchUp() moves the base forward
+    // past every reload a free-running timer went through.
+    Word T1Latch = 0;
+    Word T1Start = 0;
+    uint64_t T1Base = 0;
+    uint64_t T1Fires = 0;   // Cycle the counter goes past zero
+    bool T1Armed = false;   // Sets IRQ_T1 at T1Fires. One-shots only do it once.
+    unsigned int T1Event = 0;
+
+    PortDevice *Port = nullptr;
+
+    // Without a scheduler timer 1 still runs, but the VIA only notices it
+    // ran out the next time the firmware reads it
+    events_6502::Scheduler *Events = nullptr;
+    cpu_6502::Byte IRQLine;
+
+    cpu_6502::CPU &Cpu;
+
+    // Level on the pins right now
+    Byte PinsA() const { return (ORA & DDRA) | ~DDRA; }
+    Byte PinsB() const { return (ORB & DDRB) | ~DDRB; }
+
+    // mem_28c256::Device
+    Byte Read(Word addr) override;
+    void Write(Word addr, Byte data) override;
+
+    // state_6502::Stateful
+    void SaveState(state_6502::Packer &out) const override;
+    bool LoadState(state_6502::Unpacker &in) override;
+
+    Word T1Counter() const;
+
+    void NotifyPort();
+    void StartT1(Word count);
+    void CatchUp(uint64_t now);
+    void ScheduleT1();
+    void UpdateIRQ();
+};
+
+#endif
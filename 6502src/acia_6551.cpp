@@ -0,0 +1,373 @@
+#include "acia_6551.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    bool SetNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+}
+
+unsigned int acia_6551::Ring::ContiguousCount() const {
+    unsigned int toEnd = SIZE - (Tail & (SIZE - 1));
+    return Count() < toEnd ? Count() : toEnd;
+}
+
+acia_6551::ACIA::ACIA(cpu_6502::CPU &cpu, events_6502::Scheduler &events, cpu_6502::Byte irqLine)
+    : Cpu(cpu), Events(events), IRQLine(irqLine) {
+    LastFlush = Cpu.Cycles;
+    PollEvent = Events.Schedule(Cpu.Cycles + PollCycles, [this](uint64_t when) { Poll(when); });
+}
+
+acia_6551::ACIA::~ACIA() {
+    Events.Cancel(PollEvent);
+    Detach();
+}
+
+void acia_6551::ACIA::AttachFds(int rxFd, int txFd) {
+    Detach();
+    RxFd = rxFd;
+    TxFd = txFd;
+    if (RxFd >= 0)
+        SetNonBlocking(RxFd);
+    if (TxFd >= 0)
+        SetNonBlocking(TxFd);
+}
+
+bool acia_6551::ACIA::AttachStdio() {
+    Detach();
+    int flags = fcntl(STDIN_FILENO, F_GETFL);
+    if (flags < 0 || !SetNonBlocking(STDIN_FILENO))
+        return false;
+    SavedStdinFlags = flags;
+
+    // Character at a time with no local echo, the firmware does its own
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &SavedTermios) == 0) {
+        struct termios raw = SavedTermios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        RestoreTermios = true;
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0) {
+            Detach();
+            return false;
+        }
+    }
+
+    // stdout stays blocking: its file description is shared with the shell
+    // and stderr, and they'd get non-blocking writes too. A slow reader at
+    // the other end still can't stall a guest STA, since WriteHost() checks
+    // it can take the bytes first.
+    RxFd = STDIN_FILENO;
+    TxFd = STDOUT_FILENO;
+    PollTx = true;
+    return true;
+}
+
+bool acia_6551::ACIA::OpenPty(std::string &slaveName) {
+    Detach();
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0)
+        return false;
+    if (grantpt(master) != 0 || unlockpt(master) != 0 || !SetNonBlocking(master)) {
+        close(master);
+        return false;
+    }
+    slaveName = ptsname(master);
+
+    // Hold the slave open ourselves so the master doesn't return EIO while
+    // nobody has connected yet, and put it in raw mode for the terminal
+    // program that eventually does.
+    SlaveFd = open(slaveName.c_str(), O_RDWR | O_NOCTTY);
+    if (SlaveFd >= 0) {
+        struct termios raw;
+        if (tcgetattr(SlaveFd, &raw) == 0) {
+            cfmakeraw(&raw);
+            tcsetattr(SlaveFd, TCSANOW, &raw);
+        }
+    }
+
+    RxFd = TxFd = OwnedFd = master;
+    return true;
+}
+
+bool acia_6551::ACIA::ListenUnixSocket(const std::string &path) {
+    Detach();
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0 || !SetNonBlocking(fd)) {
+        close(fd);
+        return false;
+    }
+    ListenFd = fd;
+    SocketPath = path;
+    return true;
+}
+
+void acia_6551::ACIA::Detach() {
+    // Blocking writes for the last of the output, so it all gets out
+    PollTx = false;
+    Flush();
+    if (SavedStdinFlags >= 0) {
+        fcntl(STDIN_FILENO, F_SETFL, SavedStdinFlags);
+        SavedStdinFlags = -1;
+    }
+    if (RestoreTermios) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &SavedTermios);
+        RestoreTermios = false;
+    }
+    if (OwnedFd >= 0)
+        close(OwnedFd);
+    if (SlaveFd >= 0)
+        close(SlaveFd);
+    if (ListenFd >= 0)
+        close(ListenFd);
+    if (!SocketPath.empty())
+        unlink(SocketPath.c_str());
+    OwnedFd = SlaveFd = ListenFd = RxFd = TxFd = -1;
+    SocketPath.clear();
+    Unsent.clear();
+}
+
+acia_6551::Byte acia_6551::ACIA::Read(Word addr) {
+    switch (addr & 3) {
+        case REG_DATA: {
+            Byte data = RxData;
+            Status &= ~STATUS_RDRF;
+            LoadNextRxByte();
+            return data;
+        }
+        case REG_STATUS: {
+            Byte status = Status;
+            if (Tx.Full())
+                status &= ~STATUS_TDRE;
+            // Reading status is how the IRQ gets acknowledged
+            Status &= ~STATUS_IRQ;
+            UpdateIRQ();
+            return status;
+        }
+        case REG_COMMAND:
+            return Command;
+        default:
+            return Control;
+    }
+}
+
+void acia_6551::ACIA::Write(Word addr, Byte data) {
+    switch (addr & 3) {
+        case REG_DATA:
+            if (Tx.Full())
+                DrainTx();
+            if (!Tx.Full())
+                Tx.Push(data);  // Otherwise it's an overrun, same as the real thing
+            if (Tx.Count() >= Ring::SIZE / 2)
+                DrainTx();
+            if ((Command & COMMAND_TX_MASK) == COMMAND_TX_IRQ_ON) {
+                Status |= STATUS_IRQ;
+                UpdateIRQ();
+            }
+            break;
+        case REG_STATUS:
+            // Programmed reset: clears the bottom of the command register
+            Command &= 0xE0;
+            UpdateIRQ();
+            break;
+        case REG_COMMAND:
+            Command = data;
+            UpdateIRQ();
+            break;
+        default:
+            Control = data;
+    }
+}
+
+void acia_6551::ACIA::Flush() {
+    DrainTx();
+}
+
+void acia_6551::ACIA::Poll(uint64_t now) {
+    // After a save state load the clock can be way past the last poll.
+    // Skip to the latest poll that's due rather than running every one in
+    // between, which would also stamp host input with long gone cycles.
+    if (Cpu.Cycles >= now + PollCycles) {
+        uint64_t latest = Cpu.Cycles - (Cpu.Cycles - now) % PollCycles;
+        PollEvent = Events.Schedule(latest, [this](uint64_t when) { Poll(when); });
+        return;
+    }
+
+    if (RxFd < 0 && ListenFd >= 0) {
+        int client = accept(ListenFd, NULL, NULL);
+        if (client >= 0) {
+            SetNonBlocking(client);
+            RxFd = TxFd = OwnedFd = client;
+        }
+    }
+
+    FillRx();
+    if (!(Status & STATUS_RDRF))
+        LoadNextRxByte();
+
+    if (!Tx.Empty() && now - LastFlush >= FlushCycles)
+        DrainTx();
+    else if (!Unsent.empty())
+        WriteUnsent();
+
+    PollEvent = Events.Schedule(now + PollCycles, [this](uint64_t when) { Poll(when); });
+}
+
+void acia_6551::ACIA::FillRx() {
+    // Input is stamped with the cycle it actually arrived on rather than
+    // when the poll was due, since a checkpoint can fall in between
+    Byte buf[Ring::SIZE];
+    if (Journal && Journal->Replaying()) {
+        size_t n = Journal->TakeInput(Cpu.Cycles, replay_6502::CHANNEL_ACIA, buf, Rx.Space());
+        for (size_t i = 0; i < n; i++)
+            Rx.Push(buf[i]);
+        BytesIn += n;
+        return;
+    }
+
+    while (RxFd >= 0 && !Rx.Full()) {
+        ssize_t n = read(RxFd, buf, Rx.Space());
+        if (n > 0) {
+            for (ssize_t i = 0; i < n; i++)
+                Rx.Push(buf[i]);
+            BytesIn += n;
+            if (Journal)
+                Journal->Input(Cpu.Cycles, replay_6502::CHANNEL_ACIA, buf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+
+        // EOF or a real error. A socket client going away means go back to
+        // waiting for the next one, anything else just stops input.
+        if (RxFd == OwnedFd && ListenFd >= 0) {
+            close(OwnedFd);
+            OwnedFd = TxFd = -1;
+        }
+        RxFd = -1;
+    }
+}
+
+void acia_6551::ACIA::DrainTx() {
+    LastFlush = Cpu.Cycles;
+    if (TxFd < 0) {
+        Tx.Drop(Tx.Count());
+        return;
+    }
+    if (Journal) {
+        // The ring has to empty on the same cycles every run, whatever the
+        // host's doing, so what it can't take yet waits out here instead
+        while (!Tx.Empty()) {
+            unsigned int n = Tx.ContiguousCount();
+            if (Unsent.size() + n <= MaxUnsent)
+                Unsent.append((const char *)Tx.Front(), n);
+            else
+                BytesDropped += n;
+            Tx.Drop(n);
+        }
+        WriteUnsent();
+        return;
+    }
+    while (!Tx.Empty()) {
+        ssize_t n = WriteHost(Tx.Front(), Tx.ContiguousCount());
+        if (n <= 0)
+            break;      // Host isn't keeping up, try again next poll
+        Tx.Drop(n);
+        BytesOut += n;
+    }
+}
+
+void acia_6551::ACIA::WriteUnsent() {
+    size_t done = 0;
+    while (TxFd >= 0 && done < Unsent.size()) {
+        ssize_t n = WriteHost(Unsent.data() + done, Unsent.size() - done);
+        if (n <= 0)
+            break;
+        done += n;
+        BytesOut += n;
+    }
+    Unsent.erase(0, done);
+}
+
+ssize_t acia_6551::ACIA::WriteHost(const void *data, size_t size) {
+    if (PollTx) {
+        // Blocking fd: only write if it has room, and no more than a pipe
+        // guarantees it can take in one go
+        struct pollfd pfd = { TxFd, POLLOUT, 0 };
+        if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLOUT))
+            return 0;
+        if (size > PIPE_BUF)
+            size = PIPE_BUF;
+    }
+    WriteCalls++;
+    return write(TxFd, data, size);
+}
+
+void acia_6551::ACIA::LoadNextRxByte() {
+    if (Rx.Empty() || (Status & STATUS_RDRF))
+        return;
+    RxData = Rx.Pop();
+    Status |= STATUS_RDRF;
+    if ((Command & COMMAND_DTR) && !(Command & COMMAND_RX_IRQ_OFF))
+        Status |= STATUS_IRQ;
+    UpdateIRQ();
+}
+
+void acia_6551::ACIA::UpdateIRQ() {
+    if (Status & STATUS_IRQ)
+        Cpu.AssertIRQ(IRQLine);
+    else
+        Cpu.ReleaseIRQ(IRQLine);
+}
+
+void acia_6551::ACIA::SaveState(state_6502::Packer &out) const {
+    out.U8(RxData);
+    out.U8(Status);
+    out.U8(Command);
+    out.U8(Control);
+    out.U64(LastFlush);
+    for (const Ring *ring : { &Rx, &Tx }) {
+        out.U16(ring->Count());
+        for (unsigned int i = ring->Tail; i != ring->Head; i++)
+            out.U8(ring->Data[i & (Ring::SIZE - 1)]);
+    }
+}
+
+bool acia_6551::ACIA::LoadState(state_6502::Unpacker &in) {
+    RxData = in.U8();
+    Status = in.U8();
+    Command = in.U8();
+    Control = in.U8();
+    LastFlush = in.U64();
+    for (Ring *ring : { &Rx, &Tx }) {
+        unsigned int count = in.U16();
+        if (count > Ring::SIZE)
+            return false;
+        ring->Head = ring->Tail = 0;
+        for (unsigned int i = 0; i < count; i++)
+            ring->Push(in.U8());
+    }
+    UpdateIRQ();
+    return !in.Bad;
+}
@@ -0,0 +1,290 @@
+#include "block_device.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+block_device::BlockDevice::BlockDevice(cpu_6502::CPU &cpu, mem_28c256::Mem &mem, events_6502::Scheduler &events, cpu_6502::Byte irqLine)
+    : Cpu(cpu), Memory(mem), Events(events), IRQLine(irqLine) {
+    memset(Buffer, 0, sizeof(Buffer));
+}
+
+block_device::BlockDevice::~BlockDevice() {
+    Close();
+}
+
+bool block_device::BlockDevice::Open(const std::string &path, bool readOnly) {
+    Close();
+    int fd = open(path.c_str(), readOnly ? O_RDONLY : O_RDWR);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)SECTOR_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    int prot = readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+    void *image = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    Image = (Byte *)image;
+    ImageSize = st.st_size;
+    Sectors = ImageSize / SECTOR_SIZE;  // A partial sector at the end is ignored
+    ReadOnly = readOnly;
+    Fd = fd;
+    Status = STATUS_READY;
+    return true;
+}
+
+void block_device::BlockDevice::Close() {
+    if (Status & STATUS_BUSY) {
+        Events.Cancel(DMAEvent);
+        Status &= ~STATUS_BUSY;
+    }
+    if (Image) {
+        if (!ReadOnly)
+            msync(Image, ImageSize, MS_SYNC);
+        munmap(Image, ImageSize);
+    }
+    if (Fd >= 0)
+        close(Fd);
+    Image = nullptr;
+    ImageSize = 0;
+    Sectors = 0;
+    Fd = -1;
+    Status = 0;
+    UpdateIRQ();
+}
+
+block_device::Byte block_device::BlockDevice::Read(Word addr) {
+    switch (addr & 0xF) {
+        case REG_COMMAND: {
+            Byte status = Status;
+            // Reading status acknowledges the interrupt
+            Status &= ~STATUS_IRQ;
+            UpdateIRQ();
+            return status;
+        }
+        case REG_DATA: {
+            if (!(Status & STATUS_DRQ) || Writing)
+                return 0xFF;
+            Byte data = Buffer[BufferPos++];
+            if (BufferPos == SECTOR_SIZE)
+                Status &= ~STATUS_DRQ;
+            return data;
+        }
+        case REG_LBA0:
+            return LBA;
+        case REG_LBA1:
+            return LBA >> 8;
+        case REG_LBA2:
+            return LBA >> 16;
+        case REG_LBA3:
+            return LBA >> 24;
+        case REG_DMA_LO:
+            return DMAAddress;
+        case REG_DMA_HI:
+            return DMAAddress >> 8;
+        case REG_COUNT:
+            return Count;
+        case REG_CONTROL:
+            return Control;
+        default:
+            return 0xFF;
+    }
+}
+
+void block_device::BlockDevice::Write(Word addr, Byte data) {
+    // Like commands, the transfer registers are locked while DMA runs, so
+    // FinishDMA() copies exactly what StartCommand() checked
+    Word reg = addr & 0xF;
+    if ((Status & STATUS_BUSY) && reg >= REG_LBA0 && reg <= REG_COUNT)
+        return;
+
+    switch (reg) {
+        case REG_COMMAND:
+            StartCommand(data);
+            break;
+        case REG_DATA:
+            if (!(Status & STATUS_DRQ) || !Writing)
+                break;
+            Buffer[BufferPos++] = data;
+            if (BufferPos == SECTOR_SIZE) {
+                memcpy(Sector(BufferLBA), Buffer, SECTOR_SIZE);
+                SectorsWritten++;
+                Status &= ~STATUS_DRQ;
+                Writing = false;
+            }
+            break;
+        case REG_LBA0:
+            LBA = (LBA & 0xFFFFFF00) | data;
+            break;
+        case REG_LBA1:
+            LBA = (LBA & 0xFFFF00FF) | (uint32_t(data) << 8);
+            break;
+        case REG_LBA2:
+            LBA = (LBA & 0xFF00FFFF) | (uint32_t(data) << 16);
+            break;
+        case REG_LBA3:
+            LBA = (LBA & 0x00FFFFFF) | (uint32_t(data) << 24);
+            break;
+        case REG_DMA_LO:
+            DMAAddress = (DMAAddress & 0xFF00) | data;
+            break;
+        case REG_DMA_HI:
+            DMAAddress = (DMAAddress & 0x00FF) | (data << 8);
+            break;
+        case REG_COUNT:
+            Count = data;
+            break;
+        case REG_CONTROL:
+            Control = data;
+            UpdateIRQ();
+            break;
+    }
+}
+
+void block_device::BlockDevice::StartCommand(Byte cmd) {
+    // The real thing ignores commands while it's busy, so do we
+    if (!Image || (Status & STATUS_BUSY))
+        return;
+    Status &= ~(STATUS_ERR | STATUS_DRQ);
+    Writing = false;
+
+    switch (cmd) {
+        case CMD_READ:
+            if (LBA >= Sectors)
+                return Fail();
+            memcpy(Buffer, Sector(LBA), SECTOR_SIZE);
+            SectorsRead++;
+            BufferPos = 0;
+            Status |= STATUS_DRQ;
+            break;
+        case CMD_WRITE:
+            if (LBA >= Sectors || ReadOnly)
+                return Fail();
+            BufferLBA = LBA;
+            BufferPos = 0;
+            Writing = true;
+            Status |= STATUS_DRQ;
+            break;
+        case CMD_DMA_READ:
+        case CMD_DMA_WRITE: {
+            unsigned int n = TransferSectors();
+            if (uint64_t(LBA) + n > Sectors || DMAAddress + n * SECTOR_SIZE > MAX_MEM)
+                return Fail();
+            if (cmd == CMD_DMA_WRITE && ReadOnly)
+                return Fail();
+            // The copy itself happens when the transfer finishes so the
+            // firmware can't see the data before it's been "paid for"
+            PendingCommand = cmd;
+            Status = (Status & ~STATUS_READY) | STATUS_BUSY;
+            DMADone = Cpu.Cycles + CommandCycles + n * CyclesPerSector;
+            DMAEvent = Events.Schedule(DMADone, [this](uint64_t) { FinishDMA(); }, this);
+            break;
+        }
+        case CMD_FLUSH:
+            if (!ReadOnly)
+                msync(Image, ImageSize, MS_ASYNC);
+            break;
+        default:
+            Fail();
+    }
+}
+
+void block_device::BlockDevice::FinishDMA() {
+    unsigned int bytes = TransferSectors() * SECTOR_SIZE;
+    if (PendingCommand == CMD_DMA_READ) {
+        memcpy(&Memory.Data[DMAAddress], Sector(LBA), bytes);
+        Memory.Touch(DMAAddress, DMAAddress + bytes - 1);
+        SectorsRead += TransferSectors();
+    } else {
+        memcpy(Sector(LBA), &Memory.Data[DMAAddress], bytes);
+        SectorsWritten += TransferSectors();
+    }
+    DMATransfers++;
+
+    Status = (Status & ~STATUS_BUSY) | STATUS_READY;
+    if (Control & CONTROL_IRQ_ON)
+        Status |= STATUS_IRQ;
+    UpdateIRQ();
+}
+
+void block_device::BlockDevice::Fail() {
+    Status |= STATUS_ERR;
+}
+
+void block_device::BlockDevice::UpdateIRQ() {
+    if ((Status & STATUS_IRQ) && (Control & CONTROL_IRQ_ON))
+        Cpu.AssertIRQ(IRQLine);
+    else
+        Cpu.ReleaseIRQ(IRQLine);
+}
+
+void block_device::BlockDevice::SaveState(state_6502::Packer &out) const {
+    out.U8(Status);
+    out.U8(Control);
+    out.U32(LBA);
+    out.U16(DMAAddress);
+    out.U8(Count);
+    out.Bytes(Buffer, sizeof(Buffer));
+    out.U16(BufferPos);
+    out.U8(Writing);
+    out.U32(BufferLBA);
+    out.U8(PendingCommand);
+    out.U64(DMADone);
+}
+
+bool block_device::BlockDevice::LoadState(state_6502::Unpacker &in) {
+    // Decoded and checked before anything changes. A state from elsewhere
+    // has to fit the image open now: a transfer in flight or a PIO write
+    // pointing past its end would have FinishDMA() or DATA copy off it.
+    Byte status = in.U8();
+    Byte control = in.U8();
+    uint32_t lba = in.U32();
+    Word dmaAddress = in.U16();
+    Byte count = in.U8();
+    Byte buffer[SECTOR_SIZE];
+    in.Take(buffer, sizeof(buffer));
+    unsigned int bufferPos = in.U16();
+    bool writing = in.U8();
+    uint32_t bufferLBA = in.U32();
+    Byte pendingCommand = in.U8();
+    uint64_t dmaDone = in.U64();
+    if (in.Bad || bufferPos > SECTOR_SIZE)
+        return false;
+    if ((status & STATUS_DRQ) && writing && (bufferLBA >= Sectors || ReadOnly))
+        return false;
+    if (status & STATUS_BUSY) {
+        unsigned int n = count ? count : 1;
+        if (!Image || uint64_t(lba) + n > Sectors || dmaAddress + n * SECTOR_SIZE > MAX_MEM)
+            return false;
+        if (pendingCommand != CMD_DMA_READ && (pendingCommand != CMD_DMA_WRITE || ReadOnly))
+            return false;
+    }
+
+    if (Status & STATUS_BUSY)
+        Events.Cancel(DMAEvent);
+    Status = status;
+    Control = control;
+    LBA = lba;
+    DMAAddress = dmaAddress;
+    Count = count;
+    memcpy(Buffer, buffer, sizeof(Buffer));
+    BufferPos = bufferPos;
+    Writing = writing;
+    BufferLBA = bufferLBA;
+    PendingCommand = pendingCommand;
+    DMADone = dmaDone;
+    if (Status & STATUS_BUSY)
+        DMAEvent = Events.Schedule(DMADone, [this](uint64_t) { FinishDMA(); }, this);
+    UpdateIRQ();
+    return true;
+}
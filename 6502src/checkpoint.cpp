@@ -0,0 +1,206 @@
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <dirent.h>
+#include <unistd.h>
+
+namespace {
+    uint64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    // Stands in for a device on the writer thread, where only the bytes it
+    // saved on the emulator thread are left
+    struct Blob : state_6502::Stateful {
+        std::string Data;
+        void SaveState(state_6502::Packer &out) const override { out.Bytes(Data.data(), Data.size()); }
+        bool LoadState(state_6502::Unpacker &) override { return false; }
+    };
+
+    std::string FileName(const std::string &base, uint64_t seq) {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%06llu", (unsigned long long)seq);
+        return base + suffix;
+    }
+
+    // Sequence number of a checkpoint file, 0 if it isn't one of ours
+    uint64_t SequenceOf(const std::string &name, const std::string &prefix) {
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+            return 0;
+        std::string digits = name.substr(prefix.size());
+        if (digits.find_first_not_of("0123456789") != std::string::npos)
+            return 0;
+        return strtoull(digits.c_str(), NULL, 10);
+    }
+
+    // (sequence, path) of every checkpoint for `base`, oldest first
+    std::vector<std::pair<uint64_t, std::string>> Scan(const std::string &base) {
+        size_t slash = base.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : base.substr(0, slash + 1);
+        std::string prefix = (slash == std::string::npos ? base : base.substr(slash + 1)) + ".";
+
+        std::vector<std::pair<uint64_t, std::string>> found;
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+            return found;
+        while (dirent *entry = readdir(d)) {
+            uint64_t seq = SequenceOf(entry->d_name, prefix);
+            if (seq)
+                found.push_back(std::make_pair(seq, FileName(base, seq)));
+        }
+        closedir(d);
+        std::sort(found.begin(), found.end());
+        return found;
+    }
+}
+
+std::vector<std::string> checkpoint_6502::List(const std::string &base) {
+    std::vector<std::string> files;
+    for (const auto &f : Scan(base))
+        files.push_back(f.second);
+    return files;
+}
+
+bool checkpoint_6502::Resume(const std::string &base, cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+                             const state_6502::Devices &devices, std::string *path) {
+    // A file only ever appears once it's complete, but the disk can still
+    // eat one afterwards; the CRCs catch that and we fall back a step
+    std::vector<std::string> files = List(base);
+    for (auto f = files.rbegin(); f != files.rend(); ++f) {
+        if (state_6502::LoadFile(*f, cpu, mem, devices)) {
+            if (path)
+                *path = *f;
+            return true;
+        }
+    }
+    return false;
+}
+
+void checkpoint_6502::Snapshot::Clear() {
+    Devices.clear();
+    PageIndex.clear();
+    Pages.clear();
+    for (unsigned int page = 0; page < NUM_PAGES; page++)
+        Slot[page] = -1;
+}
+
+checkpoint_6502::Checkpointer::Checkpointer(const std::string &base, unsigned int keep)
+    : Base(base), Keep(keep ? keep : 1) {
+    // Carry on numbering after whatever a previous run left behind
+    std::vector<std::pair<uint64_t, std::string>> files = Scan(base);
+    if (!files.empty())
+        Sequence = files.back().first;
+
+    Shadow = new mem_28c256::Mem;
+    Shadow->Init();
+    Writer = std::thread(&Checkpointer::WriterLoop, this);
+}
+
+checkpoint_6502::Checkpointer::~Checkpointer() {
+    {
+        std::lock_guard<std::mutex> hold(Lock);
+        Quit = true;
+    }
+    Wake.notify_one();
+    Writer.join();
+    delete Shadow;
+}
+
+void checkpoint_6502::Checkpointer::Take(const cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+                                         const state_6502::Devices &devices) {
+    uint64_t start = NowNs();
+
+    // Device state is small, get it before taking the lock
+    std::vector<std::pair<std::string, std::string>> blobs;
+    for (const auto &dev : devices) {
+        state_6502::Packer p;
+        dev.second->SaveState(p);
+        blobs.push_back(std::make_pair(dev.first, p.Data));
+    }
+
+    uint64_t since = Mark;
+    Mark = mem.NextGeneration();
+
+    std::lock_guard<std::mutex> hold(Lock);
+    if (HavePending)
+        Merged++;
+    Pending.Cpu = cpu;
+    Pending.Devices.swap(blobs);
+    for (unsigned int page = 0; page < NUM_PAGES; page++) {
+        if (!First && !mem.ChangedSince(page, since))
+            continue;
+        int slot = Pending.Slot[page];
+        if (slot < 0) {
+            slot = Pending.Slot[page] = Pending.PageIndex.size();
+            Pending.PageIndex.push_back(page);
+            Pending.Pages.resize(Pending.Pages.size() + PAGE_SIZE);
+        }
+        memcpy(&Pending.Pages[slot * PAGE_SIZE], &mem.Data[page * PAGE_SIZE], PAGE_SIZE);
+    }
+    First = false;
+    HavePending = true;
+    Taken++;
+    Wake.notify_one();
+    TakeNs += NowNs() - start;
+}
+
+void checkpoint_6502::Checkpointer::Flush() {
+    std::unique_lock<std::mutex> hold(Lock);
+    Idle.wait(hold, [this] { return !HavePending && !Writing; });
+}
+
+void checkpoint_6502::Checkpointer::WriterLoop() {
+    std::unique_lock<std::mutex> hold(Lock);
+    for (;;) {
+        Wake.wait(hold, [this] { return HavePending || Quit; });
+        if (!HavePending)
+            break;
+        // Swapping only moves the vectors' buffers, so the emulator gets
+        // the lock back straight away
+        std::swap(Pending, Working);
+        Pending.Clear();
+        HavePending = false;
+        Writing = true;
+
+        hold.unlock();
+        uint64_t start = NowNs();
+        WriteOut();
+        WriteNs += NowNs() - start;
+        hold.lock();
+
+        Writing = false;
+        Idle.notify_all();
+    }
+}
+
+void checkpoint_6502::Checkpointer::WriteOut() {
+    for (size_t i = 0; i < Working.PageIndex.size(); i++)
+        memcpy(&Shadow->Data[Working.PageIndex[i] * PAGE_SIZE], &Working.Pages[i * PAGE_SIZE], PAGE_SIZE);
+
+    std::vector<Blob> blobs(Working.Devices.size());
+    state_6502::Devices devices;
+    for (size_t i = 0; i < blobs.size(); i++) {
+        blobs[i].Data = Working.Devices[i].second;
+        devices.push_back(std::make_pair(Working.Devices[i].first, &blobs[i]));
+    }
+
+    uint64_t seq = Sequence + 1;
+    if (!state_6502::SaveFile(FileName(Base, seq), Working.Cpu, *Shadow, devices)) {
+        Failed++;
+        return;
+    }
+    Sequence = seq;
+    Written++;
+    Prune();
+}
+
+void checkpoint_6502::Checkpointer::Prune() {
+    std::vector<std::string> files = List(Base);
+    for (size_t i = 0; i + Keep < files.size(); i++)
+        unlink(files[i].c_str());
+}
@@ -0,0 +1,121 @@
+#include "coverage.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "symbols.hpp"
+
+namespace {
+    double Percent(unsigned int part, unsigned int whole) {
+        return whole ? 100.0 * part / whole : 0.0;
+    }
+
+    // 0 for an untouched page, otherwise 64..255 on a log scale against the
+    // busiest page, so a page hit once still shows up next to one hit a
+    // billion times
+    unsigned int Level(uint64_t count, uint64_t most) {
+        if (!count)
+            return 0;
+        return 64 + unsigned(std::lround(191 * std::log1p(double(count)) / std::log1p(double(most))));
+    }
+
+    uint64_t Most(const uint64_t *counts) {
+        uint64_t most = 0;
+        for (unsigned int i = 0; i < 256; i++)
+            most = counts[i] > most ? counts[i] : most;
+        return most;
+    }
+}
+
+void coverage_6502::Coverage::Clear() {
+    memset(Executed, 0, sizeof(Executed));
+    memset(Read, 0, sizeof(Read));
+    memset(Written, 0, sizeof(Written));
+    memset(Fetches, 0, sizeof(Fetches));
+    memset(Reads, 0, sizeof(Reads));
+    memset(Writes, 0, sizeof(Writes));
+}
+
+unsigned int coverage_6502::Coverage::Count(const uint64_t *bits, Word first, Word last) {
+    // A word at a time, with the odd bits at either end masked off
+    unsigned int count = 0;
+    for (unsigned int word = first >> 6; word <= unsigned(last >> 6); word++) {
+        uint64_t set = bits[word];
+        if (word == unsigned(first >> 6))
+            set &= ~uint64_t(0) << (first & 63);
+        if (word == unsigned(last >> 6))
+            set &= ~uint64_t(0) >> (63 - (last & 63));
+        count += __builtin_popcountll(set);
+    }
+    return count;
+}
+
+void coverage_6502::Coverage::Report(std::ostream &out, const symbols_6502::Table *symbols) const {
+    char line[160];
+    snprintf(line, sizeof(line), "%u bytes executed, %u read, %u written\n\n",
+             Count(Executed, 0, 0xFFFF), Count(Read, 0, 0xFFFF), Count(Written, 0, 0xFFFF));
+    out << line;
+
+    auto row = [&](const char *name, unsigned int first, unsigned int size) {
+        Word last = Word(first + size - 1);
+        unsigned int executed = Count(Executed, Word(first), last);
+        unsigned int read = Count(Read, Word(first), last);
+        unsigned int written = Count(Written, Word(first), last);
+        snprintf(line, sizeof(line), "  %04X  %5u  %5u %5.1f%%  %5u %5.1f%%  %5u %5.1f%%  %s\n", first, size,
+                 executed, Percent(executed, size), read, Percent(read, size), written, Percent(written, size), name);
+        out << line;
+    };
+
+    out << "  addr   size   executed        read        written\n";
+    if (symbols && !symbols->Empty()) {
+        // Unsized symbols run up to the next one, the last to the top of
+        // memory. Sized ones stop at their size or the next, whichever's first.
+        for (size_t i = 0; i < symbols->Symbols.size(); i++) {
+            const symbols_6502::Symbol &s = symbols->Symbols[i];
+            unsigned int end = i + 1 < symbols->Symbols.size() ? symbols->Symbols[i + 1].Address : 0x10000;
+            if (s.Size && s.Address + s.Size < end)
+                end = s.Address + s.Size;
+            row(symbols->NameOf(s), s.Address, end - s.Address);
+        }
+        return;
+    }
+
+    for (unsigned int page = 0; page < 256; page++) {
+        if (!Fetches[page] && !Reads[page] && !Writes[page])
+            continue;
+        char name[16];
+        snprintf(name, sizeof(name), "page %02X", page);
+        row(name, page << 8, 256);
+    }
+}
+
+void coverage_6502::Coverage::WriteCSV(std::ostream &out) const {
+    out << "page,executed,read,written,fetches,reads,writes\n";
+    char line[160];
+    for (unsigned int page = 0; page < 256; page++) {
+        Word first = Word(page << 8), last = Word(first | 0xFF);
+        snprintf(line, sizeof(line), "%u,%u,%u,%u,%llu,%llu,%llu\n", page, Count(Executed, first, last),
+                 Count(Read, first, last), Count(Written, first, last), (unsigned long long)Fetches[page],
+                 (unsigned long long)Reads[page], (unsigned long long)Writes[page]);
+        out << line;
+    }
+}
+
+void coverage_6502::Coverage::WritePPM(std::ostream &out) const {
+    out << "P6\n256 256\n255\n";
+    uint64_t mostFetches = Most(Fetches), mostReads = Most(Reads), mostWrites = Most(Writes);
+    char row[256 * 3];
+    for (unsigned int page = 0; page < 256; page++) {
+        Byte red = Byte(Level(Writes[page], mostWrites));
+        Byte green = Byte(Level(Fetches[page], mostFetches));
+        Byte blue = Byte(Level(Reads[page], mostReads));
+        for (unsigned int i = 0; i < 256; i++) {
+            Word addr = Word(page << 8 | i);
+            row[i * 3] = Test(Written, addr) ? red : 0;
+            row[i * 3 + 1] = Test(Executed, addr) ? green : 0;
+            row[i * 3 + 2] = Test(Read, addr) ? blue : 0;
+        }
+        out.write(row, sizeof(row));
+    }
+}
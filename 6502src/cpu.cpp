@@ -1,4 +1,7 @@
 #include "cpu_6502.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+#include "usdt.hpp"
 
 /*
  *ADC AND ASL BCC BCS BEQ BIT BMI BNE BPL BRK BVC BVS CLC
@@ -7,7 +10,12 @@
  *RTS SBC SEC SED SEI STA STX STY TAX TAY TSX TXA TXS TYA
  */
 
-void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
+void cpu_6502::CPU::Execute(unsigned int cycles, mem_28c256::Mem &mem) {
+    // Signed so an instruction that runs past the end of the budget just ends
+    // the loop instead of wrapping around to four billion.
+    int64_t nCycles = cycles;
+    USDT_PROBE2(emu6502, slice_start, Cycles, cycles);
+
     auto lAND = [&mem, this](cpu_6502::Word addr) {
         A &= ReadByte(addr, mem);
         UpdateZeroAndNegativeFlags(A);
@@ -30,10 +38,13 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
         SF.Z = (A & val) == 0;
     };
 
+    // Read-modify-write instructions read the value, write it straight back
+    // unchanged while the ALU works on it, then write the result.
     auto IncrementMem = [&mem, this](cpu_6502::Word addr) {
         cpu_6502::Byte xd = ReadByte(addr, mem);
+        DummyWrite(addr, xd, mem);
         WriteByte(++xd, addr, mem);
-        UpdateZeroAndNegativeFlags(mem[addr]);
+        UpdateZeroAndNegativeFlags(xd);
     };
 
     auto IncrementReg = [&mem, this](cpu_6502::Byte &reg) {
@@ -43,8 +54,9 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
 
     auto DecrementMem = [&mem, this](cpu_6502::Word addr) {
         cpu_6502::Byte xd = ReadByte(addr, mem);
+        DummyWrite(addr, xd, mem);
         WriteByte(--xd, addr, mem);
-        UpdateZeroAndNegativeFlags(mem[addr]);
+        UpdateZeroAndNegativeFlags(xd);
     };
 
     auto DecrementReg = [&mem, this](cpu_6502::Byte &reg) {
@@ -54,45 +66,64 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
 
     auto ASL = [&mem, this](cpu_6502::Word addr) {
         cpu_6502::Byte val = ReadByte(addr, mem);
+        DummyWrite(addr, val, mem);
         SF.C = (val & 0b10000000) > 0;
-        SF.Z = (val == 0);
-        WriteByte(val << 1, addr, mem);
-        SF.N = (mem[addr] & 0b10000000) > 0;
-        UpdateZeroAndNegativeFlags(mem[addr]);
+        val = val << 1;
+        WriteByte(val, addr, mem);
+        UpdateZeroAndNegativeFlags(val);
     };
 
     auto LSR = [&mem, this](cpu_6502::Word addr) {
-        SF.C = (mem[addr] & 0b1);
-        WriteByte(mem[addr] >> 1, addr, mem);
-        UpdateZeroAndNegativeFlags(mem[addr]);
+        cpu_6502::Byte val = ReadByte(addr, mem);
+        DummyWrite(addr, val, mem);
+        SF.C = (val & 0b1);
+        val = val >> 1;
+        WriteByte(val, addr, mem);
+        UpdateZeroAndNegativeFlags(val);
     };
 
     auto ROL = [&mem, this](cpu_6502::Word addr) {
         cpu_6502::Byte old = ReadByte(addr, mem);
-        WriteByte(mem[addr] << 1, addr, mem);
-        cpu_6502::Byte val = ReadByte(addr, mem) | SF.C << 0;
+        DummyWrite(addr, old, mem);
+        cpu_6502::Byte val = (old << 1) | SF.C << 0;
         WriteByte(val, addr, mem);
         SF.C = (old & 0b10000000) > 0;
-        UpdateZeroAndNegativeFlags(mem[addr]);
+        UpdateZeroAndNegativeFlags(val);
     };
 
     auto ROR = [&mem, this](cpu_6502::Word addr) {
         cpu_6502::Byte old = ReadByte(addr, mem);
-        WriteByte(mem[addr] >> 1, addr, mem); // Right shift everything
-        cpu_6502::Byte asdf = ReadByte(addr, mem) ;
-        asdf |= asdf << 7;
-        WriteByte(asdf, addr, mem);
+        DummyWrite(addr, old, mem);
+        cpu_6502::Byte val = (old >> 1) | SF.C << 7; // Right shift everything, C goes in the top
+        WriteByte(val, addr, mem);
         SF.C = (old & 0b1);
-        UpdateZeroAndNegativeFlags(asdf);
+        UpdateZeroAndNegativeFlags(val);
     };
 
+    // Not taken: 2 cycles. Taken: one more to add the offset to PCL, and one
+    // more again if that carried into PCH. The offset is signed and counts
+    // from the instruction after the branch.
     auto Branch = [&nCycles, &mem, this](bool test, bool val) {
         cpu_6502::Byte displacement = FetchByte(mem);
+#ifdef CPU_6502_PROFILE
+        if (Profile)
+            Profile->Branch(PC - 2, test == val);
+#endif
         if (test == val) {
-            PC+=displacement;
-            return true;
+            DummyRead(PC, mem);
+            cpu_6502::Word target = PC + int8_t(displacement);
+            nCycles -= 1;
+            if ((target & 0xFF00) != (PC & 0xFF00)) {
+                // PCH hasn't been fixed up yet on this cycle
+                DummyRead((PC & 0xFF00) | (target & 0xFF), mem);
+                nCycles -= 1;
+#ifdef CPU_6502_PROFILE
+                PagePenalty = true;
+#endif
+            }
+            PC = target;
         }
-        return false;
+        nCycles -= 2;
     };
 
     auto Compare = [&mem, this](cpu_6502::Byte &reg, cpu_6502::Word addr) {
@@ -132,14 +163,102 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
         SF.V = !((origA ^ val) & 0b10000000) && ((A ^ val) & 0b10000000);
     };
 
-    auto CheckPCCrossedPageBoundary = [&nCycles, this](cpu_6502::Word OldPC) {
-        return ((OldPC >> 8) != (PC >> 8)) ? true : false;
+    // In the fast build every cycle an instruction used gets counted here. In
+    // the cycle exact build the bus already counted them one by one, so just
+    // make sure both engines agree on how long the instruction took.
+    auto Retire = [this](uint64_t busStart, int64_t used) {
+#ifdef CPU_6502_CYCLE_EXACT
+        assert(Cycles - busStart == uint64_t(used));
+        (void)busStart;
+        (void)used;
+#else
+        (void)busStart;
+        Cycles += used;
+#endif
     };
 
     using namespace cpu_6502;
 
     while (nCycles > 0) {
+        if (Events && Cycles >= Events->NextEvent())
+            Events->RunUntil(Cycles);
+
+        if (Waiting || Stopped) {
+            // A pending interrupt wakes WAI up even with I set, it just won't
+            // be serviced in that case. STP ignores everything but reset.
+            if (!Stopped && (NMIPending || IRQLines))
+                Waiting = false;
+            else {
+                // Nothing can happen until the next device event, so jump
+                // straight there instead of spinning on fake cycles.
+                uint64_t until = Cycles + nCycles;
+                if (Events && Events->NextEvent() < until)
+                    until = Events->NextEvent();
+                nCycles -= until - Cycles;
+                Cycles = until;
+                continue;
+            }
+        }
+
+        int64_t startCycles = nCycles;
+        uint64_t busStart = Cycles;
+
+        // Registers go in before the instruction runs, the rest after
+        trace_6502::Record *traced = nullptr;
+        if (Trace) {
+            traced = Trace->Begin();
+            traced->Cycle = Cycles;
+            traced->PC = PC;
+            traced->A = A;
+            traced->X = X;
+            traced->Y = Y;
+            traced->SP = SP;
+            traced->P = PSF;
+            traced->Kind = trace_6502::KIND_INSTRUCTION;
+            EffectiveAddress = 0;
+        }
+
+        if (NMIPending) {
+            NMIPending = false;
+            Interrupts++;
+            Interrupt(0xFFFA, mem);
+            nCycles -= 7;
+            Retire(busStart, startCycles - nCycles);
+            if (traced)
+                TraceInterrupt(traced, trace_6502::KIND_NMI, 0xFFFA);
+#ifdef CPU_6502_PROFILE
+            if (Profile)
+                Profile->Interrupts++;
+            if (Calls)
+                Calls->Interrupt(profile_6502::ENTERED_NMI, 7, PC, SP);
+#endif
+            USDT_PROBE3(emu6502, interrupt, trace_6502::KIND_NMI, PC, Cycles);
+            continue;
+        }
+        if (IRQLines && !SF.I) {
+            Interrupts++;
+            Interrupt(0xFFFE, mem);
+            nCycles -= 7;
+            Retire(busStart, startCycles - nCycles);
+            if (traced)
+                TraceInterrupt(traced, trace_6502::KIND_IRQ, 0xFFFE);
+#ifdef CPU_6502_PROFILE
+            if (Profile)
+                Profile->Interrupts++;
+            if (Calls)
+                Calls->Interrupt(profile_6502::ENTERED_IRQ, 7, PC, SP);
+#endif
+            USDT_PROBE3(emu6502, interrupt, trace_6502::KIND_IRQ, PC, Cycles);
+            continue;
+        }
+
+#ifdef CPU_6502_PROFILE
+        cpu_6502::Word profiledPC = PC;
+        PagePenalty = false;
+#endif
+
         cpu_6502::Byte instruction = FetchByte(mem);
+        USDT_PROBE6(emu6502, instruction, cpu_6502::Word(PC - 1), instruction, A, X, Y, SP);
         switch (instruction) {
             // Add and subtract
             case INS_ADC_IM: {
@@ -167,16 +286,14 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             break;
             case INS_ADC_ABX: {
-                Word oldPC = PC;
                 ADC(AddressingAbsoluteX(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
             case INS_ADC_ABY: {
-                Word oldPC = PC;
                 ADC(AddressingAbsoluteY(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -185,9 +302,8 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_ADC_IDY: {
-                Word oldPC = PC;
                 ADC(AddressingIndirectIndexed(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 5;
             } break;
@@ -215,16 +331,14 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_SBC_ABX: {
-                Word oldPC = PC;
                 SBC(AddressingAbsoluteX(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
             case INS_SBC_ABY: {
-                Word oldPC = PC;
                 SBC(AddressingAbsoluteY(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -233,9 +347,8 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_SBC_IDY: {
-                Word oldPC = PC;
                 SBC(AddressingIndirectIndexed(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 5;
             } break;
@@ -290,16 +403,14 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_CMP_ABX: {
-                Word oldPC = PC;
                 Compare(A, AddressingAbsoluteX(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
             case INS_CMP_ABY: {
-                Word oldPC = PC;
                 Compare(A, AddressingAbsoluteY(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -308,82 +419,43 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_CMP_IDY: {
-                Word oldPC = PC;
                 Compare(A, AddressingIndirectIndexed(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 5;
             } break;
             // Branch Functions
-            case INS_BCC: {
-                Word oldPC = PC;
-                if(Branch(SF.C, false)) 
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
-            case INS_BCS: {
-                Word oldPC = PC;
-                if(Branch(SF.C, true))
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
-            case INS_BEQ: {
-                Word oldPC = PC;
-                if(Branch(SF.Z, true))
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
-            case INS_BMI: {
-                Word oldPC = PC;
-                if(Branch(SF.N, true))
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
-            case INS_BNE: {
-                Word oldPC = PC;
-                if(Branch(SF.Z, false))
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
-            case INS_BPL: {
-                Word oldPC = PC;
-                if(Branch(SF.N, false))
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
-            case INS_BVC: {
-                Word oldPC = PC;
-                if(Branch(SF.V, false)) 
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
-            case INS_BVS: {
-                Word oldPC = PC;
-                if(Branch(SF.V, true)) 
-                    nCycles -= 1;
-                if(CheckPCCrossedPageBoundary(oldPC))
-                    nCycles -= 2;
-                nCycles -= 2;
-            } break;
+            case INS_BCC:
+                Branch(SF.C, false);
+            break;
+            case INS_BCS:
+                Branch(SF.C, true);
+            break;
+            case INS_BEQ:
+                Branch(SF.Z, true);
+            break;
+            case INS_BMI:
+                Branch(SF.N, true);
+            break;
+            case INS_BNE:
+                Branch(SF.Z, false);
+            break;
+            case INS_BPL:
+                Branch(SF.N, false);
+            break;
+            case INS_BVC:
+                Branch(SF.V, false);
+            break;
+            case INS_BVS:
+                Branch(SF.V, true);
+            break;
             // System Functions
             case INS_NOP:
+                DummyRead(PC, mem);
                 nCycles -= 2;
             break;
             case INS_BRK: {
+                DummyRead(PC, mem);     // Padding byte after the opcode
                 PushWord(PC + 1, mem);
                 PushStatusFlagsToStack(mem);
                 PC = ReadWord(0xFFFE, mem);
@@ -391,43 +463,67 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 7;
             } break;
             case INS_RTI: {
+                DummyRead(PC, mem);
+                DummyRead(SPToAddr(), mem);
                 PopStatusFlagsFromStack(mem);
                 PC = PopWord(mem);
                 SF.B = 0;
                 SF.na = 0;
                 nCycles -= 6;
+                USDT_PROBE2(emu6502, interrupt_return, PC, Cycles);
+            } break;
+            case INS_WAI: {
+                DummyRead(PC, mem);
+                DummyRead(PC, mem);
+                Waiting = true;
+                nCycles -= 3;
+            } break;
+            case INS_STP: {
+                DummyRead(PC, mem);
+                DummyRead(PC, mem);
+                Stopped = true;
+                StoppedAt = busStart + 3;
+                nCycles -= 3;
             } break;
             // Status flag changes
             case INS_CLC: {
+                DummyRead(PC, mem);
                 SF.C = 0;
                 nCycles -= 2;
             } break;
             case INS_CLD: {
+                DummyRead(PC, mem);
                 SF.D = 0;
                 nCycles -= 2;
             } break;
             case INS_CLI: {
+                DummyRead(PC, mem);
                 SF.I = 0;
                 nCycles -= 2;
             } break;
             case INS_CLV: {
+                DummyRead(PC, mem);
                 SF.V = 0;
                 nCycles -= 2;
             } break;
             case INS_SEC: {
+                DummyRead(PC, mem);
                 SF.C = 1;
                 nCycles -= 2;
             } break;
             case INS_SED: {
+                DummyRead(PC, mem);
                 SF.D = 1;
                 nCycles -= 2;
             } break;
             case INS_SEI: {
+                DummyRead(PC, mem);
                 SF.I = 1;
                 nCycles -= 2;
             } break;
             // Rotate Right ---------------------------------------------
             case INS_ROR_ACC: {
+                DummyRead(PC, mem);
                 cpu_6502::Byte old = A;
                 A = A >> 1; // Right shift everything
                 A |= SF.C << 7; // Set 7th bit to C
@@ -447,11 +543,12 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_ROR_ABX: {
-                ROR(AddressingAbsoluteX(mem));
+                ROR(AddressingAbsoluteX(mem, true));
                 nCycles -= 7;
             } break;
             // Arithmetic Shift Left -------------------------------------------------
             case INS_ASL_ACC: {
+                DummyRead(PC, mem);
                 SF.C = (A & 0b10000000) > 0;
                 SF.Z = (A == 0);
                 A = A << 1;
@@ -471,11 +568,12 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_ASL_ABX: {
-                ASL(AddressingAbsoluteX(mem));
+                ASL(AddressingAbsoluteX(mem, true));
                 nCycles -= 7;
             } break;
             // Logical Shift Right ---------------------------------------------------
             case INS_LSR_ACC: {
+                DummyRead(PC, mem);
                 SF.C = (A & 0b1);
                 A = A >> 1;
                 UpdateZeroAndNegativeFlags(A);
@@ -494,11 +592,12 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_LSR_ABX: {
-                LSR(AddressingAbsoluteX(mem));
+                LSR(AddressingAbsoluteX(mem, true));
                 nCycles -= 7;
             } break;
             // Rotate left ---------------------------------------------
             case INS_ROL_ACC: {
+                DummyRead(PC, mem);
                 cpu_6502::Byte old = A;
                 A = A << 1;
                 A |= SF.C << 0;
@@ -519,7 +618,7 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_ROL_ABX: {
-                ROL(AddressingAbsoluteX(mem));
+                ROL(AddressingAbsoluteX(mem, true));
                 nCycles -= 7;
             } break;
             // Increment memory location ---------------------------------------------
@@ -536,7 +635,7 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_INC_ABX: {
-                IncrementMem(AddressingAbsoluteX(mem));
+                IncrementMem(AddressingAbsoluteX(mem, true));
                 nCycles -= 7;
             } break;
             // Decrement memory location
@@ -553,23 +652,27 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_DEC_ABX: {
-                DecrementMem(AddressingAbsoluteX(mem));
+                DecrementMem(AddressingAbsoluteX(mem, true));
                 nCycles -= 7;
             } break;
             // Increment and decrement register
             case INS_INX: {
+                DummyRead(PC, mem);
                 IncrementReg(X);
                 nCycles -= 2;
             } break;
             case INS_INY: {
+                DummyRead(PC, mem);
                 IncrementReg(Y);
                 nCycles -= 2;
             } break;
             case INS_DEX: {
+                DummyRead(PC, mem);
                 DecrementReg(X);
                 nCycles -= 2;
             } break;
             case INS_DEY: {
+                DummyRead(PC, mem);
                 DecrementReg(Y);
                 nCycles -= 2;
             } break;
@@ -602,16 +705,14 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_ORA_ABX: {
-                Word oldPC = PC;
                 ORA(AddressingAbsoluteX(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
             case INS_ORA_ABY: {
-                Word oldPC = PC;
                 ORA(AddressingAbsoluteY(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -620,9 +721,8 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_ORA_IDY: {
-                Word oldPC = PC;
                 ORA(AddressingIndirectIndexed(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 5;
             } break;
@@ -645,16 +745,14 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_EOR_ABX: {
-                Word oldPC = PC;
                 EOR(AddressingAbsoluteX(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
             case INS_EOR_ABY: {
-                Word oldPC = PC;
                 EOR(AddressingAbsoluteY(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -663,9 +761,8 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_EOR_IDY: {
-                Word oldPC = PC;
                 EOR(AddressingIndirectIndexed(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 5;
             } break;
@@ -688,16 +785,14 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_AND_ABX: {
-                Word oldPC = PC;
                 lAND(AddressingAbsoluteX(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
             case INS_AND_ABY: {
-                Word oldPC = PC;
                 lAND(AddressingAbsoluteY(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -706,52 +801,63 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_AND_IDY: {
-                Word oldPC = PC;
                 lAND(AddressingIndirectIndexed(mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 5;
             } break;
             // Transfer Instructions ----------------------------------------------------------
             case INS_TAX:{
+                DummyRead(PC, mem);
                 TransferRegister(A, X);
                 nCycles -= 2;
             } break;
             case INS_TAY: {
+                DummyRead(PC, mem);
                 TransferRegister(A, Y);
                 nCycles -= 2;
             } break;
             case INS_TSX: {
+                DummyRead(PC, mem);
                 TransferRegister(SP, X);
                 nCycles -= 2;
             } break;
             case INS_TXA: {
+                DummyRead(PC, mem);
                 TransferRegister(X, A);
                 nCycles -= 2;
             } break;
             case INS_TXS: {
+                DummyRead(PC, mem);
                 TransferRegister(X, SP);
                 nCycles -= 2;
             } break;
             case INS_TYA: {
+                DummyRead(PC, mem);
                 TransferRegister(Y, A);
                 nCycles -= 2;
             } break;
             // Various stack operations
             case INS_PHA: {
+                DummyRead(PC, mem);
                 PushByte(A, mem);
                 nCycles -= 3;
             } break;
             case INS_PHP: {
+                DummyRead(PC, mem);
                 PushStatusFlagsToStack(mem);
                 nCycles -= 3;
             } break;
             case INS_PLA: {
+                DummyRead(PC, mem);
+                DummyRead(SPToAddr(), mem);
                 A = PopByte(mem);
                 UpdateZeroAndNegativeFlags(A);
                 nCycles -= 4;
             } break;
             case INS_PLP: {
+                DummyRead(PC, mem);
+                DummyRead(SPToAddr(), mem);
                 PopStatusFlagsFromStack(mem);
                 nCycles -= 4;
             } break;
@@ -773,16 +879,14 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_LDA_ABX: {
-                Word oldPC = PC;
                 WriteRegister(A, ReadByte(AddressingAbsoluteX(mem), mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
             case INS_LDA_ABY: {
-                Word oldPC = PC;
                 WriteRegister(A, ReadByte(AddressingAbsoluteY(mem), mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -791,9 +895,8 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
             case INS_LDA_IDY: {
-                Word oldPC = PC;
                 WriteRegister(A, ReadByte(AddressingIndirectIndexed(mem), mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 5;
             } break;
@@ -815,9 +918,8 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_LDX_ABY: {
-                Word oldPC = PC;
                 WriteRegister(X, ReadByte(AddressingAbsoluteY(mem), mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -831,7 +933,7 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 3;
             } break;
             case INS_LDY_ZPX: {
-                WriteRegister(Y, ReadByte(AddressingZeroPageY(mem), mem));
+                WriteRegister(Y, ReadByte(AddressingZeroPageX(mem), mem));
                 nCycles -= 4;
             } break;
             case INS_LDY_AB: {
@@ -839,9 +941,8 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_LDY_ABX: {
-                Word oldPC = PC;
-                WriteRegister(Y, ReadByte(AddressingAbsoluteY(mem), mem));
-                if(CheckPCCrossedPageBoundary(oldPC))
+                WriteRegister(Y, ReadByte(AddressingAbsoluteX(mem), mem));
+                if (PageCrossed)
                     nCycles -= 1;
                 nCycles -= 4;
             } break;
@@ -859,11 +960,11 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 4;
             } break;
             case INS_STA_ABX: {
-                WriteToMemFromRegister(A, AddressingAbsoluteX(mem), mem);
+                WriteToMemFromRegister(A, AddressingAbsoluteX(mem, true), mem);
                 nCycles -= 5;
             } break;
             case INS_STA_ABY: {
-                WriteToMemFromRegister(A, AddressingAbsoluteY(mem), mem);
+                WriteToMemFromRegister(A, AddressingAbsoluteY(mem, true), mem);
                 nCycles -= 5;
             } break;
             case INS_STA_IDX:{ 
@@ -871,7 +972,7 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 6;
             } break;
              case INS_STA_IDY: {
-                WriteToMemFromRegister(A, AddressingIndirectIndexed(mem), mem);
+                WriteToMemFromRegister(A, AddressingIndirectIndexed(mem, true), mem);
                 nCycles -= 6;
              } break;
             // STX instruction ------------------------------------------------------------------
@@ -902,16 +1003,23 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
             } break;
             // JSR instruction ------------------------------------------------------------------
             case INS_JSR: {
-                cpu_6502::Word target = FetchWord(mem);
-                cpu_6502::Word pcMinusOne = PC - 1;
+                // The high byte of the target is only fetched after the
+                // return address (which points at it) has been pushed.
+                cpu_6502::Word target = FetchByte(mem);
+                DummyRead(SPToAddr(), mem);
+                cpu_6502::Word pcMinusOne = PC;
                 PushWord(pcMinusOne, mem);
+                target |= FetchByte(mem) << 8;
                 PC = target;
                 nCycles -= 6;
             } break;
             case INS_RTS: {
                 // It pulls the program counter (minus one) from the stack.
-                cpu_6502::Word PCPlusOne = PopWord(mem) + 1;
-                PC = PCPlusOne;
+                DummyRead(PC, mem);
+                DummyRead(SPToAddr(), mem);
+                cpu_6502::Word pcMinusOne = PopWord(mem);
+                DummyRead(pcMinusOne, mem);
+                PC = pcMinusOne + 1;
                 nCycles -= 6;
             } break;
             case INS_JMP_AB: 
@@ -923,9 +1031,60 @@ void cpu_6502::CPU::Execute(unsigned int nCycles, mem_28c256::Mem &mem) {
                 nCycles -= 5;
             break;
             default:
+                // Treat it as a 2 cycle NOP so a stray byte can't stall the loop
                 std::cout << "Instruction: " << std::hex << unsigned(instruction) << " not handled!\n" ;     
+                DummyRead(PC, mem);
+                nCycles -= 2;
         };
+        Retire(busStart, startCycles - nCycles);
+        Instructions++;
+        if (traced) {
+            traced->Opcode = instruction;
+            traced->Operand[0] = mem[cpu_6502::Word(traced->PC + 1)];
+            traced->Operand[1] = mem[cpu_6502::Word(traced->PC + 2)];
+            traced->EA = EffectiveAddress;
+            Trace->Commit();
+        }
+#ifdef CPU_6502_PROFILE
+        if (Profile)
+            Profile->Instruction(profiledPC, instruction, startCycles - nCycles, PagePenalty);
+        if (Calls)
+            Calls->Instruction(profiledPC, instruction, startCycles - nCycles, PC, SP);
+#endif
     }
+    USDT_PROBE2(emu6502, slice_end, Cycles, Instructions);
+}
+
+void cpu_6502::CPU::TraceInterrupt(trace_6502::Record *traced, cpu_6502::Byte kind, cpu_6502::Word vector) {
+    traced->Kind = kind;
+    traced->Opcode = 0;
+    traced->Operand[0] = traced->Operand[1] = 0;
+    traced->EA = vector;
+    Trace->Commit();
+}
+
+void cpu_6502::CPU::AssertIRQ(cpu_6502::Byte line) {
+    IRQLines |= line;
+}
+
+void cpu_6502::CPU::ReleaseIRQ(cpu_6502::Byte line) {
+    IRQLines &= ~line;
+}
+
+void cpu_6502::CPU::TriggerNMI() {
+    NMIPending = true;
+}
+
+void cpu_6502::CPU::Interrupt(cpu_6502::Word vector, mem_28c256::Mem &mem) {
+    // Two cycles of the opcode fetch that got hijacked
+    DummyRead(PC, mem);
+    DummyRead(PC, mem);
+    PushWord(PC, mem);
+    SF.B = 0;           // B only ever reads back as 1 when pushed by BRK
+    PushStatusFlagsToStack(mem);
+    SF.I = 1;
+    SF.D = 0;           // The 65C02 clears decimal mode on interrupt
+    PC = ReadWord(vector, mem);
 }
 
 void cpu_6502::CPU::PushStatusFlagsToStack(mem_28c256::Mem &mem) {
@@ -958,24 +1117,72 @@ void cpu_6502::CPU::UpdateZeroAndNegativeFlags(cpu_6502::Byte &reg) {
     SF.N = (reg & 0b10000000) > 0;
 }
 
+cpu_6502::Byte cpu_6502::CPU::BusRead(cpu_6502::Word addr, mem_28c256::Mem &mem) {
+    cpu_6502::Byte data = mem.Read(addr);
+#ifdef CPU_6502_CYCLE_EXACT
+    if (BusCycle)
+        BusCycle(Cycles, addr, data, false);
+    Cycles++;
+#endif
+    return data;
+}
+
+cpu_6502::Byte cpu_6502::CPU::BusFetch(cpu_6502::Word addr, mem_28c256::Mem &mem) {
+    cpu_6502::Byte data = mem.Fetch(addr);
+#ifdef CPU_6502_CYCLE_EXACT
+    if (BusCycle)
+        BusCycle(Cycles, addr, data, false);
+    Cycles++;
+#endif
+    return data;
+}
+
+void cpu_6502::CPU::BusWrite(cpu_6502::Word addr, cpu_6502::Byte data, mem_28c256::Mem &mem) {
+    mem.Write(addr, data);
+#ifdef CPU_6502_CYCLE_EXACT
+    if (BusCycle)
+        BusCycle(Cycles, addr, data, true);
+    Cycles++;
+#endif
+}
+
+void cpu_6502::CPU::DummyRead(cpu_6502::Word addr, mem_28c256::Mem &mem) {
+#ifdef CPU_6502_CYCLE_EXACT
+    BusRead(addr, mem);
+#else
+    (void)addr;
+    (void)mem;
+#endif
+}
+
+void cpu_6502::CPU::DummyWrite(cpu_6502::Word addr, cpu_6502::Byte data, mem_28c256::Mem &mem) {
+#ifdef CPU_6502_CYCLE_EXACT
+    BusWrite(addr, data, mem);
+#else
+    (void)addr;
+    (void)data;
+    (void)mem;
+#endif
+}
+
 cpu_6502::Byte cpu_6502::CPU::FetchByte(mem_28c256::Mem &mem) {
-    cpu_6502::Byte ins = mem[PC];
+    cpu_6502::Byte ins = BusFetch(PC, mem);
     PC++;
     return ins;
 }
 
 cpu_6502::Byte cpu_6502::CPU::ReadByte(cpu_6502::Word addr, mem_28c256::Mem &mem) {
-    cpu_6502::Byte ins = mem[addr];
+    cpu_6502::Byte ins = BusRead(addr, mem);
     return ins;
 }
 
 cpu_6502::Word cpu_6502::CPU::FetchWord(mem_28c256::Mem &mem) {
     // Remember the 6502 is LITTLE ENDIAN, MEANING THE LEAST SIGNIFICANT
     // BIT COMES FIRST.
-    cpu_6502::Word Data = mem[PC];
+    cpu_6502::Word Data = BusFetch(PC, mem);
     PC++;
 
-    Data |= (mem[PC] << 8);
+    Data |= (BusFetch(PC, mem) << 8);
     PC++;
 
     return Data;
@@ -984,24 +1191,24 @@ cpu_6502::Word cpu_6502::CPU::FetchWord(mem_28c256::Mem &mem) {
 cpu_6502::Word cpu_6502::CPU::ReadWord(cpu_6502::Word addr, mem_28c256::Mem &mem) {
     // Remember the 6502 is LITTLE ENDIAN, MEANING THE LEAST SIGNIFICANT
     // BIT COMES FIRST.
-    cpu_6502::Word Data = mem[addr];
+    cpu_6502::Word Data = BusRead(addr, mem);
     addr++;
-    Data |= (mem[addr] << 8);
+    Data |= (BusRead(addr, mem) << 8);
 
     return Data;
 }
 
 void cpu_6502::CPU::WriteWord(cpu_6502::Word dta, unsigned int addr, mem_28c256::Mem &mem) {
-    mem[addr] = dta & 0xFF;
-    mem[addr+1] = (dta >> 8);
+    BusWrite(addr, dta & 0xFF, mem);
+    BusWrite(addr+1, (dta >> 8), mem);
 }
 
 void cpu_6502::CPU::WriteByte(cpu_6502::Byte data, unsigned int addr, mem_28c256::Mem &mem) {
-    mem[addr] = data;
+    BusWrite(addr, data, mem);
 }
 
 void cpu_6502::CPU::WriteToMemFromRegister(cpu_6502::Byte &reg, cpu_6502::Word addr, mem_28c256::Mem &mem) {
-    mem[addr] = reg;
+    BusWrite(addr, reg, mem);
 }
 
 void cpu_6502::CPU::WriteRegister(cpu_6502::Byte &reg, cpu_6502::Byte value) {
@@ -1018,23 +1225,23 @@ cpu_6502::Byte cpu_6502::CPU::PopByte(mem_28c256::Mem &mem) {
 }
 
 cpu_6502::Word cpu_6502::CPU::PopWord(mem_28c256::Mem &mem) {
-    cpu_6502::Word value = mem[SPToAddr()+1];
+    cpu_6502::Word value = BusRead(SPToAddr()+1, mem);
     SP++;
-    value |= (mem[SPToAddr()+1] << 8);
+    value |= (BusRead(SPToAddr()+1, mem) << 8);
 
     SP++;
     return value;
 }
 
 void cpu_6502::CPU::PushByte(cpu_6502::Byte value, mem_28c256::Mem &mem) {
-    mem[SPToAddr()] = value;
+    BusWrite(SPToAddr(), value, mem);
     SP--;
 }
 
 void cpu_6502::CPU::PushWord(cpu_6502::Word value, mem_28c256::Mem &mem) {
-    mem[SPToAddr()] = value >> 8;
+    BusWrite(SPToAddr(), value >> 8, mem);
     SP--;
-    mem[SPToAddr()] = value & 0xFF;
+    BusWrite(SPToAddr(), value & 0xFF, mem);
     SP--;
 }
 
@@ -1043,51 +1250,67 @@ void cpu_6502::CPU::PushWord(cpu_6502::Word value, mem_28c256::Mem &mem) {
 //      some addressing modes here!
 cpu_6502::Byte cpu_6502::CPU::AddressingZeroPage(mem_28c256::Mem &mem) {
     // zero page addressing mode has only an 8 bit address operand
-    return FetchByte(mem);
+    return EffectiveAddress = FetchByte(mem);
 }
 
 cpu_6502::Byte cpu_6502::CPU::AddressingZeroPageX(mem_28c256::Mem &mem) {
     // taking the 8 bit zero page address from the instruction and adding the current value of 
     // the X register to it
     cpu_6502::Byte zpAddress = FetchByte(mem);
+    DummyRead(zpAddress, mem);  // Reads the unindexed address while adding
     zpAddress += X;
     if(zpAddress >= 0xFF) { zpAddress -= 0x100; }
-    return zpAddress;
+    return EffectiveAddress = zpAddress;
 }
 
 cpu_6502::Byte cpu_6502::CPU::AddressingZeroPageY(mem_28c256::Mem &mem) {
     // taking the 8 bit zero page address from the instruction and adding the current value of 
     // the Y register to it
     cpu_6502::Byte zpAddress = FetchByte(mem);
+    DummyRead(zpAddress, mem);
     zpAddress += Y; 
     if(zpAddress >= 0xFF) { zpAddress -= 0x100; }
-    return zpAddress;
+    return EffectiveAddress = zpAddress;
 }
 
 cpu_6502::Word cpu_6502::CPU::AddressingAbsolute(mem_28c256::Mem &mem) {
     // contain a full 16 bit address to identify the target location
-    return FetchWord(mem);
+    return EffectiveAddress = FetchWord(mem);
 }
 
-cpu_6502::Word cpu_6502::CPU::AddressingAbsoluteX(mem_28c256::Mem &mem) {
+cpu_6502::Word cpu_6502::CPU::AddressingAbsoluteX(mem_28c256::Mem &mem, bool write) {
     // taking the 16 bit address from the instruction and added the contents of the X register
     cpu_6502::Word addr = FetchWord(mem);
-    addr += X; // Add X register to the fetched address
-    return addr;
+    return IndexAddress(addr, X, write, mem);
 }
 
-cpu_6502::Word cpu_6502::CPU::AddressingAbsoluteY(mem_28c256::Mem &mem) {
+cpu_6502::Word cpu_6502::CPU::AddressingAbsoluteY(mem_28c256::Mem &mem, bool write) {
     // same as the previous mode only with the contents of the Y register
     cpu_6502::Word addr = FetchWord(mem);
-    addr += Y; // Add X register to the fetched address
-    return addr;
+    return IndexAddress(addr, Y, write, mem);
+}
+
+cpu_6502::Word cpu_6502::CPU::IndexAddress(cpu_6502::Word base, cpu_6502::Byte index, bool write, mem_28c256::Mem &mem) {
+    // The index gets added to the low byte first and the CPU reads from there
+    // straight away, carry or not. If it did carry that read was from the
+    // wrong page and has to be done again once the high byte is fixed up.
+    // Stores and read-modify-writes can't take the gamble, they always wait.
+    cpu_6502::Word addr = base + index;
+    PageCrossed = (base & 0xFF00) != (addr & 0xFF00);
+    if (PageCrossed || write)
+        DummyRead((base & 0xFF00) | (addr & 0xFF), mem);
+#ifdef CPU_6502_PROFILE
+    // Reads are the ones that pay for it, see above
+    PagePenalty = PageCrossed && !write;
+#endif
+    return EffectiveAddress = addr;
 }
 
 cpu_6502::Word cpu_6502::CPU::AddressingIndirect(mem_28c256::Mem &mem) {
     // The instruction contains a 16 bit address which identifies the location of the least 
     //significant byte of another 16 bit memory address which is the real target of the instruction
     cpu_6502::Word addr = FetchWord(mem);
-    return ReadWord(addr, mem);
+    return EffectiveAddress = ReadWord(addr, mem);
 
 }
 
@@ -1095,23 +1318,35 @@ cpu_6502::Word cpu_6502::CPU::AddressingIndexedIndirect(mem_28c256::Mem &mem) {
     // The address of the table is taken from the instruction and the X register added to it (with 
     // zero page wrap around) to give the location of the least significant byte of the target address.
     cpu_6502::Byte addr = FetchByte(mem);
+    DummyRead(addr, mem);
     addr += X;
-    return ReadWord(addr, mem);
+    cpu_6502::Word target = ReadByte(addr, mem);
+    addr++;                     // Pointer wraps around inside the zero page
+    target |= ReadByte(addr, mem) << 8;
+    return EffectiveAddress = target;
 }
 
-cpu_6502::Word cpu_6502::CPU::AddressingIndirectIndexed(mem_28c256::Mem &mem) {
+cpu_6502::Word cpu_6502::CPU::AddressingIndirectIndexed(mem_28c256::Mem &mem, bool write) {
     // In instruction contains the zero page location of the least significant byte of 16 bit address. 
     // The Y register is dynamically added to this value to generated the actual target address for operation.
     cpu_6502::Byte addr = FetchByte(mem);
-    addr += Y;
-    return ReadWord(addr, mem);
-}   
+    cpu_6502::Word base = ReadByte(addr, mem);
+    addr++;                     // Pointer wraps around inside the zero page
+    base |= ReadByte(addr, mem) << 8;
+    return IndexAddress(base, Y, write, mem);
+}
 
 void cpu_6502::CPU::Reset(mem_28c256::Mem &mem) {
     PC = 0xFFFC;             // Initialize program counter to 0xFFC
     SP = 0xFF;            // Inititalize stack pointer to 0x01FF
     SF.C = SF.Z = SF.I = SF.D = SF.B = SF.V = SF.N = 0; // Reset status flags
     A = X = Y = 0;          // Reset registers
+    Cycles = 0;
+    Instructions = 0;
+    Interrupts = 0;
+    Waiting = Stopped = NMIPending = false;
+    StoppedAt = 0;
+    IRQLines = 0;
     mem.Init();             // Reset memory
 }
 
@@ -0,0 +1,146 @@
+#include "fork.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+    uint64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    void WriteAll(int fd, const std::string &data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            done += n;
+        }
+    }
+
+    void Reap(pid_t pid, fork_6502::Result &result) {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (WIFEXITED(status))
+            result.ExitCode = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            result.Signal = WTERMSIG(status);
+    }
+
+    struct Child {
+        pid_t Pid;
+        int Fd;
+        unsigned int Index;
+    };
+}
+
+std::vector<fork_6502::Result> fork_6502::Forker::Run(unsigned int n, cpu_6502::CPU &cpu, mem_28c256::Mem &mem, const Body &body) {
+    std::vector<Result> results(n);
+    std::vector<Child> running;
+    unsigned int limit = MaxParallel;
+    if (limit == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        limit = cores > 0 ? cores : 1;
+    }
+    ForkNs = 0;
+    Forks = 0;
+    Error = 0;
+
+    // Otherwise anything sitting in a buffer gets printed once per child
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(NULL);
+
+    unsigned int next = 0;
+    while (next < n || !running.empty()) {
+        while (next < n && running.size() < limit) {
+            unsigned int index = next++;
+            int fds[2];
+            if (pipe(fds) != 0)
+                continue;   // Result stays at ExitCode -1
+
+            uint64_t start = NowNs();
+            pid_t pid = fork();
+            ForkNs += NowNs() - start;
+
+            if (pid == 0) {
+                close(fds[0]);
+                for (const Child &other : running)
+                    close(other.Fd);
+                int code = 0;
+                std::string output;
+                try {
+                    output = body(index, cpu, mem);
+                } catch (...) {
+                    code = 1;
+                }
+                WriteAll(fds[1], output);
+                std::cout.flush();
+                fflush(NULL);
+                // Skip atexit handlers and destructors, they belong to the parent
+                _exit(code);
+            }
+
+            close(fds[1]);
+            if (pid < 0) {
+                close(fds[0]);
+                continue;
+            }
+            Forks++;
+            running.push_back({ pid, fds[0], index });
+        }
+        if (running.empty())
+            continue;
+
+        // Read as output arrives so a child with a lot to say can't fill its
+        // pipe and block before it exits
+        std::vector<pollfd> polls(running.size());
+        for (unsigned int i = 0; i < running.size(); i++)
+            polls[i] = { running[i].Fd, POLLIN, 0 };
+        if (poll(polls.data(), polls.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            // No way to wait for them any more, so the whole set fails:
+            // what's still running is killed, and what never started stays
+            // at ExitCode -1
+            Error = errno;
+            for (const Child &child : running) {
+                kill(child.Pid, SIGKILL);
+                close(child.Fd);
+                Reap(child.Pid, results[child.Index]);
+            }
+            return results;
+        }
+
+        for (unsigned int i = running.size(); i-- > 0;) {
+            if (!polls[i].revents)
+                continue;
+            Child &child = running[i];
+            char buf[4096];
+            ssize_t got = read(child.Fd, buf, sizeof(buf));
+            if (got > 0) {
+                results[child.Index].Output.append(buf, got);
+                continue;
+            }
+            if (got < 0 && errno == EINTR)
+                continue;
+
+            // EOF, the child has exited or is about to
+            close(child.Fd);
+            Reap(child.Pid, results[child.Index]);
+            running.erase(running.begin() + i);
+        }
+    }
+    return results;
+}
@@ -0,0 +1,86 @@
+#include "hash.hpp"
+
+#include <cstring>
+
+namespace {
+    const uint64_t FNV_OFFSET = 0xCBF29CE484222325ull;
+    const uint64_t FNV_PRIME = 0x100000001B3ull;
+
+    // splitmix64's finaliser. The parts get added together, so each one
+    // needs every input bit spread over all 64 output bits first.
+    uint64_t Mix(uint64_t h) {
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    uint64_t Fnv(uint64_t h, const void *data, size_t size) {
+        const hash_6502::Byte *p = (const hash_6502::Byte *)data;
+        while (size--)
+            h = (h ^ *p++) * FNV_PRIME;
+        return h;
+    }
+}
+
+uint64_t hash_6502::CpuHash(const cpu_6502::CPU &cpu) {
+    Byte regs[] = {
+        Byte(cpu.PC), Byte(cpu.PC >> 8), cpu.SP, cpu.A, cpu.X, cpu.Y, cpu.PSF,
+        Byte(cpu.Waiting | cpu.Stopped << 1 | cpu.NMIPending << 2), cpu.IRQLines,
+    };
+    uint64_t h = Fnv(FNV_OFFSET, regs, sizeof(regs));
+    h = Fnv(h, &cpu.Cycles, sizeof(cpu.Cycles));
+    return Mix(h);
+}
+
+uint64_t hash_6502::PageHash(unsigned int page, const Byte *data) {
+    // A word at a time, which is plenty for telling pages apart and four
+    // times quicker than going byte by byte
+    uint64_t h = FNV_OFFSET ^ page;
+    for (unsigned int i = 0; i < PAGE_SIZE; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * FNV_PRIME;
+    }
+    return Mix(h);
+}
+
+uint64_t hash_6502::DevicesHash(const state_6502::Devices &devices) {
+    uint64_t sum = 0;
+    for (const auto &dev : devices) {
+        state_6502::Packer p;
+        dev.second->SaveState(p);
+        uint64_t h = Fnv(FNV_OFFSET, dev.first.data(), dev.first.size());
+        sum += Mix(Fnv(h, p.Data.data(), p.Data.size()));
+    }
+    return sum;
+}
+
+uint64_t hash_6502::Hash(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem, const state_6502::Devices &devices) {
+    uint64_t sum = CpuHash(cpu) + DevicesHash(devices);
+    for (unsigned int page = 0; page < NUM_PAGES; page++)
+        sum += PageHash(page, &mem.Data[page * PAGE_SIZE]);
+    return sum;
+}
+
+uint64_t hash_6502::Tracker::Hash(const cpu_6502::CPU &cpu, mem_28c256::Mem &mem, const state_6502::Devices &devices) {
+    if (!Primed)
+        MemSum = 0;
+
+    // Pages only ever get swapped in and out of the sum, which is why the
+    // parts are added rather than chained
+    for (unsigned int page = 0; page < NUM_PAGES; page++) {
+        if (Primed && !mem.ChangedSince(page, Mark))
+            continue;
+        uint64_t h = PageHash(page, &mem.Data[page * PAGE_SIZE]);
+        MemSum += h - (Primed ? Pages[page] : 0);
+        Pages[page] = h;
+        PagesHashed++;
+    }
+    Primed = true;
+    Mark = mem.NextGeneration();
+    Queries++;
+    return CpuHash(cpu) + DevicesHash(devices) + MemSum;
+}
@@ -0,0 +1,146 @@
+#include "hostperf.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const uint64_t NS_PER_SEC = 1000000000ull;
+
+    uint64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * NS_PER_SEC + ts.tv_nsec;
+    }
+
+#ifdef __linux__
+    struct Event {
+        uint32_t Type;
+        uint64_t Config;
+        const char *Name;
+    };
+
+    const Event EVENTS[hostperf_6502::NUM_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                              PERF_COUNT_HW_CACHE_RESULT_MISS << 16, "L1-dcache-load-misses" },
+    };
+
+    int Open(const Event &event, int group) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = event.Type;
+        attr.config = event.Config;
+        attr.disabled = group < 0;      // The leader starts the lot
+        // Just this thread in user space, which is all an unprivileged
+        // process gets with the usual perf_event_paranoid of 2 anyway
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return int(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+    }
+#endif
+
+    double PerInstruction(uint64_t count, uint64_t instructions) {
+        return instructions ? double(count) / instructions : 0.0;
+    }
+}
+
+hostperf_6502::Counters::Counters() {
+    for (int &fd : Fds)
+        fd = -1;
+#ifdef __linux__
+    int firstError = 0;
+    bool sameError = true;
+    for (unsigned int i = 0; i < NUM_COUNTERS; i++) {
+        Fds[i] = Open(EVENTS[i], Leader);
+        if (Fds[i] < 0) {
+            if (!Why.empty())
+                Why += ", ";
+            Why += std::string(EVENTS[i].Name) + ": " + strerror(errno);
+            firstError = firstError ? firstError : errno;
+            sameError = sameError && errno == firstError;
+        } else {
+            sameError = false;
+            if (Leader < 0)
+                Leader = Fds[i];
+        }
+    }
+    // Usually it's all or nothing, and then once is enough
+    if (Leader < 0 && sameError)
+        Why = std::string("perf_event_open: ") + strerror(firstError);
+#else
+    Why = "perf events are Linux only";
+#endif
+}
+
+hostperf_6502::Counters::~Counters() {
+#ifdef __linux__
+    for (int fd : Fds)
+        if (fd >= 0)
+            close(fd);
+#endif
+}
+
+void hostperf_6502::Counters::Start() {
+#ifdef __linux__
+    if (Leader >= 0) {
+        ioctl(Leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    StartNs = NowNs();
+}
+
+void hostperf_6502::Counters::Stop() {
+    Total.Ns += NowNs() - StartNs;
+    Slices++;
+#ifdef __linux__
+    if (Leader < 0)
+        return;
+    ioctl(Leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (unsigned int i = 0; i < NUM_COUNTERS; i++) {
+        uint64_t value;
+        if (Fds[i] >= 0 && read(Fds[i], &value, sizeof(value)) == sizeof(value))
+            Total.Count[i] += value;
+    }
+#endif
+}
+
+void hostperf_6502::Counters::Report(std::ostream &out, uint64_t instructions, uint64_t cycles) const {
+    char line[256];
+    double seconds = Total.Ns / 1e9;
+    snprintf(line, sizeof(line), "%llu instructions, %llu cycles in %.3f s: %.2f MIPS, %.2f MHz\n",
+             (unsigned long long)instructions, (unsigned long long)cycles, seconds,
+             seconds > 0 ? instructions / seconds / 1e6 : 0.0, seconds > 0 ? cycles / seconds / 1e6 : 0.0);
+    out << line;
+    snprintf(line, sizeof(line), "Host per instruction: %.1f ns", PerInstruction(Total.Ns, instructions));
+    out << line;
+    if (!Hardware()) {
+        out << " (no perf counters: " << Why << ")\n";
+        return;
+    }
+
+    const char *names[NUM_COUNTERS] = { "cycles", "instructions", "branch misses", "L1d misses" };
+    for (unsigned int i = 0; i < NUM_COUNTERS; i++) {
+        if (!Available(i))
+            continue;
+        snprintf(line, sizeof(line), ", %.3f %s", PerInstruction(Total.Count[i], instructions), names[i]);
+        out << line;
+    }
+    if (Available(HOST_CYCLES) && Available(HOST_INSTRUCTIONS) && Total.Count[HOST_CYCLES]) {
+        snprintf(line, sizeof(line), " (IPC %.2f)", double(Total.Count[HOST_INSTRUCTIONS]) / Total.Count[HOST_CYCLES]);
+        out << line;
+    }
+    out << "\n";
+}
@@ -0,0 +1,300 @@
+#include "lcd_hd44780.hpp"
+
+#include <cstring>
+#include <ctime>
+
+namespace {
+    uint64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    // Characters per line in DDRAM when in two line mode
+    const unsigned int LINE_LENGTH = 40;
+}
+
+lcd_hd44780::LCD::LCD(cpu_6502::CPU &cpu) : Cpu(cpu) {
+    memset(DDRAM, ' ', sizeof(DDRAM));
+    memset(CGRAM, 0, sizeof(CGRAM));
+}
+
+lcd_hd44780::LCD::~LCD() {
+    if (Events)
+        Events->Cancel(RenderEvent);
+}
+
+void lcd_hd44780::LCD::PinsChanged(Byte portA, Byte portB) {
+    bool e = portA & PIN_E;
+    bool rw = portA & PIN_RW;
+    bool rs = portA & PIN_RS;
+
+    if (e && !PrevE && rw) {
+        // Read: the controller puts data on the bus for as long as E is high
+        Byte value = ReadValue(rs);
+        if (EightBit || !SecondNibble) {
+            PendingHigh = value;
+            ReadLatch = value & (EightBit ? 0xFF : 0xF0);
+        } else
+            ReadLatch = PendingHigh << 4;
+        ReadCycle = true;
+    } else if (!e && PrevE) {
+        if (ReadCycle) {
+            ReadCycle = false;
+            bool done = EightBit || SecondNibble;
+            if (!EightBit)
+                SecondNibble = !SecondNibble;
+            if (done && rs)
+                AdvanceAC();    // Data reads move the address counter too
+        } else if (!rw) {
+            // Writes latch on the falling edge
+            if (EightBit)
+                Transfer(rs, portB);
+            else if (!SecondNibble) {
+                PendingHigh = portB & 0xF0;
+                SecondNibble = true;
+            } else {
+                SecondNibble = false;
+                Transfer(rs, PendingHigh | (portB >> 4));
+            }
+        }
+    }
+    PrevE = e;
+}
+
+lcd_hd44780::Byte lcd_hd44780::LCD::InputB() {
+    return ReadCycle ? ReadLatch : 0xFF;
+}
+
+lcd_hd44780::Byte lcd_hd44780::LCD::ReadValue(bool rs) {
+    if (!rs)
+        return (Busy() ? BUSY_FLAG : 0) | (AC & 0x7F);
+    return AddressingCGRAM ? CGRAM[AC & 0x3F] : DDRAM[AC & 0x7F];
+}
+
+void lcd_hd44780::LCD::Transfer(bool rs, Byte value) {
+    if (Busy()) {
+        WritesWhileBusy++;
+        return;
+    }
+    if (rs)
+        WriteData(value);
+    else
+        Command(value);
+}
+
+void lcd_hd44780::LCD::Command(Byte cmd) {
+    Commands++;
+    if (cmd & 0x80) {
+        // Set DDRAM address
+        AC = cmd & 0x7F;
+        AddressingCGRAM = false;
+        Dirty |= CursorOn || BlinkOn;
+        SetBusy(37);
+    } else if (cmd & 0x40) {
+        // Set CGRAM address
+        AC = cmd & 0x3F;
+        AddressingCGRAM = true;
+        SetBusy(37);
+    } else if (cmd & 0x20) {
+        // Function set
+        EightBit = cmd & 0x10;
+        TwoLines = cmd & 0x08;
+        SecondNibble = false;
+        Dirty = true;
+        SetBusy(37);
+    } else if (cmd & 0x10) {
+        // Cursor or display shift
+        bool right = cmd & 0x04;
+        if (cmd & 0x08) {
+            DisplayShift = (DisplayShift + (right ? LINE_LENGTH - 1 : 1)) % LINE_LENGTH;
+            Dirty = true;
+        } else {
+            bool saved = Increment;
+            Increment = right;
+            AdvanceAC();
+            Increment = saved;
+        }
+        SetBusy(37);
+    } else if (cmd & 0x08) {
+        // Display on/off control
+        DisplayOn = cmd & 0x04;
+        CursorOn = cmd & 0x02;
+        BlinkOn = cmd & 0x01;
+        Dirty = true;
+        SetBusy(37);
+    } else if (cmd & 0x04) {
+        // Entry mode set
+        Increment = cmd & 0x02;
+        ShiftOnWrite = cmd & 0x01;
+        SetBusy(37);
+    } else if (cmd & 0x02) {
+        // Return home
+        AC = 0;
+        AddressingCGRAM = false;
+        DisplayShift = 0;
+        Dirty = true;
+        SetBusy(1520);
+    } else if (cmd & 0x01) {
+        // Clear display
+        memset(DDRAM, ' ', sizeof(DDRAM));
+        AC = 0;
+        AddressingCGRAM = false;
+        Increment = true;
+        DisplayShift = 0;
+        Dirty = true;
+        SetBusy(1520);
+    }
+}
+
+void lcd_hd44780::LCD::WriteData(Byte data) {
+    DataWrites++;
+    if (AddressingCGRAM) {
+        CGRAM[AC & 0x3F] = data;
+        AC = (AC + (Increment ? 1 : -1)) & 0x3F;
+    } else {
+        if (DDRAM[AC & 0x7F] != data) {
+            DDRAM[AC & 0x7F] = data;
+            Dirty = true;
+        }
+        AdvanceAC();
+        if (ShiftOnWrite) {
+            DisplayShift = (DisplayShift + (Increment ? 1 : LINE_LENGTH - 1)) % LINE_LENGTH;
+            Dirty = true;
+        }
+    }
+    SetBusy(41);
+}
+
+void lcd_hd44780::LCD::AdvanceAC() {
+    if (AddressingCGRAM) {
+        AC = (AC + (Increment ? 1 : -1)) & 0x3F;
+        return;
+    }
+    // In two line mode DDRAM is two 40 byte runs at 0x00 and 0x40, and the
+    // counter hops between them. One line mode is a single 80 byte run.
+    if (TwoLines) {
+        if (Increment)
+            AC = AC == 0x27 ? 0x40 : AC == 0x67 ? 0x00 : AC + 1;
+        else
+            AC = AC == 0x00 ? 0x67 : AC == 0x40 ? 0x27 : AC - 1;
+    } else {
+        if (Increment)
+            AC = AC >= 0x4F ? 0x00 : AC + 1;
+        else
+            AC = AC == 0x00 ? 0x4F : AC - 1;
+    }
+    Dirty |= CursorOn || BlinkOn;
+}
+
+void lcd_hd44780::LCD::SetBusy(uint64_t microseconds) {
+    BusyUntil = Cpu.Cycles + (microseconds * ClockHz + 999999) / 1000000;
+}
+
+lcd_hd44780::Byte lcd_hd44780::LCD::LineAddress(unsigned int row) const {
+    // Rows 3 and 4 of a 20x4 module carry on from the end of rows 1 and 2
+    static const Byte starts[] = { 0x00, 0x40, 0x14, 0x54 };
+    return starts[row & 3];
+}
+
+std::string lcd_hd44780::LCD::Line(unsigned int row) const {
+    std::string line(Columns, ' ');
+    if (!DisplayOn || row >= Rows)
+        return line;
+    for (unsigned int col = 0; col < Columns; col++) {
+        Byte addr = LineAddress(row) + (col + DisplayShift) % LINE_LENGTH;
+        Byte c = DDRAM[addr & 0x7F];
+        line[col] = (c >= 0x20 && c < 0x7F) ? char(c) : '?';
+    }
+    return line;
+}
+
+std::string lcd_hd44780::LCD::Text() const {
+    std::string text;
+    for (unsigned int row = 0; row < Rows; row++) {
+        if (row)
+            text += '\n';
+        text += Line(row);
+    }
+    return text;
+}
+
+void lcd_hd44780::LCD::StartRendering(events_6502::Scheduler &events, std::ostream &out) {
+    Events = &events;
+    Out = &out;
+    Dirty = true;
+    RenderEvent = Events->Schedule(Cpu.Cycles + RefreshCycles, [this](uint64_t when) { RenderTick(when); });
+}
+
+void lcd_hd44780::LCD::RenderTick(uint64_t when) {
+    // Flat out the emulator can get through RefreshCycles far quicker than
+    // a terminal can keep up with, hence the wall clock check as well
+    if (Dirty && NowNs() - LastRenderNs >= MinRenderNs)
+        Render();
+    RenderEvent = Events->Schedule(when + RefreshCycles, [this](uint64_t next) { RenderTick(next); });
+}
+
+void lcd_hd44780::LCD::Render() {
+    if (!Out)
+        return;
+    // Save the terminal cursor, draw in the top left corner, put it back
+    std::ostream &out = *Out;
+    std::string border = "+" + std::string(Columns, '-') + "+";
+    out << "\x1b" "7" << "\x1b[1;1H" << border << "\n";
+    for (unsigned int row = 0; row < Rows; row++) {
+        std::string line = Line(row);
+        out << "|";
+        for (unsigned int col = 0; col < Columns; col++) {
+            Byte addr = (LineAddress(row) + (col + DisplayShift) % LINE_LENGTH) & 0x7F;
+            bool cursor = DisplayOn && (CursorOn || BlinkOn) && !AddressingCGRAM && addr == AC;
+            if (cursor)
+                out << "\x1b[4m" << line[col] << "\x1b[24m";
+            else
+                out << line[col];
+        }
+        out << "|\n";
+    }
+    out << border << "\x1b" "8" << std::flush;
+
+    Dirty = false;
+    LastRenderNs = NowNs();
+    Renders++;
+}
+
+void lcd_hd44780::LCD::SaveState(state_6502::Packer &out) const {
+    out.Bytes(DDRAM, sizeof(DDRAM));
+    out.Bytes(CGRAM, sizeof(CGRAM));
+    out.U8(AC);
+    out.U8(AddressingCGRAM | Increment << 1 | ShiftOnWrite << 2 | DisplayOn << 3 |
+           CursorOn << 4 | BlinkOn << 5 | EightBit << 6 | TwoLines << 7);
+    out.U8(DisplayShift);
+    out.U64(BusyUntil);
+    out.U8(PrevE | ReadCycle << 1 | SecondNibble << 2);
+    out.U8(PendingHigh);
+    out.U8(ReadLatch);
+}
+
+bool lcd_hd44780::LCD::LoadState(state_6502::Unpacker &in) {
+    in.Take(DDRAM, sizeof(DDRAM));
+    in.Take(CGRAM, sizeof(CGRAM));
+    AC = in.U8();
+    Byte modes = in.U8();
+    AddressingCGRAM = modes & 0x01;
+    Increment = modes & 0x02;
+    ShiftOnWrite = modes & 0x04;
+    DisplayOn = modes & 0x08;
+    CursorOn = modes & 0x10;
+    BlinkOn = modes & 0x20;
+    EightBit = modes & 0x40;
+    TwoLines = modes & 0x80;
+    DisplayShift = in.U8() % LINE_LENGTH;
+    BusyUntil = in.U64();
+    Byte pins = in.U8();
+    PrevE = pins & 0x01;
+    ReadCycle = pins & 0x02;
+    SecondNibble = pins & 0x04;
+    PendingHigh = in.U8();
+    ReadLatch = in.U8();
+    Dirty = true;
+    return !in.Bad;
+}
@@ -0,0 +1,585 @@
+#include "lockstep.hpp"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace {
+    using namespace lockstep_6502;
+    using cpu_6502::CPU;
+
+    // Lanes are processed this many at a time, and the register arrays are
+    // padded out to a multiple of it so the kernels never need a tail loop.
+    // Only this file is built with -mavx2, so only it gets to know.
+#ifdef __AVX2__
+    const unsigned int VECTOR_WIDTH = 32;
+#else
+    const unsigned int VECTOR_WIDTH = 16;
+#endif
+
+    // What the lockstep path knows how to do. Everything else is NONE and
+    // goes to CPU::Execute.
+    enum Kind : Byte {
+        NONE,
+        LDA, LDX, LDY, STA, STX, STY,
+        ADC, SBC, AND, ORA, EOR, CMP, CPX, CPY,
+        ASL, LSR, ROL, ROR,
+        TAX, TAY, TXA, TYA, INX, INY, DEX, DEY,
+        CLC, SEC, CLV, NOP,
+        BRANCH, JMP
+    };
+
+    enum Mode : Byte { IMP, IMM, ZP, ZPX, ZPY, ABS, ABSX, ABSY, REL };
+
+    struct Op {
+        Kind What;
+        Mode How;
+    };
+
+    Op Decode(Byte opcode) {
+        switch (opcode) {
+            case CPU::INS_LDA_IM: return { LDA, IMM };
+            case CPU::INS_LDA_ZP: return { LDA, ZP };
+            case CPU::INS_LDA_ZPX: return { LDA, ZPX };
+            case CPU::INS_LDA_AB: return { LDA, ABS };
+            case CPU::INS_LDA_ABX: return { LDA, ABSX };
+            case CPU::INS_LDA_ABY: return { LDA, ABSY };
+            case CPU::INS_LDX_IM: return { LDX, IMM };
+            case CPU::INS_LDX_ZP: return { LDX, ZP };
+            case CPU::INS_LDX_ZPY: return { LDX, ZPY };
+            case CPU::INS_LDX_AB: return { LDX, ABS };
+            case CPU::INS_LDX_ABY: return { LDX, ABSY };
+            case CPU::INS_LDY_IM: return { LDY, IMM };
+            case CPU::INS_LDY_ZP: return { LDY, ZP };
+            case CPU::INS_LDY_ZPX: return { LDY, ZPX };
+            case CPU::INS_LDY_AB: return { LDY, ABS };
+            case CPU::INS_LDY_ABX: return { LDY, ABSX };
+            case CPU::INS_STA_ZP: return { STA, ZP };
+            case CPU::INS_STA_ZPX: return { STA, ZPX };
+            case CPU::INS_STA_AB: return { STA, ABS };
+            case CPU::INS_STA_ABX: return { STA, ABSX };
+            case CPU::INS_STA_ABY: return { STA, ABSY };
+            case CPU::INS_STX_ZP: return { STX, ZP };
+            case CPU::INS_STX_ZPY: return { STX, ZPY };
+            case CPU::INS_STX_AB: return { STX, ABS };
+            case CPU::INS_STY_ZP: return { STY, ZP };
+            case CPU::INS_STY_ZPX: return { STY, ZPX };
+            case CPU::INS_STY_AB: return { STY, ABS };
+            case CPU::INS_ADC_IM: return { ADC, IMM };
+            case CPU::INS_ADC_ZP: return { ADC, ZP };
+            case CPU::INS_ADC_ZPX: return { ADC, ZPX };
+            case CPU::INS_ADC_AB: return { ADC, ABS };
+            case CPU::INS_ADC_ABX: return { ADC, ABSX };
+            case CPU::INS_ADC_ABY: return { ADC, ABSY };
+            case CPU::INS_SBC_IM: return { SBC, IMM };
+            case CPU::INS_SBC_ZP: return { SBC, ZP };
+            case CPU::INS_SBC_ZPX: return { SBC, ZPX };
+            case CPU::INS_SBC_AB: return { SBC, ABS };
+            case CPU::INS_SBC_ABX: return { SBC, ABSX };
+            case CPU::INS_SBC_ABY: return { SBC, ABSY };
+            case CPU::INS_AND_IM: return { AND, IMM };
+            case CPU::INS_AND_ZP: return { AND, ZP };
+            case CPU::INS_AND_ZPX: return { AND, ZPX };
+            case CPU::INS_AND_AB: return { AND, ABS };
+            case CPU::INS_AND_ABX: return { AND, ABSX };
+            case CPU::INS_AND_ABY: return { AND, ABSY };
+            case CPU::INS_ORA_IM: return { ORA, IMM };
+            case CPU::INS_ORA_ZP: return { ORA, ZP };
+            case CPU::INS_ORA_ZPX: return { ORA, ZPX };
+            case CPU::INS_ORA_AB: return { ORA, ABS };
+            case CPU::INS_ORA_ABX: return { ORA, ABSX };
+            case CPU::INS_ORA_ABY: return { ORA, ABSY };
+            case CPU::INS_EOR_IM: return { EOR, IMM };
+            case CPU::INS_EOR_ZP: return { EOR, ZP };
+            case CPU::INS_EOR_ZPX: return { EOR, ZPX };
+            case CPU::INS_EOR_AB: return { EOR, ABS };
+            case CPU::INS_EOR_ABX: return { EOR, ABSX };
+            case CPU::INS_EOR_ABY: return { EOR, ABSY };
+            case CPU::INS_CMP_IM: return { CMP, IMM };
+            case CPU::INS_CMP_ZP: return { CMP, ZP };
+            case CPU::INS_CMP_ZPX: return { CMP, ZPX };
+            case CPU::INS_CMP_AB: return { CMP, ABS };
+            case CPU::INS_CMP_ABX: return { CMP, ABSX };
+            case CPU::INS_CMP_ABY: return { CMP, ABSY };
+            case CPU::INS_CPX_IM: return { CPX, IMM };
+            case CPU::INS_CPX_ZP: return { CPX, ZP };
+            case CPU::INS_CPX_AB: return { CPX, ABS };
+            case CPU::INS_CPY_IM: return { CPY, IMM };
+            case CPU::INS_CPY_ZP: return { CPY, ZP };
+            case CPU::INS_CPY_AB: return { CPY, ABS };
+            case CPU::INS_ASL_ACC: return { ASL, IMP };
+            case CPU::INS_LSR_ACC: return { LSR, IMP };
+            case CPU::INS_ROL_ACC: return { ROL, IMP };
+            case CPU::INS_ROR_ACC: return { ROR, IMP };
+            case CPU::INS_TAX: return { TAX, IMP };
+            case CPU::INS_TAY: return { TAY, IMP };
+            case CPU::INS_TXA: return { TXA, IMP };
+            case CPU::INS_TYA: return { TYA, IMP };
+            case CPU::INS_INX: return { INX, IMP };
+            case CPU::INS_INY: return { INY, IMP };
+            case CPU::INS_DEX: return { DEX, IMP };
+            case CPU::INS_DEY: return { DEY, IMP };
+            case CPU::INS_CLC: return { CLC, IMP };
+            case CPU::INS_SEC: return { SEC, IMP };
+            case CPU::INS_CLV: return { CLV, IMP };
+            case CPU::INS_NOP: return { NOP, IMP };
+            case CPU::INS_BCC:
+            case CPU::INS_BCS:
+            case CPU::INS_BEQ:
+            case CPU::INS_BMI:
+            case CPU::INS_BNE:
+            case CPU::INS_BPL:
+            case CPU::INS_BVC:
+            case CPU::INS_BVS: return { BRANCH, REL };
+            case CPU::INS_JMP_AB: return { JMP, ABS };
+            default: return { NONE, IMP };
+        }
+    }
+
+    // Cycles before any page crossing penalty, same as CPU::Execute charges
+    unsigned int BaseCycles(Mode how) {
+        switch (how) {
+            case ZP: return 3;
+            case ZPX:
+            case ZPY:
+            case ABS:
+            case ABSX:
+            case ABSY: return 4;
+            default: return 2;
+        }
+    }
+
+    unsigned int Length(Mode how) {
+        switch (how) {
+            case IMP: return 1;
+            case ABS:
+            case ABSX:
+            case ABSY: return 3;
+            default: return 2;
+        }
+    }
+
+    bool IsStore(Kind what) { return what == STA || what == STX || what == STY; }
+
+    // Opcode's Z/N update, shared by the scalar paths
+    void SetZN(Byte value, Byte &z, Byte &n) {
+        z = value == 0;
+        n = value >> 7;
+    }
+
+#ifdef __AVX2__
+    // AVX2 has no byte shifts or byte sign tests, so everything here works on
+    // 0x00/0xFF masks and turns them into 0/1 flags at the end.
+    inline __m256i Get(const std::vector<Byte> &v, unsigned int i) {
+        return _mm256_loadu_si256((const __m256i *)&v[i]);
+    }
+
+    inline void Put(std::vector<Byte> &v, unsigned int i, __m256i value, __m256i mask) {
+        _mm256_storeu_si256((__m256i *)&v[i], _mm256_blendv_epi8(Get(v, i), value, mask));
+    }
+
+    inline __m256i Bit(__m256i mask) { return _mm256_and_si256(mask, _mm256_set1_epi8(1)); }
+    inline __m256i Top(__m256i v) { return _mm256_cmpgt_epi8(_mm256_setzero_si256(), v); }
+    inline __m256i IsZero(__m256i v) { return _mm256_cmpeq_epi8(v, _mm256_setzero_si256()); }
+    inline __m256i Not(__m256i v) { return _mm256_xor_si256(v, _mm256_set1_epi8(-1)); }
+
+    // Byte shifts by one, via 16 bit shifts with the bit that leaked in from
+    // the neighbouring byte masked off
+    inline __m256i ShiftRight1(__m256i v) {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 1), _mm256_set1_epi8(0x7F));
+    }
+
+    inline void PutZN(std::vector<Byte> &z, std::vector<Byte> &n, unsigned int i, __m256i value, __m256i mask) {
+        Put(z, i, Bit(IsZero(value)), mask);
+        Put(n, i, Bit(Top(value)), mask);
+    }
+#endif
+}
+
+lockstep_6502::Lockstep::Lockstep(unsigned int lanes)
+    : Lanes(lanes), Padded((lanes + VECTOR_WIDTH - 1) / VECTOR_WIDTH * VECTOR_WIDTH) {
+    // Padding lanes are permanently stopped and never in a group
+    A.assign(Padded, 0);
+    X.assign(Padded, 0);
+    Y.assign(Padded, 0);
+    SP.assign(Padded, 0xFF);
+    PC.assign(Padded, 0);
+    C.assign(Padded, 0);
+    Z.assign(Padded, 0);
+    V.assign(Padded, 0);
+    N.assign(Padded, 0);
+    Cold.assign(Padded, 0);
+    Cycles.assign(Padded, 0);
+    Stopped.assign(Padded, 0);
+    Memory.assign(Padded, nullptr);
+    Mask.assign(Padded, 0);
+    Operand.assign(Padded, 0);
+    Address.assign(Padded, 0);
+    Group.reserve(Padded);
+    for (unsigned int i = Lanes; i < Padded; i++)
+        Stopped[i] = 1;
+}
+
+void lockstep_6502::Lockstep::Load(unsigned int lane, const cpu_6502::CPU &cpu, mem_28c256::Mem &mem) {
+    A[lane] = cpu.A;
+    X[lane] = cpu.X;
+    Y[lane] = cpu.Y;
+    SP[lane] = cpu.SP;
+    PC[lane] = cpu.PC;
+    C[lane] = cpu.SF.C;
+    Z[lane] = cpu.SF.Z;
+    V[lane] = cpu.SF.V;
+    N[lane] = cpu.SF.N;
+    Cold[lane] = cpu.PSF;
+    Cycles[lane] = cpu.Cycles;
+    // Without interrupts a WAI is as good as a STP, but keep them apart so
+    // Store() can give back what actually happened
+    Stopped[lane] = cpu.Stopped ? 1 : cpu.Waiting ? 2 : 0;
+    Memory[lane] = &mem;
+}
+
+void lockstep_6502::Lockstep::Store(unsigned int lane, cpu_6502::CPU &cpu) const {
+    cpu.A = A[lane];
+    cpu.X = X[lane];
+    cpu.Y = Y[lane];
+    cpu.SP = SP[lane];
+    cpu.PC = PC[lane];
+    cpu.PSF = Cold[lane];
+    cpu.SF.C = C[lane];
+    cpu.SF.Z = Z[lane];
+    cpu.SF.V = V[lane];
+    cpu.SF.N = N[lane];
+    cpu.Cycles = Cycles[lane];
+    cpu.Stopped = Stopped[lane] == 1;
+    cpu.Waiting = Stopped[lane] == 2;
+}
+
+void lockstep_6502::Lockstep::RunScalar(unsigned int lane) {
+    Store(lane, Scalar);
+    Scalar.Execute(1, *Memory[lane]);   // Always exactly one instruction
+    Load(lane, Scalar, *Memory[lane]);
+    ScalarLanes++;
+}
+
+bool lockstep_6502::Lockstep::Step(uint64_t limit) {
+    unsigned int lowest = 0x10000;
+    for (unsigned int i = 0; i < Lanes; i++)
+        if (!Stopped[i] && Cycles[i] < limit && PC[i] < lowest)
+            lowest = PC[i];
+    if (lowest == 0x10000)
+        return false;
+    Steps++;
+
+    // Lanes at the same PC nearly always have the same opcode there, but
+    // self-modifying code can make them differ. The odd ones out go alone.
+    Group.clear();
+    int opcode = -1;
+    for (unsigned int i = 0; i < Lanes; i++) {
+        if (Stopped[i] || Cycles[i] >= limit || PC[i] != lowest)
+            continue;
+        Byte op = Memory[i]->Read(lowest);
+        if (opcode < 0)
+            opcode = op;
+        if (op == opcode)
+            Group.push_back(i);
+        else
+            RunScalar(i);
+    }
+
+    Op op = Decode(opcode);
+    if (op.What == NONE) {
+        for (unsigned int lane : Group)
+            RunScalar(lane);
+        return true;
+    }
+
+    // Operand fetch and addressing can't be vectorised, every lane has its
+    // own memory
+    for (unsigned int lane : Group) {
+        mem_28c256::Mem &mem = *Memory[lane];
+        Word pc = PC[lane];
+        Word addr = 0;
+        uint64_t cycles = BaseCycles(op.How);
+        switch (op.How) {
+            case IMM:
+            case REL:
+                Operand[lane] = mem.Read(pc + 1);
+                break;
+            case ZP:
+                addr = mem.Read(pc + 1);
+                break;
+            case ZPX:
+                addr = Byte(mem.Read(pc + 1) + X[lane]);
+                break;
+            case ZPY:
+                addr = Byte(mem.Read(pc + 1) + Y[lane]);
+                break;
+            case ABS:
+                addr = mem.Read(pc + 1) | mem.Read(pc + 2) << 8;
+                break;
+            case ABSX:
+            case ABSY: {
+                Word base = mem.Read(pc + 1) | mem.Read(pc + 2) << 8;
+                addr = base + (op.How == ABSX ? X[lane] : Y[lane]);
+                if (IsStore(op.What) || (base & 0xFF00) != (addr & 0xFF00))
+                    cycles++;
+            } break;
+            default:
+                break;
+        }
+        if (op.How != IMP && op.How != IMM && op.How != REL && !IsStore(op.What) && op.What != JMP)
+            Operand[lane] = mem.Read(addr);
+        Address[lane] = addr;
+        PC[lane] = pc + Length(op.How);
+        Cycles[lane] += op.What == JMP ? 3 : cycles;
+        Mask[lane] = 0xFF;
+    }
+
+    switch (op.What) {
+        case LDA: LoadRegister(A); break;
+        case LDX: LoadRegister(X); break;
+        case LDY: LoadRegister(Y); break;
+        case ADC: Add(false); break;
+        case SBC: Add(true); break;
+        case AND: Logic(LOGIC_AND); break;
+        case ORA: Logic(LOGIC_ORA); break;
+        case EOR: Logic(LOGIC_EOR); break;
+        case CMP: Compare(A); break;
+        case CPX: Compare(X); break;
+        case CPY: Compare(Y); break;
+        case ASL: Shift(SHIFT_ASL); break;
+        case LSR: Shift(SHIFT_LSR); break;
+        case ROL: Shift(SHIFT_ROL); break;
+        case ROR: Shift(SHIFT_ROR); break;
+        case STA:
+        case STX:
+        case STY: {
+            std::vector<Byte> &reg = op.What == STA ? A : op.What == STX ? X : Y;
+            for (unsigned int lane : Group)
+                Memory[lane]->Write(Address[lane], reg[lane]);
+        } break;
+        case TAX:
+        case TAY:
+        case TXA:
+        case TYA: {
+            std::vector<Byte> &src = op.What == TXA ? X : op.What == TYA ? Y : A;
+            std::vector<Byte> &dst = op.What == TAX ? X : op.What == TAY ? Y : A;
+            for (unsigned int lane : Group) {
+                dst[lane] = src[lane];
+                SetZN(dst[lane], Z[lane], N[lane]);
+            }
+        } break;
+        case INX:
+        case INY:
+        case DEX:
+        case DEY: {
+            std::vector<Byte> &reg = op.What == INX || op.What == DEX ? X : Y;
+            Byte delta = op.What == INX || op.What == INY ? 1 : 0xFF;
+            for (unsigned int lane : Group) {
+                reg[lane] += delta;
+                SetZN(reg[lane], Z[lane], N[lane]);
+            }
+        } break;
+        case CLC:
+        case SEC:
+            for (unsigned int lane : Group)
+                C[lane] = op.What == SEC;
+            break;
+        case CLV:
+            for (unsigned int lane : Group)
+                V[lane] = 0;
+            break;
+        case BRANCH: {
+            // Bits 7-6 of the opcode pick the flag, bit 5 the value wanted
+            std::vector<Byte> *flags[] = { &N, &V, &C, &Z };
+            std::vector<Byte> &flag = *flags[opcode >> 6];
+            Byte want = (opcode >> 5) & 1;
+            for (unsigned int lane : Group) {
+                if (flag[lane] != want)
+                    continue;
+                Word target = PC[lane] + int8_t(Operand[lane]);
+                Cycles[lane] += (target & 0xFF00) != (PC[lane] & 0xFF00) ? 2 : 1;
+                PC[lane] = target;
+            }
+        } break;
+        case JMP:
+            for (unsigned int lane : Group)
+                PC[lane] = Address[lane];
+            break;
+        default:
+            break;
+    }
+
+    for (unsigned int lane : Group)
+        Mask[lane] = 0;
+    VectorLanes += Group.size();
+    return true;
+}
+
+void lockstep_6502::Lockstep::Run(uint64_t limit) {
+    while (Step(limit))
+        ;
+}
+
+void lockstep_6502::Lockstep::LoadRegister(std::vector<Byte> &reg) {
+    unsigned int i = 0;
+#ifdef __AVX2__
+    for (; i < Padded; i += 32) {
+        __m256i mask = Get(Mask, i);
+        __m256i m = Get(Operand, i);
+        Put(reg, i, m, mask);
+        PutZN(Z, N, i, m, mask);
+    }
+#endif
+    for (; i < Padded; i++) {
+        if (!Mask[i])
+            continue;
+        reg[i] = Operand[i];
+        SetZN(reg[i], Z[i], N[i]);
+    }
+}
+
+void lockstep_6502::Lockstep::Logic(LogicOp op) {
+    unsigned int i = 0;
+#ifdef __AVX2__
+    for (; i < Padded; i += 32) {
+        __m256i mask = Get(Mask, i);
+        __m256i a = Get(A, i), m = Get(Operand, i);
+        __m256i r = op == LOGIC_AND ? _mm256_and_si256(a, m) : op == LOGIC_ORA ? _mm256_or_si256(a, m) : _mm256_xor_si256(a, m);
+        Put(A, i, r, mask);
+        PutZN(Z, N, i, r, mask);
+    }
+#endif
+    for (; i < Padded; i++) {
+        if (!Mask[i])
+            continue;
+        A[i] = op == LOGIC_AND ? A[i] & Operand[i] : op == LOGIC_ORA ? A[i] | Operand[i] : A[i] ^ Operand[i];
+        SetZN(A[i], Z[i], N[i]);
+    }
+}
+
+void lockstep_6502::Lockstep::Add(bool subtract) {
+    // SBC here is A - M - C with C meaning "borrowed", which is what
+    // CPU::Execute does, so that's what this has to match
+    unsigned int i = 0;
+#ifdef __AVX2__
+    for (; i < Padded; i += 32) {
+        __m256i mask = Get(Mask, i);
+        __m256i a = Get(A, i), m = Get(Operand, i), c = Get(C, i);
+        __m256i r, carry;
+        if (!subtract) {
+            // Carried out of either add if the saturating version came out different
+            __m256i t = _mm256_add_epi8(a, m);
+            r = _mm256_add_epi8(t, c);
+            carry = _mm256_or_si256(Not(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, m), t)),
+                                    Not(_mm256_cmpeq_epi8(_mm256_adds_epu8(t, c), r)));
+        } else {
+            // Borrowed if either subtrahend was bigger than what it came off
+            __m256i t = _mm256_sub_epi8(a, m);
+            r = _mm256_sub_epi8(t, c);
+            carry = _mm256_or_si256(Not(IsZero(_mm256_subs_epu8(m, a))),
+                                    Not(IsZero(_mm256_subs_epu8(c, t))));
+        }
+        __m256i v = Top(_mm256_andnot_si256(_mm256_xor_si256(a, m), _mm256_xor_si256(r, m)));
+        Put(A, i, r, mask);
+        Put(C, i, Bit(carry), mask);
+        Put(V, i, Bit(v), mask);
+        PutZN(Z, N, i, r, mask);
+    }
+#endif
+    for (; i < Padded; i++) {
+        if (!Mask[i])
+            continue;
+        Byte a = A[i], m = Operand[i];
+        Word sum = subtract ? Word(a - m - C[i]) : Word(a + m + C[i]);
+        A[i] = sum & 0xFF;
+        C[i] = sum > 0xFF;
+        V[i] = !((a ^ m) & 0x80) && ((A[i] ^ m) & 0x80);
+        SetZN(A[i], Z[i], N[i]);
+    }
+}
+
+void lockstep_6502::Lockstep::Compare(const std::vector<Byte> &reg) {
+    unsigned int i = 0;
+#ifdef __AVX2__
+    for (; i < Padded; i += 32) {
+        __m256i mask = Get(Mask, i);
+        __m256i r = Get(reg, i), m = Get(Operand, i);
+        Put(C, i, Bit(_mm256_cmpeq_epi8(_mm256_max_epu8(r, m), r)), mask);
+        Put(Z, i, Bit(_mm256_cmpeq_epi8(r, m)), mask);
+        Put(N, i, Bit(Top(_mm256_sub_epi8(r, m))), mask);
+    }
+#endif
+    for (; i < Padded; i++) {
+        if (!Mask[i])
+            continue;
+        C[i] = reg[i] >= Operand[i];
+        Z[i] = reg[i] == Operand[i];
+        N[i] = Byte(reg[i] - Operand[i]) >> 7;
+    }
+}
+
+void lockstep_6502::Lockstep::Shift(ShiftOp op) {
+    // Flag quirks are CPU::Execute's: ASL takes Z from the value before the
+    // shift, and ROR A leaves Z and N alone
+    unsigned int i = 0;
+#ifdef __AVX2__
+    for (; i < Padded; i += 32) {
+        __m256i mask = Get(Mask, i);
+        __m256i a = Get(A, i), c = Get(C, i);
+        __m256i one = _mm256_set1_epi8(1);
+        __m256i low = _mm256_and_si256(a, one);
+        __m256i r;
+        switch (op) {
+            case SHIFT_ASL:
+                r = _mm256_add_epi8(a, a);
+                Put(Z, i, Bit(IsZero(a)), mask);
+                Put(N, i, Bit(Top(r)), mask);
+                Put(C, i, Bit(Top(a)), mask);
+                break;
+            case SHIFT_LSR:
+                r = ShiftRight1(a);
+                PutZN(Z, N, i, r, mask);
+                Put(C, i, low, mask);
+                break;
+            case SHIFT_ROL:
+                r = _mm256_or_si256(_mm256_add_epi8(a, a), c);
+                PutZN(Z, N, i, r, mask);
+                Put(C, i, Bit(Top(a)), mask);
+                break;
+            default:
+                r = _mm256_or_si256(ShiftRight1(a), _mm256_and_si256(_mm256_cmpeq_epi8(c, one), _mm256_set1_epi8(-128)));
+                Put(C, i, low, mask);
+                break;
+        }
+        Put(A, i, r, mask);
+    }
+#endif
+    for (; i < Padded; i++) {
+        if (!Mask[i])
+            continue;
+        Byte a = A[i];
+        switch (op) {
+            case SHIFT_ASL:
+                A[i] = a << 1;
+                Z[i] = a == 0;
+                N[i] = A[i] >> 7;
+                C[i] = a >> 7;
+                break;
+            case SHIFT_LSR:
+                A[i] = a >> 1;
+                SetZN(A[i], Z[i], N[i]);
+                C[i] = a & 1;
+                break;
+            case SHIFT_ROL:
+                A[i] = (a << 1) | C[i];
+                SetZN(A[i], Z[i], N[i]);
+                C[i] = a >> 7;
+                break;
+            default:
+                A[i] = (a >> 1) | (C[i] << 7);
+                C[i] = a & 1;
+                break;
+        }
+    }
+}
@@ -4,14 +4,29 @@ void mem_28c256::Mem::Init() {
     // Reset all of memory to 0's
     for ( unsigned int i = 0; i < MAX_MEM; i++ )
         Data[i] = 0;
+    Touch(0, MAX_MEM - 1);
 }
 
-void mem_28c256::Mem::LoadMem(std::string filename) {
+void mem_28c256::Mem::Map(Word first, Word last, Device *dev) {
+    for (unsigned int page = first >> 8; page <= (unsigned int)(last >> 8); page++)
+        IO[page] = dev;
+}
+
+void mem_28c256::Mem::Touch(Word first, Word last) {
+    for (unsigned int page = first >> 8; page <= (unsigned int)(last >> 8); page++)
+        PageGen[page] = WriteGen;
+}
+
+bool mem_28c256::Mem::LoadMem(std::string filename) {
     using namespace std;
     FILE *file = NULL;
-    if ((file = fopen(filename.c_str(), "rb")) == NULL)
+    if ((file = fopen(filename.c_str(), "rb")) == NULL) {
         cout << "Could not open specified file." << endl;
+        return false;
+    }
     fread(Data, 1, MAX_MEM, file);
+    Touch(0, MAX_MEM - 1);
 
     fclose(file);
+    return true;
 }
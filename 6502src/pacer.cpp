@@ -0,0 +1,109 @@
+#include "pacer.hpp"
+
+#include <cerrno>
+#include <ctime>
+
+namespace {
+    const uint64_t NS_PER_SEC = 1000000000ull;
+
+    uint64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * NS_PER_SEC + ts.tv_nsec;
+    }
+
+    void SleepUntil(uint64_t ns) {
+        timespec ts;
+        ts.tv_sec = ns / NS_PER_SEC;
+        ts.tv_nsec = ns % NS_PER_SEC;
+        // Absolute deadline, so being woken by a signal just means going
+        // back to sleep with the same timespec.
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+
+    // cycles * 1e9 / hz without overflowing after a few hours of emulated time
+    uint64_t CyclesToNs(uint64_t cycles, uint64_t hz) {
+        return (cycles / hz) * NS_PER_SEC + (cycles % hz) * NS_PER_SEC / hz;
+    }
+}
+
+uint64_t pace_6502::Pacer::BatchCycles() const {
+    // Emulated time runs ahead of the wall clock by up to one batch, so one
+    // batch can't be longer than the jitter we're allowed.
+    uint64_t batch = (MaxJitterNs / NS_PER_SEC) * TargetHz
+                   + (MaxJitterNs % NS_PER_SEC) * TargetHz / NS_PER_SEC;
+    return batch > 0 ? batch : 1;
+}
+
+void pace_6502::Pacer::Run(cpu_6502::CPU &cpu, mem_28c256::Mem &mem, uint64_t nCycles) {
+    CyclesRun = ElapsedNs = Batches = WorstLateNs = Resyncs = 0;
+
+    const uint64_t batch = BatchCycles();
+    const uint64_t startNs = NowNs();
+    const uint64_t startCycles = cpu.Cycles;
+
+    // Real time that lines up with anchorCycles. Only moves on a resync.
+    uint64_t anchorNs = startNs;
+    uint64_t anchorCycles = startCycles;
+    uint64_t slack = 0;
+
+    while (!cpu.Stopped && !(Quit && *Quit)) {
+        uint64_t done = cpu.Cycles - startCycles;
+        if (nCycles && done >= nCycles)
+            break;
+
+        uint64_t slice = batch;
+        if (nCycles && nCycles - done < slice)
+            slice = nCycles - done;
+        if (slice > 0x7FFFFFFF)
+            slice = 0x7FFFFFFF;
+        cpu.Execute(slice, mem);
+        Batches++;
+        if (AfterBatch)
+            AfterBatch();
+
+        uint64_t deadline = anchorNs + CyclesToNs(cpu.Cycles - anchorCycles, TargetHz);
+        uint64_t now = NowNs();
+        if (now > deadline + ResyncNs) {
+            // Hopelessly behind, running flat out to catch up would just turn
+            // into a burst of emulated time, so start over from here.
+            anchorNs = now;
+            anchorCycles = cpu.Cycles;
+            Resyncs++;
+            continue;
+        }
+        if (deadline > now + slack) {
+            // The kernel tends to wake us late by a fairly steady amount, so
+            // aim that much early. Capped so we never trade late wake-ups for
+            // running too far ahead.
+            uint64_t target = deadline - slack;
+            SleepUntil(target);
+            now = NowNs();
+            uint64_t late = now > target ? now - target : 0;
+            slack = (slack * 7 + late) / 8;
+            if (slack > MaxJitterNs / 2)
+                slack = MaxJitterNs / 2;
+        }
+        if (now > deadline && now - deadline > WorstLateNs)
+            WorstLateNs = now - deadline;
+    }
+
+    CyclesRun = cpu.Cycles - startCycles;
+    ElapsedNs = NowNs() - startNs;
+}
+
+double pace_6502::Pacer::AchievedHz() const {
+    if (ElapsedNs == 0)
+        return 0.0;
+    return double(CyclesRun) * NS_PER_SEC / ElapsedNs;
+}
+
+void pace_6502::Pacer::Report(std::ostream &out) const {
+    double achieved = AchievedHz();
+    out << "Target: " << TargetHz / 1e6 << " MHz, achieved: " << achieved / 1e6 << " MHz ("
+        << (TargetHz ? 100.0 * achieved / TargetHz : 0.0) << "%)\n";
+    out << "Batches: " << Batches << " of " << BatchCycles() << " cycles, worst late wake-up: "
+        << WorstLateNs / 1000 << " us (bound " << MaxJitterNs / 1000 << " us), resyncs: "
+        << Resyncs << "\n";
+}
@@ -0,0 +1,421 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "symbols.hpp"
+
+namespace {
+    struct Name {
+        profile_6502::Byte Opcode;
+        const char *Text;
+    };
+
+    const Name NAMES[] = {
+        { cpu_6502::CPU::INS_LDA_IM, "LDA_IM" },
+        { cpu_6502::CPU::INS_LDA_ZP, "LDA_ZP" },
+        { cpu_6502::CPU::INS_LDA_ZPX, "LDA_ZPX" },
+        { cpu_6502::CPU::INS_LDA_AB, "LDA_AB" },
+        { cpu_6502::CPU::INS_LDA_ABX, "LDA_ABX" },
+        { cpu_6502::CPU::INS_LDA_ABY, "LDA_ABY" },
+        { cpu_6502::CPU::INS_LDA_IDX, "LDA_IDX" },
+        { cpu_6502::CPU::INS_LDA_IDY, "LDA_IDY" },
+        { cpu_6502::CPU::INS_LDX_IM, "LDX_IM" },
+        { cpu_6502::CPU::INS_LDX_ZP, "LDX_ZP" },
+        { cpu_6502::CPU::INS_LDX_ZPY, "LDX_ZPY" },
+        { cpu_6502::CPU::INS_LDX_AB, "LDX_AB" },
+        { cpu_6502::CPU::INS_LDX_ABY, "LDX_ABY" },
+        { cpu_6502::CPU::INS_LDY_IM, "LDY_IM" },
+        { cpu_6502::CPU::INS_LDY_ZP, "LDY_ZP" },
+        { cpu_6502::CPU::INS_LDY_ZPX, "LDY_ZPX" },
+        { cpu_6502::CPU::INS_LDY_AB, "LDY_AB" },
+        { cpu_6502::CPU::INS_LDY_ABX, "LDY_ABX" },
+        { cpu_6502::CPU::INS_STA_ZP, "STA_ZP" },
+        { cpu_6502::CPU::INS_STA_ZPX, "STA_ZPX" },
+        { cpu_6502::CPU::INS_STA_AB, "STA_AB" },
+        { cpu_6502::CPU::INS_STA_ABX, "STA_ABX" },
+        { cpu_6502::CPU::INS_STA_ABY, "STA_ABY" },
+        { cpu_6502::CPU::INS_STA_IDX, "STA_IDX" },
+        { cpu_6502::CPU::INS_STA_IDY, "STA_IDY" },
+        { cpu_6502::CPU::INS_STX_ZP, "STX_ZP" },
+        { cpu_6502::CPU::INS_STX_ZPY, "STX_ZPY" },
+        { cpu_6502::CPU::INS_STX_AB, "STX_AB" },
+        { cpu_6502::CPU::INS_STY_ZP, "STY_ZP" },
+        { cpu_6502::CPU::INS_STY_ZPX, "STY_ZPX" },
+        { cpu_6502::CPU::INS_STY_AB, "STY_AB" },
+        { cpu_6502::CPU::INS_JSR, "JSR" },
+        { cpu_6502::CPU::INS_RTS, "RTS" },
+        { cpu_6502::CPU::INS_ADC_IM, "ADC_IM" },
+        { cpu_6502::CPU::INS_ADC_ZP, "ADC_ZP" },
+        { cpu_6502::CPU::INS_ADC_ZPX, "ADC_ZPX" },
+        { cpu_6502::CPU::INS_ADC_AB, "ADC_AB" },
+        { cpu_6502::CPU::INS_ADC_ABX, "ADC_ABX" },
+        { cpu_6502::CPU::INS_ADC_ABY, "ADC_ABY" },
+        { cpu_6502::CPU::INS_ADC_IDX, "ADC_IDX" },
+        { cpu_6502::CPU::INS_ADC_IDY, "ADC_IDY" },
+        { cpu_6502::CPU::INS_SBC_IM, "SBC_IM" },
+        { cpu_6502::CPU::INS_SBC_ZP, "SBC_ZP" },
+        { cpu_6502::CPU::INS_SBC_ZPX, "SBC_ZPX" },
+        { cpu_6502::CPU::INS_SBC_AB, "SBC_AB" },
+        { cpu_6502::CPU::INS_SBC_ABX, "SBC_ABX" },
+        { cpu_6502::CPU::INS_SBC_ABY, "SBC_ABY" },
+        { cpu_6502::CPU::INS_SBC_IDX, "SBC_IDX" },
+        { cpu_6502::CPU::INS_SBC_IDY, "SBC_IDY" },
+        { cpu_6502::CPU::INS_TAX, "TAX" },
+        { cpu_6502::CPU::INS_TAY, "TAY" },
+        { cpu_6502::CPU::INS_TSX, "TSX" },
+        { cpu_6502::CPU::INS_TXA, "TXA" },
+        { cpu_6502::CPU::INS_TXS, "TXS" },
+        { cpu_6502::CPU::INS_TYA, "TYA" },
+        { cpu_6502::CPU::INS_AND_IM, "AND_IM" },
+        { cpu_6502::CPU::INS_AND_ZP, "AND_ZP" },
+        { cpu_6502::CPU::INS_AND_ZPX, "AND_ZPX" },
+        { cpu_6502::CPU::INS_AND_AB, "AND_AB" },
+        { cpu_6502::CPU::INS_AND_ABX, "AND_ABX" },
+        { cpu_6502::CPU::INS_AND_ABY, "AND_ABY" },
+        { cpu_6502::CPU::INS_AND_IDX, "AND_IDX" },
+        { cpu_6502::CPU::INS_AND_IDY, "AND_IDY" },
+        { cpu_6502::CPU::INS_EOR_IM, "EOR_IM" },
+        { cpu_6502::CPU::INS_EOR_ZP, "EOR_ZP" },
+        { cpu_6502::CPU::INS_EOR_ZPX, "EOR_ZPX" },
+        { cpu_6502::CPU::INS_EOR_AB, "EOR_AB" },
+        { cpu_6502::CPU::INS_EOR_ABX, "EOR_ABX" },
+        { cpu_6502::CPU::INS_EOR_ABY, "EOR_ABY" },
+        { cpu_6502::CPU::INS_EOR_IDX, "EOR_IDX" },
+        { cpu_6502::CPU::INS_EOR_IDY, "EOR_IDY" },
+        { cpu_6502::CPU::INS_ORA_IM, "ORA_IM" },
+        { cpu_6502::CPU::INS_ORA_ZP, "ORA_ZP" },
+        { cpu_6502::CPU::INS_ORA_ZPX, "ORA_ZPX" },
+        { cpu_6502::CPU::INS_ORA_AB, "ORA_AB" },
+        { cpu_6502::CPU::INS_ORA_ABX, "ORA_ABX" },
+        { cpu_6502::CPU::INS_ORA_ABY, "ORA_ABY" },
+        { cpu_6502::CPU::INS_ORA_IDX, "ORA_IDX" },
+        { cpu_6502::CPU::INS_ORA_IDY, "ORA_IDY" },
+        { cpu_6502::CPU::INS_BIT_ZP, "BIT_ZP" },
+        { cpu_6502::CPU::INS_BIT_AB, "BIT_AB" },
+        { cpu_6502::CPU::INS_INC_ZP, "INC_ZP" },
+        { cpu_6502::CPU::INS_INC_ZPX, "INC_ZPX" },
+        { cpu_6502::CPU::INS_INC_AB, "INC_AB" },
+        { cpu_6502::CPU::INS_INC_ABX, "INC_ABX" },
+        { cpu_6502::CPU::INS_INX, "INX" },
+        { cpu_6502::CPU::INS_INY, "INY" },
+        { cpu_6502::CPU::INS_DEC_ZP, "DEC_ZP" },
+        { cpu_6502::CPU::INS_DEC_ZPX, "DEC_ZPX" },
+        { cpu_6502::CPU::INS_DEC_AB, "DEC_AB" },
+        { cpu_6502::CPU::INS_DEC_ABX, "DEC_ABX" },
+        { cpu_6502::CPU::INS_DEX, "DEX" },
+        { cpu_6502::CPU::INS_DEY, "DEY" },
+        { cpu_6502::CPU::INS_ASL_ACC, "ASL_ACC" },
+        { cpu_6502::CPU::INS_ASL_ZP, "ASL_ZP" },
+        { cpu_6502::CPU::INS_ASL_ZPX, "ASL_ZPX" },
+        { cpu_6502::CPU::INS_ASL_AB, "ASL_AB" },
+        { cpu_6502::CPU::INS_ASL_ABX, "ASL_ABX" },
+        { cpu_6502::CPU::INS_LSR_ACC, "LSR_ACC" },
+        { cpu_6502::CPU::INS_LSR_ZP, "LSR_ZP" },
+        { cpu_6502::CPU::INS_LSR_ZPX, "LSR_ZPX" },
+        { cpu_6502::CPU::INS_LSR_AB, "LSR_AB" },
+        { cpu_6502::CPU::INS_LSR_ABX, "LSR_ABX" },
+        { cpu_6502::CPU::INS_ROL_ACC, "ROL_ACC" },
+        { cpu_6502::CPU::INS_ROL_ZP, "ROL_ZP" },
+        { cpu_6502::CPU::INS_ROL_ZPX, "ROL_ZPX" },
+        { cpu_6502::CPU::INS_ROL_AB, "ROL_AB" },
+        { cpu_6502::CPU::INS_ROL_ABX, "ROL_ABX" },
+        { cpu_6502::CPU::INS_ROR_ACC, "ROR_ACC" },
+        { cpu_6502::CPU::INS_ROR_ZP, "ROR_ZP" },
+        { cpu_6502::CPU::INS_ROR_ZPX, "ROR_ZPX" },
+        { cpu_6502::CPU::INS_ROR_AB, "ROR_AB" },
+        { cpu_6502::CPU::INS_ROR_ABX, "ROR_ABX" },
+        { cpu_6502::CPU::INS_CLC, "CLC" },
+        { cpu_6502::CPU::INS_CLD, "CLD" },
+        { cpu_6502::CPU::INS_CLI, "CLI" },
+        { cpu_6502::CPU::INS_CLV, "CLV" },
+        { cpu_6502::CPU::INS_SEC, "SEC" },
+        { cpu_6502::CPU::INS_SED, "SED" },
+        { cpu_6502::CPU::INS_SEI, "SEI" },
+        { cpu_6502::CPU::INS_BRK, "BRK" },
+        { cpu_6502::CPU::INS_NOP, "NOP" },
+        { cpu_6502::CPU::INS_RTI, "RTI" },
+        { cpu_6502::CPU::INS_WAI, "WAI" },
+        { cpu_6502::CPU::INS_STP, "STP" },
+        { cpu_6502::CPU::INS_PHA, "PHA" },
+        { cpu_6502::CPU::INS_PHP, "PHP" },
+        { cpu_6502::CPU::INS_PLA, "PLA" },
+        { cpu_6502::CPU::INS_PLP, "PLP" },
+        { cpu_6502::CPU::INS_BCC, "BCC" },
+        { cpu_6502::CPU::INS_BCS, "BCS" },
+        { cpu_6502::CPU::INS_BEQ, "BEQ" },
+        { cpu_6502::CPU::INS_BMI, "BMI" },
+        { cpu_6502::CPU::INS_BNE, "BNE" },
+        { cpu_6502::CPU::INS_BPL, "BPL" },
+        { cpu_6502::CPU::INS_BVC, "BVC" },
+        { cpu_6502::CPU::INS_BVS, "BVS" },
+        { cpu_6502::CPU::INS_CMP_IM, "CMP_IM" },
+        { cpu_6502::CPU::INS_CMP_ZP, "CMP_ZP" },
+        { cpu_6502::CPU::INS_CMP_ZPX, "CMP_ZPX" },
+        { cpu_6502::CPU::INS_CMP_AB, "CMP_AB" },
+        { cpu_6502::CPU::INS_CMP_ABX, "CMP_ABX" },
+        { cpu_6502::CPU::INS_CMP_ABY, "CMP_ABY" },
+        { cpu_6502::CPU::INS_CMP_IDX, "CMP_IDX" },
+        { cpu_6502::CPU::INS_CMP_IDY, "CMP_IDY" },
+        { cpu_6502::CPU::INS_CPX_IM, "CPX_IM" },
+        { cpu_6502::CPU::INS_CPX_ZP, "CPX_ZP" },
+        { cpu_6502::CPU::INS_CPX_AB, "CPX_AB" },
+        { cpu_6502::CPU::INS_CPY_IM, "CPY_IM" },
+        { cpu_6502::CPU::INS_CPY_ZP, "CPY_ZP" },
+        { cpu_6502::CPU::INS_CPY_AB, "CPY_AB" },
+        { cpu_6502::CPU::INS_JMP_AB, "JMP_AB" },
+        { cpu_6502::CPU::INS_JMP_ID, "JMP_ID" },
+    };
+
+    // Indices of the `top` biggest entries of `values`, biggest first,
+    // leaving out zeros
+    std::vector<unsigned int> Top(const uint64_t *values, unsigned int n, unsigned int top) {
+        std::vector<unsigned int> order;
+        for (unsigned int i = 0; i < n; i++)
+            if (values[i])
+                order.push_back(i);
+        top = std::min<size_t>(top, order.size());
+        std::partial_sort(order.begin(), order.begin() + top, order.end(),
+                          [values](unsigned int a, unsigned int b) { return values[a] > values[b]; });
+        order.resize(top);
+        return order;
+    }
+
+    double Percent(uint64_t part, uint64_t whole) {
+        return whole ? 100.0 * part / whole : 0.0;
+    }
+
+    // Name column for an address, if there's anything to put in it
+    std::string Where(const symbols_6502::Table *symbols, unsigned int addr) {
+        if (!symbols || !symbols->Find(addr))
+            return "";
+        return "  " + symbols->Format(addr);
+    }
+}
+
+const char *profile_6502::OpcodeName(Byte opcode) {
+    struct Table {
+        const char *Names[256] = {};
+        Table() {
+            for (const Name &n : NAMES)
+                Names[n.Opcode] = n.Text;
+        }
+    };
+    static const Table table;
+    return table.Names[opcode];
+}
+
+void profile_6502::Profile::Clear() {
+    memset(Instructions, 0, sizeof(Instructions));
+    memset(Cycles, 0, sizeof(Cycles));
+    memset(PagePenalties, 0, sizeof(PagePenalties));
+    memset(Hits, 0, sizeof(Hits));
+    memset(PCCycles, 0, sizeof(PCCycles));
+    memset(Taken, 0, sizeof(Taken));
+    memset(NotTaken, 0, sizeof(NotTaken));
+    Interrupts = 0;
+}
+
+uint64_t profile_6502::Profile::TotalInstructions() const {
+    uint64_t total = 0;
+    for (uint64_t n : Instructions)
+        total += n;
+    return total;
+}
+
+uint64_t profile_6502::Profile::TotalCycles() const {
+    uint64_t total = 0;
+    for (uint64_t n : Cycles)
+        total += n;
+    return total;
+}
+
+void profile_6502::Profile::Report(std::ostream &out, unsigned int top, const symbols_6502::Table *symbols) const {
+    uint64_t instructions = TotalInstructions();
+    uint64_t cycles = TotalCycles();
+    char line[128];
+    snprintf(line, sizeof(line), "%llu instructions, %llu cycles (%.2f per instruction), %llu interrupts\n",
+             (unsigned long long)instructions, (unsigned long long)cycles,
+             instructions ? double(cycles) / instructions : 0.0, (unsigned long long)Interrupts);
+    out << line;
+
+    out << "\nOpcodes by cycles:\n"
+        << "  op  name          count        cycles   %cyc   page+\n";
+    for (unsigned int op : Top(Cycles, 256, top)) {
+        const char *name = OpcodeName(op);
+        snprintf(line, sizeof(line), "  %02X  %-8s %10llu  %12llu  %5.1f  %6llu\n", op, name ? name : "?",
+                 (unsigned long long)Instructions[op], (unsigned long long)Cycles[op],
+                 Percent(Cycles[op], cycles), (unsigned long long)PagePenalties[op]);
+        out << line;
+    }
+
+    out << "\nAddresses by cycles:\n"
+        << "  addr        hits        cycles   %cyc\n";
+    for (unsigned int pc : Top(PCCycles, 65536, top)) {
+        snprintf(line, sizeof(line), "  %04X  %10llu  %12llu  %5.1f", pc, (unsigned long long)Hits[pc],
+                 (unsigned long long)PCCycles[pc], Percent(PCCycles[pc], cycles));
+        out << line << Where(symbols, pc) << "\n";
+    }
+
+    std::vector<uint64_t> branches(65536);
+    for (unsigned int pc = 0; pc < 65536; pc++)
+        branches[pc] = Taken[pc] + NotTaken[pc];
+    out << "\nBranches by count:\n"
+        << "  addr       taken   not taken  %taken\n";
+    for (unsigned int pc : Top(branches.data(), 65536, top)) {
+        snprintf(line, sizeof(line), "  %04X  %10llu  %10llu  %5.1f", pc, (unsigned long long)Taken[pc],
+                 (unsigned long long)NotTaken[pc], Percent(Taken[pc], branches[pc]));
+        out << line << Where(symbols, pc) << "\n";
+    }
+}
+
+void profile_6502::CallGraph::Clear() {
+    Nodes.assign(1, Node());
+    Nodes[0].Address = 0;
+    Nodes[0].Entered = ENTERED_JSR;
+    Nodes[0].Parent = 0;
+    Stack.assign(1, Frame{ 0, 0x100 });
+    Children.clear();
+    Overflows = 0;
+    Started = false;
+}
+
+void profile_6502::CallGraph::Instruction(Word pc, Byte opcode, unsigned int cycles, Word pcAfter, Byte spAfter) {
+    if (!Started) {
+        Nodes[0].Address = pc;
+        Started = true;
+    }
+
+    // Charged to whoever ran it: the caller pays for the JSR and the callee
+    // for its RTS
+    Nodes[Stack.back().Node].Self += cycles;
+    if (opcode == cpu_6502::CPU::INS_JSR)
+        Push(pcAfter, ENTERED_JSR, spAfter + 2);
+    else if (opcode == cpu_6502::CPU::INS_BRK)
+        Push(pcAfter, ENTERED_BRK, spAfter + 3);
+    else
+        Unwind(spAfter);
+}
+
+void profile_6502::CallGraph::Interrupt(Byte entered, unsigned int cycles, Word pcAfter, Byte spAfter) {
+    if (!Started) {
+        Nodes[0].Address = pcAfter;
+        Started = true;
+    }
+    Push(pcAfter, entered, spAfter + 3);
+    Nodes[Stack.back().Node].Self += cycles;
+}
+
+void profile_6502::CallGraph::Push(Word addr, Byte entered, unsigned int returnSP) {
+    if (Stack.size() >= MAX_CALL_DEPTH) {
+        Overflows++;
+        return;
+    }
+    uint32_t parent = Stack.back().Node;
+    uint64_t key = uint64_t(parent) << 24 | uint32_t(entered) << 16 | addr;
+    auto it = Children.find(key);
+    uint32_t node;
+    if (it != Children.end())
+        node = it->second;
+    else {
+        node = Nodes.size();
+        Node n;
+        n.Address = addr;
+        n.Entered = entered;
+        n.Parent = parent;
+        Nodes.push_back(n);
+        Children[key] = node;
+    }
+    Nodes[node].Calls++;
+    Stack.push_back(Frame{ node, returnSP });
+}
+
+void profile_6502::CallGraph::Unwind(Byte sp) {
+    // The root frame's ReturnSP is past the top of the stack, so it stays
+    while (Stack.back().ReturnSP <= sp)
+        Stack.pop_back();
+}
+
+std::string profile_6502::CallGraph::Name(Word addr, Byte entered) const {
+    static const char *prefix[] = { "", "[irq] ", "[nmi] ", "[brk] " };
+    if (Symbols)
+        return prefix[entered & 3] + Symbols->Format(addr);
+    char name[16];
+    snprintf(name, sizeof(name), "%s$%04X", prefix[entered & 3], addr);
+    return name;
+}
+
+std::string profile_6502::CallGraph::Path(uint32_t node) const {
+    std::vector<uint32_t> chain;
+    for (uint32_t n = node; n != 0; n = Nodes[n].Parent)
+        chain.push_back(n);
+    std::string path = Name(Nodes[0].Address);
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        path += ";" + Name(Nodes[*it].Address, Nodes[*it].Entered);
+    return path;
+}
+
+void profile_6502::CallGraph::WriteFolded(std::ostream &out) const {
+    for (uint32_t n = 0; n < Nodes.size(); n++)
+        if (Nodes[n].Self)
+            out << Path(n) << " " << Nodes[n].Self << "\n";
+}
+
+std::vector<profile_6502::CallGraph::Function> profile_6502::CallGraph::Functions() const {
+    // Children always come after their parent, so going backwards adds up
+    // each subtree before its root needs it
+    std::vector<uint64_t> subtree(Nodes.size());
+    for (size_t n = Nodes.size(); n-- > 0;) {
+        subtree[n] += Nodes[n].Self;
+        if (n)
+            subtree[Nodes[n].Parent] += subtree[n];
+    }
+
+    std::map<uint32_t, Function> functions;
+    for (uint32_t n = 0; n < Nodes.size(); n++) {
+        const Node &node = Nodes[n];
+        uint32_t key = uint32_t(node.Entered) << 16 | node.Address;
+        Function &f = functions[key];
+        f.Address = node.Address;
+        f.Entered = node.Entered;
+        f.Calls += node.Calls;
+        f.Exclusive += node.Self;
+
+        // Only the outermost call of a recursive routine counts towards
+        // inclusive, or its time would be counted once per level
+        bool nested = false;
+        for (uint32_t up = n; up != 0 && !nested;) {
+            up = Nodes[up].Parent;
+            nested = Nodes[up].Address == node.Address && Nodes[up].Entered == node.Entered;
+        }
+        if (!nested)
+            f.Inclusive += subtree[n];
+    }
+
+    std::vector<Function> out;
+    for (const auto &f : functions)
+        out.push_back(f.second);
+    std::sort(out.begin(), out.end(), [](const Function &a, const Function &b) { return a.Inclusive > b.Inclusive; });
+    return out;
+}
+
+void profile_6502::CallGraph::Report(std::ostream &out, unsigned int top) const {
+    std::vector<Function> functions = Functions();
+    uint64_t total = functions.empty() ? 0 : functions[0].Inclusive;
+    char line[160];
+    out << "\nSubroutines by inclusive cycles:\n"
+        << "       calls     inclusive   %incl     exclusive   %excl  name\n";
+    for (size_t i = 0; i < functions.size() && i < top; i++) {
+        const Function &f = functions[i];
+        snprintf(line, sizeof(line), "  %10llu  %12llu  %5.1f  %12llu  %5.1f  %s\n", (unsigned long long)f.Calls,
+                 (unsigned long long)f.Inclusive, Percent(f.Inclusive, total), (unsigned long long)f.Exclusive,
+                 Percent(f.Exclusive, total), Name(f.Address, f.Entered).c_str());
+        out << line;
+    }
+    if (Overflows)
+        out << Overflows << " calls too deep to follow\n";
+}
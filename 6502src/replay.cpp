@@ -0,0 +1,217 @@
+#include "replay.hpp"
+
+namespace {
+    // Big enough that recording a busy serial line is a write() every so
+    // often rather than per byte
+    const size_t STREAM_BUFFER = 1 << 16;
+}
+
+replay_6502::Journal::~Journal() {
+    Close();
+}
+
+bool replay_6502::Journal::Record(const std::string &path, uint64_t cycle) {
+    Close();
+    Out = fopen(path.c_str(), "wb");
+    if (!Out)
+        return false;
+    setvbuf(Out, NULL, _IOFBF, STREAM_BUFFER);
+    for (int i = 0; i < 4; i++)
+        fputc(MAGIC >> (8 * i), Out);
+    fputc(VERSION, Out);
+    fputc(VERSION >> 8, Out);
+    PutVarint(cycle);
+    LastCycle = cycle;
+    return true;
+}
+
+bool replay_6502::Journal::Replay(const std::string &path, uint64_t cycle, std::string *error) {
+    Close();
+    In = fopen(path.c_str(), "rb");
+    if (!In) {
+        if (error)
+            *error = "couldn't open journal";
+        return false;
+    }
+    setvbuf(In, NULL, _IOFBF, STREAM_BUFFER);
+
+    uint32_t magic = 0;
+    for (int i = 0; i < 4; i++)
+        magic |= uint32_t(fgetc(In) & 0xFF) << (8 * i);
+    uint16_t version = fgetc(In) & 0xFF;
+    version |= (fgetc(In) & 0xFF) << 8;
+    if (magic != MAGIC || version != VERSION || !GetVarint(LastCycle)) {
+        if (error)
+            *error = magic != MAGIC ? "not a journal" : "unsupported journal version";
+        Close();
+        return false;
+    }
+
+    // Starting from a checkpoint, so whatever came before it is already
+    // baked into the machine
+    ReadNext();
+    while (HaveNext && NextCycle < cycle)
+        ReadNext();
+    return true;
+}
+
+void replay_6502::Journal::Close() {
+    if (Out)
+        fclose(Out);
+    if (In)
+        fclose(In);
+    Out = In = nullptr;
+    HaveNext = false;
+}
+
+void replay_6502::Journal::Flush() {
+    if (Out)
+        fflush(Out);
+}
+
+void replay_6502::Journal::Input(uint64_t cycle, Byte channel, const Byte *data, size_t n) {
+    if (!Out || n == 0)
+        return;
+    PutVarint(cycle - LastCycle);
+    fputc(RECORD_INPUT, Out);
+    fputc(channel, Out);
+    PutVarint(n);
+    fwrite(data, 1, n, Out);
+    LastCycle = cycle;
+    Records++;
+    Bytes += n;
+}
+
+void replay_6502::Journal::Nmi(uint64_t cycle) {
+    if (!Out)
+        return;
+    PutVarint(cycle - LastCycle);
+    fputc(RECORD_NMI, Out);
+    LastCycle = cycle;
+    Records++;
+}
+
+size_t replay_6502::Journal::TakeInput(uint64_t cycle, Byte channel, Byte *out, size_t max) {
+    if (!Matches(cycle, RECORD_INPUT) || NextChannel != channel)
+        return 0;
+    size_t n = NextData.size() - NextUsed;
+    if (n > max)
+        n = max;
+    NextData.copy((char *)out, n, NextUsed);
+    NextUsed += n;
+    Bytes += n;
+    if (NextUsed == NextData.size())
+        ReadNext();
+    return n;
+}
+
+bool replay_6502::Journal::TakeNmi(uint64_t cycle) {
+    if (!Matches(cycle, RECORD_NMI))
+        return false;
+    ReadNext();
+    return true;
+}
+
+bool replay_6502::Journal::Matches(uint64_t cycle, Byte kind) {
+    if (!In || !HaveNext)
+        return false;
+    // A record nobody asked for on its cycle means the machine has gone a
+    // different way than when it was recorded
+    if (NextCycle < cycle && !Diverged) {
+        Diverged = true;
+        DivergedAt = NextCycle;
+    }
+    return NextCycle == cycle && NextKind == kind;
+}
+
+void replay_6502::Journal::PutVarint(uint64_t v) {
+    while (v >= 0x80) {
+        fputc(Byte(v) | 0x80, Out);
+        v >>= 7;
+    }
+    fputc(Byte(v), Out);
+}
+
+bool replay_6502::Journal::GetVarint(uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(In);
+        if (c == EOF)
+            return false;
+        v |= uint64_t(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+void replay_6502::Journal::ReadNext() {
+    HaveNext = false;
+    NextData.clear();
+    NextUsed = 0;
+
+    uint64_t delta;
+    if (!GetVarint(delta)) {
+        Ended = true;
+        return;
+    }
+    int kind = fgetc(In);
+    NextKind = kind;
+    if (kind == RECORD_INPUT) {
+        int channel = fgetc(In);
+        uint64_t n;
+        if (channel == EOF || !GetVarint(n) || n > STREAM_BUFFER) {
+            Ended = true;
+            return;
+        }
+        NextChannel = channel;
+        NextData.resize(n);
+        if (fread(&NextData[0], 1, n, In) != n) {
+            Ended = true;
+            return;
+        }
+    } else if (kind != RECORD_NMI) {
+        // Cut off mid record, or something we don't know how to skip
+        Ended = true;
+        return;
+    }
+    LastCycle += delta;
+    NextCycle = LastCycle;
+    HaveNext = true;
+    Records++;
+}
+
+bool replay_6502::Journal::Finish(uint64_t cycle) {
+    if (In && !Diverged && HaveNext && NextCycle < cycle) {
+        Diverged = true;
+        DivergedAt = NextCycle;
+    }
+    return !Diverged;
+}
+
+replay_6502::NmiButton::NmiButton(cpu_6502::CPU &cpu, events_6502::Scheduler &events, replay_6502::Journal &journal)
+    : Cpu(cpu), Events(events), Journal(journal) {
+}
+
+replay_6502::NmiButton::~NmiButton() {
+    if (PollEvent)
+        Events.Cancel(PollEvent);
+}
+
+void replay_6502::NmiButton::Start() {
+    if (PollEvent)
+        Events.Cancel(PollEvent);
+    PollEvent = Events.Schedule(Cpu.Cycles / PollCycles * PollCycles, [this](uint64_t when) { Poll(when); });
+}
+
+void replay_6502::NmiButton::Poll(uint64_t when) {
+    // Stamped with the cycle it's looked at, like serial input
+    bool pressed = Journal.Replaying() ? Journal.TakeNmi(Cpu.Cycles) : Pressed != 0;
+    if (pressed) {
+        Pressed = 0;
+        Presses++;
+        Journal.Nmi(Cpu.Cycles);
+        Cpu.TriggerNMI();
+    }
+    PollEvent = Events.Schedule(when + PollCycles, [this](uint64_t when) { Poll(when); });
+}
@@ -0,0 +1,232 @@
+#include "rewind.hpp"
+
+#include <cstring>
+
+rewind_6502::Rewinder::Rewinder(cpu_6502::CPU &cpu, mem_28c256::Mem &mem, events_6502::Scheduler &events,
+                                const state_6502::Devices &devices)
+    : Cpu(cpu), Mem(mem), Events(events), Devices(devices) {
+}
+
+void rewind_6502::Rewinder::Tick() {
+    if (Ring.empty() || Cpu.Cycles >= Ring.back().Cpu.Cycles + Interval)
+        Take();
+}
+
+void rewind_6502::Rewinder::Take() {
+    Ring.push_back(Snapshot());
+    Snapshot &snap = Ring.back();
+    snap.Cpu = Cpu;
+    snap.Events = Events.Queue;
+    for (const auto &dev : Devices) {
+        state_6502::Packer p;
+        dev.second->SaveState(p);
+        snap.Devices.push_back(p.Data);
+        snap.Bytes += p.Data.size();
+    }
+
+    if (Ring.size() == 1)
+        Newest.assign(Mem.Data, Mem.Data + MAX_MEM);
+    else {
+        // Most of a page that changed is usually still the same, so the XOR
+        // is mostly zeros and packs down to a few bytes
+        state_6502::Packer delta;
+        for (unsigned int page = 0; page < NUM_PAGES; page++) {
+            if (!Mem.ChangedSince(page, Mark))
+                continue;
+            Byte *was = &Newest[page * PAGE_SIZE];
+            const Byte *now = &Mem.Data[page * PAGE_SIZE];
+            Byte x[PAGE_SIZE];
+            Byte any = 0;
+            for (unsigned int i = 0; i < PAGE_SIZE; i++)
+                any |= x[i] = was[i] ^ now[i];
+            if (!any)
+                continue;
+            Byte packed[PAGE_SIZE];
+            unsigned int size = state_6502::CompressPage(x, packed);
+            delta.U8(page);
+            delta.U16(size);
+            delta.Bytes(size < PAGE_SIZE ? packed : x, size);
+            memcpy(was, now, PAGE_SIZE);
+        }
+        snap.Delta.swap(delta.Data);
+    }
+    Mark = Mem.NextGeneration();
+
+    snap.Bytes += sizeof(Snapshot) + snap.Delta.size() + snap.Events.size() * sizeof(events_6502::Scheduler::Event);
+    Bytes += snap.Bytes;
+    Taken++;
+    Evict();
+}
+
+void rewind_6502::Rewinder::Evict() {
+    while (Bytes > MaxBytes && Ring.size() > 1) {
+        Bytes -= Ring.front().Bytes;
+        Ring.pop_front();
+        Dropped++;
+
+        // Nothing goes back past the oldest, so its delta is dead weight
+        Snapshot &oldest = Ring.front();
+        Bytes -= oldest.Delta.size();
+        oldest.Bytes -= oldest.Delta.size();
+        std::string().swap(oldest.Delta);
+    }
+}
+
+void rewind_6502::Rewinder::Rebuild(size_t index, std::vector<Byte> &image) const {
+    image = Newest;
+    for (size_t j = Ring.size() - 1; j > index; j--) {
+        state_6502::Unpacker in(Ring[j].Delta);
+        while (in.Left) {
+            unsigned int page = in.U8();
+            unsigned int size = in.U16();
+            Byte x[PAGE_SIZE];
+            if (size == PAGE_SIZE)
+                in.Take(x, PAGE_SIZE);
+            else {
+                state_6502::DecompressPage(in.P, size, x);
+                in.P += size;
+                in.Left -= size;
+            }
+            Byte *p = &image[page * PAGE_SIZE];
+            for (unsigned int i = 0; i < PAGE_SIZE; i++)
+                p[i] ^= x[i];
+        }
+    }
+}
+
+bool rewind_6502::Rewinder::Restore(size_t index, const std::vector<Byte> &image) {
+    const Snapshot &snap = Ring[index];
+    std::vector<std::pair<state_6502::Stateful *, state_6502::Unpacker>> chunks;
+    std::vector<const state_6502::Stateful *> owners;
+    for (size_t i = 0; i < Devices.size(); i++) {
+        chunks.push_back(std::make_pair(Devices[i].second, state_6502::Unpacker(snap.Devices[i])));
+        owners.push_back(Devices[i].second);
+    }
+    if (!state_6502::LoadDevices(chunks))
+        return false;
+    // Devices have just put their own events back, the rest come from the
+    // snapshot. Ids only go up, so restored events keep their order among
+    // themselves and anything scheduled from here on still comes after them.
+    Events.Restore(snap.Events, owners);
+
+    // Only the registers, the hooks and counters belong to now
+    Cpu.PC = snap.Cpu.PC;
+    Cpu.SP = snap.Cpu.SP;
+    Cpu.A = snap.Cpu.A;
+    Cpu.X = snap.Cpu.X;
+    Cpu.Y = snap.Cpu.Y;
+    Cpu.PSF = snap.Cpu.PSF;
+    Cpu.Cycles = snap.Cpu.Cycles;
+    Cpu.Waiting = snap.Cpu.Waiting;
+    Cpu.Stopped = snap.Cpu.Stopped;
+    Cpu.StoppedAt = snap.Cpu.StoppedAt;
+    Cpu.IRQLines = snap.Cpu.IRQLines;
+    Cpu.NMIPending = snap.Cpu.NMIPending;
+
+    for (unsigned int page = 0; page < NUM_PAGES; page++) {
+        unsigned int base = page * PAGE_SIZE;
+        if (memcmp(&Mem.Data[base], &image[base], PAGE_SIZE) != 0) {
+            memcpy(&Mem.Data[base], &image[base], PAGE_SIZE);
+            Mem.Touch(base, base + PAGE_SIZE - 1);
+        }
+    }
+    Restores++;
+    return true;
+}
+
+void rewind_6502::Rewinder::Truncate(size_t index, const std::vector<Byte> &image) {
+    // Running forward from here needn't go the same way as last time (the
+    // debugger can poke things), so what came after is no good any more
+    while (Ring.size() > index + 1) {
+        Bytes -= Ring.back().Bytes;
+        Ring.pop_back();
+    }
+    if (&image != &Newest)
+        Newest = image;
+    Mark = Mem.NextGeneration();
+}
+
+long rewind_6502::Rewinder::Find(uint64_t cycle) const {
+    for (size_t i = Ring.size(); i-- > 0; ) {
+        if (Ring[i].Cpu.Cycles <= cycle)
+            return i;
+    }
+    return -1;
+}
+
+bool rewind_6502::Rewinder::SeekTo(uint64_t cycle) {
+    if (cycle == Cpu.Cycles)
+        return true;
+    long k = Find(cycle);
+    if (k < 0)
+        return false;
+
+    std::vector<Byte> image;
+    Rebuild(k, image);
+    if (!Restore(k, image))
+        return false;
+    Truncate(k, image);
+
+    // Instructions don't say how long they are until they've run, so count
+    // how many fit and if the last one went past, do it again one short
+    uint64_t steps = 0;
+    while (Cpu.Cycles < cycle) {
+        Cpu.Execute(1, Mem);
+        if (Cpu.Cycles > cycle)
+            break;
+        steps++;
+    }
+    StepsRun += steps;
+    if (Cpu.Cycles == cycle)
+        return true;
+
+    if (!Restore(k, Newest))
+        return false;
+    Truncate(k, Newest);
+    for (uint64_t i = 0; i < steps; i++)
+        Cpu.Execute(1, Mem);
+    StepsRun += steps;
+    return true;
+}
+
+bool rewind_6502::Rewinder::StepBack() {
+    return Cpu.Cycles > 0 && SeekTo(Cpu.Cycles - 1);
+}
+
+bool rewind_6502::Rewinder::ReverseContinue(const std::function<bool()> &stop) {
+    const uint64_t from = Cpu.Cycles;
+    if (from == 0)
+        return false;
+
+    std::vector<Byte> image;
+    uint64_t limit = from;
+    for (long k = Find(from - 1); k >= 0; k--) {
+        Rebuild(k, image);
+        if (!Restore(k, image))
+            break;
+        long found = -1;
+        uint64_t steps = 0;
+        while (Cpu.Cycles < limit) {
+            if (stop())
+                found = steps;
+            Cpu.Execute(1, Mem);
+            steps++;
+        }
+        StepsRun += steps;
+        if (found >= 0) {
+            if (!Restore(k, image))
+                break;
+            Truncate(k, image);
+            for (long i = 0; i < found; i++)
+                Cpu.Execute(1, Mem);
+            StepsRun += found;
+            return true;
+        }
+        limit = Ring[k].Cpu.Cycles;
+    }
+
+    // Never happened as far back as the ring goes, so back to where we were
+    if (from != Cpu.Cycles)
+        SeekTo(from);
+    return false;
+}
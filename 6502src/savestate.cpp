@@ -0,0 +1,318 @@
+#include "savestate.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    using namespace state_6502;
+
+    const Byte ZERO_PAGE[PAGE_SIZE] = {};
+
+    // CPU chunk flags byte
+    const Byte CPU_WAITING = 0x01;
+    const Byte CPU_STOPPED = 0x02;
+    const Byte CPU_NMI_PENDING = 0x04;
+
+    // LZ tokens: 0x00-0x7F is a run of token+1 literal bytes, 0x80-0xFF is a
+    // match of (token & 0x7F) + MIN_MATCH bytes starting the next byte's
+    // worth of bytes back
+    const unsigned int MIN_MATCH = 3;
+    const unsigned int MAX_MATCH = 0x7F + MIN_MATCH;
+    const unsigned int MAX_LITERALS = 0x80;
+
+    struct CrcTable {
+        uint32_t Entries[256];
+        CrcTable() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                Entries[i] = c;
+            }
+        }
+    };
+    const CrcTable CRC_TABLE;
+
+    void Chunk(Packer &file, uint32_t tag, const std::string &payload) {
+        file.U32(tag);
+        file.U32(payload.size());
+        file.Bytes(payload.data(), payload.size());
+        file.U32(Crc32(payload.data(), payload.size()));
+    }
+
+    bool Fail(std::string *error, const char *why) {
+        if (error)
+            *error = why;
+        return false;
+    }
+}
+
+uint32_t state_6502::Crc32(const void *data, size_t size, uint32_t crc) {
+    const Byte *p = (const Byte *)data;
+    crc = ~crc;
+    while (size--)
+        crc = CRC_TABLE.Entries[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+unsigned int state_6502::CompressPage(const Byte *page, Byte *out) {
+    // Last position each 3 byte prefix was seen at. A page is small enough
+    // that a tiny table catches nearly everything worth catching.
+    int16_t last[256];
+    memset(last, 0xFF, sizeof(last));
+
+    unsigned int in = 0, o = 0, literals = 0;
+    auto flush = [&](unsigned int end) {
+        while (literals < end) {
+            unsigned int n = end - literals < MAX_LITERALS ? end - literals : MAX_LITERALS;
+            if (o + 1 + n >= PAGE_SIZE)
+                return false;
+            out[o++] = n - 1;
+            memcpy(out + o, page + literals, n);
+            o += n;
+            literals += n;
+        }
+        return true;
+    };
+
+    while (in + MIN_MATCH <= PAGE_SIZE) {
+        unsigned int h = ((page[in] | page[in + 1] << 8 | page[in + 2] << 16) * 2654435761u) >> 24;
+        int candidate = last[h];
+        last[h] = in;
+        if (candidate < 0 || memcmp(page + candidate, page + in, MIN_MATCH) != 0) {
+            in++;
+            continue;
+        }
+
+        // Matches may overlap where they're copied to, which is how runs of
+        // the same byte come out as one token
+        unsigned int len = MIN_MATCH;
+        while (in + len < PAGE_SIZE && len < MAX_MATCH && page[candidate + len] == page[in + len])
+            len++;
+        if (!flush(in) || o + 2 >= PAGE_SIZE)
+            return PAGE_SIZE;
+        out[o++] = 0x80 | (len - MIN_MATCH);
+        out[o++] = in - candidate;
+        in += len;
+        literals = in;
+    }
+    if (!flush(PAGE_SIZE))
+        return PAGE_SIZE;
+    return o;
+}
+
+bool state_6502::DecompressPage(const Byte *in, unsigned int size, Byte *page) {
+    unsigned int i = 0, o = 0;
+    while (i < size) {
+        Byte token = in[i++];
+        if (token < 0x80) {
+            unsigned int n = token + 1;
+            if (i + n > size || o + n > PAGE_SIZE)
+                return false;
+            memcpy(page + o, in + i, n);
+            i += n;
+            o += n;
+        } else {
+            if (i >= size)
+                return false;
+            unsigned int n = (token & 0x7F) + MIN_MATCH;
+            unsigned int offset = in[i++];
+            if (offset == 0 || offset > o || o + n > PAGE_SIZE)
+                return false;
+            for (unsigned int k = 0; k < n; k++, o++)
+                page[o] = page[o - offset];
+        }
+    }
+    return o == PAGE_SIZE;
+}
+
+void state_6502::PackPage(unsigned int index, const Byte *page, std::string &out) {
+    if (memcmp(page, ZERO_PAGE, PAGE_SIZE) == 0)
+        return;
+    Byte packed[PAGE_SIZE];
+    unsigned int size = CompressPage(page, packed);
+    Packer p;
+    p.U8(index);
+    p.U8(size < PAGE_SIZE ? PAGE_LZ : PAGE_RAW);
+    p.U16(size);
+    p.Bytes(size < PAGE_SIZE ? packed : page, size);
+    out += p.Data;
+}
+
+std::string state_6502::Save(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem, const Devices &devices) {
+    Packer file;
+    file.U32(MAGIC);
+    file.U16(VERSION);
+
+    Packer regs;
+    regs.U16(cpu.PC);
+    regs.U8(cpu.SP);
+    regs.U8(cpu.A);
+    regs.U8(cpu.X);
+    regs.U8(cpu.Y);
+    regs.U8(cpu.PSF);
+    regs.U64(cpu.Cycles);
+    regs.U8((cpu.Waiting ? CPU_WAITING : 0) | (cpu.Stopped ? CPU_STOPPED : 0) | (cpu.NMIPending ? CPU_NMI_PENDING : 0));
+    regs.U8(cpu.IRQLines);
+    regs.U64(cpu.StoppedAt);
+    Chunk(file, CHUNK_CPU, regs.Data);
+
+    std::string pages;
+    for (unsigned int page = 0; page < NUM_PAGES; page++)
+        PackPage(page, &mem.Data[page * PAGE_SIZE], pages);
+    Chunk(file, CHUNK_MEM, pages);
+
+    for (const auto &dev : devices) {
+        Packer p;
+        p.U8(dev.first.size());
+        p.Bytes(dev.first.data(), dev.first.size());
+        dev.second->SaveState(p);
+        Chunk(file, CHUNK_DEV, p.Data);
+    }
+
+    Chunk(file, CHUNK_END, std::string());
+    return file.Data;
+}
+
+bool state_6502::Load(const std::string &data, cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+                      const Devices &devices, std::string *error) {
+    Unpacker file(data);
+    if (file.U32() != MAGIC)
+        return Fail(error, "not a save state");
+    if (file.U16() != VERSION)
+        return Fail(error, "unsupported save state version");
+
+    // Everything gets decoded into these first and only copied over once
+    // the whole file has checked out
+    cpu_6502::CPU regs = cpu;
+    std::vector<Byte> memory(MAX_MEM, 0);
+    std::vector<std::pair<Stateful *, Unpacker>> deviceChunks;
+    bool haveCpu = false, haveMem = false;
+
+    for (;;) {
+        uint32_t tag = file.U32();
+        uint32_t size = file.U32();
+        if (file.Bad || size + 4ull > file.Left)
+            return Fail(error, "truncated save state");
+        const Byte *payload = file.P;
+        file.P += size;
+        file.Left -= size;
+        if (file.U32() != Crc32(payload, size))
+            return Fail(error, "save state checksum mismatch");
+
+        Unpacker chunk(payload, size);
+        if (tag == CHUNK_END)
+            break;
+        if (tag == CHUNK_CPU) {
+            regs.PC = chunk.U16();
+            regs.SP = chunk.U8();
+            regs.A = chunk.U8();
+            regs.X = chunk.U8();
+            regs.Y = chunk.U8();
+            regs.PSF = chunk.U8();
+            regs.Cycles = chunk.U64();
+            Byte flags = chunk.U8();
+            regs.Waiting = flags & CPU_WAITING;
+            regs.Stopped = flags & CPU_STOPPED;
+            regs.NMIPending = flags & CPU_NMI_PENDING;
+            regs.IRQLines = chunk.U8();
+            regs.StoppedAt = chunk.U64();
+            if (chunk.Bad)
+                return Fail(error, "bad CPU chunk");
+            haveCpu = true;
+        } else if (tag == CHUNK_MEM) {
+            while (chunk.Left && !chunk.Bad) {
+                unsigned int page = chunk.U8();
+                Byte encoding = chunk.U8();
+                unsigned int n = chunk.U16();
+                if (chunk.Bad || n > chunk.Left)
+                    return Fail(error, "bad MEM chunk");
+                Byte *to = &memory[page * PAGE_SIZE];
+                if (encoding == PAGE_RAW && n == PAGE_SIZE)
+                    memcpy(to, chunk.P, PAGE_SIZE);
+                else if (encoding != PAGE_LZ || !DecompressPage(chunk.P, n, to))
+                    return Fail(error, "bad page in MEM chunk");
+                chunk.P += n;
+                chunk.Left -= n;
+            }
+            haveMem = true;
+        } else if (tag == CHUNK_DEV) {
+            std::string name(chunk.U8(), '\0');
+            chunk.Take(&name[0], name.size());
+            for (const auto &dev : devices)
+                if (dev.first == name)
+                    deviceChunks.push_back(std::make_pair(dev.second, chunk));
+        }
+        // Anything else is from a newer writer and we don't need it
+    }
+    if (!haveCpu || !haveMem)
+        return Fail(error, "save state is missing CPU or memory");
+
+    if (!LoadDevices(deviceChunks))
+        return Fail(error, "bad device state");
+
+    cpu.PC = regs.PC;
+    cpu.SP = regs.SP;
+    cpu.A = regs.A;
+    cpu.X = regs.X;
+    cpu.Y = regs.Y;
+    cpu.PSF = regs.PSF;
+    cpu.Cycles = regs.Cycles;
+    cpu.Waiting = regs.Waiting;
+    cpu.Stopped = regs.Stopped;
+    cpu.NMIPending = regs.NMIPending;
+    cpu.IRQLines = regs.IRQLines;
+    cpu.StoppedAt = regs.StoppedAt;
+    memcpy(mem.Data, memory.data(), MAX_MEM);
+    mem.Touch(0, MAX_MEM - 1);
+    return true;
+}
+
+bool state_6502::LoadDevices(std::vector<std::pair<Stateful *, Unpacker>> &chunks) {
+    std::vector<std::string> before;
+    for (const auto &chunk : chunks) {
+        Packer p;
+        chunk.first->SaveState(p);
+        before.push_back(p.Data);
+    }
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i].first->LoadState(chunks[i].second) && !chunks[i].second.Bad)
+            continue;
+        // Newest first, so a device that appears twice ends up as it started
+        for (size_t j = i + 1; j-- > 0; ) {
+            Unpacker in(before[j]);
+            chunks[j].first->LoadState(in);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool state_6502::SaveFile(const std::string &path, const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem,
+                          const Devices &devices) {
+    // Write then rename, so a crash halfway through never leaves a broken
+    // file where a good one used to be
+    std::string data = Save(cpu, mem, devices);
+    std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool state_6502::LoadFile(const std::string &path, cpu_6502::CPU &cpu, mem_28c256::Mem &mem,
+                          const Devices &devices, std::string *error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return Fail(error, "couldn't open save state");
+    std::stringstream data;
+    data << file.rdbuf();
+    return Load(data.str(), cpu, mem, devices, error);
+}
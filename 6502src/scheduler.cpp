@@ -0,0 +1,65 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+
+namespace {
+    // std::push_heap builds a max-heap, so "less" here means "fires later"
+    bool FiresLater(const events_6502::Scheduler::Event &a, const events_6502::Scheduler::Event &b) {
+        if (a.When != b.When)
+            return a.When > b.When;
+        return a.Id > b.Id;
+    }
+}
+
+unsigned int events_6502::Scheduler::Schedule(uint64_t when, events_6502::Callback fn, const state_6502::Stateful *owner) {
+    Event ev;
+    ev.When = when;
+    ev.Id = NextId++;
+    ev.Fn = fn;
+    ev.Owner = owner;
+    Queue.push_back(ev);
+    std::push_heap(Queue.begin(), Queue.end(), FiresLater);
+    return ev.Id;
+}
+
+void events_6502::Scheduler::Cancel(unsigned int id) {
+    // The queue only ever holds a handful of device timers, so a linear scan
+    // and re-heap is cheaper than keeping tombstones around.
+    for (size_t i = 0; i < Queue.size(); i++) {
+        if (Queue[i].Id == id) {
+            Queue.erase(Queue.begin() + i);
+            std::make_heap(Queue.begin(), Queue.end(), FiresLater);
+            return;
+        }
+    }
+}
+
+void events_6502::Scheduler::RunUntil(uint64_t now) {
+    while (!Queue.empty() && Queue.front().When <= now) {
+        std::pop_heap(Queue.begin(), Queue.end(), FiresLater);
+        Event ev = Queue.back();
+        Queue.pop_back();
+        // Callback may well schedule its own follow-up, so it runs after the
+        // event has been taken off the queue.
+        ev.Fn(ev.When);
+    }
+}
+
+void events_6502::Scheduler::Clear() {
+    Queue.clear();
+}
+
+void events_6502::Scheduler::Restore(const std::vector<Event> &saved, const std::vector<const state_6502::Stateful *> &owners) {
+    auto owned = [&owners](const Event &ev) {
+        return ev.Owner && std::find(owners.begin(), owners.end(), ev.Owner) != owners.end();
+    };
+    std::vector<Event> queue;
+    for (const Event &ev : saved)
+        if (!owned(ev))
+            queue.push_back(ev);
+    for (const Event &ev : Queue)
+        if (owned(ev))
+            queue.push_back(ev);
+    Queue.swap(queue);
+    std::make_heap(Queue.begin(), Queue.end(), FiresLater);
+}
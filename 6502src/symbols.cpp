@@ -0,0 +1,131 @@
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+    // Pulls `key=value` out of an ld65 debug file line. Values can be quoted.
+    bool Field(const char *line, const char *key, std::string &value) {
+        size_t len = strlen(key);
+        for (const char *p = line; (p = strstr(p, key)); p += len) {
+            if ((p != line && p[-1] != ',' && p[-1] != '\t' && p[-1] != ' ') || p[len] != '=')
+                continue;
+            p += len + 1;
+            const char *end;
+            if (*p == '"') {
+                end = strchr(++p, '"');
+                if (!end)
+                    return false;
+            } else
+                end = p + strcspn(p, ",\r\n");
+            value.assign(p, end);
+            return true;
+        }
+        return false;
+    }
+
+    bool Local(const char *name) {
+        return name[0] == '@' || name[0] == '_';
+    }
+}
+
+int symbols_6502::Table::Load(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+        return -1;
+
+    int count = 0;
+    char line[1024], name[256];
+    unsigned int addr, size;
+    bool vasmSymbols = false;
+    while (fgets(line, sizeof(line), f)) {
+        size = 0;
+        bool found = false;
+        if (strncmp(line, "al ", 3) == 0) {
+            found = sscanf(line, "al C:%x .%255s", &addr, name) == 2 ||
+                    sscanf(line, "al %x .%255s", &addr, name) == 2;
+        } else if (strncmp(line, "sym\t", 4) == 0) {
+            std::string symName, val, type, sz;
+            if (Field(line, "name", symName) && Field(line, "val", val) && Field(line, "type", type) &&
+                type == "lab" && symName.size() < sizeof(name)) {
+                strcpy(name, symName.c_str());
+                addr = strtoul(val.c_str(), NULL, 0);
+                if (Field(line, "size", sz))
+                    size = strtoul(sz.c_str(), NULL, 0);
+                found = true;
+            }
+        } else if (strncmp(line, "Symbols by ", 11) == 0) {
+            vasmSymbols = strncmp(line + 11, "name", 4) == 0;
+        } else if (vasmSymbols) {
+            found = sscanf(line, "%255s A:%x", name, &addr) == 2;
+        } else {
+            found = sscanf(line, "%255[A-Za-z0-9_.@] = $%x", name, &addr) == 2;
+        }
+        if (!found || addr > 0xFFFF || size > 0xFFFF)
+            continue;
+        Add(Word(addr), name, Word(size));
+        count++;
+    }
+    fclose(f);
+    Build();
+    return count;
+}
+
+void symbols_6502::Table::Add(Word addr, const std::string &name, Word size) {
+    Symbols.push_back(Symbol{ addr, size, uint32_t(Names.size()) });
+    Names.append(name);
+    Names += '\0';
+}
+
+void symbols_6502::Table::Build() {
+    std::stable_sort(Symbols.begin(), Symbols.end(),
+                     [](const Symbol &a, const Symbol &b) { return a.Address < b.Address; });
+
+    // One name per address: one with a size if there is one, then anything
+    // that doesn't look like a local label, then whichever came first
+    std::vector<Symbol> kept;
+    for (const Symbol &s : Symbols) {
+        if (kept.empty() || kept.back().Address != s.Address) {
+            kept.push_back(s);
+            continue;
+        }
+        Symbol &best = kept.back();
+        if ((!best.Size && s.Size) || (best.Size == s.Size && Local(NameOf(best)) && !Local(NameOf(s))))
+            best = s;
+    }
+    Symbols.swap(kept);
+
+    Starts.resize(Symbols.size());
+    for (size_t i = 0; i < Symbols.size(); i++)
+        Starts[i] = Symbols[i].Address;
+}
+
+const symbols_6502::Symbol *symbols_6502::Table::Find(Word addr) const {
+    auto it = std::upper_bound(Starts.begin(), Starts.end(), addr);
+    if (it == Starts.begin())
+        return nullptr;
+    const Symbol &s = Symbols[it - Starts.begin() - 1];
+    if (s.Size && addr - s.Address >= s.Size)
+        return nullptr;
+    return &s;
+}
+
+const symbols_6502::Symbol *symbols_6502::Table::Exact(Word addr) const {
+    auto it = std::lower_bound(Starts.begin(), Starts.end(), addr);
+    if (it == Starts.end() || *it != addr)
+        return nullptr;
+    return &Symbols[it - Starts.begin()];
+}
+
+std::string symbols_6502::Table::Format(Word addr) const {
+    char text[300];
+    const Symbol *s = Find(addr);
+    if (!s)
+        snprintf(text, sizeof(text), "$%04X", addr);
+    else if (s->Address == addr)
+        return NameOf(*s);
+    else
+        snprintf(text, sizeof(text), "%s+%u", NameOf(*s), unsigned(addr - s->Address));
+    return text;
+}
@@ -0,0 +1,181 @@
+#include "telemetry.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+
+namespace {
+    const uint64_t NS_PER_SEC = 1000000000ull;
+
+    uint64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * NS_PER_SEC + ts.tv_nsec;
+    }
+
+    uint64_t Get(const std::atomic<uint64_t> &counter) {
+        return counter.load(std::memory_order_relaxed);
+    }
+}
+
+void telemetry_6502::Counters::Begin(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem) {
+    StartInstructions = cpu.Instructions;
+    StartCycles = cpu.Cycles;
+    StartInterrupts = cpu.Interrupts;
+    StartDeviceReads = mem.DeviceReads;
+    StartDeviceWrites = mem.DeviceWrites;
+    StartNs = NowNs();
+}
+
+void telemetry_6502::Counters::End(const cpu_6502::CPU &cpu, const mem_28c256::Mem &mem) {
+    Add(Instructions, cpu.Instructions - StartInstructions);
+    Add(Cycles, cpu.Cycles - StartCycles);
+    Add(Interrupts, cpu.Interrupts - StartInterrupts);
+    Add(DeviceReads, mem.DeviceReads - StartDeviceReads);
+    Add(DeviceWrites, mem.DeviceWrites - StartDeviceWrites);
+    Add(BusyNs, NowNs() - StartNs);
+}
+
+telemetry_6502::Exporter::Exporter(const std::string &path, double interval)
+    : Path(path), Interval(interval), LastNs(NowNs()) {}
+
+telemetry_6502::Exporter::~Exporter() {
+    Stop();
+}
+
+telemetry_6502::Counters &telemetry_6502::Exporter::Thread() {
+    std::lock_guard<std::mutex> hold(Lock);
+    Threads.emplace_back();
+    return Threads.back();
+}
+
+void telemetry_6502::Exporter::Start() {
+    Writer = std::thread([this] {
+        std::unique_lock<std::mutex> hold(QuitLock);
+        auto every = std::chrono::duration<double>(Interval);
+        while (!Wake.wait_for(hold, every, [this] { return Quit; })) {
+            hold.unlock();
+            WriteFile();
+            hold.lock();
+        }
+    });
+}
+
+void telemetry_6502::Exporter::Stop() {
+    if (!Writer.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> hold(QuitLock);
+        Quit = true;
+    }
+    Wake.notify_all();
+    Writer.join();
+    // The last word, so a finished run's file has its final numbers
+    WriteFile();
+}
+
+telemetry_6502::Totals telemetry_6502::Exporter::Sum() {
+    Totals t;
+    std::lock_guard<std::mutex> hold(Lock);
+    for (const Counters &c : Threads) {
+        t.Instructions += Get(c.Instructions);
+        t.Cycles += Get(c.Cycles);
+        t.Interrupts += Get(c.Interrupts);
+        t.DeviceReads += Get(c.DeviceReads);
+        t.DeviceWrites += Get(c.DeviceWrites);
+        t.BusyNs += Get(c.BusyNs);
+        t.Snapshots += Get(c.Snapshots);
+        t.SnapshotNs += Get(c.SnapshotNs);
+        t.Checkpoints += Get(c.Checkpoints);
+        t.CheckpointNs += Get(c.CheckpointNs);
+        t.JobsDone += Get(c.JobsDone);
+        t.JobsTimedOut += Get(c.JobsTimedOut);
+    }
+    return t;
+}
+
+void telemetry_6502::Exporter::Write(std::ostream &out) {
+    Totals t = Sum();
+    size_t threads;
+    double mhz, jobsPerSecond;
+    {
+        // Rates since the last write, or since we started for the first
+        std::lock_guard<std::mutex> hold(Lock);
+        uint64_t now = NowNs();
+        double seconds = double(now - LastNs) / NS_PER_SEC;
+        uint64_t jobs = t.JobsDone + t.JobsTimedOut;
+        mhz = seconds > 0 ? (t.Cycles - LastCycles) / seconds / 1e6 : 0.0;
+        jobsPerSecond = seconds > 0 ? (jobs - LastJobs) / seconds : 0.0;
+        LastNs = now;
+        LastCycles = t.Cycles;
+        LastJobs = jobs;
+        threads = Threads.size();
+    }
+
+    auto series = [this](const char *name, const char *extra) {
+        std::string labels = Labels;
+        if (*extra)
+            labels += (labels.empty() ? "" : ",") + std::string(extra);
+        return labels.empty() ? std::string(name) : std::string(name) + "{" + labels + "}";
+    };
+    auto header = [&out](const char *name, const char *type, const char *help) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    };
+    char value[64];
+    auto integer = [&](const char *name, const char *extra, uint64_t n) {
+        snprintf(value, sizeof(value), " %llu\n", (unsigned long long)n);
+        out << series(name, extra) << value;
+    };
+    auto real = [&](const char *name, const char *extra, double x) {
+        snprintf(value, sizeof(value), " %.9g\n", x);
+        out << series(name, extra) << value;
+    };
+
+    header("emu6502_instructions_total", "counter", "Emulated instructions retired.");
+    integer("emu6502_instructions_total", "", t.Instructions);
+    header("emu6502_cycles_total", "counter", "Emulated CPU cycles run.");
+    integer("emu6502_cycles_total", "", t.Cycles);
+    header("emu6502_interrupts_total", "counter", "IRQs and NMIs taken.");
+    integer("emu6502_interrupts_total", "", t.Interrupts);
+    header("emu6502_device_accesses_total", "counter", "CPU reads and writes that went to a device.");
+    integer("emu6502_device_accesses_total", "access=\"read\"", t.DeviceReads);
+    integer("emu6502_device_accesses_total", "access=\"write\"", t.DeviceWrites);
+    header("emu6502_busy_seconds_total", "counter", "Host time spent emulating, summed over threads.");
+    real("emu6502_busy_seconds_total", "", double(t.BusyNs) / NS_PER_SEC);
+    header("emu6502_achieved_mhz", "gauge", "Emulated clock rate since the previous write.");
+    real("emu6502_achieved_mhz", "", mhz);
+    header("emu6502_snapshot_seconds", "summary", "Time the emulator stopped for to take a checkpoint.");
+    real("emu6502_snapshot_seconds_sum", "", double(t.SnapshotNs) / NS_PER_SEC);
+    integer("emu6502_snapshot_seconds_count", "", t.Snapshots);
+    header("emu6502_checkpoint_write_seconds", "summary", "Time spent writing checkpoint files in the background.");
+    real("emu6502_checkpoint_write_seconds_sum", "", double(t.CheckpointNs) / NS_PER_SEC);
+    integer("emu6502_checkpoint_write_seconds_count", "", t.Checkpoints);
+    header("emu6502_jobs_total", "counter", "Batch jobs finished.");
+    integer("emu6502_jobs_total", "result=\"ok\"", t.JobsDone);
+    integer("emu6502_jobs_total", "result=\"timeout\"", t.JobsTimedOut);
+    header("emu6502_jobs_per_second", "gauge", "Batch jobs finished per second since the previous write.");
+    real("emu6502_jobs_per_second", "", jobsPerSecond);
+    header("emu6502_threads", "gauge", "Emulation threads reporting.");
+    integer("emu6502_threads", "", threads);
+}
+
+bool telemetry_6502::Exporter::WriteFile() {
+    // The textfile collector only reads *.prom, so the temporary file next
+    // to it is never picked up
+    std::string tmp = Path + ".tmp";
+    {
+        std::ofstream out(tmp);
+        Write(out);
+        out.flush();
+        if (!out) {
+            Failed++;
+            return false;
+        }
+    }
+    if (rename(tmp.c_str(), Path.c_str()) != 0) {
+        Failed++;
+        return false;
+    }
+    return true;
+}
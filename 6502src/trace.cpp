@@ -0,0 +1,611 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "savestate.hpp"
+
+namespace {
+    const size_t HEADER_SIZE = 10;          // MAGIC, VERSION, BLOCK_RECORDS
+    const size_t BLOCK_HEADER_SIZE = 40;    // BLOCK_MAGIC, then BlockInfo less Offset
+    const size_t INDEX_ENTRY_SIZE = 44;
+    const size_t FOOTER_SIZE = 20;
+
+    // Which fields of a record differ from the one before
+    const trace_6502::Byte CHANGED_A = 0x01;
+    const trace_6502::Byte CHANGED_X = 0x02;
+    const trace_6502::Byte CHANGED_Y = 0x04;
+    const trace_6502::Byte CHANGED_SP = 0x08;
+    const trace_6502::Byte CHANGED_P = 0x10;
+    const trace_6502::Byte CODE_SEEN = 0x20;    // Opcode and operands as last time at this PC
+    const trace_6502::Byte HAS_EA = 0x40;
+    const trace_6502::Byte NOT_INSTRUCTION = 0x80;
+
+    // Last opcode and operands seen at each PC, by the low bits of the PC.
+    // Code hardly ever changes under a running program, so most records
+    // don't need to carry theirs at all.
+    const unsigned int CODE_CACHE = 1024;
+    struct CodeCache {
+        uint64_t Key[CODE_CACHE];
+        CodeCache() { memset(Key, 0xFF, sizeof(Key)); }
+        static uint64_t KeyFor(const trace_6502::Record &r) {
+            return uint64_t(r.PC) << 24 | uint32_t(r.Opcode) << 16 | r.Operand[0] << 8 | r.Operand[1];
+        }
+        bool Seen(const trace_6502::Record &r) const { return Key[r.PC & (CODE_CACHE - 1)] == KeyFor(r); }
+        void Note(const trace_6502::Record &r) { Key[r.PC & (CODE_CACHE - 1)] = KeyFor(r); }
+    };
+
+    // LZ tokens: 0x00-0x7F is a run of that many plus one literals, 0x80-0xFF
+    // a match of (token & 0x7F) + MIN_MATCH bytes at a u16 distance back
+    const unsigned int MIN_MATCH = 4;
+    const unsigned int MAX_MATCH = 0x7F + MIN_MATCH;
+    const unsigned int MAX_LITERALS = 0x80;
+    const unsigned int MAX_DISTANCE = 0xFFFF;
+    const unsigned int HASH_BITS = 14;
+
+    // Worst case for one record: mask, cycle and PC deltas, code, EA,
+    // registers, kind
+    const size_t MAX_ENCODED = 1 + 10 + 3 + 3 + 3 + 5 + 1;
+
+    trace_6502::Byte *PutVarint(trace_6502::Byte *p, uint64_t v) {
+        while (v >= 0x80) {
+            *p++ = v | 0x80;
+            v >>= 7;
+        }
+        *p++ = v;
+        return p;
+    }
+
+    bool GetVarint(const trace_6502::Byte *&p, const trace_6502::Byte *end, uint64_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+            trace_6502::Byte c = *p++;
+            v |= uint64_t(c & 0x7F) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    // Signed 16 bit differences, small either way round
+    uint16_t ZigZag(uint16_t now, uint16_t before) {
+        int16_t d = int16_t(now - before);
+        return uint16_t(d << 1) ^ uint16_t(d >> 15);
+    }
+
+    uint16_t UnZigZag(uint64_t z, uint16_t before) {
+        int16_t d = int16_t((z >> 1) ^ -(z & 1));
+        return uint16_t(before + d);
+    }
+
+    // FNV-1a a word at a time, same as the state hash's pages
+    uint64_t Hash64(const std::string &data) {
+        uint64_t h = 0xCBF29CE484222325ull ^ data.size();
+        size_t i = 0;
+        for (; i + 8 <= data.size(); i += 8) {
+            uint64_t word;
+            memcpy(&word, &data[i], 8);
+            h = (h ^ word) * 0x100000001B3ull;
+        }
+        for (; i < data.size(); i++)
+            h = (h ^ (unsigned char)data[i]) * 0x100000001B3ull;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+void trace_6502::Encode(const Record *records, size_t n, std::string &out) {
+    // Straight into the string rather than appending a byte at a time,
+    // which is most of the cost at this size
+    size_t start = out.size();
+    out.resize(start + n * MAX_ENCODED);
+    Byte *p = (Byte *)&out[start];
+
+    Record prev = Record();
+    Word prevEA = 0;
+    CodeCache code;
+    for (size_t i = 0; i < n; i++) {
+        const Record &r = records[i];
+        Byte mask = 0;
+        if (r.A != prev.A) mask |= CHANGED_A;
+        if (r.X != prev.X) mask |= CHANGED_X;
+        if (r.Y != prev.Y) mask |= CHANGED_Y;
+        if (r.SP != prev.SP) mask |= CHANGED_SP;
+        if (r.P != prev.P) mask |= CHANGED_P;
+        if (code.Seen(r)) mask |= CODE_SEEN;
+        if (r.EA) mask |= HAS_EA;
+        if (r.Kind != KIND_INSTRUCTION) mask |= NOT_INSTRUCTION;
+
+        *p++ = mask;
+        p = PutVarint(p, r.Cycle - prev.Cycle);
+        p = PutVarint(p, ZigZag(r.PC, prev.PC));
+        if (!(mask & CODE_SEEN)) {
+            *p++ = r.Opcode;
+            *p++ = r.Operand[0];
+            *p++ = r.Operand[1];
+            code.Note(r);
+        }
+        if (mask & HAS_EA) {
+            p = PutVarint(p, ZigZag(r.EA, prevEA));
+            prevEA = r.EA;
+        }
+        if (mask & CHANGED_A) *p++ = r.A;
+        if (mask & CHANGED_X) *p++ = r.X;
+        if (mask & CHANGED_Y) *p++ = r.Y;
+        if (mask & CHANGED_SP) *p++ = r.SP;
+        if (mask & CHANGED_P) *p++ = r.P;
+        if (mask & NOT_INSTRUCTION) *p++ = r.Kind;
+        prev = r;
+    }
+    out.resize(p - (Byte *)&out[0]);
+}
+
+bool trace_6502::Decode(const Byte *data, size_t size, size_t n, std::vector<Record> &out) {
+    const Byte *p = data, *end = data + size;
+    Record prev = Record();
+    Word prevEA = 0;
+    CodeCache code;
+    // What each cache slot stands for, since the cache itself only has keys
+    Record cached[CODE_CACHE];
+    out.reserve(out.size() + n);
+    for (size_t i = 0; i < n; i++) {
+        if (p >= end)
+            return false;
+        Byte mask = *p++;
+        Record r = prev;
+        uint64_t v;
+        if (!GetVarint(p, end, v))
+            return false;
+        r.Cycle = prev.Cycle + v;
+        if (!GetVarint(p, end, v))
+            return false;
+        r.PC = UnZigZag(v, prev.PC);
+        if (mask & CODE_SEEN) {
+            const Record &c = cached[r.PC & (CODE_CACHE - 1)];
+            if (c.PC != r.PC || !code.Seen(c))
+                return false;
+            r.Opcode = c.Opcode;
+            r.Operand[0] = c.Operand[0];
+            r.Operand[1] = c.Operand[1];
+        } else {
+            if (end - p < 3)
+                return false;
+            r.Opcode = *p++;
+            r.Operand[0] = *p++;
+            r.Operand[1] = *p++;
+            code.Note(r);
+            cached[r.PC & (CODE_CACHE - 1)] = r;
+        }
+        r.EA = 0;
+        if (mask & HAS_EA) {
+            if (!GetVarint(p, end, v))
+                return false;
+            r.EA = prevEA = UnZigZag(v, prevEA);
+        }
+        unsigned int bytes = __builtin_popcount(mask & (CHANGED_A | CHANGED_X | CHANGED_Y | CHANGED_SP | CHANGED_P | NOT_INSTRUCTION));
+        if (size_t(end - p) < bytes)
+            return false;
+        if (mask & CHANGED_A) r.A = *p++;
+        if (mask & CHANGED_X) r.X = *p++;
+        if (mask & CHANGED_Y) r.Y = *p++;
+        if (mask & CHANGED_SP) r.SP = *p++;
+        if (mask & CHANGED_P) r.P = *p++;
+        r.Kind = (mask & NOT_INSTRUCTION) ? *p++ : KIND_INSTRUCTION;
+        memset(r.Pad, 0, sizeof(r.Pad));
+        out.push_back(r);
+        prev = r;
+    }
+    return p == end;
+}
+
+void trace_6502::Pack(const std::string &in, std::string &out) {
+    const Byte *src = (const Byte *)in.data();
+    const size_t size = in.size();
+    std::vector<int32_t> last(1 << HASH_BITS, -1);
+
+    size_t pos = 0, literals = 0;
+    auto flush = [&](size_t upto) {
+        while (literals < upto) {
+            size_t n = std::min<size_t>(upto - literals, MAX_LITERALS);
+            out += char(n - 1);
+            out.append((const char *)src + literals, n);
+            literals += n;
+        }
+    };
+
+    while (pos + MIN_MATCH <= size) {
+        uint32_t word;
+        memcpy(&word, src + pos, 4);
+        uint32_t h = (word * 2654435761u) >> (32 - HASH_BITS);
+        int32_t candidate = last[h];
+        last[h] = pos;
+        if (candidate < 0 || pos - candidate > MAX_DISTANCE || memcmp(src + candidate, src + pos, MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+
+        size_t len = MIN_MATCH;
+        while (len < MAX_MATCH && pos + len < size && src[candidate + len] == src[pos + len])
+            len++;
+        flush(pos);
+        size_t distance = pos - candidate;
+        out += char(0x80 | (len - MIN_MATCH));
+        out += char(distance);
+        out += char(distance >> 8);
+        pos += len;
+        literals = pos;
+    }
+    flush(size);
+}
+
+bool trace_6502::Unpack(const Byte *in, size_t size, size_t unpacked, std::string &out) {
+    out.clear();
+    out.reserve(unpacked);
+    const Byte *end = in + size;
+    while (in < end) {
+        Byte token = *in++;
+        if (token < 0x80) {
+            size_t n = token + 1;
+            if (size_t(end - in) < n)
+                return false;
+            out.append((const char *)in, n);
+            in += n;
+        } else {
+            if (end - in < 2)
+                return false;
+            size_t len = (token & 0x7F) + MIN_MATCH;
+            size_t distance = in[0] | in[1] << 8;
+            in += 2;
+            if (distance == 0 || distance > out.size())
+                return false;
+            // Byte at a time: matches can overlap what they're copying
+            size_t from = out.size() - distance;
+            for (size_t i = 0; i < len; i++)
+                out += out[from + i];
+        }
+        if (out.size() > unpacked)
+            return false;
+    }
+    return out.size() == unpacked;
+}
+
+trace_6502::Tracer::~Tracer() {
+    Close();
+}
+
+bool trace_6502::Tracer::Open(const std::string &path, size_t capacity) {
+    Close();
+    Out = fopen(path.c_str(), "wb");
+    if (!Out)
+        return false;
+
+    Capacity = BLOCK_RECORDS;
+    while (Capacity < capacity)
+        Capacity <<= 1;
+    Ring.assign(Capacity, Record());
+    Head = CachedTail = 0;
+    PublishedHead = 0;
+    Tail = 0;
+    Quit = false;
+    Failed = false;
+    Stalls = 0;
+    Blocks = 0;
+    Bytes = 0;
+    Block.clear();
+    Block.reserve(BLOCK_RECORDS);
+    Index.clear();
+    Offset = Written = 0;
+
+    state_6502::Packer header;
+    header.U32(MAGIC);
+    header.U16(VERSION);
+    header.U32(BLOCK_RECORDS);
+    Put(header.Data);
+
+    Writer = std::thread(&Tracer::WriterLoop, this);
+    return true;
+}
+
+void trace_6502::Tracer::Close() {
+    if (!Out)
+        return;
+    Quit.store(true, std::memory_order_release);
+    Writer.join();
+    fclose(Out);
+    Out = nullptr;
+}
+
+void trace_6502::Tracer::Put(const std::string &data) {
+    if (!Failed && fwrite(data.data(), 1, data.size(), Out) != data.size())
+        Failed = true;
+    Offset += data.size();
+    Bytes += data.size();
+}
+
+void trace_6502::Tracer::WriterLoop() {
+    // Polling rather than being woken keeps the CPU side down to a store
+    for (;;) {
+        bool quitting = Quit.load(std::memory_order_acquire);
+        bool busy = Drain();
+        if (quitting)
+            break;
+        if (!busy)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (!Block.empty())
+        WriteBlock();
+    state_6502::Packer index;
+    for (const BlockInfo &b : Index) {
+        index.U64(b.FirstCycle);
+        index.U64(b.FirstRecord);
+        index.U64(b.Offset);
+        index.U32(b.Count);
+        index.U32(b.Encoded);
+        index.U32(b.Packed);
+        index.U64(b.Hash);
+    }
+    index.U64(Offset);
+    index.U64(Index.size());
+    index.U32(INDEX_MAGIC);
+    Put(index.Data);
+    fflush(Out);
+}
+
+bool trace_6502::Tracer::Drain() {
+    uint64_t head = PublishedHead.load(std::memory_order_acquire);
+    uint64_t tail = Tail.load(std::memory_order_relaxed);
+    if (head == tail)
+        return false;
+
+    while (tail != head) {
+        // Up to the end of the ring or the end of the block, whichever's first
+        uint64_t start = tail & (Capacity - 1);
+        uint64_t n = head - tail;
+        n = std::min<uint64_t>(n, Capacity - start);
+        n = std::min<uint64_t>(n, BLOCK_RECORDS - Block.size());
+        Block.insert(Block.end(), &Ring[start], &Ring[start] + n);
+        tail += n;
+        Tail.store(tail, std::memory_order_release);
+        if (Block.size() == BLOCK_RECORDS)
+            WriteBlock();
+    }
+    return true;
+}
+
+void trace_6502::Tracer::WriteBlock() {
+    std::string encoded, packed;
+    Encode(Block.data(), Block.size(), encoded);
+    Pack(encoded, packed);
+    // Not worth it, store it as is
+    if (packed.size() >= encoded.size())
+        packed = encoded;
+
+    BlockInfo info;
+    info.FirstCycle = Block.front().Cycle;
+    info.FirstRecord = Written;
+    info.Count = Block.size();
+    info.Encoded = encoded.size();
+    info.Packed = packed.size();
+    info.Hash = Hash64(encoded);
+    info.Offset = Offset + BLOCK_HEADER_SIZE;
+
+    state_6502::Packer header;
+    header.U32(BLOCK_MAGIC);
+    header.U64(info.FirstCycle);
+    header.U64(info.FirstRecord);
+    header.U32(info.Count);
+    header.U32(info.Encoded);
+    header.U32(info.Packed);
+    header.U64(info.Hash);
+    Put(header.Data);
+    Put(packed);
+
+    Index.push_back(info);
+    Written += Block.size();
+    Blocks++;
+    Block.clear();
+}
+
+trace_6502::Reader::~Reader() {
+    Close();
+}
+
+bool trace_6502::Reader::Open(const std::string &path, std::string *error) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (error)
+            *error = "couldn't open trace";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)HEADER_SIZE) {
+        Size = st.st_size;
+        void *map = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+        Map = map == MAP_FAILED ? nullptr : (const Byte *)map;
+    }
+    close(fd);
+
+    state_6502::Unpacker header(Map, Map ? HEADER_SIZE : 0);
+    uint32_t magic = header.U32();
+    uint16_t version = header.U16();
+    uint32_t blockRecords = header.U32();
+    if (!Map || magic != MAGIC || version != VERSION || blockRecords != BLOCK_RECORDS) {
+        if (error)
+            *error = !Map || magic != MAGIC ? "not a trace" : "unsupported trace version";
+        Close();
+        return false;
+    }
+    if (!ReadIndex())
+        ScanBlocks();
+    return true;
+}
+
+void trace_6502::Reader::Close() {
+    if (Map)
+        munmap((void *)Map, Size);
+    Map = nullptr;
+    Size = 0;
+    Index.clear();
+    Recovered = false;
+}
+
+bool trace_6502::Reader::ReadIndex() {
+    if (Size < HEADER_SIZE + FOOTER_SIZE)
+        return false;
+    state_6502::Unpacker footer(Map + Size - FOOTER_SIZE, FOOTER_SIZE);
+    uint64_t offset = footer.U64();
+    uint64_t count = footer.U64();
+    if (footer.U32() != INDEX_MAGIC || offset < HEADER_SIZE || offset > Size - FOOTER_SIZE ||
+        (Size - FOOTER_SIZE - offset) / INDEX_ENTRY_SIZE != count)
+        return false;
+
+    state_6502::Unpacker in(Map + offset, count * INDEX_ENTRY_SIZE);
+    for (uint64_t i = 0; i < count; i++) {
+        BlockInfo b;
+        b.FirstCycle = in.U64();
+        b.FirstRecord = in.U64();
+        b.Offset = in.U64();
+        b.Count = in.U32();
+        b.Encoded = in.U32();
+        b.Packed = in.U32();
+        b.Hash = in.U64();
+        if (b.Offset > offset || b.Packed > offset - b.Offset) {
+            Index.clear();
+            return false;
+        }
+        Index.push_back(b);
+    }
+    return true;
+}
+
+void trace_6502::Reader::ScanBlocks() {
+    Recovered = true;
+    size_t pos = HEADER_SIZE;
+    while (Size - pos >= BLOCK_HEADER_SIZE) {
+        state_6502::Unpacker in(Map + pos, BLOCK_HEADER_SIZE);
+        if (in.U32() != BLOCK_MAGIC)
+            break;
+        BlockInfo b;
+        b.FirstCycle = in.U64();
+        b.FirstRecord = in.U64();
+        b.Count = in.U32();
+        b.Encoded = in.U32();
+        b.Packed = in.U32();
+        b.Hash = in.U64();
+        b.Offset = pos + BLOCK_HEADER_SIZE;
+        if (b.Packed > Size - b.Offset)
+            break;      // Cut off half way through
+        Index.push_back(b);
+        pos = b.Offset + b.Packed;
+    }
+}
+
+long trace_6502::Reader::Find(uint64_t cycle) const {
+    auto it = std::upper_bound(Index.begin(), Index.end(), cycle,
+                               [](uint64_t c, const BlockInfo &b) { return c < b.FirstCycle; });
+    return long(it - Index.begin()) - 1;
+}
+
+bool trace_6502::Reader::DecodeBlock(size_t block, std::vector<Record> &out) const {
+    out.clear();
+    if (block >= Index.size())
+        return false;
+    const BlockInfo &b = Index[block];
+    std::string encoded;
+    if (b.Packed == b.Encoded)
+        encoded.assign((const char *)Map + b.Offset, b.Packed);
+    else if (!Unpack(Map + b.Offset, b.Packed, b.Encoded, encoded))
+        return false;
+    if (Hash64(encoded) != b.Hash)
+        return false;
+    return Decode((const Byte *)encoded.data(), encoded.size(), b.Count, out);
+}
+
+bool trace_6502::Reader::At(uint64_t cycle, Record &out) const {
+    long block = Find(cycle);
+    std::vector<Record> records;
+    if (block < 0 || !DecodeBlock(block, records))
+        return false;
+    auto it = std::upper_bound(records.begin(), records.end(), cycle,
+                               [](uint64_t c, const Record &r) { return c < r.Cycle; });
+    out = *(it - 1);
+    return true;
+}
+
+uint64_t trace_6502::Reader::Records() const {
+    return Index.empty() ? 0 : Index.back().FirstRecord + Index.back().Count;
+}
+
+bool trace_6502::Reader::Get(uint64_t first, size_t count, std::vector<Record> &out) const {
+    out.clear();
+    std::vector<Record> records;
+    while (count && first < Records()) {
+        auto it = std::upper_bound(Index.begin(), Index.end(), first,
+                                   [](uint64_t r, const BlockInfo &b) { return r < b.FirstRecord; });
+        size_t block = it - Index.begin() - 1;
+        if (!DecodeBlock(block, records))
+            return false;
+        size_t from = first - Index[block].FirstRecord;
+        size_t n = std::min(count, records.size() - from);
+        out.insert(out.end(), records.begin() + from, records.begin() + from + n);
+        first += n;
+        count -= n;
+    }
+    return true;
+}
+
+bool trace_6502::FirstDivergence(const Reader &a, const Reader &b, Divergence &out) {
+    out = Divergence();
+    std::vector<Record> left, right;
+    size_t blocks = std::min(a.Index.size(), b.Index.size());
+    for (size_t i = 0; i < blocks; i++) {
+        const BlockInfo &x = a.Index[i], &y = b.Index[i];
+        if (x.Hash == y.Hash && x.Count == y.Count && x.Encoded == y.Encoded) {
+            out.BlocksSkipped++;
+            continue;
+        }
+
+        out.BlocksDecoded++;
+        if (!a.DecodeBlock(i, left) || !b.DecodeBlock(i, right))
+            return false;
+        size_t n = std::min(left.size(), right.size());
+        size_t j = 0;
+        while (j < n && memcmp(&left[j], &right[j], sizeof(Record)) == 0)
+            j++;
+        if (j < n || left.size() != right.size()) {
+            out.Found = true;
+            out.Record = x.FirstRecord + j;
+            return true;
+        }
+    }
+
+    // All the same as far as the shorter one goes
+    if (a.Records() != b.Records()) {
+        out.Found = true;
+        out.Record = std::min(a.Records(), b.Records());
+    }
+    return true;
+}
+
+bool trace_6502::ReadFile(const std::string &path, std::vector<Record> &records) {
+    Reader reader;
+    if (!reader.Open(path))
+        return false;
+    records.clear();
+    std::vector<Record> block;
+    for (size_t i = 0; i < reader.Index.size(); i++) {
+        if (!reader.DecodeBlock(i, block))
+            return false;
+        records.insert(records.end(), block.begin(), block.end());
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#include "verify.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "hash.hpp"
+
+verify_6502::Machine::Machine() {
+    Cpu.Reset(Mem);
+    Cpu.Events = &Events;
+}
+
+bool verify_6502::Verifier::Run(const std::vector<std::string> &checkpoints, const std::string &journal,
+                                const Factory &factory) {
+    Segments.clear();
+    FirstBad = -1;
+    for (size_t i = 1; i < checkpoints.size(); i++) {
+        Segment segment;
+        segment.From = checkpoints[i - 1];
+        segment.To = checkpoints[i];
+        Segments.push_back(segment);
+    }
+
+    unsigned int nThreads = Threads ? Threads : std::thread::hardware_concurrency();
+    if (nThreads == 0)
+        nThreads = 1;
+    if (nThreads > Segments.size())
+        nThreads = Segments.size();
+
+    // Segments are much the same length, so just hand them out in order
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < Segments.size(); i = next++)
+            Replay(Segments[i], journal, factory);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < nThreads; i++)
+        pool.push_back(std::thread(worker));
+    for (auto &t : pool)
+        t.join();
+
+    for (size_t i = 0; i < Segments.size(); i++) {
+        if (!Segments[i].Ok) {
+            FirstBad = i;
+            break;
+        }
+    }
+    return FirstBad < 0;
+}
+
+void verify_6502::Verifier::Replay(Segment &segment, const std::string &journal, const Factory &factory) {
+    std::string error;
+
+    // What it's supposed to come out as
+    {
+        std::unique_ptr<Machine> end(factory());
+        if (!state_6502::LoadFile(segment.To, end->Cpu, end->Mem, end->Devices, &error)) {
+            segment.Error = segment.To + ": " + error;
+            return;
+        }
+        segment.EndCycle = end->Cpu.Cycles;
+        segment.Expected = hash_6502::Hash(end->Cpu, end->Mem, end->Devices);
+    }
+
+    std::unique_ptr<Machine> m(factory());
+    if (!state_6502::LoadFile(segment.From, m->Cpu, m->Mem, m->Devices, &error)) {
+        segment.Error = segment.From + ": " + error;
+        return;
+    }
+    segment.StartCycle = m->Cpu.Cycles;
+    if (segment.EndCycle < segment.StartCycle) {
+        segment.Error = "checkpoints out of order";
+        return;
+    }
+    if (!m->Journal.Replay(journal, segment.StartCycle, &error)) {
+        segment.Error = journal + ": " + error;
+        return;
+    }
+    m->Resumed();
+
+    while (!m->Cpu.Stopped && m->Cpu.Cycles < segment.EndCycle) {
+        uint64_t slice = segment.EndCycle - m->Cpu.Cycles;
+        if (slice > 0x7FFFFFFF)
+            slice = 0x7FFFFFFF;
+        m->Cpu.Execute(slice, m->Mem);
+    }
+
+    if (!m->Journal.Finish(m->Cpu.Cycles))
+        segment.Error = "journal diverged at cycle " + std::to_string(m->Journal.DivergedAt);
+    segment.Got = hash_6502::Hash(m->Cpu, m->Mem, m->Devices);
+    segment.Ok = segment.Error.empty() && segment.Got == segment.Expected;
+}
@@ -0,0 +1,204 @@
+#include "via_65c22.hpp"
+
+via_65c22::VIA::VIA(cpu_6502::CPU &cpu, cpu_6502::Byte irqLine) : IRQLine(irqLine), Cpu(cpu) {
+}
+
+via_65c22::VIA::~VIA() {
+    if (Events)
+        Events->Cancel(T1Event);
+}
+
+via_65c22::Byte via_65c22::VIA::Read(Word addr) {
+    switch (addr & 0xF) {
+        case REG_ORB: {
+            Byte in = Port ? Port->InputB() : 0xFF;
+            return (ORB & DDRB) | (in & ~DDRB);
+        }
+        case REG_ORA:
+        case REG_ORA_NH: {
+            Byte in = Port ? Port->InputA() : 0xFF;
+            return (ORA & DDRA) | (in & ~DDRA);
+        }
+        case REG_DDRB:
+            return DDRB;
+        case REG_DDRA:
+            return DDRA;
+        case REG_T1CL:
+            // Reading the low byte is how the firmware acknowledges the timer
+            CatchUp(Cpu.Cycles);
+            IFR &= ~IRQ_T1;
+            UpdateIRQ();
+            return T1Counter() & 0xFF;
+        case REG_T1CH:
+            CatchUp(Cpu.Cycles);
+            return T1Counter() >> 8;
+        case REG_T1LL:
+            return T1Latch & 0xFF;
+        case REG_T1LH:
+            return T1Latch >> 8;
+        case REG_ACR:
+            return ACR;
+        case REG_IFR:
+            CatchUp(Cpu.Cycles);
+            return IFR | ((IFR & IER & ~IRQ_ANY) ? IRQ_ANY : 0);
+        case REG_IER:
+            return IER | IRQ_ANY;
+        default:
+            return Regs[addr & 0xF];
+    }
+}
+
+void via_65c22::VIA::Write(Word addr, Byte data) {
+    switch (addr & 0xF) {
+        case REG_ORB:
+            ORB = data;
+            break;
+        case REG_ORA:
+        case REG_ORA_NH:
+            ORA = data;
+            break;
+        case REG_DDRB:
+            DDRB = data;
+            break;
+        case REG_DDRA:
+            DDRA = data;
+            break;
+        case REG_T1CL:
+        case REG_T1LL:
+            // Reloads that already happened used the old latch
+            CatchUp(Cpu.Cycles);
+            T1Latch = (T1Latch & 0xFF00) | data;
+            return;
+        case REG_T1CH:
+            T1Latch = (T1Latch & 0x00FF) | Word(data) << 8;
+            IFR &= ~IRQ_T1;
+            StartT1(T1Latch);
+            UpdateIRQ();
+            return;
+        case REG_T1LH:
+            CatchUp(Cpu.Cycles);
+            T1Latch = (T1Latch & 0x00FF) | Word(data) << 8;
+            IFR &= ~IRQ_T1;
+            UpdateIRQ();
+            return;
+        case REG_ACR:
+            CatchUp(Cpu.Cycles);
+            // A one-shot that already ran out is still counting down, and
+            // reloads the next time it goes past zero
+            if ((data & ACR_T1_FREE_RUN) && !T1Armed)
+                StartT1(T1Counter());
+            ACR = data;
+            return;
+        case REG_IFR:
+            CatchUp(Cpu.Cycles);
+            IFR &= ~data;
+            UpdateIRQ();
+            return;
+        case REG_IER:
+            if (data & IRQ_ANY)
+                IER |= data & ~IRQ_ANY;
+            else
+                IER &= ~data;
+            UpdateIRQ();
+            return;
+        default:
+            Regs[addr & 0xF] = data;
+            return;
+    }
+    NotifyPort();
+}
+
+void via_65c22::VIA::NotifyPort() {
+    if (Port)
+        Port->PinsChanged(PinsA(), PinsB());
+}
+
+via_65c22::Word via_65c22::VIA::T1Counter() const {
+    // A free-running timer shows 0xFFFF for a cycle before it reloads
+    if (Cpu.Cycles < T1Base)
+        return 0xFFFF;
+    return T1Start - Word(Cpu.Cycles - T1Base);
+}
+
+void via_65c22::VIA::StartT1(Word count) {
+    T1Start = count;
+    T1Base = Cpu.Cycles;
+    T1Fires = T1Base + count + 1;
+    T1Armed = true;
+    ScheduleT1();
+}
+
+void via_65c22::VIA::CatchUp(uint64_t now) {
+    if (!T1Armed || now < T1Fires)
+        return;
+    IFR |= IRQ_T1;
+    if (ACR & ACR_T1_FREE_RUN) {
+        // N, N-1 ... 0, 0xFFFF, then back to the latch: N+2 cycles a round
+        uint64_t period = uint64_t(T1Latch) + 2;
+        uint64_t last = T1Fires + (now - T1Fires) / period * period;
+        T1Start = T1Latch;
+        T1Base = last + 1;
+        T1Fires = last + period;
+    } else {
+        T1Armed = false;
+    }
+    UpdateIRQ();
+}
+
+void via_65c22::VIA::ScheduleT1() {
+    if (!Events)
+        return;
+    Events->Cancel(T1Event);
+    T1Event = 0;
+    if (T1Armed) {
+        T1Event = Events->Schedule(T1Fires, [this](uint64_t when) {
+            T1Event = 0;
+            CatchUp(when);
+            ScheduleT1();
+        }, this);
+    }
+}
+
+void via_65c22::VIA::UpdateIRQ() {
+    if (IFR & IER & ~IRQ_ANY)
+        Cpu.AssertIRQ(IRQLine);
+    else
+        Cpu.ReleaseIRQ(IRQLine);
+}
+
+void via_65c22::VIA::SaveState(state_6502::Packer &out) const {
+    out.U8(ORA);
+    out.U8(ORB);
+    out.U8(DDRA);
+    out.U8(DDRB);
+    out.Bytes(Regs, sizeof(Regs));
+    out.U8(ACR);
+    out.U8(IFR);
+    out.U8(IER);
+    out.U16(T1Latch);
+    out.U16(T1Start);
+    out.U64(T1Base);
+    out.U64(T1Fires);
+    out.U8(T1Armed);
+}
+
+bool via_65c22::VIA::LoadState(state_6502::Unpacker &in) {
+    ORA = in.U8();
+    ORB = in.U8();
+    DDRA = in.U8();
+    DDRB = in.U8();
+    in.Take(Regs, sizeof(Regs));
+    ACR = in.U8();
+    IFR = in.U8();
+    IER = in.U8();
+    T1Latch = in.U16();
+    T1Start = in.U16();
+    T1Base = in.U64();
+    T1Fires = in.U64();
+    T1Armed = in.U8();
+    if (in.Bad)
+        return false;
+    ScheduleT1();
+    UpdateIRQ();
+    return true;
+}
@@ -0,0 +1,179 @@
+#include "gtest/gtest.h"
+#include "acia_6551.hpp"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+class ACIATests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        events_6502::Scheduler events;
+        acia_6551::ACIA *acia;
+        int toAcia[2];      // Test writes, ACIA reads
+        int fromAcia[2];    // ACIA writes, test reads
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        cpu.Events = &events;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        ASSERT_EQ(pipe(toAcia), 0);
+        ASSERT_EQ(pipe(fromAcia), 0);
+        acia = new acia_6551::ACIA(cpu, events, 0x01);
+        acia->AttachFds(toAcia[0], fromAcia[1]);
+        mem.Map(0x5000, 0x5000, acia);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        delete acia;
+        close(toAcia[0]);
+        close(toAcia[1]);
+        close(fromAcia[0]);
+        close(fromAcia[1]);
+    }
+
+    std::string ReadHost() {
+        char buf[256];
+        ssize_t n = read(fromAcia[0], buf, sizeof(buf));
+        return n > 0 ? std::string(buf, n) : std::string();
+    }
+};
+
+TEST_F(ACIATests, RegistersAreMirrored) {
+    mem.Write(0x5002, 0x0B);
+    EXPECT_EQ(mem.Read(0x5002), 0x0B);
+    EXPECT_EQ(mem.Read(0x5006), 0x0B);
+    EXPECT_EQ(mem.Read(0x50FE), 0x0B);
+    // Plain memory underneath is untouched
+    EXPECT_EQ(mem[0x5002], 0x00);
+}
+
+TEST_F(ACIATests, ReceivesOnPoll) {
+    ASSERT_EQ(write(toAcia[1], "hi", 2), 2);
+
+    // Nothing shows up until the device gets polled
+    EXPECT_FALSE(mem.Read(0x5001) & acia_6551::STATUS_RDRF);
+    events.RunUntil(acia->PollCycles);
+
+    EXPECT_TRUE(mem.Read(0x5001) & acia_6551::STATUS_RDRF);
+    EXPECT_EQ(mem.Read(0x5000), 'h');
+    EXPECT_TRUE(mem.Read(0x5001) & acia_6551::STATUS_RDRF);
+    EXPECT_EQ(mem.Read(0x5000), 'i');
+    EXPECT_FALSE(mem.Read(0x5001) & acia_6551::STATUS_RDRF);
+}
+
+TEST_F(ACIATests, EmptyHostDoesNotBlock) {
+    // Nobody's written anything, the read() behind this must not hang
+    events.RunUntil(acia->PollCycles * 10);
+    EXPECT_FALSE(mem.Read(0x5001) & acia_6551::STATUS_RDRF);
+}
+
+TEST_F(ACIATests, ReceiveRaisesIRQWhenEnabled) {
+    mem.Write(0x5002, acia_6551::COMMAND_DTR);
+    ASSERT_EQ(write(toAcia[1], "x", 1), 1);
+    events.RunUntil(acia->PollCycles);
+
+    EXPECT_EQ(cpu.IRQLines, 0x01);
+    cpu_6502::Byte status = mem.Read(0x5001);
+    EXPECT_TRUE(status & acia_6551::STATUS_IRQ);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+}
+
+TEST_F(ACIATests, OutputIsBatched) {
+    for (char c : std::string("hello, world\n"))
+        mem.Write(0x5000, c);
+
+    // Still sitting in the ring, no syscalls yet
+    EXPECT_EQ(acia->WriteCalls, 0u);
+
+    cpu.Cycles = acia->FlushCycles;
+    events.RunUntil(acia->FlushCycles);
+    EXPECT_EQ(acia->WriteCalls, 1u);
+    EXPECT_EQ(ReadHost(), "hello, world\n");
+}
+
+TEST_F(ACIATests, BlockingHostIsPolledBeforeWriting) {
+    // Fill the pipe, then make it blocking like stdout is
+    char junk[4096] = {};
+    while (write(fromAcia[1], junk, sizeof(junk)) > 0)
+        ;
+    int flags = fcntl(fromAcia[1], F_GETFL);
+    fcntl(fromAcia[1], F_SETFL, flags & ~O_NONBLOCK);
+    acia->PollTx = true;
+
+    // Would hang in write() if it didn't check first
+    mem.Write(0x5000, 'x');
+    acia->Flush();
+    EXPECT_EQ(acia->BytesOut, 0u);
+
+    // Room again, and it goes out
+    fcntl(fromAcia[0], F_SETFL, O_NONBLOCK);
+    while (read(fromAcia[0], junk, sizeof(junk)) > 0)
+        ;
+    acia->Flush();
+    EXPECT_EQ(acia->BytesOut, 1u);
+    EXPECT_EQ(ReadHost(), "x");
+}
+
+TEST_F(ACIATests, RecordingHoldsOutputTheHostCantTake) {
+    // A host that's stopped reading: the pipe is full
+    fcntl(fromAcia[0], F_SETFL, O_NONBLOCK);
+    std::string full(4096, 'F');
+    while (write(fromAcia[1], full.data(), full.size()) > 0)
+        ;
+
+    char path[] = "/tmp/aciajnlXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    replay_6502::Journal journal;
+    ASSERT_TRUE(journal.Record(path, cpu.Cycles));
+    acia->Journal = &journal;
+
+    // The ring still empties, so the firmware can't tell, and nothing's lost
+    for (char c : std::string("xyz"))
+        mem.Write(0x5000, c);
+    acia->Flush();
+    EXPECT_TRUE(acia->Tx.Empty());
+    EXPECT_EQ(acia->Unsent, "xyz");
+
+    // Once the host catches up the next poll gets it out
+    std::string out;
+    for (std::string got; !(got = ReadHost()).empty(); )
+        out += got;
+    events.RunUntil(acia->PollCycles);
+    out += ReadHost();
+    EXPECT_EQ(out.substr(out.size() - 3), "xyz");
+    EXPECT_TRUE(acia->Unsent.empty());
+    EXPECT_EQ(acia->BytesDropped, 0u);
+
+    acia->Journal = nullptr;
+    journal.Close();
+    unlink(path);
+}
+
+TEST_F(ACIATests, FirmwareEcho) {
+    // loop: LDA $5001 / AND #$08 / BEQ loop / LDA $5000 / STA $5000 / JMP loop
+    cpu_6502::Byte prog[] = {
+        cpu.INS_LDA_AB, 0x01, 0x50,
+        cpu.INS_AND_IM, 0x08,
+        cpu.INS_BEQ, 0xF7,
+        cpu.INS_LDA_AB, 0x00, 0x50,
+        cpu.INS_STA_AB, 0x00, 0x50,
+        cpu.INS_JMP_AB, 0x00, 0x00,
+    };
+    for (unsigned int i = 0; i < sizeof(prog); i++)
+        mem[i] = prog[i];
+
+    ASSERT_EQ(write(toAcia[1], "abc", 3), 3);
+    cpu.Execute(50000, mem);
+    acia->Flush();
+
+    EXPECT_EQ(ReadHost(), "abc");
+}
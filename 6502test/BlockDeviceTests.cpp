@@ -0,0 +1,226 @@
+#include "gtest/gtest.h"
+#include "block_device.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    const unsigned int SECTORS = 4;    // Size of the test image
+}
+
+class BlockDeviceTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        events_6502::Scheduler events;
+        block_device::BlockDevice *disk;
+        char path[32];
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        cpu.Events = &events;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        // Sector n is filled with n, except byte i of each is n ^ i
+        strcpy(path, "/tmp/blockdevXXXXXX");
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        for (unsigned int n = 0; n < SECTORS; n++) {
+            cpu_6502::Byte sector[block_device::SECTOR_SIZE];
+            for (unsigned int i = 0; i < block_device::SECTOR_SIZE; i++)
+                sector[i] = n ^ i;
+            ASSERT_EQ(write(fd, sector, sizeof(sector)), (ssize_t)sizeof(sector));
+        }
+        close(fd);
+
+        disk = new block_device::BlockDevice(cpu, mem, events, 0x02);
+        ASSERT_TRUE(disk->Open(path));
+        mem.Map(0x7000, 0x7000, disk);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        delete disk;
+        unlink(path);
+    }
+
+    void SetLBA(uint32_t lba) {
+        mem.Write(0x7002, lba);
+        mem.Write(0x7003, lba >> 8);
+        mem.Write(0x7004, lba >> 16);
+        mem.Write(0x7005, lba >> 24);
+    }
+
+    cpu_6502::Byte FileByte(off_t offset) {
+        int fd = open(path, O_RDONLY);
+        cpu_6502::Byte b = 0;
+        EXPECT_EQ(pread(fd, &b, 1, offset), 1);
+        close(fd);
+        return b;
+    }
+};
+
+TEST_F(BlockDeviceTests, OpenMissingImageFails) {
+    block_device::BlockDevice other(cpu, mem, events, 0x04);
+    EXPECT_FALSE(other.Open("/nonexistent/disk.img"));
+    EXPECT_FALSE(other.IsOpen());
+    EXPECT_EQ(disk->Sectors, SECTORS);
+}
+
+TEST_F(BlockDeviceTests, PIORead) {
+    SetLBA(2);
+    mem.Write(0x7000, block_device::CMD_READ);
+
+    EXPECT_EQ(mem.Read(0x7000), block_device::STATUS_READY | block_device::STATUS_DRQ);
+    for (unsigned int i = 0; i < block_device::SECTOR_SIZE; i++)
+        ASSERT_EQ(mem.Read(0x7001), cpu_6502::Byte(2 ^ i));
+    EXPECT_EQ(mem.Read(0x7000), block_device::STATUS_READY);
+    EXPECT_EQ(disk->SectorsRead, 1u);
+}
+
+TEST_F(BlockDeviceTests, PIOWriteReachesTheImage) {
+    SetLBA(1);
+    mem.Write(0x7000, block_device::CMD_WRITE);
+    for (unsigned int i = 0; i < block_device::SECTOR_SIZE; i++)
+        mem.Write(0x7001, 0xA5);
+
+    EXPECT_FALSE(mem.Read(0x7000) & block_device::STATUS_DRQ);
+    EXPECT_EQ(disk->SectorsWritten, 1u);
+
+    // Straight through to the file once it's synced
+    disk->Close();
+    EXPECT_EQ(FileByte(1 * block_device::SECTOR_SIZE), 0xA5);
+    EXPECT_EQ(FileByte(2 * block_device::SECTOR_SIZE - 1), 0xA5);
+    EXPECT_EQ(FileByte(2 * block_device::SECTOR_SIZE), 2);
+}
+
+TEST_F(BlockDeviceTests, DMAReadChargesCycles) {
+    SetLBA(1);
+    mem.Write(0x7006, 0x00);
+    mem.Write(0x7007, 0x40);
+    mem.Write(0x7008, 2);
+    mem.Write(0x7000, block_device::CMD_DMA_READ);
+
+    EXPECT_TRUE(mem.Read(0x7000) & block_device::STATUS_BUSY);
+    uint64_t done = disk->CommandCycles + 2 * disk->CyclesPerSector;
+    EXPECT_EQ(events.NextEvent(), done);
+
+    // Nothing there until the transfer's had time to happen
+    events.RunUntil(done - 1);
+    EXPECT_EQ(mem[0x4001], 0x00);
+    EXPECT_TRUE(mem.Read(0x7000) & block_device::STATUS_BUSY);
+
+    events.RunUntil(done);
+    EXPECT_EQ(mem.Read(0x7000), block_device::STATUS_READY);
+    EXPECT_EQ(mem[0x4000], 1);
+    EXPECT_EQ(mem[0x4001], 1 ^ 1);
+    EXPECT_EQ(mem[0x4200], 2);
+    EXPECT_EQ(mem[0x43FF], cpu_6502::Byte(2 ^ 0x1FF));
+    EXPECT_EQ(mem[0x4400], 0x00);
+    EXPECT_EQ(disk->DMATransfers, 1u);
+}
+
+TEST_F(BlockDeviceTests, DMAWriteAndIRQ) {
+    for (unsigned int i = 0; i < block_device::SECTOR_SIZE; i++)
+        mem[0x0300 + i] = 0x5A;
+    mem.Write(0x7009, block_device::CONTROL_IRQ_ON);
+    SetLBA(3);
+    mem.Write(0x7006, 0x00);
+    mem.Write(0x7007, 0x03);
+    mem.Write(0x7000, block_device::CMD_DMA_WRITE);
+
+    // Commands while busy are ignored
+    mem.Write(0x7000, block_device::CMD_READ);
+    EXPECT_FALSE(mem.Read(0x7000) & block_device::STATUS_DRQ);
+
+    events.RunUntil(events.NextEvent());
+    EXPECT_EQ(cpu.IRQLines, 0x02);
+    EXPECT_TRUE(mem.Read(0x7000) & block_device::STATUS_IRQ);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+
+    disk->Close();
+    EXPECT_EQ(FileByte(3 * block_device::SECTOR_SIZE + 100), 0x5A);
+}
+
+TEST_F(BlockDeviceTests, OutOfRangeIsAnError) {
+    SetLBA(SECTORS);
+    mem.Write(0x7000, block_device::CMD_READ);
+    EXPECT_EQ(mem.Read(0x7000), block_device::STATUS_READY | block_device::STATUS_ERR);
+
+    // DMA running off the end of memory
+    SetLBA(0);
+    mem.Write(0x7006, 0x00);
+    mem.Write(0x7007, 0xFF);
+    mem.Write(0x7008, 2);
+    mem.Write(0x7000, block_device::CMD_DMA_READ);
+    EXPECT_EQ(mem.Read(0x7000), block_device::STATUS_READY | block_device::STATUS_ERR);
+    EXPECT_EQ(events.NextEvent(), events_6502::NO_EVENT);
+}
+
+TEST_F(BlockDeviceTests, ReadOnlyImage) {
+    ASSERT_TRUE(disk->Open(path, true));
+    mem.Write(0x7000, block_device::CMD_WRITE);
+    EXPECT_TRUE(mem.Read(0x7000) & block_device::STATUS_ERR);
+    mem.Write(0x7000, block_device::CMD_DMA_WRITE);
+    EXPECT_TRUE(mem.Read(0x7000) & block_device::STATUS_ERR);
+}
+
+TEST_F(BlockDeviceTests, TransferRegistersLockedWhileBusy) {
+    SetLBA(1);
+    mem.Write(0x7006, 0x00);
+    mem.Write(0x7007, 0x40);
+    mem.Write(0x7000, block_device::CMD_DMA_READ);
+
+    // Pointing it off the end of everything halfway through changes nothing
+    SetLBA(SECTORS);
+    mem.Write(0x7007, 0xFF);
+    mem.Write(0x7008, 200);
+    EXPECT_EQ(mem.Read(0x7002), 1);
+    EXPECT_EQ(mem.Read(0x7007), 0x40);
+    EXPECT_EQ(mem.Read(0x7008), 0);
+
+    events.RunUntil(events.NextEvent());
+    EXPECT_EQ(mem[0x4000], 1);
+    EXPECT_EQ(mem[0x4200], 0x00);
+    EXPECT_EQ(disk->SectorsRead, 1u);
+
+    // And they take writes again once it's done
+    mem.Write(0x7008, 2);
+    EXPECT_EQ(mem.Read(0x7008), 2);
+}
+
+TEST_F(BlockDeviceTests, LoadStateRejectsTransfersOffTheEnd) {
+    SetLBA(2);
+    mem.Write(0x7006, 0x00);
+    mem.Write(0x7007, 0x40);
+    mem.Write(0x7008, 2);
+    mem.Write(0x7000, block_device::CMD_DMA_READ);
+    state_6502::Packer saved;
+    disk->SaveState(saved);
+
+    // The same transfer on a smaller image, and one running off memory
+    state_6502::Packer tooFar = saved;
+    tooFar.Data[2] = char(SECTORS - 1);
+    state_6502::Packer offMemory = saved;
+    offMemory.Data[7] = char(0xFF);
+    for (state_6502::Packer *p : { &tooFar, &offMemory }) {
+        state_6502::Unpacker in(p->Data);
+        EXPECT_FALSE(disk->LoadState(in));
+    }
+
+    // Neither touched the transfer already running
+    EXPECT_EQ(disk->LBA, 2u);
+    EXPECT_EQ(disk->DMAAddress, 0x4000);
+    events.RunUntil(events.NextEvent());
+    EXPECT_EQ(disk->DMATransfers, 1u);
+    EXPECT_EQ(events.NextEvent(), events_6502::NO_EVENT);
+
+    state_6502::Unpacker in(saved.Data);
+    EXPECT_TRUE(disk->LoadState(in));
+    EXPECT_TRUE(disk->Status & block_device::STATUS_BUSY);
+    EXPECT_NE(events.NextEvent(), events_6502::NO_EVENT);
+}
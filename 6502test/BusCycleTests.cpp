@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+#include "cpu_6502.hpp"
+
+// Bus level checks, only meaningful for the cycle exact engine
+#ifdef CPU_6502_CYCLE_EXACT
+
+#include <vector>
+
+struct BusAccess {
+    cpu_6502::Word Addr;
+    bool Write;
+};
+
+class BusCycleTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        std::vector<BusAccess> bus;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+        cpu.BusCycle = [this](uint64_t cycle, cpu_6502::Word addr, cpu_6502::Byte, bool write) {
+            EXPECT_EQ(cycle, bus.size());
+            BusAccess access = { addr, write };
+            bus.push_back(access);
+        };
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+
+    void ExpectBus(const std::vector<BusAccess> &expected) {
+        ASSERT_EQ(bus.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_EQ(bus[i].Addr, expected[i].Addr) << "cycle " << i;
+            EXPECT_EQ(bus[i].Write, expected[i].Write) << "cycle " << i;
+        }
+    }
+};
+
+TEST_F(BusCycleTests, ImpliedReadsNextByte) {
+    mem[0x0] = cpu.INS_INX;
+    cpu.Execute(1, mem);
+
+    ExpectBus({ {0x0000, false}, {0x0001, false} });
+}
+
+TEST_F(BusCycleTests, AbsoluteXPageCrossReadsWrongPageFirst) {
+    cpu.X = 0x10;
+    mem[0x0] = cpu.INS_LDA_ABX;
+    mem[0x1] = 0xF8;
+    mem[0x2] = 0x30;
+    cpu.Execute(1, mem);
+
+    ExpectBus({ {0x0000, false}, {0x0001, false}, {0x0002, false},
+                {0x3008, false}, {0x3108, false} });
+}
+
+TEST_F(BusCycleTests, IndirectYPageCrossReadsWrongPageFirst) {
+    cpu.Y = 0x10;
+    mem[0x0] = cpu.INS_LDA_IDY;
+    mem[0x1] = 0x40;
+    mem[0x40] = 0xF8;
+    mem[0x41] = 0x30;
+    cpu.Execute(1, mem);
+
+    ExpectBus({ {0x0000, false}, {0x0001, false}, {0x0040, false}, {0x0041, false},
+                {0x3008, false}, {0x3108, false} });
+}
+
+TEST_F(BusCycleTests, ReadModifyWriteWritesTwice) {
+    mem[0x0] = cpu.INS_ASL_ZP;
+    mem[0x1] = 0x42;
+    cpu.Execute(1, mem);
+
+    ExpectBus({ {0x0000, false}, {0x0001, false}, {0x0042, false},
+                {0x0042, true}, {0x0042, true} });
+}
+
+TEST_F(BusCycleTests, JSRPushesBeforeFetchingHighByte) {
+    mem[0x0] = cpu.INS_JSR;
+    mem[0x1] = 0x00;
+    mem[0x2] = 0x20;
+    cpu.Execute(1, mem);
+
+    ExpectBus({ {0x0000, false}, {0x0001, false}, {0x01FF, false},
+                {0x01FF, true}, {0x01FE, true}, {0x0002, false} });
+    EXPECT_EQ(cpu.PC, 0x2000);
+}
+
+TEST_F(BusCycleTests, TakenBranchAcrossPage) {
+    cpu.PC = 0x10F0;
+    mem[0x10F0] = cpu.INS_BCC;
+    mem[0x10F1] = 0x20;
+    cpu.Execute(1, mem);
+
+    ExpectBus({ {0x10F0, false}, {0x10F1, false}, {0x10F2, false}, {0x1012, false} });
+}
+
+TEST_F(BusCycleTests, EveryOpcodeAgreesWithFastTiming) {
+    // Retire() asserts on any mismatch, this just makes sure every opcode
+    // actually gets run through it with both page crossing cases
+    for (int op = 0; op < 0x100; op++) {
+        for (int crossed = 0; crossed < 2; crossed++) {
+            cpu.Reset(mem);
+            cpu.PC = 0x0200;
+            cpu.X = cpu.Y = crossed ? 0xFF : 0x01;
+            mem[0x0200] = op;
+            mem[0x0201] = 0x80;
+            mem[0x0202] = 0x30;
+            bus.clear();
+            cpu.Execute(1, mem);
+            EXPECT_EQ(bus.size(), cpu.Cycles) << "opcode " << std::hex << op;
+        }
+    }
+}
+
+#endif
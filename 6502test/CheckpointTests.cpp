@@ -0,0 +1,172 @@
+#include "gtest/gtest.h"
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+class CheckpointTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        char dir[32];
+        std::string base;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        strcpy(dir, "/tmp/checkpointXXXXXX");
+        ASSERT_NE(mkdtemp(dir), nullptr);
+        base = std::string(dir) + "/run";
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        for (const std::string &f : checkpoint_6502::List(base))
+            unlink(f.c_str());
+        rmdir(dir);
+    }
+
+    // INC $10,X over and over, with X stepping through a page
+    void LoadCounterProgram() {
+        mem[0x0200] = cpu.INS_INC_ZPX;
+        mem[0x0201] = 0x10;
+        mem[0x0202] = cpu.INS_INX;
+        mem[0x0203] = cpu.INS_JMP_AB;
+        mem[0x0204] = 0x00;
+        mem[0x0205] = 0x02;
+        cpu.PC = 0x0200;
+    }
+};
+
+TEST_F(CheckpointTests, WriteGenerationsTrackDirtyPages) {
+    uint64_t mark = mem.NextGeneration();
+    EXPECT_FALSE(mem.ChangedSince(0x12, mark));
+
+    mem.Write(0x1234, 0x56);
+    EXPECT_TRUE(mem.ChangedSince(0x12, mark));
+    EXPECT_FALSE(mem.ChangedSince(0x13, mark));
+
+    // Direct pokes don't count until they're owned up to
+    mem[0x1300] = 0x01;
+    EXPECT_FALSE(mem.ChangedSince(0x13, mark));
+    mem.Touch(0x1300, 0x1300);
+    EXPECT_TRUE(mem.ChangedSince(0x13, mark));
+
+    // A later mark starts clean again
+    uint64_t later = mem.NextGeneration();
+    EXPECT_FALSE(mem.ChangedSince(0x12, later));
+    EXPECT_TRUE(mem.ChangedSince(0x12, mark));
+}
+
+TEST_F(CheckpointTests, ResumesFromLatest) {
+    LoadCounterProgram();
+    mem[0x8000] = 0xAB;     // Only ever in the first snapshot
+    {
+        checkpoint_6502::Checkpointer checkpoints(base);
+        cpu.Execute(1000, mem);
+        checkpoints.Take(cpu, mem);
+        checkpoints.Flush();
+        cpu.Execute(1000, mem);
+        checkpoints.Take(cpu, mem);
+        checkpoints.Flush();
+
+        // Only the zero page changed in between
+        EXPECT_EQ(checkpoints.Working.PageIndex.size(), 1u);
+        EXPECT_EQ(checkpoints.Written, 2u);
+    }
+
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    cpu2.Reset(*mem2);
+    std::string from;
+    ASSERT_TRUE(checkpoint_6502::Resume(base, cpu2, *mem2, state_6502::Devices(), &from));
+    EXPECT_EQ(from, base + ".000002");
+    EXPECT_EQ(cpu2.PC, cpu.PC);
+    EXPECT_EQ(cpu2.X, cpu.X);
+    EXPECT_EQ(cpu2.Cycles, cpu.Cycles);
+    EXPECT_EQ(memcmp(mem2->Data, mem.Data, MAX_MEM), 0);
+    delete mem2;
+}
+
+TEST_F(CheckpointTests, SnapshotsMergeWhenWriterIsBehind) {
+    LoadCounterProgram();
+    {
+        checkpoint_6502::Checkpointer checkpoints(base);
+        for (int i = 0; i < 50; i++) {
+            cpu.Execute(3000, mem);
+            mem.Write(0x3000 + i * 0x100, i + 1);
+            checkpoints.Take(cpu, mem);
+        }
+        checkpoints.Flush();
+        EXPECT_EQ(checkpoints.Taken, 50u);
+        EXPECT_EQ(checkpoints.Written + checkpoints.Merged, 50u);
+    }
+
+    // However many got merged, the last file is the machine as it ended up
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    ASSERT_TRUE(checkpoint_6502::Resume(base, cpu2, *mem2));
+    EXPECT_EQ(cpu2.Cycles, cpu.Cycles);
+    EXPECT_EQ(memcmp(mem2->Data, mem.Data, MAX_MEM), 0);
+    delete mem2;
+}
+
+TEST_F(CheckpointTests, KeepsOnlyTheNewest) {
+    checkpoint_6502::Checkpointer checkpoints(base, 2);
+    for (int i = 0; i < 5; i++) {
+        cpu.A = i;
+        checkpoints.Take(cpu, mem);
+        checkpoints.Flush();
+    }
+    std::vector<std::string> files = checkpoint_6502::List(base);
+    ASSERT_EQ(files.size(), 2u);
+    EXPECT_EQ(files[0], base + ".000004");
+    EXPECT_EQ(files[1], base + ".000005");
+
+    // A new run picks the numbering up where the old one left off
+    checkpoint_6502::Checkpointer next(base, 2);
+    next.Take(cpu, mem);
+    next.Flush();
+    EXPECT_EQ(checkpoint_6502::List(base).back(), base + ".000006");
+}
+
+TEST_F(CheckpointTests, BadNewestFallsBackToPrevious) {
+    {
+        checkpoint_6502::Checkpointer checkpoints(base);
+        cpu.A = 0x11;
+        checkpoints.Take(cpu, mem);
+        checkpoints.Flush();
+        cpu.A = 0x22;
+        checkpoints.Take(cpu, mem);
+        checkpoints.Flush();
+    }
+
+    // Flip a byte in the middle of the newest one
+    std::string newest = checkpoint_6502::List(base).back();
+    FILE *f = fopen(newest.c_str(), "r+b");
+    ASSERT_NE(f, nullptr);
+    fseek(f, 12, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, 12, SEEK_SET);
+    fputc(c ^ 0xFF, f);
+    fclose(f);
+
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    std::string from;
+    ASSERT_TRUE(checkpoint_6502::Resume(base, cpu2, *mem2, state_6502::Devices(), &from));
+    EXPECT_EQ(from, base + ".000001");
+    EXPECT_EQ(cpu2.A, 0x11);
+    delete mem2;
+}
+
+TEST_F(CheckpointTests, NothingToResumeFrom) {
+    cpu.A = 0x33;
+    EXPECT_FALSE(checkpoint_6502::Resume(base, cpu, mem));
+    EXPECT_EQ(cpu.A, 0x33);
+}
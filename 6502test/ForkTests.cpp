@@ -0,0 +1,93 @@
+#include "gtest/gtest.h"
+#include "fork.hpp"
+
+#include <csignal>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+class ForkTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        fork_6502::Forker forker;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+};
+
+TEST_F(ForkTests, ChildrenCarryOnFromParentState) {
+    mem[0x0] = cpu.INS_LDA_IM;
+    mem[0x1] = 0x40;
+    mem[0x2] = cpu.INS_STA_ZP;
+    mem[0x3] = 0x10;
+    mem[0x4] = cpu.INS_LDA_ZP;     // Each child puts its own input in 0x20
+    mem[0x5] = 0x20;
+    mem[0x6] = cpu.INS_ADC_ZP;
+    mem[0x7] = 0x10;
+    mem[0x8] = cpu.INS_STP;
+
+    // The common prefix, run once
+    cpu.Execute(5, mem);
+    ASSERT_EQ(cpu.PC, 0x4);
+
+    std::vector<fork_6502::Result> results = forker.Run(8, cpu, mem,
+        [](unsigned int index, cpu_6502::CPU &cpu, mem_28c256::Mem &mem) {
+            mem[0x20] = index;
+            cpu.Execute(100, mem);
+            return std::to_string(cpu.A);
+        });
+
+    ASSERT_EQ(results.size(), 8u);
+    for (unsigned int i = 0; i < 8; i++) {
+        EXPECT_TRUE(results[i].Ok());
+        EXPECT_EQ(results[i].Output, std::to_string(0x40 + i));
+    }
+    EXPECT_EQ(forker.Forks, 8u);
+
+    // Nothing the children did shows up here
+    EXPECT_EQ(cpu.PC, 0x4);
+    EXPECT_EQ(cpu.Cycles, 5u);
+    EXPECT_EQ(mem[0x20], 0x00);
+}
+
+TEST_F(ForkTests, FailuresAreReportedPerChild) {
+    std::vector<fork_6502::Result> results = forker.Run(3, cpu, mem,
+        [](unsigned int index, cpu_6502::CPU &, mem_28c256::Mem &) -> std::string {
+            if (index == 1)
+                abort();
+            if (index == 2)
+                throw std::runtime_error("bad input");
+            return "fine";
+        });
+
+    EXPECT_TRUE(results[0].Ok());
+    EXPECT_EQ(results[0].Output, "fine");
+    EXPECT_FALSE(results[1].Ok());
+    EXPECT_EQ(results[1].Signal, SIGABRT);
+    EXPECT_FALSE(results[2].Ok());
+    EXPECT_EQ(results[2].ExitCode, 1);
+}
+
+TEST_F(ForkTests, LargeOutputDoesNotDeadlock) {
+    // Far more than a pipe holds, with more children than can run at once
+    forker.MaxParallel = 2;
+    std::vector<fork_6502::Result> results = forker.Run(5, cpu, mem,
+        [](unsigned int index, cpu_6502::CPU &, mem_28c256::Mem &mem) {
+            return std::string(1 << 20, 'a' + index) + std::to_string(mem[0]);
+        });
+
+    for (unsigned int i = 0; i < 5; i++) {
+        ASSERT_TRUE(results[i].Ok());
+        EXPECT_EQ(results[i].Output.size(), (1u << 20) + 1);
+        EXPECT_EQ(results[i].Output[0], char('a' + i));
+    }
+}
@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+#include "hash.hpp"
+
+class HashTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+
+    // STA $0300,X / JSR sub / INX / JMP loop, with sub: INC $10 / RTS. Keeps
+    // writing to the zero page, the stack and page 3.
+    void LoadProgram() {
+        cpu_6502::Byte prog[] = {
+            cpu.INS_STA_ABX, 0x00, 0x03,
+            cpu.INS_JSR, 0x00, 0x04,
+            cpu.INS_INX,
+            cpu.INS_JMP_AB, 0x00, 0x02,
+        };
+        for (unsigned int i = 0; i < sizeof(prog); i++)
+            mem[0x0200 + i] = prog[i];
+        mem[0x0400] = cpu.INS_INC_ZP;
+        mem[0x0401] = 0x10;
+        mem[0x0402] = cpu.INS_RTS;
+        mem.Touch(0x0200, 0x04FF);
+        cpu.PC = 0x0200;
+        cpu.A = 0x5A;
+    }
+};
+
+TEST_F(HashTests, TrackerMatchesFullHash) {
+    LoadProgram();
+    hash_6502::Tracker tracker;
+    EXPECT_EQ(tracker.Hash(cpu, mem), hash_6502::Hash(cpu, mem));
+    EXPECT_EQ(tracker.PagesHashed, uint64_t(NUM_PAGES));
+
+    uint64_t last = 0;
+    for (int i = 0; i < 50; i++) {
+        cpu.Execute(97, mem);
+        uint64_t h = tracker.Hash(cpu, mem);
+        ASSERT_EQ(h, hash_6502::Hash(cpu, mem)) << "after " << cpu.Cycles << " cycles";
+        EXPECT_NE(h, last);
+        last = h;
+    }
+
+    // Only the zero page, the stack and page 3 ever needed doing again
+    EXPECT_LE(tracker.PagesHashed, uint64_t(NUM_PAGES) + 50 * 3);
+}
+
+TEST_F(HashTests, TrackerSeesTouchedPokes) {
+    hash_6502::Tracker tracker;
+    uint64_t before = tracker.Hash(cpu, mem);
+
+    mem[0x1234] = 0x56;
+    EXPECT_EQ(tracker.Hash(cpu, mem), before);      // Nobody said
+    mem.Touch(0x1234, 0x1234);
+    uint64_t after = tracker.Hash(cpu, mem);
+    EXPECT_NE(after, before);
+    EXPECT_EQ(after, hash_6502::Hash(cpu, mem));
+
+    // Putting it back gets back to the same hash
+    mem[0x1234] = 0x00;
+    mem.Touch(0x1234, 0x1234);
+    EXPECT_EQ(tracker.Hash(cpu, mem), before);
+}
+
+TEST_F(HashTests, TrackerIsCheaperThanRehashing) {
+    LoadProgram();
+    hash_6502::Tracker tracker;
+    tracker.Hash(cpu, mem);
+
+    // A hash at every instruction boundary
+    uint64_t full = 0;
+    for (int i = 0; i < 1000; i++) {
+        cpu.Execute(1, mem);
+        tracker.Hash(cpu, mem);
+        full += NUM_PAGES;
+    }
+    EXPECT_LT(tracker.PagesHashed * 20, full);
+    EXPECT_EQ(tracker.Queries, 1001u);
+}
@@ -0,0 +1,61 @@
+#include "gtest/gtest.h"
+#include "cpu_6502.hpp"
+#include "hostperf.hpp"
+
+#include <sstream>
+
+class HostPerfTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        // loop: INX / JMP loop, 5 cycles a time round
+        mem[0x0200] = cpu.INS_INX;
+        mem[0x0201] = cpu.INS_JMP_AB;
+        mem[0x0202] = 0x00;
+        mem[0x0203] = 0x02;
+        cpu.PC = 0x0200;
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+};
+
+TEST_F(HostPerfTests, CountsInstructions) {
+    cpu.Execute(5 * 1000, mem);
+    EXPECT_EQ(cpu.Instructions, 2000u);
+    cpu.Reset(mem);
+    EXPECT_EQ(cpu.Instructions, 0u);
+}
+
+TEST_F(HostPerfTests, MeasuresSlices) {
+    // Whether or not the kernel hands out perf events, the clock always works
+    hostperf_6502::Counters counters;
+    for (int i = 0; i < 10; i++) {
+        counters.Start();
+        cpu.Execute(5 * 10000, mem);
+        counters.Stop();
+    }
+    EXPECT_EQ(counters.Slices, 10u);
+    EXPECT_GT(counters.Total.Ns, 0u);
+    if (counters.Available(hostperf_6502::HOST_INSTRUCTIONS))
+        EXPECT_GT(counters.Total.Count[hostperf_6502::HOST_INSTRUCTIONS], cpu.Instructions);
+    if (!counters.Hardware())
+        EXPECT_FALSE(counters.Why.empty());
+
+    std::ostringstream out;
+    counters.Report(out, cpu.Instructions, cpu.Cycles);
+    EXPECT_NE(out.str().find("200000 instructions, 500000 cycles"), std::string::npos) << out.str();
+    EXPECT_NE(out.str().find("Host per instruction:"), std::string::npos) << out.str();
+
+    counters.Clear();
+    EXPECT_EQ(counters.Slices, 0u);
+    EXPECT_EQ(counters.Total.Ns, 0u);
+}
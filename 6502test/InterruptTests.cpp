@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+#include "cpu_6502.hpp"
+
+class InterruptTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        events_6502::Scheduler events;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        cpu.Events = &events;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        // IRQ handler at 0x2000 spins on itself, NMI handler at 0x3000 is a NOP
+        mem[0xFFFE] = 0x00;
+        mem[0xFFFF] = 0x20;
+        mem[0xFFFA] = 0x00;
+        mem[0xFFFB] = 0x30;
+        mem[0x2000] = cpu.INS_JMP_AB;
+        mem[0x2001] = 0x00;
+        mem[0x2002] = 0x20;
+        mem[0x3000] = cpu.INS_NOP;
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+};
+
+TEST_F(InterruptTests, CycleCounterTracksExecute) {
+    mem[0x0] = cpu.INS_NOP;
+    mem[0x1] = cpu.INS_LDA_IM;
+    mem[0x2] = 0x42;
+    cpu.Execute(4, mem);
+
+    EXPECT_EQ(cpu.Cycles, 4u);
+    EXPECT_EQ(cpu.A, 0x42);
+}
+
+TEST_F(InterruptTests, IRQIsServicedWhenEnabled) {
+    cpu.SF.I = 0;
+    cpu.AssertIRQ(0x01);
+    cpu.Execute(7, mem);
+
+    EXPECT_EQ(cpu.PC, 0x2000);
+    EXPECT_EQ(cpu.SF.I, 1);
+    EXPECT_EQ(mem[0x1FF], 0x00);
+    EXPECT_EQ(mem[0x1FE], 0x00);
+    EXPECT_EQ(cpu.Cycles, 7u);
+}
+
+TEST_F(InterruptTests, IRQIsIgnoredWhenMasked) {
+    cpu.SF.I = 1;
+    cpu.AssertIRQ(0x01);
+    mem[0x0] = cpu.INS_NOP;
+    cpu.Execute(2, mem);
+
+    EXPECT_EQ(cpu.PC, 0x1);
+}
+
+TEST_F(InterruptTests, ReleasingOneLineKeepsTheOther) {
+    cpu.AssertIRQ(0x01);
+    cpu.AssertIRQ(0x02);
+    cpu.ReleaseIRQ(0x01);
+    EXPECT_EQ(cpu.IRQLines, 0x02);
+}
+
+TEST_F(InterruptTests, NMIIgnoresInterruptDisable) {
+    cpu.SF.I = 1;
+    cpu.TriggerNMI();
+    cpu.Execute(7, mem);
+
+    EXPECT_EQ(cpu.PC, 0x3000);
+    EXPECT_FALSE(cpu.NMIPending);
+}
+
+TEST_F(InterruptTests, WAISleepsUntilNextEvent) {
+    cpu.SF.I = 0;
+    mem[0x0] = cpu.INS_WAI;
+    events.Schedule(100000, [this](uint64_t) { cpu.AssertIRQ(0x01); });
+
+    cpu.Execute(200000, mem);
+
+    // The CPU woke up on the event, took the IRQ and then spun in the handler
+    EXPECT_FALSE(cpu.Waiting);
+    EXPECT_EQ(cpu.PC, 0x2000);
+    EXPECT_GE(cpu.Cycles, 200000u);
+    EXPECT_EQ(mem[0x1FF], 0x00);
+    EXPECT_EQ(mem[0x1FE], 0x01);
+}
+
+TEST_F(InterruptTests, WAIChargesSkippedCycles) {
+    mem[0x0] = cpu.INS_WAI;
+    cpu.Execute(1000000, mem);
+
+    EXPECT_TRUE(cpu.Waiting);
+    EXPECT_EQ(cpu.Cycles, 1000000u);
+    EXPECT_EQ(cpu.PC, 0x1);
+}
+
+TEST_F(InterruptTests, WAIWithInterruptsMaskedResumesInline) {
+    cpu.SF.I = 1;
+    mem[0x0] = cpu.INS_WAI;
+    mem[0x1] = cpu.INS_LDA_IM;
+    mem[0x2] = 0x42;
+    events.Schedule(50, [this](uint64_t) { cpu.AssertIRQ(0x01); });
+
+    cpu.Execute(52, mem);
+
+    EXPECT_EQ(cpu.A, 0x42);
+    EXPECT_EQ(cpu.PC, 0x3);
+    EXPECT_EQ(cpu.Cycles, 52u);
+}
+
+TEST_F(InterruptTests, STPOnlyWakesOnReset) {
+    cpu.SF.I = 0;
+    mem[0x0] = cpu.INS_STP;
+    events.Schedule(10, [this](uint64_t) { cpu.AssertIRQ(0x01); });
+
+    cpu.Execute(5000, mem);
+
+    EXPECT_TRUE(cpu.Stopped);
+    EXPECT_EQ(cpu.PC, 0x1);
+    EXPECT_EQ(cpu.Cycles, 5000u);
+    EXPECT_EQ(cpu.StoppedAt, 3u);
+
+    cpu.Reset(mem);
+    EXPECT_FALSE(cpu.Stopped);
+}
+
+TEST_F(InterruptTests, SchedulerRunsEventsInOrder) {
+    std::vector<int> order;
+    events.Schedule(20, [&order](uint64_t) { order.push_back(2); });
+    events.Schedule(10, [&order](uint64_t) { order.push_back(1); });
+    events.Schedule(20, [&order](uint64_t) { order.push_back(3); });
+    unsigned int cancelled = events.Schedule(15, [&order](uint64_t) { order.push_back(99); });
+    events.Cancel(cancelled);
+
+    EXPECT_EQ(events.NextEvent(), 10u);
+    events.RunUntil(20);
+
+    ASSERT_EQ(order.size(), 3u);
+    EXPECT_EQ(order[0], 1);
+    EXPECT_EQ(order[1], 2);
+    EXPECT_EQ(order[2], 3);
+    EXPECT_EQ(events.NextEvent(), events_6502::NO_EVENT);
+}
@@ -0,0 +1,151 @@
+#include "gtest/gtest.h"
+#include "lcd_hd44780.hpp"
+
+#include <sstream>
+
+class LCDTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        events_6502::Scheduler events;
+        via_65c22::VIA *via;
+        lcd_hd44780::LCD *lcd;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        cpu.Events = &events;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        lcd = new lcd_hd44780::LCD(cpu);
+        via = new via_65c22::VIA(cpu, 0x04);
+        via->Port = lcd;
+        mem.Map(0x6000, 0x6000, via);
+        mem.Write(0x6002, 0xFF);    // Port B all outputs
+        mem.Write(0x6003, 0xE0);    // Top three bits of port A are outputs
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        delete via;
+        delete lcd;
+    }
+
+    // Same sequence of port writes the firmware uses
+    void Send(bool rs, cpu_6502::Byte value) {
+        cpu_6502::Byte ctrl = rs ? lcd_hd44780::PIN_RS : 0;
+        mem.Write(0x6000, value);
+        mem.Write(0x6001, ctrl);
+        mem.Write(0x6001, ctrl | lcd_hd44780::PIN_E);
+        mem.Write(0x6001, ctrl);
+    }
+
+    // Let the controller finish whatever it's doing
+    void Wait() { cpu.Cycles = lcd->BusyUntil; }
+
+    void Init() {
+        Send(false, 0x38); Wait();  // 8 bit, 2 lines
+        Send(false, 0x0E); Wait();  // Display on, cursor on
+        Send(false, 0x06); Wait();  // Increment, no shift
+        Send(false, 0x01); Wait();  // Clear
+    }
+
+    void Print(const std::string &s) {
+        for (char c : s) {
+            Send(true, c);
+            Wait();
+        }
+    }
+
+    cpu_6502::Byte ReadBusyAndAddress() {
+        mem.Write(0x6002, 0x00);    // Port B as inputs
+        mem.Write(0x6001, lcd_hd44780::PIN_RW);
+        mem.Write(0x6001, lcd_hd44780::PIN_RW | lcd_hd44780::PIN_E);
+        cpu_6502::Byte value = mem.Read(0x6000);
+        mem.Write(0x6001, lcd_hd44780::PIN_RW);
+        mem.Write(0x6002, 0xFF);
+        return value;
+    }
+};
+
+TEST_F(LCDTests, PrintsText) {
+    Init();
+    Print("Hello, world!");
+
+    EXPECT_EQ(lcd->Line(0), "Hello, world!   ");
+    EXPECT_EQ(lcd->Line(1), "                ");
+}
+
+TEST_F(LCDTests, SecondLine) {
+    Init();
+    Print("top");
+    Send(false, 0x80 | 0x40); Wait();
+    Print("bottom");
+
+    EXPECT_EQ(lcd->Text(), "top             \nbottom          ");
+}
+
+TEST_F(LCDTests, BusyFlagTiming) {
+    Init();
+    Send(false, 0x01);      // Clear takes 1.52 ms
+
+    EXPECT_TRUE(ReadBusyAndAddress() & lcd_hd44780::BUSY_FLAG);
+    cpu.Cycles += 1000;
+    EXPECT_TRUE(ReadBusyAndAddress() & lcd_hd44780::BUSY_FLAG);
+    cpu.Cycles += 520;
+    EXPECT_FALSE(ReadBusyAndAddress() & lcd_hd44780::BUSY_FLAG);
+
+    Send(true, 'A');        // Data writes are 41 us
+    cpu.Cycles += 40;
+    EXPECT_TRUE(ReadBusyAndAddress() & lcd_hd44780::BUSY_FLAG);
+    cpu.Cycles += 1;
+    EXPECT_EQ(ReadBusyAndAddress(), 0x01);
+}
+
+TEST_F(LCDTests, WritesWhileBusyAreDropped) {
+    Init();
+    Send(true, 'A');
+    Send(true, 'B');    // Too soon
+
+    EXPECT_EQ(lcd->WritesWhileBusy, 1u);
+    EXPECT_EQ(lcd->Line(0), "A               ");
+}
+
+TEST_F(LCDTests, FourBitMode) {
+    Send(false, 0x20); Wait();  // Switch to 4 bit, only the high nibble is wired
+    auto send4 = [this](bool rs, cpu_6502::Byte value) {
+        Send(rs, value & 0xF0);
+        Send(rs, value << 4);
+        Wait();
+    };
+    send4(false, 0x28);
+    send4(false, 0x0C);
+    send4(false, 0x01);
+    send4(true, 'h');
+    send4(true, 'i');
+
+    EXPECT_FALSE(lcd->EightBit);
+    EXPECT_EQ(lcd->Line(0), "hi              ");
+}
+
+TEST_F(LCDTests, RendersOnlyOnChange) {
+    std::ostringstream out;
+    lcd->MinRenderNs = 0;
+    lcd->StartRendering(events, out);
+    Init();
+
+    events.RunUntil(cpu.Cycles + lcd->RefreshCycles);
+    uint64_t renders = lcd->Renders;
+    EXPECT_GE(renders, 1u);
+
+    // Nothing changed, nothing drawn
+    events.RunUntil(cpu.Cycles + lcd->RefreshCycles * 10);
+    EXPECT_EQ(lcd->Renders, renders);
+
+    // Many writes inside one refresh period make one redraw
+    Print("abc");
+    events.RunUntil(cpu.Cycles + lcd->RefreshCycles * 20);
+    EXPECT_EQ(lcd->Renders, renders + 1);
+    EXPECT_NE(out.str().find("|abc"), std::string::npos);
+}
@@ -0,0 +1,232 @@
+#include "gtest/gtest.h"
+#include "lockstep.hpp"
+
+#include <cstdlib>
+#include <vector>
+
+namespace {
+    // Deliberately not a multiple of the vector width
+    const unsigned int LANES = 37;
+}
+
+class LockstepTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+
+        std::vector<mem_28c256::Mem> mems;
+        std::vector<mem_28c256::Mem> refMems;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+        mems.resize(LANES);
+        refMems.resize(LANES);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+
+    // Run `program` at 0x0400 in every lane with lane's number in 0x10 and
+    // `seed` bytes after it, once in lockstep and once lane by lane through
+    // CPU::Execute, and check they end up identical.
+    void RunBoth(const std::vector<cpu_6502::Byte> &program, uint64_t limit, lockstep_6502::Lockstep &ls, unsigned int seed = 1) {
+        srand(seed);
+        std::vector<cpu_6502::CPU> refs(LANES);
+        for (unsigned int lane = 0; lane < LANES; lane++) {
+            refs[lane].Reset(refMems[lane]);
+            for (unsigned int i = 0; i < program.size(); i++)
+                refMems[lane][0x0400 + i] = program[i];
+            refMems[lane][0x10] = lane;
+            for (unsigned int i = 0x11; i < 0x20; i++)
+                refMems[lane][i] = rand();
+            refs[lane].PC = 0x0400;
+            mems[lane] = refMems[lane];
+            ls.Load(lane, refs[lane], mems[lane]);
+        }
+
+        ls.Run(limit);
+
+        for (unsigned int lane = 0; lane < LANES; lane++) {
+            cpu_6502::CPU &ref = refs[lane];
+            ref.Execute(limit, refMems[lane]);
+            cpu_6502::CPU got;
+            ls.Store(lane, got);
+
+            ASSERT_EQ(got.PC, ref.PC) << "lane " << lane;
+            EXPECT_EQ(got.A, ref.A) << "lane " << lane;
+            EXPECT_EQ(got.X, ref.X) << "lane " << lane;
+            EXPECT_EQ(got.Y, ref.Y) << "lane " << lane;
+            EXPECT_EQ(got.SP, ref.SP) << "lane " << lane;
+            EXPECT_EQ(got.PSF, ref.PSF) << "lane " << lane;
+            EXPECT_EQ(got.Stopped, ref.Stopped) << "lane " << lane;
+            // A stopped CPU's clock runs on to the end of the budget
+            EXPECT_EQ(got.Cycles, ref.Stopped ? ref.StoppedAt : ref.Cycles) << "lane " << lane;
+            for (unsigned int addr = 0; addr < MAX_MEM; addr++)
+                ASSERT_EQ(mems[lane][addr], refMems[lane][addr]) << "lane " << lane << " addr " << addr;
+        }
+    }
+};
+
+TEST_F(LockstepTests, DivergingLoopsMatchScalar) {
+    // Sum lane+seed bytes, looping a lane dependent number of times, so
+    // lanes split up on the branch and meet again afterwards
+    std::vector<cpu_6502::Byte> program = {
+        0xA6, 0x10,         // LDX $10
+        0xE8,               // INX
+        0xA9, 0x00,         // LDA #0
+        0x18,               // loop: CLC
+        0x75, 0x10,         // ADC $10,X
+        0x2A,               // ROL A
+        0x49, 0x5A,         // EOR #$5A
+        0xE5, 0x11,         // SBC $11
+        0x4A,               // LSR A
+        0xCA,               // DEX
+        0xD0, 0xF4,         // BNE loop
+        0x9D, 0x00, 0x03,   // STA $0300,X
+        0xC9, 0x80,         // CMP #$80
+        0xB0, 0x02,         // BCS +2
+        0xA0, 0x01,         // LDY #1
+        0x8C, 0x00, 0x02,   // STY $0200
+        0xDB                // STP
+    };
+    lockstep_6502::Lockstep ls(LANES);
+    RunBoth(program, 100000, ls);
+
+    EXPECT_GT(ls.VectorLanes, 10 * ls.ScalarLanes);
+    EXPECT_LT(ls.Steps, ls.VectorLanes);
+}
+
+TEST_F(LockstepTests, UnsupportedOpcodesFallBack) {
+    std::vector<cpu_6502::Byte> program = {
+        0xA5, 0x10,         // LDA $10
+        0x48,               // PHA
+        0x20, 0x10, 0x04,   // JSR sub
+        0x68,               // PLA
+        0xE6, 0x10,         // INC $10
+        0x24, 0x11,         // BIT $11
+        0xDB,               // STP
+        0xEA, 0xEA, 0xEA, 0xEA,
+        0x0A,               // sub: ASL A
+        0x65, 0x12,         // ADC $12
+        0x60                // RTS
+    };
+    lockstep_6502::Lockstep ls(LANES);
+    RunBoth(program, 1000, ls);
+
+    EXPECT_GT(ls.ScalarLanes, 0u);
+}
+
+TEST_F(LockstepTests, CycleLimit) {
+    std::vector<cpu_6502::Byte> program = {
+        0xE8,               // INX
+        0x4C, 0x00, 0x04    // JMP $0400
+    };
+    lockstep_6502::Lockstep ls(LANES);
+    RunBoth(program, 1001, ls);
+}
+
+TEST_F(LockstepTests, RandomProgramsMatchScalar) {
+    // Opcodes that can't wander off: no jumps, no stack, no stores outside
+    // the page at 0x0200
+    const cpu_6502::Byte implied[] = { 0x0A, 0x4A, 0x2A, 0x6A, 0xAA, 0xA8, 0x8A, 0x98,
+                                       0xE8, 0xC8, 0xCA, 0x88, 0x18, 0x38, 0xB8, 0xEA };
+    const cpu_6502::Byte immediate[] = { 0xA9, 0xA2, 0xA0, 0x69, 0xE9, 0x29, 0x09, 0x49, 0xC9, 0xE0, 0xC0 };
+    const cpu_6502::Byte zeroPage[] = { 0xA5, 0xB5, 0xA6, 0xB6, 0xA4, 0xB4, 0x65, 0x75, 0xE5, 0xF5, 0x25,
+                                        0x05, 0x45, 0x55, 0xC5, 0xD5, 0xE4, 0xC4, 0x24, 0x06, 0x66 };
+    const cpu_6502::Byte absolute[] = { 0xBD, 0xB9, 0xBE, 0xBC, 0x7D, 0xF9, 0x3D, 0x19, 0x5D, 0xDD,
+                                        0x9D, 0x99, 0x8D, 0x8E, 0x8C, 0xEE };
+
+    for (unsigned int seed = 1; seed <= 20; seed++) {
+        srand(seed * 7919);
+        std::vector<cpu_6502::Byte> program;
+        while (program.size() < 200) {
+            switch (rand() % 5) {
+                case 0:
+                    program.push_back(implied[rand() % sizeof(implied)]);
+                    break;
+                case 1:
+                    program.push_back(immediate[rand() % sizeof(immediate)]);
+                    program.push_back(rand());
+                    break;
+                case 2:
+                    program.push_back(zeroPage[rand() % sizeof(zeroPage)]);
+                    program.push_back(0x10 + rand() % 0x10);
+                    break;
+                case 3:
+                    program.push_back(absolute[rand() % sizeof(absolute)]);
+                    program.push_back(rand() & 0x80);
+                    program.push_back(0x02);
+                    break;
+                default:
+                    // Short forward branch, lanes will disagree about it
+                    program.push_back(0x10 + 0x20 * (rand() % 8));
+                    program.push_back(rand() % 4);
+                    program.push_back(0xEA);
+                    program.push_back(0xEA);
+                    program.push_back(0xEA);
+                    program.push_back(0xEA);
+                    break;
+            }
+        }
+        program.push_back(0xDB);
+
+        lockstep_6502::Lockstep ls(LANES);
+        RunBoth(program, 100000, ls, seed);
+        if (HasFailure())
+            FAIL() << "program seed " << seed;
+    }
+}
+
+// The kernels against CPU::Execute for every value of A, M and C
+TEST_F(LockstepTests, KernelsAreExact) {
+    const cpu_6502::Byte opcodes[] = { cpu.INS_ADC_IM, cpu.INS_SBC_IM, cpu.INS_AND_IM, cpu.INS_ORA_IM,
+                                       cpu.INS_EOR_IM, cpu.INS_CMP_IM, cpu.INS_LDA_IM, cpu.INS_ASL_ACC,
+                                       cpu.INS_LSR_ACC, cpu.INS_ROL_ACC, cpu.INS_ROR_ACC };
+    lockstep_6502::Lockstep ls(256);
+
+    for (cpu_6502::Byte opcode : opcodes) {
+        for (unsigned int a = 0; a < 256; a++) {
+            for (unsigned int c = 0; c < 2; c++) {
+                for (unsigned int m = 0; m < 256; m++) {
+                    ls.A[m] = a;
+                    ls.C[m] = c;
+                    ls.Z[m] = ls.V[m] = ls.N[m] = 0;
+                    ls.Operand[m] = m;
+                    ls.Mask[m] = 0xFF;
+                }
+                switch (opcode) {
+                    case cpu_6502::CPU::INS_ADC_IM: ls.Add(false); break;
+                    case cpu_6502::CPU::INS_SBC_IM: ls.Add(true); break;
+                    case cpu_6502::CPU::INS_AND_IM: ls.Logic(lockstep_6502::LOGIC_AND); break;
+                    case cpu_6502::CPU::INS_ORA_IM: ls.Logic(lockstep_6502::LOGIC_ORA); break;
+                    case cpu_6502::CPU::INS_EOR_IM: ls.Logic(lockstep_6502::LOGIC_EOR); break;
+                    case cpu_6502::CPU::INS_CMP_IM: ls.Compare(ls.A); break;
+                    case cpu_6502::CPU::INS_LDA_IM: ls.LoadRegister(ls.A); break;
+                    case cpu_6502::CPU::INS_ASL_ACC: ls.Shift(lockstep_6502::SHIFT_ASL); break;
+                    case cpu_6502::CPU::INS_LSR_ACC: ls.Shift(lockstep_6502::SHIFT_LSR); break;
+                    case cpu_6502::CPU::INS_ROL_ACC: ls.Shift(lockstep_6502::SHIFT_ROL); break;
+                    case cpu_6502::CPU::INS_ROR_ACC: ls.Shift(lockstep_6502::SHIFT_ROR); break;
+                }
+
+                for (unsigned int m = 0; m < 256; m++) {
+                    cpu.PC = 0;
+                    cpu.A = a;
+                    cpu.SF.C = c;
+                    cpu.SF.Z = cpu.SF.V = cpu.SF.N = 0;
+                    mem[0] = opcode;
+                    mem[1] = m;
+                    cpu.Execute(1, mem);
+                    ASSERT_EQ(ls.A[m], cpu.A) << std::hex << "op " << unsigned(opcode) << " a " << a << " m " << m << " c " << c;
+                    ASSERT_EQ(ls.C[m], cpu.SF.C) << std::hex << "op " << unsigned(opcode) << " a " << a << " m " << m << " c " << c;
+                    ASSERT_EQ(ls.Z[m], cpu.SF.Z) << std::hex << "op " << unsigned(opcode) << " a " << a << " m " << m << " c " << c;
+                    ASSERT_EQ(ls.V[m], cpu.SF.V) << std::hex << "op " << unsigned(opcode) << " a " << a << " m " << m << " c " << c;
+                    ASSERT_EQ(ls.N[m], cpu.SF.N) << std::hex << "op " << unsigned(opcode) << " a " << a << " m " << m << " c " << c;
+                }
+            }
+        }
+    }
+}
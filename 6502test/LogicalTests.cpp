@@ -106,12 +106,12 @@ TEST_F(LogicalTests, TestANDIndirectIndexed) {
 
     mem[0x0000] = cpu.INS_AND_IDY;
     mem[0x0001] = 0x40;
-    mem[0x0050] = 0x08;
-    mem[0x0051] = 0x80;
+    mem[0x0040] = 0xF8;     // $7FF8 + Y crosses into $80
+    mem[0x0041] = 0x7F;
 
     mem[0x8008] = 0xAA;
 
-    cpu.Execute(5, mem);
+    cpu.Execute(6, mem);
     EXPECT_EQ(cpu.A, 0xAA);
 }
 
@@ -205,12 +205,12 @@ TEST_F(LogicalTests, TestEORIndirectIndexed) {
 
     mem[0x0000] = cpu.INS_EOR_IDY;
     mem[0x0001] = 0x40;
-    mem[0x0050] = 0x08;
-    mem[0x0051] = 0x80;
+    mem[0x0040] = 0xF8;     // $7FF8 + Y crosses into $80
+    mem[0x0041] = 0x7F;
 
     mem[0x8008] = 0xAA;
 
-    cpu.Execute(5, mem);
+    cpu.Execute(6, mem);
     EXPECT_EQ(cpu.A, 0xb1);
 }
 
@@ -304,12 +304,12 @@ TEST_F(LogicalTests, TestORAIndirectIndexed) {
 
     mem[0x0000] = cpu.INS_ORA_IDY;
     mem[0x0001] = 0x40;
-    mem[0x0050] = 0x08;
-    mem[0x0051] = 0x80;
+    mem[0x0040] = 0xF8;     // $7FF8 + Y crosses into $80
+    mem[0x0041] = 0x7F;
 
     mem[0x8008] = 0xAA;
 
-    cpu.Execute(5, mem);
+    cpu.Execute(6, mem);
     EXPECT_EQ(cpu.A, 0xbb);
 }
 
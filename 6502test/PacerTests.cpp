@@ -0,0 +1,55 @@
+#include "gtest/gtest.h"
+#include "cpu_6502.hpp"
+#include "pacer.hpp"
+
+class PacerTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        pace_6502::Pacer pacer;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        // JMP $0000 forever
+        mem[0x0] = cpu.INS_JMP_AB;
+        mem[0x1] = 0x00;
+        mem[0x2] = 0x00;
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+};
+
+TEST_F(PacerTests, BatchSizeFollowsJitterBound) {
+    pacer.TargetHz = 1000000;
+    pacer.MaxJitterNs = 2000000;
+    EXPECT_EQ(pacer.BatchCycles(), 2000u);
+
+    pacer.MaxJitterNs = 100;
+    EXPECT_EQ(pacer.BatchCycles(), 1u);
+}
+
+TEST_F(PacerTests, RunsAtTargetRate) {
+    // 30 ms worth of cycles at 1 MHz. Can't be early, may be a little late on
+    // a loaded machine.
+    pacer.TargetHz = 1000000;
+    pacer.MaxJitterNs = 1000000;
+    pacer.Run(cpu, mem, 30000);
+
+    EXPECT_GE(pacer.CyclesRun, 30000u);
+    EXPECT_GE(pacer.ElapsedNs, 29000000u);
+    EXPECT_LE(pacer.AchievedHz(), 1050000.0);
+}
+
+TEST_F(PacerTests, StopsOnSTP) {
+    mem[0x0] = cpu.INS_STP;
+    pacer.Run(cpu, mem, 0);
+
+    EXPECT_TRUE(cpu.Stopped);
+    EXPECT_EQ(pacer.Batches, 1u);
+}
@@ -0,0 +1,327 @@
+#include "gtest/gtest.h"
+#include "coverage.hpp"
+#include "cpu_6502.hpp"
+#include "profile.hpp"
+#include "symbols.hpp"
+
+// The counters only exist in the profiling build, which builds just this
+// file into its own test binary
+#ifdef CPU_6502_PROFILE
+
+#include <memory>
+#include <sstream>
+
+class ProfileTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        std::unique_ptr<profile_6502::Profile> profile{new profile_6502::Profile};
+        profile_6502::CallGraph calls;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+        cpu.Profile = profile.get();
+        cpu.Calls = &calls;
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+
+    void Load(cpu_6502::Word addr, std::initializer_list<cpu_6502::Byte> code) {
+        for (cpu_6502::Byte b : code)
+            mem[addr++] = b;
+    }
+
+    // main: JSR a / JSR b / JMP main, a: JSR b / RTS, b: NOP / RTS.
+    // 43 cycles a time round: 15 in main, 12 in a and 8 in each call to b.
+    void LoadCalls() {
+        Load(0x0200, { cpu.INS_JSR, 0x00, 0x03, cpu.INS_JSR, 0x10, 0x03, cpu.INS_JMP_AB, 0x00, 0x02 });
+        Load(0x0300, { cpu.INS_JSR, 0x10, 0x03, cpu.INS_RTS });
+        Load(0x0310, { cpu.INS_NOP, cpu.INS_RTS });
+        cpu.PC = 0x0200;
+    }
+
+    std::string Folded() {
+        std::ostringstream out;
+        calls.WriteFolded(out);
+        return out.str();
+    }
+};
+
+TEST_F(ProfileTests, CountsOpcodesAndAddresses) {
+    // loop: LDA $10 / STA $0300,X / INX / JMP loop
+    Load(0x0200, { cpu.INS_LDA_ZP, 0x10, cpu.INS_STA_ABX, 0x00, 0x03, cpu.INS_INX, cpu.INS_JMP_AB, 0x00, 0x02 });
+    cpu.PC = 0x0200;
+    cpu.Execute(13 * 100, mem);
+
+    EXPECT_EQ(profile->TotalInstructions(), 400u);
+    EXPECT_EQ(profile->TotalCycles(), 1300u);
+    EXPECT_EQ(profile->Instructions[cpu.INS_LDA_ZP], 100u);
+    EXPECT_EQ(profile->Cycles[cpu.INS_LDA_ZP], 300u);
+    EXPECT_EQ(profile->Cycles[cpu.INS_STA_ABX], 500u);
+    EXPECT_EQ(profile->Hits[0x0200], 100u);
+    EXPECT_EQ(profile->Hits[0x0201], 0u);       // Operands don't count
+    EXPECT_EQ(profile->PCCycles[0x0205], 200u);
+
+    // Stores always take the extra cycle, so it isn't a penalty
+    EXPECT_EQ(profile->PagePenalties[cpu.INS_STA_ABX], 0u);
+}
+
+TEST_F(ProfileTests, CountsBranchesAndPagePenalties) {
+    // LDX #3 / loop: LDA $02FE,X / DEX / BNE loop / STP
+    Load(0x0200, { cpu.INS_LDX_IM, 0x03, cpu.INS_LDA_ABX, 0xFE, 0x02, cpu.INS_DEX, cpu.INS_BNE, 0xFA, cpu.INS_STP });
+    cpu.PC = 0x0200;
+    cpu.Execute(1000, mem);
+    ASSERT_TRUE(cpu.Stopped);
+
+    EXPECT_EQ(profile->Taken[0x0206], 2u);
+    EXPECT_EQ(profile->NotTaken[0x0206], 1u);
+    // X = 3 and 2 cross into page 3, X = 1 doesn't
+    EXPECT_EQ(profile->PagePenalties[cpu.INS_LDA_ABX], 2u);
+    EXPECT_EQ(profile->Cycles[cpu.INS_LDA_ABX], 3u * 4 + 2);
+
+    // A branch that lands on the next page
+    cpu.Reset(mem);
+    profile->Clear();
+    Load(0x02F0, { cpu.INS_BEQ, 0x20 });
+    mem[0x0312] = cpu.INS_STP;
+    cpu.PC = 0x02F0;
+    cpu.SF.Z = 1;
+    cpu.Execute(1000, mem);
+    ASSERT_TRUE(cpu.Stopped);
+    EXPECT_EQ(profile->Taken[0x02F0], 1u);
+    EXPECT_EQ(profile->PagePenalties[cpu.INS_BEQ], 1u);
+    EXPECT_EQ(profile->Cycles[cpu.INS_BEQ], 4u);
+}
+
+TEST_F(ProfileTests, CountsInterrupts) {
+    mem[0xFFFA] = 0x00;
+    mem[0xFFFB] = 0x04;
+    mem[0x0400] = cpu.INS_RTI;
+    mem[0x0200] = cpu.INS_NOP;
+    cpu.PC = 0x0200;
+    cpu.TriggerNMI();
+    cpu.Execute(1, mem);
+    cpu.Execute(1, mem);
+    cpu.Execute(1, mem);
+    EXPECT_EQ(profile->Interrupts, 1u);
+    EXPECT_EQ(profile->Hits[0x0400], 1u);
+    EXPECT_EQ(profile->Hits[0x0200], 1u);
+}
+
+TEST_F(ProfileTests, ReportShowsHotSpots) {
+    Load(0x0200, { cpu.INS_LDA_ZP, 0x10, cpu.INS_STA_ABX, 0x00, 0x03, cpu.INS_INX, cpu.INS_JMP_AB, 0x00, 0x02 });
+    cpu.PC = 0x0200;
+    cpu.Execute(13 * 100, mem);
+
+    std::ostringstream out;
+    profile->Report(out, 1);
+    std::string report = out.str();
+    EXPECT_NE(report.find("400 instructions, 1300 cycles (3.25 per instruction)"), std::string::npos) << report;
+    EXPECT_NE(report.find("STA_ABX"), std::string::npos) << report;
+    EXPECT_NE(report.find("  0202         100           500   38.5"), std::string::npos) << report;
+    EXPECT_EQ(report.find("LDA_ZP"), std::string::npos) << report;      // Not the top one
+    EXPECT_STREQ(profile_6502::OpcodeName(0xA9), "LDA_IM");
+}
+
+TEST_F(ProfileTests, AttributesCyclesToCallPaths) {
+    LoadCalls();
+    cpu.Execute(43 * 100, mem);
+    EXPECT_EQ(calls.Stack.size(), 1u);
+
+    EXPECT_EQ(Folded(),
+              "$0200 1500\n"
+              "$0200;$0300 1200\n"
+              "$0200;$0300;$0310 800\n"
+              "$0200;$0310 800\n");
+
+    std::vector<profile_6502::CallGraph::Function> functions = calls.Functions();
+    ASSERT_EQ(functions.size(), 3u);
+    EXPECT_EQ(functions[0].Address, 0x0200);
+    EXPECT_EQ(functions[0].Inclusive, 4300u);
+    EXPECT_EQ(functions[0].Exclusive, 1500u);
+    EXPECT_EQ(functions[1].Address, 0x0300);
+    EXPECT_EQ(functions[1].Inclusive, 2000u);
+    EXPECT_EQ(functions[1].Exclusive, 1200u);
+    EXPECT_EQ(functions[1].Calls, 100u);
+    EXPECT_EQ(functions[2].Address, 0x0310);
+    EXPECT_EQ(functions[2].Inclusive, 1600u);
+    EXPECT_EQ(functions[2].Exclusive, 1600u);
+    EXPECT_EQ(functions[2].Calls, 200u);
+}
+
+TEST_F(ProfileTests, RecursionCountsOnce) {
+    // r: DEX / BEQ done / JSR r / done: RTS, called with X = 3
+    Load(0x0200, { cpu.INS_LDX_IM, 0x03, cpu.INS_JSR, 0x00, 0x03, cpu.INS_STP });
+    Load(0x0300, { cpu.INS_DEX, cpu.INS_BEQ, 0x03, cpu.INS_JSR, 0x00, 0x03, cpu.INS_RTS });
+    cpu.PC = 0x0200;
+    cpu.Execute(1000, mem);
+    ASSERT_TRUE(cpu.Stopped);
+
+    std::vector<profile_6502::CallGraph::Function> functions = calls.Functions();
+    ASSERT_EQ(functions.size(), 2u);
+    EXPECT_EQ(functions[1].Address, 0x0300);
+    EXPECT_EQ(functions[1].Calls, 3u);
+    // Everything but main's LDX, JSR and STP, counted the once
+    EXPECT_EQ(functions[1].Inclusive, functions[0].Inclusive - 2 - 6 - 3);
+    EXPECT_EQ(functions[1].Inclusive, functions[1].Exclusive);
+}
+
+TEST_F(ProfileTests, FollowsUnusualReturns) {
+    // main: JSR s / STP, s: PLA / PLA / JMP $0220 (dropping its own return
+    // address), then at $0220 an RTS used as a jump to $0230, then an NMI
+    Load(0x0200, { cpu.INS_JSR, 0x00, 0x03, cpu.INS_STP });
+    Load(0x0300, { cpu.INS_PLA, cpu.INS_PLA, cpu.INS_JMP_AB, 0x20, 0x02 });
+    Load(0x0220, { cpu.INS_LDA_IM, 0x02, cpu.INS_PHA, cpu.INS_LDA_IM, 0x2F, cpu.INS_PHA, cpu.INS_RTS });
+    Load(0x0230, { cpu.INS_NOP, cpu.INS_STP });
+    Load(0x0400, { cpu.INS_NOP, cpu.INS_RTI });
+    mem[0xFFFA] = 0x00;
+    mem[0xFFFB] = 0x04;
+    cpu.PC = 0x0200;
+
+    cpu.Execute(1, mem);
+    EXPECT_EQ(calls.Stack.size(), 2u);
+    cpu.Execute(1, mem);
+    cpu.Execute(1, mem);
+    EXPECT_EQ(calls.Stack.size(), 1u);      // Return address is gone
+
+    for (int i = 0; i < 6; i++)
+        cpu.Execute(1, mem);
+    EXPECT_EQ(cpu.PC, 0x0230);
+    EXPECT_EQ(calls.Stack.size(), 1u);
+
+    cpu.TriggerNMI();
+    cpu.Execute(1, mem);
+    EXPECT_EQ(calls.Stack.size(), 2u);
+    cpu.Execute(1, mem);
+    cpu.Execute(1, mem);
+    EXPECT_EQ(calls.Stack.size(), 1u);
+    EXPECT_EQ(cpu.PC, 0x0230);
+
+    EXPECT_EQ(Folded(),
+              "$0200 " + std::to_string(6 + 3 + 2 + 3 + 2 + 3 + 6) + "\n"
+              "$0200;$0300 " + std::to_string(4 + 4) + "\n"
+              "$0200;[nmi] $0400 " + std::to_string(7 + 2 + 6) + "\n");
+}
+
+TEST_F(ProfileTests, UsesSymbols) {
+    symbols_6502::Table symbols;
+    symbols.Add(0x0200, "main");
+    symbols.Add(0x0300, "print_string");
+    symbols.Add(0x0310, "putc");
+    symbols.Build();
+    calls.Symbols = &symbols;
+
+    LoadCalls();
+    cpu.Execute(43, mem);
+    EXPECT_EQ(Folded(),
+              "main 15\n"
+              "main;print_string 12\n"
+              "main;print_string;putc 8\n"
+              "main;putc 8\n");
+
+    std::ostringstream out;
+    calls.Report(out, 2);
+    EXPECT_NE(out.str().find("           1            20   46.5            12   27.9  print_string"), std::string::npos)
+        << out.str();
+
+    // Addresses in the flat profile get named too, offsets and all
+    out.str("");
+    profile->Report(out, 1, &symbols);
+    EXPECT_NE(out.str().find("  0311           2            12   27.9  putc+1"), std::string::npos) << out.str();
+}
+
+class CoverageTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        std::unique_ptr<coverage_6502::Coverage> coverage{new coverage_6502::Coverage};
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        // loop: LDA $10 / STA $0300,X / INX / JMP loop, a hundred times
+        const cpu_6502::Byte code[] = { cpu.INS_LDA_ZP, 0x10, cpu.INS_STA_ABX, 0x00, 0x03, cpu.INS_INX,
+                                        cpu.INS_JMP_AB, 0x00, 0x02 };
+        for (unsigned int i = 0; i < sizeof(code); i++)
+            mem[0x0200 + i] = code[i];
+        cpu.PC = 0x0200;
+        mem.Coverage = coverage.get();
+        cpu.Execute(13 * 100, mem);
+        mem.Coverage = nullptr;
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+};
+
+TEST_F(CoverageTests, TracksExecutedReadAndWritten) {
+    using coverage_6502::Coverage;
+    // Operands count as executed, not read
+    EXPECT_EQ(Coverage::Count(coverage->Executed, 0x0000, 0xFFFF), 9u);
+    EXPECT_TRUE(Coverage::Test(coverage->Executed, 0x0208));
+    EXPECT_FALSE(Coverage::Test(coverage->Executed, 0x0209));
+    EXPECT_EQ(Coverage::Count(coverage->Read, 0x0000, 0xFFFF), 1u);
+    EXPECT_TRUE(Coverage::Test(coverage->Read, 0x0010));
+    EXPECT_EQ(Coverage::Count(coverage->Written, 0x0000, 0xFFFF), 100u);
+    EXPECT_EQ(Coverage::Count(coverage->Written, 0x0363, 0x0363), 1u);
+    EXPECT_EQ(Coverage::Count(coverage->Written, 0x0364, 0x0400), 0u);
+
+    EXPECT_EQ(coverage->Fetches[0x02], 900u);
+    EXPECT_EQ(coverage->Reads[0x00], 100u);
+    EXPECT_EQ(coverage->Writes[0x03], 100u);
+}
+
+TEST_F(CoverageTests, ReportsBySymbol) {
+    symbols_6502::Table symbols;
+    symbols.Add(0x0010, "ptr", 1);
+    symbols.Add(0x0200, "main");
+    symbols.Add(0x0300, "buffer", 256);
+    symbols.Build();
+
+    std::ostringstream out;
+    coverage->Report(out, &symbols);
+    const std::string report = out.str();
+    EXPECT_NE(report.find("9 bytes executed, 1 read, 100 written"), std::string::npos) << report;
+    EXPECT_NE(report.find("  0010      1      0   0.0%      1 100.0%      0   0.0%  ptr\n"), std::string::npos) << report;
+    // main runs up to buffer, buffer stops where its size says
+    EXPECT_NE(report.find("  0200    256      9   3.5%      0   0.0%      0   0.0%  main\n"), std::string::npos) << report;
+    EXPECT_NE(report.find("  0300    256      0   0.0%      0   0.0%    100  39.1%  buffer\n"), std::string::npos) << report;
+
+    // No symbols, so just the pages that were touched
+    out.str("");
+    coverage->Report(out);
+    EXPECT_NE(out.str().find("page 02"), std::string::npos) << out.str();
+    EXPECT_EQ(out.str().find("page 01"), std::string::npos) << out.str();
+}
+
+TEST_F(CoverageTests, WritesHeatmaps) {
+    std::ostringstream csv;
+    coverage->WriteCSV(csv);
+    EXPECT_NE(csv.str().find("\n2,9,0,0,900,0,0\n"), std::string::npos);
+    EXPECT_NE(csv.str().find("\n3,0,0,100,0,0,100\n"), std::string::npos);
+
+    std::ostringstream ppm;
+    coverage->WritePPM(ppm);
+    const std::string image = ppm.str();
+    const std::string header = "P6\n256 256\n255\n";
+    ASSERT_EQ(image.size(), header.size() + 65536 * 3);
+    auto pixel = [&](unsigned int addr, unsigned int channel) {
+        return (unsigned char)image[header.size() + addr * 3 + channel];
+    };
+    EXPECT_EQ(pixel(0x0300, 0), 255);       // Written, busiest page for writes
+    EXPECT_EQ(pixel(0x0300, 1), 0);
+    EXPECT_EQ(pixel(0x0205, 1), 255);       // Executed
+    EXPECT_EQ(pixel(0x0010, 2), 255);       // Read
+    EXPECT_EQ(pixel(0x0400, 0) | pixel(0x0400, 1) | pixel(0x0400, 2), 0);
+}
+
+#endif
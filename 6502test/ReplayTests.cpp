@@ -0,0 +1,210 @@
+#include "gtest/gtest.h"
+#include "acia_6551.hpp"
+#include "replay.hpp"
+#include "savestate.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A machine with an ACIA at 0x5000 running firmware that copies whatever
+// comes in to 0x10 onwards
+struct SerialMachine {
+    cpu_6502::CPU cpu;
+    mem_28c256::Mem mem;
+    events_6502::Scheduler events;
+    acia_6551::ACIA *acia;
+
+    SerialMachine() {
+        cpu.Reset(mem);
+        cpu.PC = 0x0000;
+        cpu.Events = &events;
+        acia = new acia_6551::ACIA(cpu, events, 0x01);
+        mem.Map(0x5000, 0x5000, acia);
+
+        // loop: LDA $5001 / AND #$08 / BEQ loop / LDA $5000 / STA $10,X / INX / JMP loop
+        cpu_6502::Byte prog[] = {
+            cpu.INS_LDA_AB, 0x01, 0x50,
+            cpu.INS_AND_IM, 0x08,
+            cpu.INS_BEQ, 0xF9,
+            cpu.INS_LDA_AB, 0x00, 0x50,
+            cpu.INS_STA_ZPX, 0x10,
+            cpu.INS_INX,
+            cpu.INS_JMP_AB, 0x00, 0x02,
+        };
+        for (unsigned int i = 0; i < sizeof(prog); i++)
+            mem[0x0200 + i] = prog[i];
+        cpu.PC = 0x0200;
+    }
+
+    ~SerialMachine() {
+        delete acia;
+    }
+};
+
+class ReplayTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        char path[32];
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        strcpy(path, "/tmp/journalXXXXXX");
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        unlink(path);
+    }
+
+    // Record a session where the host types in three bursts
+    void RecordSession(SerialMachine &m, uint64_t *midCycles = nullptr, std::string *midState = nullptr) {
+        int host[2];
+        ASSERT_EQ(pipe(host), 0);
+        m.acia->AttachFds(host[0], -1);
+
+        replay_6502::Journal journal;
+        ASSERT_TRUE(journal.Record(path, m.cpu.Cycles));
+        m.acia->Journal = &journal;
+
+        m.cpu.Execute(3333, m.mem);
+        ASSERT_EQ(write(host[1], "ab", 2), 2);
+        m.cpu.Execute(20000, m.mem);
+        if (midState) {
+            *midCycles = m.cpu.Cycles;
+            *midState = state_6502::Save(m.cpu, m.mem, { { "acia", m.acia } });
+        }
+        ASSERT_EQ(write(host[1], "cde", 3), 3);
+        m.cpu.Execute(777, m.mem);
+        ASSERT_EQ(write(host[1], "f", 1), 1);
+        m.cpu.Execute(30000, m.mem);
+
+        EXPECT_EQ(journal.Bytes, 6u);
+        journal.Close();
+        m.acia->Detach();
+        m.acia->Journal = nullptr;
+        close(host[0]);
+        close(host[1]);
+    }
+};
+
+TEST_F(ReplayTests, JournalRoundTrip) {
+    replay_6502::Journal journal;
+    ASSERT_TRUE(journal.Record(path, 100));
+    const cpu_6502::Byte hello[] = { 'h', 'e', 'l', 'l', 'o' };
+    journal.Input(1000, replay_6502::CHANNEL_ACIA, hello, 5);
+    journal.Nmi(2000);
+    journal.Input(5000000000ull, replay_6502::CHANNEL_ACIA, hello + 4, 1);
+    journal.Close();
+
+    // A handful of bytes per record
+    struct stat st;
+    ASSERT_EQ(stat(path, &st), 0);
+    EXPECT_LT(st.st_size, 32);
+
+    ASSERT_TRUE(journal.Replay(path, 100));
+    cpu_6502::Byte buf[8];
+    EXPECT_EQ(journal.TakeInput(999, replay_6502::CHANNEL_ACIA, buf, sizeof(buf)), 0u);
+    EXPECT_EQ(journal.TakeInput(1000, replay_6502::CHANNEL_ACIA, buf, 3), 3u);
+    EXPECT_EQ(journal.TakeInput(1000, replay_6502::CHANNEL_ACIA, buf + 3, 5), 2u);
+    EXPECT_EQ(memcmp(buf, hello, 5), 0);
+    EXPECT_FALSE(journal.TakeNmi(1999));
+    EXPECT_TRUE(journal.TakeNmi(2000));
+    EXPECT_EQ(journal.TakeInput(5000000000ull, replay_6502::CHANNEL_ACIA, buf, sizeof(buf)), 1u);
+    EXPECT_TRUE(journal.Ended);
+    EXPECT_FALSE(journal.Diverged);
+}
+
+TEST_F(ReplayTests, FlushedRecordsReplayWithoutClose) {
+    replay_6502::Journal recording;
+    ASSERT_TRUE(recording.Record(path, 0));
+    const cpu_6502::Byte hi[] = { 'h', 'i' };
+    recording.Input(1000, replay_6502::CHANNEL_ACIA, hi, 2);
+    recording.Flush();
+
+    // Still open, as if the process died here
+    replay_6502::Journal journal;
+    ASSERT_TRUE(journal.Replay(path, 0));
+    cpu_6502::Byte buf[2];
+    EXPECT_EQ(journal.TakeInput(1000, replay_6502::CHANNEL_ACIA, buf, sizeof(buf)), 2u);
+    EXPECT_EQ(memcmp(buf, hi, 2), 0);
+}
+
+TEST_F(ReplayTests, ReplayIsBitExact) {
+    SerialMachine recorded;
+    RecordSession(recorded);
+    EXPECT_EQ(memcmp(&recorded.mem.Data[0x10], "abcdef", 6), 0);
+
+    // No host at all this time
+    SerialMachine replayed;
+    replay_6502::Journal journal;
+    ASSERT_TRUE(journal.Replay(path, replayed.cpu.Cycles));
+    replayed.acia->Journal = &journal;
+    replayed.cpu.Execute(recorded.cpu.Cycles, replayed.mem);
+
+    EXPECT_FALSE(journal.Diverged);
+    EXPECT_EQ(replayed.cpu.Cycles, recorded.cpu.Cycles);
+    EXPECT_EQ(replayed.cpu.PC, recorded.cpu.PC);
+    EXPECT_EQ(replayed.cpu.X, 6);
+    EXPECT_EQ(memcmp(replayed.mem.Data, recorded.mem.Data, MAX_MEM), 0);
+}
+
+TEST_F(ReplayTests, ReplayFromCheckpoint) {
+    SerialMachine recorded;
+    uint64_t midCycles;
+    std::string midState;
+    RecordSession(recorded, &midCycles, &midState);
+
+    // Pick up halfway through: the first burst is already in the save state
+    SerialMachine resumed;
+    ASSERT_TRUE(state_6502::Load(midState, resumed.cpu, resumed.mem, { { "acia", resumed.acia } }));
+    EXPECT_EQ(resumed.cpu.X, 2);
+
+    replay_6502::Journal journal;
+    ASSERT_TRUE(journal.Replay(path, resumed.cpu.Cycles));
+    resumed.acia->Journal = &journal;
+    resumed.cpu.Execute(recorded.cpu.Cycles - midCycles, resumed.mem);
+
+    EXPECT_FALSE(journal.Diverged);
+    EXPECT_EQ(resumed.cpu.X, 6);
+    EXPECT_EQ(memcmp(resumed.mem.Data, recorded.mem.Data, MAX_MEM), 0);
+}
+
+TEST_F(ReplayTests, DivergenceIsDetected) {
+    SerialMachine recorded;
+    RecordSession(recorded);
+
+    // Polling on different cycles than the recording means the input can't
+    // line up
+    SerialMachine replayed;
+    replayed.acia->PollCycles = 700;
+    replay_6502::Journal journal;
+    ASSERT_TRUE(journal.Replay(path, replayed.cpu.Cycles));
+    replayed.acia->Journal = &journal;
+    replayed.cpu.Execute(recorded.cpu.Cycles, replayed.mem);
+
+    EXPECT_TRUE(journal.Diverged);
+    EXPECT_GT(journal.DivergedAt, 3333u);
+}
+
+TEST_F(ReplayTests, RejectsOtherFiles) {
+    FILE *f = fopen(path, "wb");
+    fputs("definitely not a journal", f);
+    fclose(f);
+
+    replay_6502::Journal journal;
+    std::string error;
+    EXPECT_FALSE(journal.Replay(path, 0, &error));
+    EXPECT_EQ(error, "not a journal");
+    EXPECT_FALSE(journal.Replaying());
+}
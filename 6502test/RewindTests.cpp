@@ -0,0 +1,231 @@
+#include "gtest/gtest.h"
+#include "block_device.hpp"
+#include "hash.hpp"
+#include "rewind.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <unistd.h>
+
+class RewindTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        events_6502::Scheduler events;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+        cpu.Events = &events;
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+
+    // STA $0300,X / JSR sub / INX / JMP loop, with sub: INC $10 / ADC $10 /
+    // RTS. Touches the zero page, the stack and page 3, and A wanders.
+    void LoadProgram() {
+        cpu_6502::Byte prog[] = {
+            cpu.INS_STA_ABX, 0x00, 0x03,
+            cpu.INS_JSR, 0x00, 0x04,
+            cpu.INS_INX,
+            cpu.INS_JMP_AB, 0x00, 0x02,
+        };
+        for (unsigned int i = 0; i < sizeof(prog); i++)
+            mem[0x0200 + i] = prog[i];
+        mem[0x0400] = cpu.INS_INC_ZP;
+        mem[0x0401] = 0x10;
+        mem[0x0402] = cpu.INS_ADC_ZP;
+        mem[0x0403] = 0x10;
+        mem[0x0404] = cpu.INS_RTS;
+        mem.Touch(0x0200, 0x04FF);
+        cpu.PC = 0x0200;
+    }
+
+    // A timer that bumps 0x0500 every 777 cycles, so events have to come
+    // back right too
+    events_6502::Callback timer = [this](uint64_t when) {
+        mem.Write(0x0500, mem[0x0500] + 1);
+        events.Schedule(when + 777, timer);
+    };
+
+    // Run instruction by instruction, noting the state at every boundary
+    std::map<uint64_t, uint64_t> Run(rewind_6502::Rewinder &rewinder, unsigned int instructions) {
+        std::map<uint64_t, uint64_t> states;
+        for (unsigned int i = 0; i < instructions; i++) {
+            rewinder.Tick();
+            states[cpu.Cycles] = hash_6502::Hash(cpu, mem);
+            cpu.Execute(1, mem);
+        }
+        states[cpu.Cycles] = hash_6502::Hash(cpu, mem);
+        return states;
+    }
+};
+
+TEST_F(RewindTests, StepBackUndoesEachInstruction) {
+    LoadProgram();
+    events.Schedule(777, timer);
+    rewind_6502::Rewinder rewinder(cpu, mem, events);
+    rewinder.Interval = 1000;
+    std::map<uint64_t, uint64_t> states = Run(rewinder, 3000);
+    EXPECT_GT(rewinder.Ring.size(), 5u);
+
+    // All the way back past several snapshots, checking every stop
+    auto it = states.rbegin();
+    for (int i = 0; i < 500; i++) {
+        ++it;
+        ASSERT_TRUE(rewinder.StepBack());
+        ASSERT_EQ(cpu.Cycles, it->first);
+        ASSERT_EQ(hash_6502::Hash(cpu, mem), it->second) << "at cycle " << cpu.Cycles;
+    }
+
+    // Forward again from here goes the same way
+    uint64_t target = states.rbegin()->first;
+    while (cpu.Cycles < target)
+        cpu.Execute(1, mem);
+    EXPECT_EQ(hash_6502::Hash(cpu, mem), states.rbegin()->second);
+}
+
+TEST_F(RewindTests, SeekToAnyBoundary) {
+    LoadProgram();
+    events.Schedule(777, timer);
+    rewind_6502::Rewinder rewinder(cpu, mem, events);
+    rewinder.Interval = 2500;
+    std::map<uint64_t, uint64_t> states = Run(rewinder, 5000);
+
+    // Off a boundary lands on the one before
+    uint64_t end = states.rbegin()->first;
+    for (uint64_t target : { end - 3, end / 3 + 7, end / 2, uint64_t(2500), uint64_t(0) }) {
+        auto at = states.upper_bound(target);
+        --at;
+        ASSERT_TRUE(rewinder.SeekTo(target));
+        EXPECT_EQ(cpu.Cycles, at->first);
+        EXPECT_EQ(hash_6502::Hash(cpu, mem), at->second);
+    }
+}
+
+TEST_F(RewindTests, ReverseContinueFindsTheLastHit) {
+    LoadProgram();
+    rewind_6502::Rewinder rewinder(cpu, mem, events);
+    rewinder.Interval = 1000;
+    std::map<uint64_t, uint64_t> states;
+    uint64_t lastHit = 0;
+    for (int i = 0; i < 4000; i++) {
+        rewinder.Tick();
+        if (cpu.PC == 0x0400 && cpu.X == 0x40) {
+            lastHit = cpu.Cycles;
+            states[cpu.Cycles] = hash_6502::Hash(cpu, mem);
+        }
+        cpu.Execute(1, mem);
+    }
+    ASSERT_NE(lastHit, 0u);
+    ASSERT_LT(lastHit + 5000, cpu.Cycles);
+
+    auto atSub40 = [this]() { return cpu.PC == 0x0400 && cpu.X == 0x40; };
+    ASSERT_TRUE(rewinder.ReverseContinue(atSub40));
+    EXPECT_EQ(cpu.Cycles, lastHit);
+    EXPECT_EQ(hash_6502::Hash(cpu, mem), states[lastHit]);
+
+    // Sitting on a hit, the next one back is the one before
+    ASSERT_TRUE(rewinder.ReverseContinue(atSub40));
+    EXPECT_LT(cpu.Cycles, lastHit);
+    EXPECT_TRUE(atSub40());
+
+    // Something that never happened leaves everything where it was
+    uint64_t here = cpu.Cycles;
+    uint64_t hash = hash_6502::Hash(cpu, mem);
+    EXPECT_FALSE(rewinder.ReverseContinue([this]() { return cpu.A == 0x42 && cpu.X == 0xFF && cpu.PC == 0x0300; }));
+    EXPECT_EQ(cpu.Cycles, here);
+    EXPECT_EQ(hash_6502::Hash(cpu, mem), hash);
+}
+
+TEST_F(RewindTests, DeviceEventInFlightComesBackOnce) {
+    char path[] = "/tmp/rewinddiskXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, 4 * block_device::SECTOR_SIZE), 0);
+    close(fd);
+    block_device::BlockDevice disk(cpu, mem, events, 0x02);
+    ASSERT_TRUE(disk.Open(path));
+    mem.Map(0x7000, 0x7000, &disk);
+
+    LoadProgram();
+    mem.Write(0x7007, 0x40);
+    mem.Write(0x7000, block_device::CMD_DMA_READ);
+    rewind_6502::Rewinder rewinder(cpu, mem, events, { { "disk", &disk } });
+    rewinder.Take();
+    while (disk.DMATransfers == 0)
+        cpu.Execute(1, mem);
+
+    // Back before it finished: one transfer pending, and the device's own
+    // handle on it still works
+    ASSERT_TRUE(rewinder.SeekTo(0));
+    EXPECT_TRUE(disk.Status & block_device::STATUS_BUSY);
+    EXPECT_EQ(events.Queue.size(), 1u);
+    while (disk.Status & block_device::STATUS_BUSY)
+        cpu.Execute(1, mem);
+    EXPECT_EQ(disk.DMATransfers, 2u);
+    EXPECT_EQ(events.Queue.size(), 0u);
+
+    ASSERT_TRUE(rewinder.SeekTo(0));
+    disk.Close();
+    EXPECT_EQ(events.Queue.size(), 0u);
+    unlink(path);
+}
+
+TEST_F(RewindTests, HooksStayPut) {
+    LoadProgram();
+    cpu.Events = nullptr;
+    rewind_6502::Rewinder rewinder(cpu, mem, events);
+    rewinder.Take();
+    cpu.Events = &events;
+    for (int i = 0; i < 10; i++)
+        cpu.Execute(1, mem);
+
+    // The registers go back, what's hooked up to the CPU now doesn't
+    ASSERT_TRUE(rewinder.SeekTo(0));
+    EXPECT_EQ(cpu.PC, 0x0200);
+    EXPECT_EQ(cpu.Events, &events);
+}
+
+TEST_F(RewindTests, RingStaysWithinBudget) {
+    LoadProgram();
+    rewind_6502::Rewinder rewinder(cpu, mem, events);
+    rewinder.Interval = 500;
+    rewinder.MaxBytes = 8 << 10;
+    for (int i = 0; i < 2000; i++) {
+        rewinder.Tick();
+        cpu.Execute(50, mem);
+    }
+    EXPECT_LE(rewinder.Bytes, rewinder.MaxBytes);
+    EXPECT_GT(rewinder.Dropped, 0u);
+    EXPECT_GT(rewinder.Oldest(), 0u);
+
+    // A few changed bytes a snapshot, not a few pages
+    EXPECT_GT(rewinder.Ring.size(), 10u);
+
+    EXPECT_FALSE(rewinder.SeekTo(rewinder.Oldest() - 1));
+    EXPECT_TRUE(rewinder.SeekTo(rewinder.Oldest()));
+}
+
+TEST_F(RewindTests, StepBackIsQuick) {
+    // A few seconds at 1 MHz with the default snapshot spacing
+    LoadProgram();
+    events.Schedule(777, timer);
+    rewind_6502::Rewinder rewinder(cpu, mem, events);
+    while (cpu.Cycles < 3000000) {
+        rewinder.Tick();
+        cpu.Execute(10000, mem);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++)
+        ASSERT_TRUE(rewinder.StepBack());
+    ASSERT_TRUE(rewinder.SeekTo(500000));
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    EXPECT_LT(ms, 500);
+}
@@ -0,0 +1,233 @@
+#include "gtest/gtest.h"
+#include "savestate.hpp"
+#include "lcd_hd44780.hpp"
+#include "via_65c22.hpp"
+
+#include <chrono>
+#include <cstdlib>
+
+class SaveStateTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+
+    // Something shaped like a real machine: a program, some tables, a
+    // stack, and a lot of nothing
+    void FillMemory() {
+        srand(1234);
+        for (unsigned int i = 0x0200; i < 0x0A00; i++)
+            mem[i] = rand();
+        for (unsigned int i = 0x1000; i < 0x1800; i++)
+            mem[i] = i & 0x1F;
+        for (unsigned int i = 0x01C0; i < 0x0200; i++)
+            mem[i] = i;
+        mem[0xFFFC] = 0x00;
+        mem[0xFFFD] = 0x02;
+    }
+};
+
+TEST_F(SaveStateTests, RoundTrip) {
+    FillMemory();
+    mem[0x0] = cpu.INS_LDA_IM;
+    mem[0x1] = 0x42;
+    mem[0x2] = cpu.INS_LDX_IM;
+    mem[0x3] = 0x07;
+    mem[0x4] = cpu.INS_SEC;
+    cpu.Execute(6, mem);
+    cpu.Cycles += 5000000000ull;     // Well past 32 bits
+    cpu.AssertIRQ(0x04);
+
+    std::string saved = state_6502::Save(cpu, mem);
+
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    cpu2.Reset(*mem2);
+    std::string error;
+    ASSERT_TRUE(state_6502::Load(saved, cpu2, *mem2, state_6502::Devices(), &error)) << error;
+
+    EXPECT_EQ(cpu2.PC, cpu.PC);
+    EXPECT_EQ(cpu2.A, 0x42);
+    EXPECT_EQ(cpu2.X, 0x07);
+    EXPECT_EQ(cpu2.SP, cpu.SP);
+    EXPECT_EQ(cpu2.PSF, cpu.PSF);
+    EXPECT_EQ(cpu2.SF.C, 1);
+    EXPECT_EQ(cpu2.Cycles, cpu.Cycles);
+    EXPECT_EQ(cpu2.IRQLines, 0x04);
+    EXPECT_EQ(memcmp(mem2->Data, mem.Data, MAX_MEM), 0);
+    delete mem2;
+}
+
+TEST_F(SaveStateTests, ZeroPagesAreSkipped) {
+    // An empty machine is little more than headers
+    std::string empty = state_6502::Save(cpu, mem);
+    EXPECT_LT(empty.size(), 100u);
+
+    // Runs and repeats squash, noise doesn't
+    FillMemory();
+    std::string full = state_6502::Save(cpu, mem);
+    EXPECT_LT(full.size(), 0x0800 + 0x0800 / 4 + 200u);
+}
+
+TEST_F(SaveStateTests, CompressorRoundTrip) {
+    cpu_6502::Byte page[PAGE_SIZE], packed[PAGE_SIZE], unpacked[PAGE_SIZE];
+    srand(99);
+    for (int pattern = 0; pattern < 6; pattern++) {
+        for (unsigned int trial = 0; trial < 200; trial++) {
+            for (unsigned int i = 0; i < PAGE_SIZE; i++) {
+                switch (pattern) {
+                    case 0: page[i] = rand(); break;
+                    case 1: page[i] = 0xEA; break;
+                    case 2: page[i] = i % (trial % 17 + 1); break;
+                    case 3: page[i] = rand() % 4; break;
+                    case 4: page[i] = i < trial ? 0 : rand(); break;
+                    case 5: page[i] = (rand() % 8 == 0) ? rand() : page[i ? i - 1 : 0]; break;
+                }
+            }
+            unsigned int size = state_6502::CompressPage(page, packed);
+            ASSERT_LE(size, (unsigned int)PAGE_SIZE);
+            if (size == PAGE_SIZE)
+                continue;
+            memset(unpacked, 0xCC, sizeof(unpacked));
+            ASSERT_TRUE(state_6502::DecompressPage(packed, size, unpacked)) << pattern << " " << trial;
+            ASSERT_EQ(memcmp(page, unpacked, PAGE_SIZE), 0) << pattern << " " << trial;
+        }
+    }
+
+    // A page of one byte is a literal and a single long match or two
+    memset(page, 0x55, sizeof(page));
+    EXPECT_LT(state_6502::CompressPage(page, packed), 10u);
+}
+
+TEST_F(SaveStateTests, CorruptionIsRejected) {
+    FillMemory();
+    cpu.A = 0x11;
+    std::string saved = state_6502::Save(cpu, mem);
+
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    cpu2.Reset(*mem2);
+    cpu2.A = 0x99;
+    (*mem2)[0x0300] = 0x77;
+
+    std::string error;
+    for (size_t at : { size_t(20), saved.size() / 2, saved.size() - 10 }) {
+        std::string bad = saved;
+        bad[at] ^= 0x01;
+        EXPECT_FALSE(state_6502::Load(bad, cpu2, *mem2, state_6502::Devices(), &error)) << at;
+        EXPECT_FALSE(error.empty());
+    }
+
+    EXPECT_FALSE(state_6502::Load(saved.substr(0, saved.size() - 1), cpu2, *mem2));
+    EXPECT_FALSE(state_6502::Load(saved.substr(0, 3), cpu2, *mem2));
+
+    std::string wrongVersion = saved;
+    wrongVersion[4] = 0x7F;
+    EXPECT_FALSE(state_6502::Load(wrongVersion, cpu2, *mem2, state_6502::Devices(), &error));
+    EXPECT_EQ(error, "unsupported save state version");
+
+    EXPECT_FALSE(state_6502::Load("not a save state at all", cpu2, *mem2));
+
+    // None of that touched the machine
+    EXPECT_EQ(cpu2.A, 0x99);
+    EXPECT_EQ((*mem2)[0x0300], 0x77);
+    delete mem2;
+}
+
+TEST_F(SaveStateTests, DevicesRoundTrip) {
+    via_65c22::VIA via(cpu, 0x04);
+    lcd_hd44780::LCD lcd(cpu);
+    via.Port = &lcd;
+    mem.Map(0x6000, 0x6000, &via);
+    via.Write(0x6002, 0xFF);
+    via.Write(0x6003, 0xE0);
+    via.Write(0x6000, 0x5A);
+    lcd.DDRAM[0] = 'h';
+    lcd.DDRAM[1] = 'i';
+    lcd.AC = 2;
+    lcd.TwoLines = true;
+    lcd.DisplayOn = true;
+    lcd.BusyUntil = 123456;
+
+    std::string saved = state_6502::Save(cpu, mem, { { "via", &via }, { "lcd", &lcd } });
+
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    via_65c22::VIA via2(cpu2, 0x04);
+    lcd_hd44780::LCD lcd2(cpu2);
+    cpu2.Reset(*mem2);
+    lcd2.Dirty = false;
+    ASSERT_TRUE(state_6502::Load(saved, cpu2, *mem2, { { "via", &via2 }, { "lcd", &lcd2 } }));
+
+    EXPECT_EQ(via2.DDRB, 0xFF);
+    EXPECT_EQ(via2.DDRA, 0xE0);
+    EXPECT_EQ(via2.ORB, 0x5A);
+    EXPECT_EQ(lcd2.Line(0).substr(0, 2), "hi");
+    EXPECT_EQ(lcd2.AC, 2);
+    EXPECT_TRUE(lcd2.TwoLines);
+    EXPECT_EQ(lcd2.BusyUntil, 123456u);
+    EXPECT_TRUE(lcd2.Dirty);
+
+    // Chunks for devices that aren't there are ignored
+    EXPECT_TRUE(state_6502::Load(saved, cpu2, *mem2));
+    delete mem2;
+}
+
+TEST_F(SaveStateTests, BadDeviceUndoesTheOthers) {
+    // Saves fine, never loads
+    struct Broken : state_6502::Stateful {
+        void SaveState(state_6502::Packer &out) const override { out.U8(0); }
+        bool LoadState(state_6502::Unpacker &) override { return false; }
+    } broken;
+    via_65c22::VIA via(cpu, 0x04);
+    via.Write(0x6002, 0xFF);
+    via.Write(0x6000, 0x5A);
+    cpu.A = 0x11;
+    std::string saved = state_6502::Save(cpu, mem, { { "via", &via }, { "broken", &broken } });
+
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    cpu2.Reset(*mem2);
+    cpu2.A = 0x99;
+    via_65c22::VIA via2(cpu2, 0x04);
+    via2.Write(0x6002, 0x0F);
+    via2.Write(0x6000, 0x03);
+    std::string error;
+    EXPECT_FALSE(state_6502::Load(saved, cpu2, *mem2, { { "via", &via2 }, { "broken", &broken } }, &error));
+    EXPECT_EQ(error, "bad device state");
+
+    // The VIA loaded before the broken one failed, and got put back
+    EXPECT_EQ(via2.DDRB, 0x0F);
+    EXPECT_EQ(via2.ORB, 0x03);
+    EXPECT_EQ(cpu2.A, 0x99);
+    delete mem2;
+}
+
+TEST_F(SaveStateTests, SaveAndLoadAreFast) {
+    FillMemory();
+    cpu_6502::CPU cpu2;
+    mem_28c256::Mem *mem2 = new mem_28c256::Mem;
+    const int ROUNDS = 50;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; i++) {
+        std::string saved = state_6502::Save(cpu, mem);
+        ASSERT_TRUE(state_6502::Load(saved, cpu2, *mem2));
+    }
+    auto each = (std::chrono::steady_clock::now() - start) / ROUNDS;
+
+    // Generous so a loaded or unoptimised build doesn't flake; it's usually
+    // a good deal faster than this
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::microseconds>(each).count(), 2000);
+    delete mem2;
+}
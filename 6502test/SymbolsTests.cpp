@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+#include "symbols.hpp"
+
+#include <cstring>
+#include <unistd.h>
+
+class SymbolsTests : public ::testing::Test {
+    public:
+        symbols_6502::Table symbols;
+        char path[32];
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        strcpy(path, "/tmp/labelsXXXXXX");
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        unlink(path);
+    }
+
+    int Load(const char *text) {
+        FILE *f = fopen(path, "w");
+        fputs(text, f);
+        fclose(f);
+        return symbols.Load(path);
+    }
+};
+
+TEST_F(SymbolsTests, ReadsViceLabels) {
+    EXPECT_EQ(Load("al C:c000 .reset\n"
+                   "al 00C010 .irq\n"
+                   "al C:c020 .@loop\n"
+                   "this line means nothing\n"), 3);
+    EXPECT_EQ(symbols.Format(0xC000), "reset");
+    EXPECT_EQ(symbols.Format(0xC011), "irq+1");
+    EXPECT_EQ(symbols.Format(0xC020), "@loop");
+}
+
+TEST_F(SymbolsTests, ReadsLd65DebugFile) {
+    EXPECT_EQ(Load("version\tmajor=2,minor=0\n"
+                   "sym\tid=0,name=\"putc\",addrsize=absolute,size=6,scope=0,def=1,ref=4,val=0xC100,seg=1,type=lab\n"
+                   "sym\tid=1,name=\"BUFSIZE\",addrsize=zeropage,scope=0,def=2,val=0x40,type=equ\n"
+                   "sym\tid=2,name=\"getc\",addrsize=absolute,scope=0,def=3,val=0xC110,seg=1,type=lab\n"), 2);
+    EXPECT_EQ(symbols.Size(), 2u);
+    EXPECT_EQ(symbols.Format(0xC105), "putc+5");
+    // putc says it's 6 bytes long, so the gap after it belongs to nobody
+    EXPECT_EQ(symbols.Format(0xC106), "$C106");
+    EXPECT_EQ(symbols.Format(0xC1FF), "getc+239");
+}
+
+TEST_F(SymbolsTests, Reads64tassLabels) {
+    EXPECT_EQ(Load("main            = $0200\n"
+                   "print.loop      = $0305\n"
+                   "chrout = $ffd2\n"), 3);
+    EXPECT_EQ(symbols.Format(0x0200), "main");
+    EXPECT_EQ(symbols.Format(0x0306), "print.loop+1");
+    EXPECT_EQ(symbols.Format(0xFFD2), "chrout");
+}
+
+TEST_F(SymbolsTests, ReadsVasmListing) {
+    EXPECT_EQ(Load("Sections:\n"
+                   "00: \"seg8000\" (8000-8020)\n"
+                   "\n"
+                   "Symbols by name:\n"
+                   "loop                             A:8005\n"
+                   "reset                            A:8000\n"
+                   "\n"
+                   "Symbols by value:\n"
+                   "8000 reset\n"
+                   "8005 loop\n"), 2);
+    EXPECT_EQ(symbols.Format(0x8000), "reset");
+    EXPECT_EQ(symbols.Format(0x8007), "loop+2");
+    EXPECT_EQ(symbols.Format(0x7FFF), "$7FFF");
+}
+
+TEST_F(SymbolsTests, MissingFile) {
+    EXPECT_EQ(symbols.Load("/nonexistent/labels"), -1);
+    EXPECT_TRUE(symbols.Empty());
+}
+
+TEST_F(SymbolsTests, OneNamePerAddress) {
+    symbols.Add(0x1000, "@local");
+    symbols.Add(0x1000, "global");
+    symbols.Add(0x1000, "_hidden");
+    symbols.Add(0x2000, "first");
+    symbols.Add(0x2000, "second");
+    symbols.Add(0x3000, "nosize");
+    symbols.Add(0x3000, "sized", 4);
+    symbols.Build();
+
+    ASSERT_EQ(symbols.Size(), 3u);
+    EXPECT_STREQ(symbols.NameOf(*symbols.Exact(0x1000)), "global");
+    EXPECT_STREQ(symbols.NameOf(*symbols.Exact(0x2000)), "first");
+    EXPECT_STREQ(symbols.NameOf(*symbols.Exact(0x3000)), "sized");
+    EXPECT_EQ(symbols.Exact(0x1001), nullptr);
+    EXPECT_EQ(symbols.Find(0x0FFF), nullptr);
+    EXPECT_EQ(symbols.Find(0x3004), nullptr);
+    EXPECT_EQ(symbols.Find(0x2FFF)->Address, 0x2000);
+}
+
+TEST_F(SymbolsTests, FindsEveryAddress) {
+    // Every 16th address, then check the whole space against a straight scan
+    for (unsigned int addr = 0x0010; addr < 0x10000; addr += 16)
+        symbols.Add(symbols_6502::Word(addr), "s" + std::to_string(addr), addr % 64 == 0 ? 8 : 0);
+    symbols.Build();
+
+    for (unsigned int addr = 0; addr < 0x10000; addr++) {
+        const symbols_6502::Symbol *expect = nullptr;
+        unsigned int start = addr & ~15u;
+        if (start) {
+            expect = symbols.Exact(symbols_6502::Word(start));
+            if (start % 64 == 0 && addr - start >= 8)
+                expect = nullptr;
+        }
+        ASSERT_EQ(symbols.Find(symbols_6502::Word(addr)), expect) << addr;
+    }
+}
@@ -0,0 +1,167 @@
+#include "gtest/gtest.h"
+#include "telemetry.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+    struct Latch : mem_28c256::Device {
+        mem_28c256::Byte Value = 0;
+        mem_28c256::Byte Read(mem_28c256::Word) override { return Value; }
+        void Write(mem_28c256::Word, mem_28c256::Byte data) override { Value = data; }
+    };
+}
+
+class TelemetryTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        Latch latch;
+        char path[32];
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        strcpy(path, "/tmp/metricsXXXXXX");
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        unlink(path);
+        unlink((std::string(path) + ".tmp").c_str());
+    }
+
+    std::string Contents() {
+        std::ifstream in(path);
+        std::stringstream text;
+        text << in.rdbuf();
+        return text.str();
+    }
+};
+
+TEST_F(TelemetryTests, PicksUpWhatTheSliceDid) {
+    // loop: LDA $7000 / STA $7001 / JMP loop, 11 cycles a time round, with
+    // an NMI that goes straight back
+    mem.Map(0x7000, 0x70FF, &latch);
+    const cpu_6502::Byte code[] = { cpu.INS_LDA_AB, 0x00, 0x70, cpu.INS_STA_AB, 0x01, 0x70,
+                                    cpu.INS_JMP_AB, 0x00, 0x02 };
+    for (unsigned int i = 0; i < sizeof(code); i++)
+        mem[0x0200 + i] = code[i];
+    mem[0x0300] = cpu.INS_RTI;
+    mem[0xFFFA] = 0x00;
+    mem[0xFFFB] = 0x03;
+    cpu.PC = 0x0200;
+
+    telemetry_6502::Exporter metrics(path);
+    telemetry_6502::Counters &counters = metrics.Thread();
+    counters.Begin(cpu, mem);
+    cpu.Execute(11 * 10, mem);
+    counters.End(cpu, mem);
+    cpu.TriggerNMI();
+    counters.Begin(cpu, mem);
+    cpu.Execute(7 + 6 + 11 * 10, mem);
+    counters.End(cpu, mem);
+
+    telemetry_6502::Totals t = metrics.Sum();
+    EXPECT_EQ(t.Instructions, 61u);     // The NMI isn't one, its RTI is
+    EXPECT_EQ(t.Cycles, 11u * 20 + 13);
+    EXPECT_EQ(t.Interrupts, 1u);
+    EXPECT_EQ(t.DeviceReads, 20u);
+    EXPECT_EQ(t.DeviceWrites, 20u);
+    EXPECT_GT(t.BusyNs, 0u);
+}
+
+TEST_F(TelemetryTests, CountsFetchesFromDevices) {
+    // Running out of a device page: LDA #$A9, opcode and operand both read
+    // from the latch
+    mem.Map(0x7000, 0x70FF, &latch);
+    latch.Value = cpu.INS_LDA_IM;
+    cpu.PC = 0x7000;
+
+    telemetry_6502::Exporter metrics(path);
+    telemetry_6502::Counters &counters = metrics.Thread();
+    counters.Begin(cpu, mem);
+    cpu.Execute(2, mem);
+    counters.End(cpu, mem);
+
+    EXPECT_EQ(cpu.A, latch.Value);
+    EXPECT_EQ(metrics.Sum().DeviceReads, 2u);
+}
+
+TEST_F(TelemetryTests, AddsUpThreads) {
+    telemetry_6502::Exporter metrics(path);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&metrics] {
+            telemetry_6502::Counters &counters = metrics.Thread();
+            for (int j = 0; j < 10000; j++)
+                telemetry_6502::Counters::Add(counters.JobsDone, 1);
+        });
+    }
+    // Reading while they count is fine, it just sees part of it
+    EXPECT_LE(metrics.Sum().JobsDone, 40000u);
+    for (std::thread &t : threads)
+        t.join();
+    EXPECT_EQ(metrics.Sum().JobsDone, 40000u);
+}
+
+TEST_F(TelemetryTests, WritesPrometheusText) {
+    telemetry_6502::Exporter metrics(path);
+    metrics.Labels = "tool=\"test\"";
+    telemetry_6502::Counters &counters = metrics.Thread();
+    telemetry_6502::Counters::Add(counters.Instructions, 5);
+    telemetry_6502::Counters::Add(counters.JobsTimedOut, 1);
+    telemetry_6502::Counters::Set(counters.Snapshots, 2);
+    telemetry_6502::Counters::Set(counters.SnapshotNs, 3000000);
+
+    std::ostringstream out;
+    metrics.Write(out);
+    const std::string text = out.str();
+    EXPECT_NE(text.find("# TYPE emu6502_instructions_total counter\n"
+                        "emu6502_instructions_total{tool=\"test\"} 5\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("emu6502_jobs_total{tool=\"test\",result=\"timeout\"} 1\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("# TYPE emu6502_snapshot_seconds summary\n"
+                        "emu6502_snapshot_seconds_sum{tool=\"test\"} 0.003\n"
+                        "emu6502_snapshot_seconds_count{tool=\"test\"} 2\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("emu6502_threads{tool=\"test\"} 1\n"), std::string::npos) << text;
+
+    // Every line is a comment or a series and a number
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line[0] == '#')
+            continue;
+        size_t space = line.rfind(' ');
+        ASSERT_NE(space, std::string::npos) << line;
+        char *end;
+        strtod(line.c_str() + space + 1, &end);
+        EXPECT_EQ(*end, '\0') << line;
+    }
+}
+
+TEST_F(TelemetryTests, WritesTheFileInTheBackground) {
+    telemetry_6502::Exporter metrics(path, 0.01);
+    telemetry_6502::Counters &counters = metrics.Thread();
+    metrics.Start();
+    telemetry_6502::Counters::Add(counters.Cycles, 1234);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_NE(Contents().find("emu6502_cycles_total "), std::string::npos);
+
+    // Stopping writes it one last time, and no temporary file is left over
+    telemetry_6502::Counters::Add(counters.Cycles, 1);
+    metrics.Stop();
+    EXPECT_NE(Contents().find("emu6502_cycles_total 1235\n"), std::string::npos) << Contents();
+    EXPECT_NE(access((std::string(path) + ".tmp").c_str(), F_OK), 0);
+    EXPECT_EQ(metrics.Failed, 0u);
+}
@@ -0,0 +1,204 @@
+#include "gtest/gtest.h"
+#include "cpu_6502.hpp"
+
+// Instruction timings that depend on where things are in memory. Execute(1)
+// always runs exactly one instruction, so Cycles is its cost.
+class TimingTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+};
+
+TEST_F(TimingTests, AbsoluteXSamePage) {
+    cpu.X = 0x10;
+    mem[0x0] = cpu.INS_LDA_ABX;
+    mem[0x1] = 0x20;
+    mem[0x2] = 0x30;
+    mem[0x3030] = 0x42;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.A, 0x42);
+    EXPECT_EQ(cpu.Cycles, 4u);
+}
+
+TEST_F(TimingTests, AbsoluteXCrossesPageOfEffectiveAddress) {
+    // The instruction itself sits well inside page 0, only the operand
+    // address crosses
+    cpu.X = 0x10;
+    mem[0x0] = cpu.INS_LDA_ABX;
+    mem[0x1] = 0xF8;
+    mem[0x2] = 0x30;
+    mem[0x3108] = 0x42;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.A, 0x42);
+    EXPECT_EQ(cpu.Cycles, 5u);
+}
+
+TEST_F(TimingTests, InstructionOnPageEdgeWithoutOperandCrossing) {
+    // Old code looked at PC crossing instead of the operand address
+    cpu.PC = 0x20FE;
+    cpu.Y = 0x01;
+    mem[0x20FE] = cpu.INS_LDA_ABY;
+    mem[0x20FF] = 0x00;
+    mem[0x2100] = 0x30;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.Cycles, 4u);
+}
+
+TEST_F(TimingTests, StoreAbsoluteXAlwaysFiveCycles) {
+    cpu.X = 0x10;
+    cpu.A = 0x42;
+    mem[0x0] = cpu.INS_STA_ABX;
+    mem[0x1] = 0xF8;
+    mem[0x2] = 0x30;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(mem[0x3108], 0x42);
+    EXPECT_EQ(cpu.Cycles, 5u);
+}
+
+TEST_F(TimingTests, LDYAbsoluteXUsesX) {
+    cpu.X = 0x01;
+    cpu.Y = 0x80;
+    mem[0x0] = cpu.INS_LDY_ABX;
+    mem[0x1] = 0xFF;
+    mem[0x2] = 0x30;
+    mem[0x3100] = 0x42;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.Y, 0x42);
+    EXPECT_EQ(cpu.Cycles, 5u);
+}
+
+TEST_F(TimingTests, BranchNotTaken) {
+    cpu.SF.Z = 1;
+    mem[0x0] = cpu.INS_BNE;
+    mem[0x1] = 0x10;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.PC, 0x2);
+    EXPECT_EQ(cpu.Cycles, 2u);
+}
+
+TEST_F(TimingTests, BranchTakenSamePage) {
+    cpu.SF.Z = 0;
+    mem[0x0] = cpu.INS_BNE;
+    mem[0x1] = 0x10;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.PC, 0x12);
+    EXPECT_EQ(cpu.Cycles, 3u);
+}
+
+TEST_F(TimingTests, BranchTakenAcrossPage) {
+    cpu.PC = 0x10F0;
+    cpu.SF.Z = 0;
+    mem[0x10F0] = cpu.INS_BNE;
+    mem[0x10F1] = 0x20;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.PC, 0x1112);
+    EXPECT_EQ(cpu.Cycles, 4u);
+}
+
+TEST_F(TimingTests, BranchBackwards) {
+    cpu.PC = 0x1010;
+    cpu.SF.Z = 0;
+    mem[0x1010] = cpu.INS_BNE;
+    mem[0x1011] = 0xFC;  // -4
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.PC, 0x100E);
+    EXPECT_EQ(cpu.Cycles, 3u);
+}
+
+TEST_F(TimingTests, BranchBackwardsAcrossPage) {
+    cpu.PC = 0x1000;
+    cpu.SF.Z = 0;
+    mem[0x1000] = cpu.INS_BNE;
+    mem[0x1001] = 0xF0;  // -16
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.PC, 0x0FF2);
+    EXPECT_EQ(cpu.Cycles, 4u);
+}
+
+TEST_F(TimingTests, ReadModifyWriteAbsoluteX) {
+    cpu.X = 0x01;
+    mem[0x0] = cpu.INS_INC_ABX;
+    mem[0x1] = 0x00;
+    mem[0x2] = 0x30;
+    mem[0x3001] = 0x41;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(mem[0x3001], 0x42);
+    EXPECT_EQ(cpu.Cycles, 7u);
+}
+
+TEST_F(TimingTests, IndirectYSamePage) {
+    cpu.Y = 0x04;
+    mem[0x0] = cpu.INS_LDA_IDY;
+    mem[0x1] = 0x40;
+    mem[0x40] = 0x20;
+    mem[0x41] = 0x30;
+    mem[0x3024] = 0x42;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.A, 0x42);
+    EXPECT_EQ(cpu.Cycles, 5u);
+}
+
+TEST_F(TimingTests, IndirectYCrossesPage) {
+    cpu.Y = 0x10;
+    mem[0x0] = cpu.INS_LDA_IDY;
+    mem[0x1] = 0x40;
+    mem[0x40] = 0xF8;
+    mem[0x41] = 0x30;
+    mem[0x3108] = 0x42;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.A, 0x42);
+    EXPECT_EQ(cpu.Cycles, 6u);
+}
+
+TEST_F(TimingTests, IndirectYPointerWrapsInZeroPage) {
+    // The high byte of a pointer at $FF comes from $00, not $0100
+    cpu.PC = 0x0200;
+    cpu.Y = 0x01;
+    mem[0x0200] = cpu.INS_LDA_IDY;
+    mem[0x0201] = 0xFF;
+    mem[0x00FF] = 0x00;
+    mem[0x0000] = 0x30;
+    mem[0x0100] = 0x40;
+    mem[0x3001] = 0x42;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(cpu.A, 0x42);
+    EXPECT_EQ(cpu.Cycles, 5u);
+}
+
+TEST_F(TimingTests, StoreIndirectYAlwaysSixCycles) {
+    cpu.Y = 0x04;
+    cpu.A = 0x42;
+    mem[0x0] = cpu.INS_STA_IDY;
+    mem[0x1] = 0x40;
+    mem[0x40] = 0x20;
+    mem[0x41] = 0x30;
+    cpu.Execute(1, mem);
+
+    EXPECT_EQ(mem[0x3024], 0x42);
+    EXPECT_EQ(cpu.Cycles, 6u);
+}
@@ -0,0 +1,322 @@
+#include "gtest/gtest.h"
+#include "trace.hpp"
+#include "cpu_6502.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+    // Copies so EXPECT_EQ can take them by reference
+    const cpu_6502::Byte LDA_ZP = cpu_6502::CPU::INS_LDA_ZP;
+    const cpu_6502::Byte STA_ABX = cpu_6502::CPU::INS_STA_ABX;
+    const cpu_6502::Byte INX = cpu_6502::CPU::INS_INX;
+    const cpu_6502::Byte JMP_AB = cpu_6502::CPU::INS_JMP_AB;
+    const cpu_6502::Byte RTI = cpu_6502::CPU::INS_RTI;
+}
+
+class TraceTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        char path[32];
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        strcpy(path, "/tmp/traceXXXXXX");
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        unlink(path);
+    }
+
+    // loop: LDA $10 / STA $0300,X / INX / JMP loop
+    void LoadLoop() {
+        cpu_6502::Byte prog[] = {
+            cpu.INS_LDA_ZP, 0x10,
+            cpu.INS_STA_ABX, 0x00, 0x03,
+            cpu.INS_INX,
+            cpu.INS_JMP_AB, 0x00, 0x02,
+        };
+        for (unsigned int i = 0; i < sizeof(prog); i++)
+            mem[0x0200 + i] = prog[i];
+        mem[0x0010] = 0x77;
+        cpu.PC = 0x0200;
+    }
+};
+
+TEST_F(TraceTests, RecordsEveryInstruction) {
+    LoadLoop();
+    trace_6502::Tracer tracer;
+    ASSERT_TRUE(tracer.Open(path));
+    cpu.Trace = &tracer;
+    cpu.Execute(26, mem);       // Two times round the loop
+    cpu.Trace = nullptr;
+    tracer.Close();
+
+    std::vector<trace_6502::Record> records;
+    ASSERT_TRUE(trace_6502::ReadFile(path, records));
+    ASSERT_EQ(records.size(), 8u);
+    EXPECT_EQ(tracer.Records(), 8u);
+
+    EXPECT_EQ(records[0].Cycle, 0u);
+    EXPECT_EQ(records[0].PC, 0x0200);
+    EXPECT_EQ(records[0].Opcode, LDA_ZP);
+    EXPECT_EQ(records[0].Operand[0], 0x10);
+    EXPECT_EQ(records[0].EA, 0x0010);
+    EXPECT_EQ(records[0].A, 0x00);          // Before it ran
+
+    EXPECT_EQ(records[1].Cycle, 3u);
+    EXPECT_EQ(records[1].Opcode, STA_ABX);
+    EXPECT_EQ(records[1].Operand[0], 0x00);
+    EXPECT_EQ(records[1].Operand[1], 0x03);
+    EXPECT_EQ(records[1].A, 0x77);
+    EXPECT_EQ(records[1].EA, 0x0300);
+
+    EXPECT_EQ(records[2].Opcode, INX);
+    EXPECT_EQ(records[2].EA, 0x0000);       // Implied, nothing to point at
+    EXPECT_EQ(records[3].Opcode, JMP_AB);
+    EXPECT_EQ(records[3].EA, 0x0200);
+
+    EXPECT_EQ(records[5].X, 0x01);
+    EXPECT_EQ(records[5].EA, 0x0301);
+    EXPECT_EQ(records[7].Cycle, 23u);
+    for (const auto &r : records)
+        EXPECT_EQ(r.Kind, trace_6502::KIND_INSTRUCTION);
+}
+
+TEST_F(TraceTests, InterruptsAreMarked) {
+    LoadLoop();
+    mem[0xFFFA] = 0x00;
+    mem[0xFFFB] = 0x04;
+    mem[0x0400] = cpu.INS_RTI;
+
+    trace_6502::Tracer tracer;
+    ASSERT_TRUE(tracer.Open(path));
+    cpu.Trace = &tracer;
+    cpu.Execute(3, mem);
+    cpu.TriggerNMI();
+    cpu.Execute(1, mem);
+    cpu.Execute(1, mem);
+    cpu.Trace = nullptr;
+    tracer.Close();
+
+    std::vector<trace_6502::Record> records;
+    ASSERT_TRUE(trace_6502::ReadFile(path, records));
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[1].Kind, trace_6502::KIND_NMI);
+    EXPECT_EQ(records[1].PC, 0x0202);       // Where it got interrupted
+    EXPECT_EQ(records[1].EA, 0xFFFA);
+    EXPECT_EQ(records[2].PC, 0x0400);
+    EXPECT_EQ(records[2].Opcode, RTI);
+}
+
+TEST_F(TraceTests, SmallRingLosesNothing) {
+    LoadLoop();
+    trace_6502::Tracer tracer;
+    ASSERT_TRUE(tracer.Open(path, 1));      // Rounds up to one block
+    cpu.Trace = &tracer;
+    for (int i = 0; i < 100; i++)
+        cpu.Execute(10000, mem);
+    cpu.Trace = nullptr;
+    tracer.Close();
+    EXPECT_FALSE(tracer.Failed);
+
+    std::vector<trace_6502::Record> records;
+    ASSERT_TRUE(trace_6502::ReadFile(path, records));
+    ASSERT_EQ(records.size(), tracer.Records());
+    ASSERT_GT(records.size(), 4u * tracer.Capacity);
+    for (size_t i = 1; i < records.size(); i++) {
+        ASSERT_GT(records[i].Cycle, records[i - 1].Cycle) << "record " << i;
+        if (records[i].Opcode == STA_ABX)
+            ASSERT_EQ(records[i].EA, 0x0300 + records[i].X);
+    }
+}
+
+TEST_F(TraceTests, TracingIsCheap) {
+    LoadLoop();
+    auto run = [this]() {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 40; i++)
+            cpu.Execute(100000, mem);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    double plain = run();
+
+    trace_6502::Tracer tracer;
+    ASSERT_TRUE(tracer.Open(path));
+    cpu.Trace = &tracer;
+    double traced = run();
+    cpu.Trace = nullptr;
+    tracer.Close();
+
+    // Aiming for 2x. There's slack for a busy disk or a debug build.
+    EXPECT_LT(traced, plain * 4 + 0.05);
+}
+
+TEST_F(TraceTests, CodecRoundTrip) {
+    // Every field moving about, including ones that go backwards
+    std::vector<trace_6502::Record> records(5000);
+    uint64_t cycle = 7;
+    for (size_t i = 0; i < records.size(); i++) {
+        trace_6502::Record &r = records[i];
+        memset(&r, 0, sizeof(r));
+        r.Cycle = cycle += 2 + i % 5 + (i == 1000 ? 1ull << 40 : 0);
+        r.PC = i % 17 == 0 ? 0xFFF0 - i : 0x0200 + i % 40;
+        r.EA = i % 3 ? 0x0300 + (i * 37) % 0x1000 : 0;
+        r.Opcode = i % 9;
+        r.Operand[0] = i % 40 == 5 ? i : 0x10;
+        r.Operand[1] = 0x03;
+        r.A = i / 3;
+        r.X = i % 256;
+        r.Y = i % 7;
+        r.SP = 0xFF - i % 2;
+        r.P = 0x20;
+        r.Kind = i % 500 == 0 ? trace_6502::KIND_IRQ : trace_6502::KIND_INSTRUCTION;
+    }
+
+    std::string encoded, packed, unpacked;
+    trace_6502::Encode(records.data(), records.size(), encoded);
+    trace_6502::Pack(encoded, packed);
+    ASSERT_TRUE(trace_6502::Unpack((const cpu_6502::Byte *)packed.data(), packed.size(), encoded.size(), unpacked));
+    EXPECT_EQ(unpacked, encoded);
+
+    std::vector<trace_6502::Record> decoded;
+    ASSERT_TRUE(trace_6502::Decode((const cpu_6502::Byte *)encoded.data(), encoded.size(), records.size(), decoded));
+    ASSERT_EQ(decoded.size(), records.size());
+    for (size_t i = 0; i < records.size(); i++)
+        ASSERT_EQ(memcmp(&decoded[i], &records[i], sizeof(trace_6502::Record)), 0) << "record " << i;
+
+    // Damage gets caught rather than read past
+    decoded.clear();
+    EXPECT_FALSE(trace_6502::Decode((const cpu_6502::Byte *)encoded.data(), encoded.size() - 1, records.size(), decoded));
+    EXPECT_FALSE(trace_6502::Unpack((const cpu_6502::Byte *)packed.data(), packed.size() - 1, encoded.size(), unpacked));
+}
+
+TEST_F(TraceTests, SeekByCycle) {
+    LoadLoop();
+    trace_6502::Tracer tracer;
+    ASSERT_TRUE(tracer.Open(path));
+    cpu.Trace = &tracer;
+    cpu.Execute(1000000, mem);
+    cpu.Trace = nullptr;
+    tracer.Close();
+
+    // A loop like this packs down to well under a byte an instruction
+    EXPECT_LT(tracer.Bytes, tracer.Records());
+
+    trace_6502::Reader reader;
+    ASSERT_TRUE(reader.Open(path));
+    EXPECT_FALSE(reader.Recovered);
+    EXPECT_EQ(reader.Records(), tracer.Records());
+    EXPECT_GT(reader.Index.size(), 20u);
+
+    // The loop is 13 cycles: LDA at +0, STA at +3, INX at +8, JMP at +10.
+    // X goes up once a time round.
+    uint64_t cycle = 13 * 12345 + 9;
+    trace_6502::Record r;
+    ASSERT_TRUE(reader.At(cycle, r));
+    EXPECT_EQ(r.Cycle, 13u * 12345 + 8);
+    EXPECT_EQ(r.Opcode, INX);
+    EXPECT_EQ(r.X, 12345 % 256);
+
+    EXPECT_EQ(reader.Find(0), 0);
+    long last = reader.Find(cpu.Cycles);
+    EXPECT_EQ(last, long(reader.Index.size()) - 1);
+    ASSERT_TRUE(reader.At(reader.Index[last].FirstCycle, r));
+    EXPECT_EQ(r.Cycle, reader.Index[last].FirstCycle);
+}
+
+TEST_F(TraceTests, ReadsWithoutIndex) {
+    LoadLoop();
+    trace_6502::Tracer tracer;
+    ASSERT_TRUE(tracer.Open(path));
+    cpu.Trace = &tracer;
+    cpu.Execute(200000, mem);
+    cpu.Trace = nullptr;
+    tracer.Close();
+
+    trace_6502::Reader reader;
+    ASSERT_TRUE(reader.Open(path));
+    std::vector<trace_6502::BlockInfo> index = reader.Index;
+    uint64_t end = index.back().Offset + index.back().Packed;
+    reader.Close();
+
+    // As if the emulator died before it got to write the index, and part
+    // way through the last block
+    ASSERT_EQ(truncate(path, end - 10), 0);
+    ASSERT_TRUE(reader.Open(path));
+    EXPECT_TRUE(reader.Recovered);
+    ASSERT_EQ(reader.Index.size(), index.size() - 1);
+    for (size_t i = 0; i < reader.Index.size(); i++) {
+        EXPECT_EQ(reader.Index[i].Offset, index[i].Offset);
+        EXPECT_EQ(reader.Index[i].Hash, index[i].Hash);
+    }
+    trace_6502::Record r;
+    EXPECT_TRUE(reader.At(100000, r));
+}
+
+TEST_F(TraceTests, FindsFirstDivergence) {
+    auto record = [this](const char *file, cpu_6502::Byte poke) {
+        cpu.Reset(mem);
+        LoadLoop();
+        trace_6502::Tracer tracer;
+        ASSERT_TRUE(tracer.Open(file));
+        cpu.Trace = &tracer;
+        cpu.Execute(500000, mem);
+        // Something different gets loaded from here on
+        mem[0x0010] = poke;
+        cpu.Execute(300000, mem);
+        cpu.Trace = nullptr;
+    };
+
+    std::string other = std::string(path) + ".b";
+    record(path, 0x77);
+    record(other.c_str(), 0x78);
+
+    trace_6502::Reader a, b;
+    ASSERT_TRUE(a.Open(path));
+    ASSERT_TRUE(b.Open(other));
+    trace_6502::Divergence d;
+    ASSERT_TRUE(trace_6502::FirstDivergence(a, b, d));
+    ASSERT_TRUE(d.Found);
+
+    // The first STA after the poke is the first to see the new A
+    std::vector<trace_6502::Record> left, right;
+    ASSERT_TRUE(a.Get(d.Record - 1, 2, left));
+    ASSERT_TRUE(b.Get(d.Record - 1, 2, right));
+    ASSERT_EQ(left.size(), 2u);
+    EXPECT_EQ(memcmp(&left[0], &right[0], sizeof(trace_6502::Record)), 0);
+    EXPECT_EQ(left[1].Opcode, STA_ABX);
+    EXPECT_EQ(left[1].A, 0x77);
+    EXPECT_EQ(right[1].A, 0x78);
+    EXPECT_GE(left[1].Cycle, 500000u);
+    EXPECT_LT(left[1].Cycle, 500000u + 13);
+
+    // Only the one block got looked inside
+    EXPECT_EQ(d.BlocksDecoded, 1u);
+    EXPECT_EQ(d.BlocksSkipped, d.Record / trace_6502::BLOCK_RECORDS);
+
+    // Against itself, and against a shorter copy of itself
+    ASSERT_TRUE(trace_6502::FirstDivergence(a, a, d));
+    EXPECT_FALSE(d.Found);
+    EXPECT_EQ(d.BlocksDecoded, 0u);
+    b.Close();
+    record(other.c_str(), 0x77);
+    std::vector<trace_6502::BlockInfo> index = a.Index;
+    ASSERT_EQ(truncate(other.c_str(), index[10].Offset - 40), 0);
+    ASSERT_TRUE(b.Open(other));
+    ASSERT_TRUE(trace_6502::FirstDivergence(a, b, d));
+    EXPECT_TRUE(d.Found);
+    EXPECT_EQ(d.Record, 10u * trace_6502::BLOCK_RECORDS);
+    unlink(other.c_str());
+}
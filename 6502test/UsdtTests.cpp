@@ -0,0 +1,102 @@
+#include "gtest/gtest.h"
+#include "cpu_6502.hpp"
+#include "usdt.hpp"
+
+// Only builds that have probes have anything to look for
+#ifdef CPU_6502_USDT
+
+#include <elf.h>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+    // provider:name -> argument string, read back out of our own binary the
+    // way bpftrace would find them
+    std::map<std::string, std::string> Probes() {
+        std::map<std::string, std::string> probes;
+        std::ifstream file("/proc/self/exe", std::ios::binary);
+        std::vector<char> elf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (elf.size() < sizeof(Elf64_Ehdr))
+            return probes;
+        const Elf64_Ehdr *header = (const Elf64_Ehdr *)elf.data();
+        const Elf64_Shdr *sections = (const Elf64_Shdr *)(elf.data() + header->e_shoff);
+        const char *names = elf.data() + sections[header->e_shstrndx].sh_offset;
+
+        for (unsigned int i = 0; i < header->e_shnum; i++) {
+            if (std::string(names + sections[i].sh_name) != ".note.stapsdt")
+                continue;
+            const char *p = elf.data() + sections[i].sh_offset;
+            const char *end = p + sections[i].sh_size;
+            while (p + sizeof(Elf64_Nhdr) <= end) {
+                const Elf64_Nhdr *note = (const Elf64_Nhdr *)p;
+                const char *desc = p + sizeof(Elf64_Nhdr) + ((note->n_namesz + 3) & ~3u);
+                // Probe address, base and semaphore, then three strings
+                const char *provider = desc + 3 * 8;
+                const char *name = provider + strlen(provider) + 1;
+                const char *args = name + strlen(name) + 1;
+                probes[std::string(provider) + ":" + name] = args;
+                p = desc + ((note->n_descsz + 3) & ~3u);
+            }
+        }
+        return probes;
+    }
+}
+
+class UsdtTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+    }
+};
+
+TEST_F(UsdtTests, ProbesAreInTheBinary) {
+    std::map<std::string, std::string> probes = Probes();
+    ASSERT_FALSE(probes.empty());
+
+    // One size@location per argument, sizes as bpftrace reads them
+    const char *expected[][2] = {
+        { "emu6502:slice_start", "8@ 4@" },
+        { "emu6502:slice_end", "8@ 8@" },
+        { "emu6502:instruction", "2@ 1@ 1@ 1@ 1@ 1@" },
+        { "emu6502:interrupt", "1@ 2@ 8@" },
+        { "emu6502:interrupt_return", "2@ 8@" },
+        { "emu6502:device_read", "2@ 1@" },
+        { "emu6502:device_write", "2@ 1@" },
+    };
+    for (auto &e : expected) {
+        ASSERT_TRUE(probes.count(e[0])) << e[0];
+        std::string sizes;
+        for (size_t at = 0; (at = probes[e[0]].find('@', at)) != std::string::npos; at++) {
+            size_t start = probes[e[0]].rfind(' ', at);
+            start = start == std::string::npos ? 0 : start + 1;
+            sizes += (sizes.empty() ? "" : " ") + probes[e[0]].substr(start, at - start + 1);
+        }
+        EXPECT_EQ(sizes, e[1]) << e[0] << ": " << probes[e[0]];
+    }
+}
+
+TEST_F(UsdtTests, ProbesDontChangeAnything) {
+    // Nothing attached, so the CPU just runs: LDA #$42 / STP
+    mem[0x0200] = cpu.INS_LDA_IM;
+    mem[0x0201] = 0x42;
+    mem[0x0202] = cpu.INS_STP;
+    cpu.PC = 0x0200;
+    cpu.Execute(5, mem);
+    EXPECT_EQ(cpu.A, 0x42);
+    EXPECT_TRUE(cpu.Stopped);
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include "gtest/gtest.h"
+#include "via_65c22.hpp"
+
+class VIATests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        events_6502::Scheduler events;
+        via_65c22::VIA *via;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        cpu.Events = &events;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        via = new via_65c22::VIA(cpu, 0x04);
+        via->Events = &events;
+        mem.Map(0x6000, 0x6000, via);
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        delete via;
+    }
+
+    // Move time on and run whatever came due
+    void RunTo(uint64_t cycle) {
+        cpu.Cycles = cycle;
+        events.RunUntil(cycle);
+    }
+
+    void StartT1(cpu_6502::Word count) {
+        mem.Write(0x6004, count & 0xFF);
+        mem.Write(0x6005, count >> 8);
+    }
+
+    cpu_6502::Word Counter() {
+        cpu_6502::Word hi = mem.Read(0x6005);
+        return hi << 8 | mem.Read(0x6004);
+    }
+};
+
+TEST_F(VIATests, OneShotInterruptsOnce) {
+    mem.Write(0x600E, 0xC0);    // Enable timer 1
+    EXPECT_EQ(mem.Read(0x600E), 0xC0);
+    RunTo(100);
+    StartT1(0x0010);
+    EXPECT_EQ(mem.Read(0x6007), 0x00);
+    EXPECT_EQ(mem.Read(0x6006), 0x10);
+
+    RunTo(105);
+    EXPECT_EQ(mem.Read(0x6005), 0x00);
+    EXPECT_EQ(mem.Read(0x600D), 0x00);
+
+    RunTo(116);
+    EXPECT_EQ(mem.Read(0x600D), 0x00);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+
+    // N+1 cycles after the start it goes past zero
+    RunTo(117);
+    EXPECT_EQ(cpu.IRQLines, 0x04);
+    EXPECT_EQ(mem.Read(0x600D), 0xC0);
+
+    // Reading the low counter byte acknowledges it, and it stays quiet
+    EXPECT_EQ(mem.Read(0x6004), 0xFF);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+    RunTo(100000);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+    EXPECT_EQ(mem.Read(0x600D), 0x00);
+}
+
+TEST_F(VIATests, FreeRunReloadsFromTheLatch) {
+    mem.Write(0x600B, via_65c22::ACR_T1_FREE_RUN);
+    mem.Write(0x600E, 0xC0);
+    StartT1(0x0008);
+
+    // 8 down to 0, 0xFFFF, then the latch again: ten cycles a round
+    RunTo(8);
+    EXPECT_EQ(Counter(), 0x0000);
+    RunTo(9);
+    EXPECT_EQ(cpu.IRQLines, 0x04);
+    EXPECT_EQ(Counter(), 0xFFFF);
+    RunTo(10);
+    EXPECT_EQ(Counter(), 0x0008);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+
+    RunTo(18);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+    RunTo(19);
+    EXPECT_EQ(cpu.IRQLines, 0x04);
+
+    // Clearing the flag through IFR works too
+    mem.Write(0x600D, via_65c22::IRQ_T1);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+    RunTo(29);
+    EXPECT_EQ(cpu.IRQLines, 0x04);
+}
+
+TEST_F(VIATests, NewLatchWaitsForTheReload) {
+    mem.Write(0x600B, via_65c22::ACR_T1_FREE_RUN);
+    StartT1(0x0008);
+    RunTo(4);
+    mem.Write(0x6006, 0x20);
+    EXPECT_EQ(Counter(), 0x0004);
+
+    // Flag set but not enabled, so /IRQ stays high
+    RunTo(10);
+    EXPECT_EQ(mem.Read(0x600D), via_65c22::IRQ_T1);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+    EXPECT_EQ(Counter(), 0x0020);
+}
+
+TEST_F(VIATests, RunsWithoutAScheduler) {
+    via->Events = nullptr;
+    mem.Write(0x600E, 0xC0);
+    StartT1(0x0010);
+    RunTo(1000);
+    EXPECT_EQ(cpu.IRQLines, 0x00);
+
+    // Noticed on the next read
+    EXPECT_EQ(mem.Read(0x600D), 0xC0);
+    EXPECT_EQ(cpu.IRQLines, 0x04);
+}
+
+TEST_F(VIATests, DestroyingCancelsTheTimer) {
+    StartT1(0x0010);
+    EXPECT_EQ(events.NextEvent(), 17u);
+    mem.Map(0x6000, 0x6000, NULL);
+    delete via;
+    via = nullptr;
+    EXPECT_EQ(events.NextEvent(), events_6502::NO_EVENT);
+}
+
+TEST_F(VIATests, SaveStateKeepsTheTimerGoing) {
+    mem.Write(0x600B, via_65c22::ACR_T1_FREE_RUN);
+    mem.Write(0x600E, 0xC0);
+    StartT1(0x0063);
+    RunTo(250);
+
+    state_6502::Packer out;
+    via->SaveState(out);
+
+    cpu_6502::CPU cpu2;
+    cpu2.Reset(mem);
+    cpu2.Cycles = 250;
+    events_6502::Scheduler events2;
+    via_65c22::VIA via2(cpu2, 0x04);
+    via2.Events = &events2;
+    state_6502::Unpacker in(out.Data);
+    ASSERT_TRUE(via2.LoadState(in));
+
+    // Fired at 100 and 201, next one is at 302
+    EXPECT_EQ(via2.Read(0x6005) << 8 | via2.Read(0x6004), 0x0063 - 48);
+    EXPECT_EQ(cpu2.IRQLines, 0x00);
+    cpu2.Cycles = 301;
+    events2.RunUntil(301);
+    EXPECT_EQ(cpu2.IRQLines, 0x00);
+    cpu2.Cycles = 302;
+    events2.RunUntil(302);
+    EXPECT_EQ(cpu2.IRQLines, 0x04);
+
+    state_6502::Unpacker truncated(out.Data.substr(0, out.Data.size() - 1));
+    EXPECT_FALSE(via2.LoadState(truncated));
+}
+
+TEST_F(VIATests, FirmwareTicks) {
+    // Free-running timer every 1000 cycles, IRQ handler counts ticks in $10
+    cpu_6502::Byte prog[] = {
+        cpu.INS_LDA_IM, 0x40, cpu.INS_STA_AB, 0x0B, 0x60,
+        cpu.INS_LDA_IM, 0xC0, cpu.INS_STA_AB, 0x0E, 0x60,
+        cpu.INS_LDA_IM, 0xE6, cpu.INS_STA_AB, 0x04, 0x60,
+        cpu.INS_LDA_IM, 0x03, cpu.INS_STA_AB, 0x05, 0x60,
+        cpu.INS_CLI,
+        cpu.INS_JMP_AB, 0x15, 0x02,
+    };
+    cpu_6502::Byte handler[] = {
+        cpu.INS_INC_ZP, 0x10,
+        cpu.INS_BIT_AB, 0x04, 0x60,
+        cpu.INS_RTI,
+    };
+    for (unsigned int i = 0; i < sizeof(prog); i++)
+        mem[0x0200 + i] = prog[i];
+    for (unsigned int i = 0; i < sizeof(handler); i++)
+        mem[0x0300 + i] = handler[i];
+    mem[0xFFFE] = 0x00;
+    mem[0xFFFF] = 0x03;
+    cpu.PC = 0x0200;
+    cpu.SF.I = 1;
+
+    cpu.Execute(10500, mem);
+
+    EXPECT_EQ(mem[0x0010], 10);
+}
@@ -0,0 +1,190 @@
+#include "gtest/gtest.h"
+#include "acia_6551.hpp"
+#include "checkpoint.hpp"
+#include "hash.hpp"
+#include "verify.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+    const unsigned int SEGMENTS = 8;
+}
+
+// ACIA at 0x5000, firmware copying serial input to 0x10 onwards and an NMI
+// handler counting presses in 0x80
+struct SerialVerifyMachine : verify_6502::Machine {
+    acia_6551::ACIA *Acia;
+    replay_6502::NmiButton Button;
+
+    SerialVerifyMachine() : Button(Cpu, Events, Journal) {
+        Acia = new acia_6551::ACIA(Cpu, Events, 0x01);
+        Mem.Map(0x5000, 0x5000, Acia);
+        Devices.push_back(std::make_pair("acia", Acia));
+
+        // loop: LDA $5001 / AND #$08 / BEQ loop / LDA $5000 / STA $10,X / INX / JMP loop
+        cpu_6502::Byte prog[] = {
+            Cpu.INS_LDA_AB, 0x01, 0x50,
+            Cpu.INS_AND_IM, 0x08,
+            Cpu.INS_BEQ, 0xF9,
+            Cpu.INS_LDA_AB, 0x00, 0x50,
+            Cpu.INS_STA_ZPX, 0x10,
+            Cpu.INS_INX,
+            Cpu.INS_JMP_AB, 0x00, 0x02,
+        };
+        for (unsigned int i = 0; i < sizeof(prog); i++)
+            Mem[0x0200 + i] = prog[i];
+        Mem[0x0300] = Cpu.INS_INC_ZP;
+        Mem[0x0301] = 0x80;
+        Mem[0x0302] = Cpu.INS_RTI;
+        Mem[0xFFFA] = 0x00;
+        Mem[0xFFFB] = 0x03;
+        Cpu.PC = 0x0200;
+    }
+
+    ~SerialVerifyMachine() {
+        delete Acia;
+    }
+
+    void Resumed() override {
+        Acia->Journal = &Journal;
+        Button.Start();
+    }
+};
+
+class VerifyTests : public ::testing::Test {
+    public:
+        cpu_6502::CPU cpu;
+        mem_28c256::Mem mem;
+        char dir[32];
+        std::string base;
+        std::string journal;
+
+    void SetUp() override {
+        // Called immediately after the constructor
+        cpu.Reset( mem );
+        cpu.PC = 0x0000;
+        EXPECT_EQ(cpu.PC, 0x0);
+
+        strcpy(dir, "/tmp/verifyXXXXXX");
+        ASSERT_NE(mkdtemp(dir), nullptr);
+        base = std::string(dir) + "/run";
+        journal = std::string(dir) + "/journal";
+    }
+
+    void TearDown() override {
+        // Called immediately after the test
+        for (const std::string &f : checkpoint_6502::List(base))
+            unlink(f.c_str());
+        unlink(journal.c_str());
+        rmdir(dir);
+    }
+
+    // Type a little and press the button now and then, with a checkpoint
+    // between every Execute() call
+    void RecordSession() {
+        SerialVerifyMachine m;
+        int host[2];
+        ASSERT_EQ(pipe(host), 0);
+        m.Acia->AttachFds(host[0], -1);
+        ASSERT_TRUE(m.Journal.Record(journal, m.Cpu.Cycles));
+        m.Resumed();
+
+        checkpoint_6502::Checkpointer checkpoints(base, SEGMENTS + 1);
+        checkpoints.Take(m.Cpu, m.Mem, m.Devices);
+        checkpoints.Flush();
+        for (unsigned int i = 0; i < SEGMENTS; i++) {
+            char c = 'a' + i;
+            ASSERT_EQ(write(host[1], &c, 1), 1);
+            m.Cpu.Execute(4321, m.Mem);
+            if (i % 3 == 1)
+                m.Button.Pressed = 1;
+            m.Cpu.Execute(2345, m.Mem);
+            // Waiting each time so none get merged
+            checkpoints.Take(m.Cpu, m.Mem, m.Devices);
+            checkpoints.Flush();
+        }
+
+        EXPECT_EQ(memcmp(&m.Mem.Data[0x10], "abcdefgh", SEGMENTS), 0);
+        EXPECT_EQ(m.Mem.Data[0x80], 3);
+        m.Journal.Close();
+        m.Acia->Detach();
+        close(host[0]);
+        close(host[1]);
+    }
+};
+
+TEST_F(VerifyTests, HashCoversEverything) {
+    uint64_t h = hash_6502::Hash(cpu, mem);
+    EXPECT_EQ(hash_6502::Hash(cpu, mem), h);
+
+    mem[0x1234] ^= 0x01;
+    uint64_t poked = hash_6502::Hash(cpu, mem);
+    EXPECT_NE(poked, h);
+    mem[0x1234] ^= 0x01;
+    EXPECT_EQ(hash_6502::Hash(cpu, mem), h);
+
+    // Same byte moved to another page
+    mem[0x1334] ^= 0x01;
+    EXPECT_NE(hash_6502::Hash(cpu, mem), poked);
+    mem[0x1334] ^= 0x01;
+
+    cpu.Cycles++;
+    EXPECT_NE(hash_6502::Hash(cpu, mem), h);
+}
+
+TEST_F(VerifyTests, SegmentsReplayInParallel) {
+    RecordSession();
+    std::vector<std::string> files = checkpoint_6502::List(base);
+    ASSERT_EQ(files.size(), SEGMENTS + 1);
+
+    verify_6502::Verifier verifier;
+    verifier.Threads = 4;
+    EXPECT_TRUE(verifier.Run(files, journal, []() { return new SerialVerifyMachine; }));
+    ASSERT_EQ(verifier.Segments.size(), SEGMENTS);
+    EXPECT_EQ(verifier.FirstBad, -1);
+    for (const auto &seg : verifier.Segments) {
+        EXPECT_TRUE(seg.Ok) << seg.From << ": " << seg.Error;
+        EXPECT_EQ(seg.Got, seg.Expected);
+        EXPECT_LT(seg.StartCycle, seg.EndCycle);
+    }
+}
+
+TEST_F(VerifyTests, FirstDivergentSegmentIsReported) {
+    RecordSession();
+    std::vector<std::string> files = checkpoint_6502::List(base);
+    ASSERT_EQ(files.size(), SEGMENTS + 1);
+
+    // Knock out a byte of one checkpoint: the segments either side of it
+    // can't both come out right any more
+    SerialVerifyMachine m;
+    ASSERT_TRUE(state_6502::LoadFile(files[5], m.Cpu, m.Mem, m.Devices));
+    m.Mem[0x0800] ^= 0xFF;
+    ASSERT_TRUE(state_6502::SaveFile(files[5], m.Cpu, m.Mem, m.Devices));
+
+    verify_6502::Verifier verifier;
+    EXPECT_FALSE(verifier.Run(files, journal, []() { return new SerialVerifyMachine; }));
+    EXPECT_EQ(verifier.FirstBad, 4);
+    EXPECT_TRUE(verifier.Segments[3].Ok);
+    EXPECT_FALSE(verifier.Segments[4].Ok);
+    EXPECT_TRUE(verifier.Segments[4].Error.empty());
+    EXPECT_FALSE(verifier.Segments[5].Ok);
+    EXPECT_TRUE(verifier.Segments[6].Ok);
+}
+
+TEST_F(VerifyTests, JournalFromAnotherRunDiverges) {
+    RecordSession();
+    std::vector<std::string> files = checkpoint_6502::List(base);
+
+    // Same checkpoints, but nobody typed anything this time
+    replay_6502::Journal empty;
+    ASSERT_TRUE(empty.Record(journal, 0));
+    empty.Close();
+
+    verify_6502::Verifier verifier;
+    EXPECT_FALSE(verifier.Run(files, journal, []() { return new SerialVerifyMachine; }));
+    EXPECT_EQ(verifier.FirstBad, 0);
+    EXPECT_FALSE(verifier.Segments[0].Ok);
+}
@@ -190,11 +190,11 @@ TEST_F(CPUFunctionTests, AddressingIndirectIndexedTest) {
 	mem[0x0000] = 0x02;
 	mem[0x0001] = 0x02;
 
-	mem[0x0006] = 0x08;	//0x2 + 0x4
-	mem[0x0007] = 0x80;	
+	mem[0x0002] = 0x08;	//$8008 + Y
+	mem[0x0003] = 0x80;
 
     cpu_6502::Word addr = cpu.AddressingIndirectIndexed(mem);
-    EXPECT_EQ(addr, 0x8008);
+    EXPECT_EQ(addr, 0x800C);
 }
 
 TEST_F(CPUFunctionTests, PushPopByteTest) {
@@ -180,9 +180,9 @@ TEST_F(LoadRegisterTest, TestLDAIndirectY) {
 	mem[0x0000] = cpu.INS_LDA_IDY;
 	mem[0x0001] = 0x02;
 
-	mem[0x0006] = 0x00;	//0x2 + 0x4
-	mem[0x0007] = 0x80;	
-	mem[0x8000] = 0x37;
+	mem[0x0002] = 0x00;	//$8000 + Y
+	mem[0x0003] = 0x80;
+	mem[0x8004] = 0x37;
 
     cpu.Execute(5, mem);
     
@@ -151,12 +151,12 @@ TEST_F(MemoryInstructionTests, TestSTAIndirectY) {
 	mem[0x0000] = cpu.INS_STA_IDY;
 	mem[0x0001] = 0x02;
 
-	mem[0x0006] = 0x00;	//0x2 + 0x4
-	mem[0x0007] = 0x80;	
+	mem[0x0002] = 0x00;	//$8000 + Y
+	mem[0x0003] = 0x80;
 
     cpu.Execute(6, mem);
     
-    EXPECT_EQ(mem[0x8000], 0x42);
+    EXPECT_EQ(mem[0x8004], 0x42);
 }
 
 TEST_F(MemoryInstructionTests, TestSTXZeroPage) {
@@ -0,0 +1,349 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <unistd.h>
+
+#include "cpu_6502.hpp"
+#include "mem_28c256.hpp"
+#include "telemetry.hpp"
+
+// Runs a manifest of independent jobs, one per line:
+//
+//     rom.bin seed [cycles]
+//
+// Each job loads the ROM, puts the 32 bit seed at --seed-addr, starts at the
+// reset vector and runs until STP or the cycle budget runs out. The exit code
+// is whatever is in A at the STP. One result line per job goes to the output
+// file, in completion order:
+//
+//     line rom seed cycles exit checksum ok|timeout
+//
+// where line is the job's line in the manifest, exit is -1 on a timeout and
+// checksum is a 64 bit FNV-1a of all of memory.
+
+namespace {
+    void Usage(const char *argv0) {
+        std::cerr << "Usage: " << argv0 << " [options] manifest results\n"
+                  << "  --threads N     worker threads (default: one per core)\n"
+                  << "  --cycles N      cycle budget for jobs that don't give one (default: 100000000)\n"
+                  << "  --seed-addr A   where the seed goes, little endian (default: 0x00FC)\n"
+                  << "  --no-pin        don't pin workers to cores\n"
+                  << "  --metrics F     write Prometheus metrics to F for node_exporter's textfile collector\n"
+                  << "  --metrics-every S  seconds between metrics writes (default: 10)\n";
+    }
+
+    // How many cycles to hand Execute() at once
+    const unsigned int SLICE = 1000000;
+
+    // Results are batched per worker and written out in chunks this big
+    const size_t OUTPUT_CHUNK = 64 * 1024;
+
+    using Image = std::vector<cpu_6502::Byte>;
+
+    struct Job {
+        uint64_t Line;
+        std::string RomName;
+        std::shared_ptr<const Image> Rom;
+        uint32_t Seed;
+        uint64_t Cycles;
+    };
+
+    // One per worker. The owner takes from the front, thieves from the back,
+    // so they only fight over the lock when a queue is nearly empty.
+    struct WorkQueue {
+        std::mutex Lock;
+        std::deque<Job> Jobs;
+    };
+
+    struct Pool {
+        std::vector<std::unique_ptr<WorkQueue>> Queues;
+        std::atomic<uint64_t> Queued{0};
+        std::atomic<bool> Done{false};      // Manifest fully read
+
+        // Keeps the manifest reader from racing ahead of the workers
+        uint64_t MaxQueued = 0;
+        std::mutex ReaderLock;
+        std::condition_variable Space;
+
+        // Workers with nothing to do sleep here
+        std::mutex IdleLock;
+        std::condition_variable Work;
+
+        std::mutex OutputLock;
+        FILE *Output = NULL;
+
+        uint16_t SeedAddr = 0x00FC;
+        bool Pin = true;
+        telemetry_6502::Exporter *Metrics = NULL;
+
+        void Push(unsigned int queue, Job job);
+        bool Take(unsigned int self, Job &job);
+        void Worker(unsigned int self);
+        void Write(std::string &chunk);
+    };
+
+    uint64_t Checksum(const mem_28c256::Mem &mem) {
+        // FNV-1a, 64 bit
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (unsigned int i = 0; i < MAX_MEM; i++)
+            hash = (hash ^ mem.Data[i]) * 0x100000001b3ull;
+        return hash;
+    }
+
+    void PinToCore(unsigned int n) {
+#ifdef __linux__
+        // Count through the CPUs we're allowed on rather than assuming 0..N-1,
+        // so running under taskset or a cgroup does the right thing.
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+            return;
+        n %= CPU_COUNT(&allowed);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed) || n-- != 0)
+                continue;
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+            return;
+        }
+#else
+        (void)n;
+#endif
+    }
+}
+
+void Pool::Push(unsigned int queue, Job job) {
+    {
+        std::unique_lock<std::mutex> lock(ReaderLock);
+        Space.wait(lock, [this] { return Queued.load() < MaxQueued; });
+    }
+    // Count it before it's visible so a worker can't finish it first
+    Queued++;
+    {
+        std::lock_guard<std::mutex> lock(Queues[queue]->Lock);
+        Queues[queue]->Jobs.push_back(std::move(job));
+    }
+    std::lock_guard<std::mutex> lock(IdleLock);
+    Work.notify_one();
+}
+
+bool Pool::Take(unsigned int self, Job &job) {
+    {
+        WorkQueue &own = *Queues[self];
+        std::lock_guard<std::mutex> lock(own.Lock);
+        if (!own.Jobs.empty()) {
+            job = std::move(own.Jobs.front());
+            own.Jobs.pop_front();
+            return true;
+        }
+    }
+    for (unsigned int i = 1; i < Queues.size(); i++) {
+        WorkQueue &victim = *Queues[(self + i) % Queues.size()];
+        std::lock_guard<std::mutex> lock(victim.Lock);
+        if (!victim.Jobs.empty()) {
+            job = std::move(victim.Jobs.back());
+            victim.Jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Pool::Write(std::string &chunk) {
+    std::lock_guard<std::mutex> lock(OutputLock);
+    fwrite(chunk.data(), 1, chunk.size(), Output);
+    chunk.clear();
+}
+
+void Pool::Worker(unsigned int self) {
+    if (Pin)
+        PinToCore(self);
+
+    // Allocated after pinning so the pages land on this core's NUMA node
+    std::unique_ptr<cpu_6502::CPU> cpu(new cpu_6502::CPU);
+    std::unique_ptr<mem_28c256::Mem> mem(new mem_28c256::Mem);
+    std::string results;
+    Job job;
+    telemetry_6502::Counters *telemetry = Metrics ? &Metrics->Thread() : NULL;
+
+    for (;;) {
+        if (!Take(self, job)) {
+            if (Done && Queued == 0)
+                break;
+            std::unique_lock<std::mutex> lock(IdleLock);
+            Work.wait_for(lock, std::chrono::milliseconds(1));
+            continue;
+        }
+
+        cpu->Reset(*mem);
+        memcpy(mem->Data, job.Rom->data(), MAX_MEM);
+        for (unsigned int i = 0; i < 4; i++)
+            (*mem)[(SeedAddr + i) & 0xFFFF] = job.Seed >> (8 * i);
+        cpu->PC = cpu->ReadWord(0xFFFC, *mem);
+
+        while (!cpu->Stopped && cpu->Cycles < job.Cycles) {
+            uint64_t slice = SLICE;
+            if (job.Cycles - cpu->Cycles < slice)
+                slice = job.Cycles - cpu->Cycles;
+            if (telemetry)
+                telemetry->Begin(*cpu, *mem);
+            cpu->Execute(slice, *mem);
+            if (telemetry)
+                telemetry->End(*cpu, *mem);
+        }
+        if (telemetry)
+            telemetry_6502::Counters::Add(cpu->Stopped ? telemetry->JobsDone : telemetry->JobsTimedOut, 1);
+
+        char line[512];
+        snprintf(line, sizeof(line), "%llu %s %u %llu %d %016llx %s\n",
+                 (unsigned long long)job.Line, job.RomName.c_str(), job.Seed,
+                 (unsigned long long)(cpu->Stopped ? cpu->StoppedAt : cpu->Cycles), cpu->Stopped ? cpu->A : -1,
+                 (unsigned long long)Checksum(*mem), cpu->Stopped ? "ok" : "timeout");
+        results += line;
+        if (results.size() >= OUTPUT_CHUNK)
+            Write(results);
+
+        if (Queued-- == MaxQueued) {
+            std::lock_guard<std::mutex> lock(ReaderLock);
+            Space.notify_one();
+        }
+    }
+    if (!results.empty())
+        Write(results);
+}
+
+int main(int argc, char **argv) {
+    unsigned int threads = std::thread::hardware_concurrency();
+    uint64_t defaultCycles = 100000000;
+    std::vector<std::string> files;
+    Pool pool;
+    std::string metricsPath;
+    double metricsEvery = 10;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+            threads = strtoul(argv[++i], NULL, 0);
+        else if (arg == "--cycles" && i + 1 < argc)
+            defaultCycles = strtoull(argv[++i], NULL, 0);
+        else if (arg == "--seed-addr" && i + 1 < argc)
+            pool.SeedAddr = strtoul(argv[++i], NULL, 0);
+        else if (arg == "--no-pin")
+            pool.Pin = false;
+        else if (arg == "--metrics" && i + 1 < argc)
+            metricsPath = argv[++i];
+        else if (arg == "--metrics-every" && i + 1 < argc)
+            metricsEvery = strtod(argv[++i], NULL);
+        else if (arg[0] != '-')
+            files.push_back(arg);
+        else {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if (files.size() != 2 || !(metricsEvery > 0)) {
+        Usage(argv[0]);
+        return 2;
+    }
+    if (threads == 0)
+        threads = 1;
+
+    std::ifstream manifest(files[0]);
+    if (!manifest) {
+        std::cerr << "Couldn't open " << files[0] << "\n";
+        return 1;
+    }
+    pool.Output = fopen(files[1].c_str(), "w");
+    if (!pool.Output) {
+        std::cerr << "Couldn't open " << files[1] << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<telemetry_6502::Exporter> metrics;
+    if (!metricsPath.empty()) {
+        metrics.reset(new telemetry_6502::Exporter(metricsPath, metricsEvery));
+        metrics->Labels = "tool=\"6502batch\",pid=\"" + std::to_string(getpid()) + "\"";
+        metrics->Start();
+        pool.Metrics = metrics.get();
+    }
+
+    pool.MaxQueued = 256 * threads;
+    for (unsigned int i = 0; i < threads; i++)
+        pool.Queues.emplace_back(new WorkQueue);
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(&Pool::Worker, &pool, i);
+
+    // The same few ROMs usually come up over and over with different seeds,
+    // so each one is only read from disk once and then shared read-only.
+    std::map<std::string, std::shared_ptr<const Image>> roms;
+    std::string text;
+    uint64_t lineNo = 0, jobs = 0;
+    int status = 0;
+    while (std::getline(manifest, text)) {
+        lineNo++;
+        std::istringstream fields(text);
+        Job job;
+        unsigned long long seed = 0;
+        if (!(fields >> job.RomName) || job.RomName[0] == '#')
+            continue;
+        if (!(fields >> seed)) {
+            std::cerr << files[0] << ":" << lineNo << ": expected 'rom seed [cycles]'\n";
+            status = 1;
+            continue;
+        }
+        if (!(fields >> job.Cycles))
+            job.Cycles = defaultCycles;
+
+        std::shared_ptr<const Image> &rom = roms[job.RomName];
+        if (!rom) {
+            std::shared_ptr<Image> image(new Image(MAX_MEM, 0));
+            FILE *file = fopen(job.RomName.c_str(), "rb");
+            if (!file) {
+                std::cerr << files[0] << ":" << lineNo << ": couldn't open " << job.RomName << "\n";
+                roms.erase(job.RomName);
+                status = 1;
+                continue;
+            }
+            fread(image->data(), 1, MAX_MEM, file);
+            fclose(file);
+            rom = image;
+        }
+
+        job.Line = lineNo;
+        job.Rom = rom;
+        job.Seed = seed;
+        pool.Push(jobs++ % threads, std::move(job));
+    }
+
+    pool.Done = true;
+    for (std::thread &worker : workers)
+        worker.join();
+    fclose(pool.Output);
+    if (metrics) {
+        metrics->Stop();
+        if (metrics->Failed)
+            std::cerr << "Couldn't write metrics to " << metricsPath << " " << metrics->Failed << " times\n";
+    }
+    std::cerr << jobs << " jobs on " << threads << " threads\n";
+    return status;
+}
@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cpu_6502.hpp"
+#include "hostperf.hpp"
+#include "mem_28c256.hpp"
+
+// Runs ROMs flat out and says how fast, and what the host spent doing it:
+//
+//     6502bench [--cycles N] [--runs N] [--slice N] rom.bin...
+//
+// Each ROM starts from its reset vector and runs until STP or the cycle
+// budget, and the fastest of --runs goes in the table. Everything after MHz
+// is per emulated instruction: ns, host cycles, host instructions (hins),
+// branch misses and L1 data cache misses. The host counters come from perf
+// events, and without them only the times get filled in.
+
+namespace {
+    void Usage(const char *argv0) {
+        std::cerr << "Usage: " << argv0 << " [options] rom.bin...\n"
+                  << "  --cycles N      cycle budget per run (default: 100000000)\n"
+                  << "  --runs N        runs per ROM, the fastest is reported (default: 3)\n"
+                  << "  --slice N       cycles per Execute() call (default: 1000000)\n";
+    }
+
+    struct Result {
+        uint64_t Instructions = 0;
+        uint64_t Cycles = 0;
+        hostperf_6502::Sample Host;
+    };
+
+    bool Run(const std::vector<cpu_6502::Byte> &rom, uint64_t budget, uint64_t slice,
+             hostperf_6502::Counters &counters, Result &result) {
+        std::unique_ptr<cpu_6502::CPU> cpu(new cpu_6502::CPU);
+        std::unique_ptr<mem_28c256::Mem> mem(new mem_28c256::Mem);
+        cpu->Reset(*mem);
+        memcpy(mem->Data, rom.data(), MAX_MEM);
+        cpu->PC = cpu->ReadWord(0xFFFC, *mem);
+        cpu->Cycles = 0;
+
+        counters.Clear();
+        while (!cpu->Stopped && cpu->Cycles < budget) {
+            uint64_t n = budget - cpu->Cycles < slice ? budget - cpu->Cycles : slice;
+            counters.Start();
+            cpu->Execute(n, *mem);
+            counters.Stop();
+        }
+        result.Instructions = cpu->Instructions;
+        result.Cycles = cpu->Cycles;
+        result.Host = counters.Total;
+        return cpu->Instructions > 0;
+    }
+
+    void Field(bool available, uint64_t count, uint64_t instructions, int width) {
+        if (available && instructions)
+            printf(" %*.3f", width, double(count) / instructions);
+        else
+            printf(" %*s", width, "-");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t budget = 100000000;
+    unsigned int runs = 3;
+    uint64_t slice = 1000000;
+    std::vector<std::string> roms;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--cycles" && i + 1 < argc)
+            budget = strtoull(argv[++i], NULL, 0);
+        else if (arg == "--runs" && i + 1 < argc)
+            runs = strtoul(argv[++i], NULL, 0);
+        else if (arg == "--slice" && i + 1 < argc)
+            slice = strtoull(argv[++i], NULL, 0);
+        else if (arg[0] != '-')
+            roms.push_back(arg);
+        else {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if (roms.empty() || budget == 0 || runs == 0 || slice == 0 || slice > 0xFFFFFFFFu) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    hostperf_6502::Counters counters;
+    if (!counters.Hardware())
+        std::cerr << "No perf counters, timing only (" << counters.Why << ")\n";
+    else if (!counters.Why.empty())
+        std::cerr << "Some perf counters missing (" << counters.Why << ")\n";
+
+    using namespace hostperf_6502;
+    printf("%-24s %10s %8s %8s %9s %9s %6s %9s %9s\n", "rom", "MIPS", "MHz", "ns/ins", "cyc/ins", "hins/ins",
+           "IPC", "brmis/ins", "l1mis/ins");
+    int status = 0;
+    for (const std::string &path : roms) {
+        std::vector<cpu_6502::Byte> rom(MAX_MEM, 0);
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file) {
+            std::cerr << "Couldn't open " << path << "\n";
+            status = 1;
+            continue;
+        }
+        size_t got = fread(rom.data(), 1, MAX_MEM, file);
+        fclose(file);
+        if (got != MAX_MEM) {
+            std::cerr << path << ": only read " << got << " of " << MAX_MEM << " bytes\n";
+            status = 1;
+            continue;
+        }
+
+        Result best, result;
+        for (unsigned int run = 0; run < runs; run++) {
+            if (Run(rom, budget, slice, counters, result) && (!best.Host.Ns || result.Host.Ns < best.Host.Ns))
+                best = result;
+        }
+        if (!best.Instructions) {
+            std::cerr << path << ": didn't run any instructions\n";
+            status = 1;
+            continue;
+        }
+
+        double seconds = best.Host.Ns / 1e9;
+        const uint64_t *count = best.Host.Count;
+        printf("%-24s %10.2f %8.2f %8.2f", path.c_str(), best.Instructions / seconds / 1e6,
+               best.Cycles / seconds / 1e6, double(best.Host.Ns) / best.Instructions);
+        Field(counters.Available(HOST_CYCLES), count[HOST_CYCLES], best.Instructions, 9);
+        Field(counters.Available(HOST_INSTRUCTIONS), count[HOST_INSTRUCTIONS], best.Instructions, 9);
+        if (counters.Available(HOST_CYCLES) && counters.Available(HOST_INSTRUCTIONS) && count[HOST_CYCLES])
+            printf(" %6.2f", double(count[HOST_INSTRUCTIONS]) / count[HOST_CYCLES]);
+        else
+            printf(" %6s", "-");
+        Field(counters.Available(BRANCH_MISSES), count[BRANCH_MISSES], best.Instructions, 9);
+        Field(counters.Available(L1D_MISSES), count[L1D_MISSES], best.Instructions, 9);
+        printf("\n");
+    }
+    return status;
+}
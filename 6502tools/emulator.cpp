@@ -0,0 +1,634 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "acia_6551.hpp"
+#include "block_device.hpp"
+#include "checkpoint.hpp"
+#include "coverage.hpp"
+#include "cpu_6502.hpp"
+#include "hash.hpp"
+#include "hostperf.hpp"
+#include "lcd_hd44780.hpp"
+#include "mem_28c256.hpp"
+#include "pacer.hpp"
+#include "profile.hpp"
+#include "replay.hpp"
+#include "savestate.hpp"
+#include "scheduler.hpp"
+#include "symbols.hpp"
+#include "telemetry.hpp"
+#include "trace.hpp"
+#include "verify.hpp"
+#include "via_65c22.hpp"
+
+namespace {
+    void Usage(const char *argv0) {
+        std::cerr << "Usage: " << argv0 << " [options] rom.bin\n"
+                  << "       " << argv0 << " --checkpoint B --verify F [device options]\n"
+                  << "  --cycles N      stop after running N cycles (default: run until STP)\n"
+                  << "  --hz N          pace the emulated clock to N Hz (default: flat out)\n"
+                  << "  --jitter-us N   max pacing jitter in microseconds (default: 2000)\n"
+                  << "  --report        print registers and timing when done\n"
+                  << "  --acia ADDR     map a 6551 ACIA at ADDR (e.g. 0x5000)\n"
+                  << "  --acia-host H   where the ACIA talks to: stdio (default), pty, unix:PATH\n"
+                  << "  --via ADDR      map a 65C22 VIA at ADDR (e.g. 0x6000)\n"
+                  << "  --lcd           wire an HD44780 LCD to the VIA and draw it on stderr\n"
+                  << "  --disk IMAGE    attach a block device backed by IMAGE\n"
+                  << "  --disk-addr A   where the block device sits (default: 0x7000)\n"
+                  << "  --disk-ro       don't let the 6502 write to the image\n"
+                  << "  --load-state F  resume from save state F instead of the reset vector\n"
+                  << "  --save-state F  write a save state to F when done\n"
+                  << "  --checkpoint B  write checkpoints to B.000001, B.000002... in the background\n"
+                  << "  --checkpoint-every N   cycles between checkpoints (default: 10000000)\n"
+                  << "  --checkpoint-keep N    how many checkpoints to keep (default: 3)\n"
+                  << "  --resume        carry on from the newest good checkpoint, if there is one\n"
+                  << "  --record F      log serial input and NMIs to journal F\n"
+                  << "  --replay F      take serial input and NMIs from journal F instead of the host\n"
+                  << "  --verify F      replay journal F between each pair of checkpoints in parallel\n"
+                  << "                  and check every one ends up where it did when recorded\n"
+                  << "  --threads N     threads to verify with (default: one per core)\n"
+                  << "  --hash-log F    write the machine state hash to F every --hash-every cycles\n"
+                  << "  --hash-every N  cycles between hashes (default: 1000000)\n"
+                  << "  --trace F       write every instruction to binary trace file F\n"
+                  << "  --profile F     write hot opcodes, addresses and branches to F when done\n"
+                  << "                  (- for stderr; needs a build with -DPROFILE=ON)\n"
+                  << "  --folded F      write cycles per call path to F for flamegraph tools\n"
+                  << "                  (needs a build with -DPROFILE=ON)\n"
+                  << "  --coverage F    write bytes executed, read and written per symbol to F\n"
+                  << "                  (- for stderr; needs a build with -DPROFILE=ON)\n"
+                  << "  --heatmap F     write memory accesses per page to F, a CSV if it ends in .csv,\n"
+                  << "                  otherwise a PPM image (needs a build with -DPROFILE=ON)\n"
+                  << "  --metrics F     write Prometheus metrics to F for node_exporter's textfile collector\n"
+                  << "  --metrics-every S  seconds between metrics writes (default: 10)\n"
+                  << "  --labels F      name addresses in the profile and coverage from symbol file F\n"
+                  << "                  (ld65 -Ln or --dbgfile, 64tass, vasm listing; can be repeated)\n"
+                  << "SIGUSR1 presses the NMI button.\n";
+    }
+
+    // How many cycles to hand Execute() at once when running flat out
+    const unsigned int FLAT_OUT_SLICE = 1000000;
+
+    // Which bit of CPU::IRQLines each device pulls on
+    const cpu_6502::Byte IRQ_ACIA = 0x01;
+    const cpu_6502::Byte IRQ_DISK = 0x02;
+    const cpu_6502::Byte IRQ_VIA = 0x04;
+
+    // What's plugged in, from the command line
+    struct Options {
+        long AciaAddr = -1;
+        long ViaAddr = -1;
+        bool LcdOn = false;
+        uint64_t Hz = 0;
+    };
+
+    // The signal handler only sets a flag, the button does the rest
+    replay_6502::NmiButton *NmiButton = NULL;
+
+    void PressNmi(int) {
+        if (NmiButton)
+            NmiButton->Pressed = 1;
+    }
+
+    // Ctrl-C and kill end the run between slices, so the terminal, the
+    // journal and checkpoints all get put away as if it had finished
+    volatile sig_atomic_t Quit = 0;
+
+    void RequestQuit(int sig) {
+        Quit = sig;
+    }
+
+    // The machine and the devices that can go in a save state. Verifying
+    // builds lots of these with nothing attached to the host; the disk is
+    // left to main() since it needs an image opening.
+    struct Machine : verify_6502::Machine {
+        acia_6551::ACIA *Acia = NULL;
+        via_65c22::VIA *Via = NULL;
+        lcd_hd44780::LCD *Lcd = NULL;
+        block_device::BlockDevice *Disk = NULL;
+        replay_6502::NmiButton Button;
+
+        Machine(const Options &opts) : Button(Cpu, Events, Journal) {
+            if (opts.AciaAddr >= 0) {
+                Acia = new acia_6551::ACIA(Cpu, Events, IRQ_ACIA);
+                Mem.Map(opts.AciaAddr, opts.AciaAddr, Acia);
+                Devices.push_back(std::make_pair("acia", Acia));
+            }
+            if (opts.ViaAddr >= 0) {
+                Via = new via_65c22::VIA(Cpu, IRQ_VIA);
+                Via->Events = &Events;
+                Mem.Map(opts.ViaAddr, opts.ViaAddr, Via);
+                Devices.push_back(std::make_pair("via", Via));
+            }
+            if (opts.LcdOn) {
+                Lcd = new lcd_hd44780::LCD(Cpu);
+                if (opts.Hz)
+                    Lcd->ClockHz = opts.Hz;
+                Via->Port = Lcd;
+                Devices.push_back(std::make_pair("lcd", Lcd));
+            }
+        }
+
+        ~Machine() {
+            if (NmiButton == &Button)
+                NmiButton = NULL;
+            delete Disk;
+            delete Lcd;
+            delete Via;
+            delete Acia;
+        }
+
+        void Resumed() override {
+            if (Acia && (Journal.Recording() || Journal.Replaying()))
+                Acia->Journal = &Journal;
+            Button.Start();
+        }
+    };
+
+    int Verify(const std::string &base, const std::string &journal, unsigned int threads, const Options &opts) {
+        std::vector<std::string> files = checkpoint_6502::List(base);
+        if (files.size() < 2) {
+            std::cerr << "Need at least two checkpoints of " << base << " to verify\n";
+            return 1;
+        }
+
+        verify_6502::Verifier verifier;
+        verifier.Threads = threads;
+        bool ok = verifier.Run(files, journal, [&]() { return new Machine(opts); });
+
+        for (const auto &seg : verifier.Segments) {
+            std::cerr << seg.From << " -> " << seg.To << ": cycles " << seg.StartCycle << "-" << seg.EndCycle << " ";
+            if (seg.Ok)
+                std::cerr << "ok\n";
+            else if (!seg.Error.empty())
+                std::cerr << seg.Error << "\n";
+            else
+                std::cerr << std::hex << "state " << seg.Got << ", expected " << seg.Expected << std::dec << "\n";
+        }
+        if (!ok) {
+            const auto &bad = verifier.Segments[verifier.FirstBad];
+            std::cerr << "First divergent segment: " << bad.From << " -> " << bad.To << "\n";
+            return 3;
+        }
+        std::cerr << verifier.Segments.size() << " segments verified\n";
+        return 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    uint64_t nCycles = 0;
+    uint64_t jitterUs = 2000;
+    bool report = false;
+    std::string aciaHost = "stdio";
+    std::string diskImage;
+    long diskAddr = 0x7000;
+    bool diskReadOnly = false;
+    std::string loadState;
+    std::string saveState;
+    std::string checkpointBase;
+    uint64_t checkpointEvery = 10000000;
+    unsigned int checkpointKeep = 3;
+    bool resume = false;
+    std::string recordPath;
+    std::string replayPath;
+    std::string verifyPath;
+    unsigned int threads = 0;
+    std::string hashLog;
+    uint64_t hashEvery = 1000000;
+    std::string tracePath;
+    std::string profilePath;
+    std::string foldedPath;
+    std::string coveragePath;
+    std::string heatmapPath;
+    std::vector<std::string> labelPaths;
+    std::string metricsPath;
+    double metricsEvery = 10;
+    std::string rom;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--cycles" && i + 1 < argc)
+            nCycles = strtoull(argv[++i], NULL, 0);
+        else if (arg == "--hz" && i + 1 < argc)
+            opts.Hz = strtoull(argv[++i], NULL, 0);
+        else if (arg == "--jitter-us" && i + 1 < argc)
+            jitterUs = strtoull(argv[++i], NULL, 0);
+        else if (arg == "--report")
+            report = true;
+        else if (arg == "--acia" && i + 1 < argc)
+            opts.AciaAddr = strtol(argv[++i], NULL, 0);
+        else if (arg == "--acia-host" && i + 1 < argc)
+            aciaHost = argv[++i];
+        else if (arg == "--via" && i + 1 < argc)
+            opts.ViaAddr = strtol(argv[++i], NULL, 0);
+        else if (arg == "--lcd")
+            opts.LcdOn = true;
+        else if (arg == "--disk" && i + 1 < argc)
+            diskImage = argv[++i];
+        else if (arg == "--disk-addr" && i + 1 < argc)
+            diskAddr = strtol(argv[++i], NULL, 0);
+        else if (arg == "--disk-ro")
+            diskReadOnly = true;
+        else if (arg == "--load-state" && i + 1 < argc)
+            loadState = argv[++i];
+        else if (arg == "--save-state" && i + 1 < argc)
+            saveState = argv[++i];
+        else if (arg == "--checkpoint" && i + 1 < argc)
+            checkpointBase = argv[++i];
+        else if (arg == "--checkpoint-every" && i + 1 < argc)
+            checkpointEvery = strtoull(argv[++i], NULL, 0);
+        else if (arg == "--checkpoint-keep" && i + 1 < argc)
+            checkpointKeep = strtoul(argv[++i], NULL, 0);
+        else if (arg == "--resume")
+            resume = true;
+        else if (arg == "--record" && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (arg == "--verify" && i + 1 < argc)
+            verifyPath = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = strtoul(argv[++i], NULL, 0);
+        else if (arg == "--hash-log" && i + 1 < argc)
+            hashLog = argv[++i];
+        else if (arg == "--hash-every" && i + 1 < argc)
+            hashEvery = strtoull(argv[++i], NULL, 0);
+        else if (arg == "--trace" && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (arg == "--profile" && i + 1 < argc)
+            profilePath = argv[++i];
+        else if (arg == "--folded" && i + 1 < argc)
+            foldedPath = argv[++i];
+        else if (arg == "--coverage" && i + 1 < argc)
+            coveragePath = argv[++i];
+        else if (arg == "--heatmap" && i + 1 < argc)
+            heatmapPath = argv[++i];
+        else if (arg == "--metrics" && i + 1 < argc)
+            metricsPath = argv[++i];
+        else if (arg == "--metrics-every" && i + 1 < argc)
+            metricsEvery = strtod(argv[++i], NULL);
+        else if (arg == "--labels" && i + 1 < argc)
+            labelPaths.push_back(argv[++i]);
+        else if (arg[0] != '-' && rom.empty())
+            rom = arg;
+        else {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((rom.empty() && verifyPath.empty()) || (opts.LcdOn && opts.ViaAddr < 0) ||
+        (resume && checkpointBase.empty()) || checkpointEvery == 0 || hashEvery == 0 ||
+        (!recordPath.empty() && !replayPath.empty()) || !(metricsEvery > 0)) {
+        Usage(argv[0]);
+        return 2;
+    }
+#ifndef CPU_6502_PROFILE
+    if (!profilePath.empty() || !foldedPath.empty() || !coveragePath.empty() || !heatmapPath.empty()) {
+        std::cerr << "This build has no profiler, configure with -DPROFILE=ON\n";
+        return 2;
+    }
+#endif
+
+    // Everything needed comes from the checkpoints. The disk image isn't
+    // part of a save state, so there's nothing to check a disk against.
+    if (!verifyPath.empty()) {
+        if (checkpointBase.empty() || !diskImage.empty()) {
+            Usage(argv[0]);
+            return 2;
+        }
+        return Verify(checkpointBase, verifyPath, threads, opts);
+    }
+
+    signal(SIGINT, RequestQuit);
+    signal(SIGTERM, RequestQuit);
+
+    std::unique_ptr<Machine> m(new Machine(opts));
+    cpu_6502::CPU &cpu = m->Cpu;
+    mem_28c256::Mem &mem = m->Mem;
+    if (!mem.LoadMem(rom))
+        return 1;
+    cpu.PC = cpu.ReadWord(0xFFFC, mem);   // Start at the reset vector
+
+    if (m->Acia) {
+        bool attached = false;
+        if (aciaHost == "stdio")
+            attached = m->Acia->AttachStdio();
+        else if (aciaHost == "pty") {
+            std::string slave;
+            attached = m->Acia->OpenPty(slave);
+            if (attached)
+                std::cerr << "ACIA on " << slave << "\n";
+        } else if (aciaHost.compare(0, 5, "unix:") == 0)
+            attached = m->Acia->ListenUnixSocket(aciaHost.substr(5));
+        if (!attached) {
+            std::cerr << "Couldn't attach ACIA to " << aciaHost << "\n";
+            return 1;
+        }
+    }
+
+    if (!diskImage.empty()) {
+        m->Disk = new block_device::BlockDevice(cpu, mem, m->Events, IRQ_DISK);
+        if (!m->Disk->Open(diskImage, diskReadOnly)) {
+            std::cerr << "Couldn't open disk image " << diskImage << "\n";
+            return 1;
+        }
+        mem.Map(diskAddr, diskAddr, m->Disk);
+        m->Devices.push_back(std::make_pair("disk", m->Disk));
+    }
+
+    // Devices have to exist before a state can be loaded into them, and
+    // the same set has to be given on the command line as when it was saved
+    if (!loadState.empty()) {
+        std::string error;
+        if (!state_6502::LoadFile(loadState, cpu, mem, m->Devices, &error)) {
+            std::cerr << loadState << ": " << error << "\n";
+            return 1;
+        }
+    }
+    if (resume) {
+        std::string from;
+        if (checkpoint_6502::Resume(checkpointBase, cpu, mem, m->Devices, &from))
+            std::cerr << "Resuming from " << from << "\n";
+    }
+
+    // Anything driven off the cycle counter starts after a state is loaded,
+    // otherwise it'd spend a while catching up
+    if (m->Lcd)
+        m->Lcd->StartRendering(m->Events, std::cerr);
+
+    // Recording starts, or replay picks up, wherever the machine is now.
+    // The recording gets flushed between slices, so even a run that's
+    // killed outright leaves a journal that replays up to the last one.
+    replay_6502::Journal &journal = m->Journal;
+    if (!recordPath.empty() && !journal.Record(recordPath, cpu.Cycles)) {
+        std::cerr << "Couldn't create journal " << recordPath << "\n";
+        return 1;
+    }
+    if (!replayPath.empty()) {
+        std::string error;
+        if (!journal.Replay(replayPath, cpu.Cycles, &error)) {
+            std::cerr << replayPath << ": " << error << "\n";
+            return 1;
+        }
+    }
+    m->Resumed();
+    NmiButton = &m->Button;
+    signal(SIGUSR1, PressNmi);
+
+    // Checkpoints are taken between Execute() calls rather than from an
+    // event, so nothing due on the same cycle has run yet. That's where a
+    // replay from the checkpoint starts too, which is what --verify needs.
+    std::unique_ptr<checkpoint_6502::Checkpointer> checkpoints;
+    uint64_t nextCheckpoint = cpu.Cycles + checkpointEvery;
+    auto checkpointDue = [&]() {
+        if (checkpoints && cpu.Cycles >= nextCheckpoint) {
+            checkpoints->Take(cpu, mem, m->Devices);
+            nextCheckpoint = cpu.Cycles + checkpointEvery;
+        }
+    };
+
+    // Hashes go on a fixed grid so two runs of the same thing can be diffed
+    // line by line; the first line that differs says where to start looking.
+    // Run flat out for that, paced runs only stop between batches.
+    FILE *hashes = NULL;
+    hash_6502::Tracker tracker;
+    uint64_t nextHash = (cpu.Cycles / hashEvery + 1) * hashEvery;
+    uint64_t hashedAt = ~0ull;
+    auto hashDue = [&]() {
+        if (hashes && cpu.Cycles >= nextHash) {
+            fprintf(hashes, "%llu %016llx\n", (unsigned long long)cpu.Cycles,
+                    (unsigned long long)tracker.Hash(cpu, mem, m->Devices));
+            nextHash = (cpu.Cycles / hashEvery + 1) * hashEvery;
+            hashedAt = cpu.Cycles;
+        }
+    };
+    if (!hashLog.empty() && !(hashes = fopen(hashLog.c_str(), "w"))) {
+        std::cerr << "Couldn't create hash log " << hashLog << "\n";
+        return 1;
+    }
+
+    if (!checkpointBase.empty()) {
+        checkpoints.reset(new checkpoint_6502::Checkpointer(checkpointBase, checkpointKeep));
+        // A recording can only be verified from its first checkpoint on
+        if (journal.Recording())
+            checkpoints->Take(cpu, mem, m->Devices);
+    }
+
+    trace_6502::Tracer tracer;
+    if (!tracePath.empty()) {
+        if (!tracer.Open(tracePath)) {
+            std::cerr << "Couldn't create trace " << tracePath << "\n";
+            return 1;
+        }
+        cpu.Trace = &tracer;
+    }
+
+#ifdef CPU_6502_PROFILE
+    std::unique_ptr<profile_6502::Profile> profile;
+    profile_6502::CallGraph calls;
+    if (!profilePath.empty()) {
+        profile.reset(new profile_6502::Profile);
+        cpu.Profile = profile.get();
+    }
+    if (!profilePath.empty() || !foldedPath.empty())
+        cpu.Calls = &calls;
+    symbols_6502::Table symbols;
+    for (const std::string &path : labelPaths) {
+        if (symbols.Load(path) < 0) {
+            std::cerr << "Couldn't read symbols from " << path << "\n";
+            return 1;
+        }
+    }
+    calls.Symbols = &symbols;
+    std::unique_ptr<coverage_6502::Coverage> coverage;
+    if (!coveragePath.empty() || !heatmapPath.empty()) {
+        coverage.reset(new coverage_6502::Coverage);
+        mem.Coverage = coverage.get();
+    }
+#endif
+
+    // Counted by the CPU and memory as they go, picked up between slices
+    std::unique_ptr<telemetry_6502::Exporter> metrics;
+    telemetry_6502::Counters *telemetry = NULL;
+    if (!metricsPath.empty()) {
+        metrics.reset(new telemetry_6502::Exporter(metricsPath, metricsEvery));
+        metrics->Labels = "tool=\"6502em\",pid=\"" + std::to_string(getpid()) + "\"";
+        telemetry = &metrics->Thread();
+        telemetry->Begin(cpu, mem);
+        metrics->Start();
+    }
+    auto publish = [&]() {
+        if (!telemetry)
+            return;
+        telemetry->End(cpu, mem);
+        if (checkpoints) {
+            telemetry_6502::Counters::Set(telemetry->Snapshots, checkpoints->Taken);
+            telemetry_6502::Counters::Set(telemetry->SnapshotNs, checkpoints->TakeNs);
+            telemetry_6502::Counters::Set(telemetry->Checkpoints, checkpoints->Written + checkpoints->Failed);
+            telemetry_6502::Counters::Set(telemetry->CheckpointNs, checkpoints->WriteNs);
+        }
+        telemetry->Begin(cpu, mem);
+    };
+
+    if (opts.Hz) {
+        pace_6502::Pacer pacer;
+        pacer.TargetHz = opts.Hz;
+        pacer.MaxJitterNs = jitterUs * 1000;
+        pacer.Quit = &Quit;
+        pacer.AfterBatch = [&]() {
+            journal.Flush();
+            checkpointDue();
+            hashDue();
+            publish();
+        };
+        pacer.Run(cpu, mem, nCycles);
+        if (report)
+            pacer.Report(std::cerr);
+    } else {
+        // Only worth the syscalls around each slice if anyone's going to look
+        std::unique_ptr<hostperf_6502::Counters> host;
+        if (report)
+            host.reset(new hostperf_6502::Counters);
+        // --cycles counts from wherever a loaded state left the clock, same
+        // as the Pacer
+        uint64_t firstCycle = cpu.Cycles, firstInstruction = cpu.Instructions;
+        while (!cpu.Stopped && !Quit && (nCycles == 0 || cpu.Cycles - firstCycle < nCycles)) {
+            uint64_t slice = FLAT_OUT_SLICE;
+            uint64_t left = nCycles - (cpu.Cycles - firstCycle);
+            if (nCycles && left < slice)
+                slice = left;
+            if (checkpoints && nextCheckpoint - cpu.Cycles < slice)
+                slice = nextCheckpoint - cpu.Cycles;
+            if (hashes && nextHash - cpu.Cycles < slice)
+                slice = nextHash - cpu.Cycles;
+            if (host)
+                host->Start();
+            cpu.Execute(slice, mem);
+            if (host)
+                host->Stop();
+            journal.Flush();
+            checkpointDue();
+            hashDue();
+            publish();
+        }
+        if (host)
+            host->Report(std::cerr, cpu.Instructions - firstInstruction, cpu.Cycles - firstCycle);
+    }
+
+    if (m->Lcd && m->Lcd->Dirty)
+        m->Lcd->Render();
+
+    cpu.Trace = NULL;
+    tracer.Close();
+    if (tracer.Failed)
+        std::cerr << "Couldn't write all of the trace to " << tracePath << "\n";
+
+#ifdef CPU_6502_PROFILE
+    cpu.Profile = NULL;
+    cpu.Calls = NULL;
+    if (profile) {
+        std::ofstream file;
+        if (profilePath != "-")
+            file.open(profilePath);
+        std::ostream &out = profilePath == "-" ? std::cerr : file;
+        profile->Report(out, 20, &symbols);
+        calls.Report(out);
+        if (!out)
+            std::cerr << "Couldn't write the profile to " << profilePath << "\n";
+    }
+    if (!foldedPath.empty()) {
+        std::ofstream out(foldedPath);
+        calls.WriteFolded(out);
+        if (!out)
+            std::cerr << "Couldn't write the call stacks to " << foldedPath << "\n";
+    }
+    mem.Coverage = NULL;
+    if (!coveragePath.empty()) {
+        std::ofstream file;
+        if (coveragePath != "-")
+            file.open(coveragePath);
+        std::ostream &out = coveragePath == "-" ? std::cerr : file;
+        coverage->Report(out, &symbols);
+        if (!out)
+            std::cerr << "Couldn't write the coverage report to " << coveragePath << "\n";
+    }
+    if (!heatmapPath.empty()) {
+        // A spreadsheet of pages if it's asked for, a picture otherwise
+        bool csv = heatmapPath.size() >= 4 && heatmapPath.compare(heatmapPath.size() - 4, 4, ".csv") == 0;
+        std::ofstream out(heatmapPath, std::ios::binary);
+        if (csv)
+            coverage->WriteCSV(out);
+        else
+            coverage->WritePPM(out);
+        if (!out)
+            std::cerr << "Couldn't write the heatmap to " << heatmapPath << "\n";
+    }
+#endif
+
+    bool diverged = false;
+    if (journal.Replaying()) {
+        diverged = !journal.Finish(cpu.Cycles);
+        if (diverged)
+            std::cerr << "Replay diverged from the journal at cycle " << journal.DivergedAt << "\n";
+    }
+    journal.Close();
+
+    if (hashes) {
+        // Where it finished up, even if that's off the grid
+        if (hashedAt != cpu.Cycles) {
+            nextHash = cpu.Cycles;
+            hashDue();
+        }
+        fclose(hashes);
+    }
+
+    if (checkpoints) {
+        // One last one so a run that finished can be picked up from the end
+        checkpoints->Take(cpu, mem, m->Devices);
+        checkpoints->Flush();
+        if (checkpoints->Failed)
+            std::cerr << "Failed to write " << checkpoints->Failed << " checkpoints\n";
+    }
+
+    if (metrics) {
+        publish();
+        metrics->Stop();
+        if (metrics->Failed)
+            std::cerr << "Couldn't write metrics to " << metricsPath << " " << metrics->Failed << " times\n";
+    }
+
+    if (!saveState.empty() && !state_6502::SaveFile(saveState, cpu, mem, m->Devices)) {
+        std::cerr << "Couldn't write save state " << saveState << "\n";
+        return 1;
+    }
+
+    if (report) {
+        std::cerr << std::dec << "Cycles: " << cpu.Cycles << "\n";
+        cpu.debugReport();
+        if (m->Lcd)
+            std::cerr << "LCD:\n" << m->Lcd->Text() << "\n";
+        if (m->Disk)
+            std::cerr << "Disk: " << m->Disk->SectorsRead << " sectors read, " << m->Disk->SectorsWritten
+                      << " written, " << m->Disk->DMATransfers << " DMA transfers\n";
+        if (checkpoints)
+            std::cerr << "Checkpoints: " << checkpoints->Written << " written, " << checkpoints->Merged
+                      << " merged while the writer was busy\n";
+        if (!recordPath.empty() || !replayPath.empty())
+            std::cerr << "Journal: " << journal.Records << " records, " << journal.Bytes << " input bytes\n";
+        if (!tracePath.empty())
+            std::cerr << "Trace: " << tracer.Records() << " instructions, " << tracer.Bytes << " bytes in "
+                      << tracer.Blocks << " blocks, waited on the writer " << tracer.Stalls << " times\n";
+    }
+
+    if (Quit)
+        return 128 + Quit;
+    return diverged ? 3 : 0;
+}
@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "symbols.hpp"
+#include "trace.hpp"
+
+// Compares two traces written by 6502em --trace and shows where they first
+// part ways, with the instructions leading up to it:
+//
+//     6502tracediff [--context N] [--labels F] a.trace b.trace
+//
+// Runs of identical blocks are skipped on their hashes without being
+// decoded, so finding a divergence late in a long trace costs about the
+// same as finding one early. Exits 0 if the traces are the same, 1 if they
+// differ and 2 if something went wrong, same as diff.
+
+namespace {
+    void Usage(const char *argv0) {
+        std::cerr << "Usage: " << argv0 << " [options] a.trace b.trace\n"
+                  << "  --context N     instructions to show either side (default: 8)\n"
+                  << "  --labels F      name addresses from an assembler label file (repeatable)\n";
+    }
+
+    symbols_6502::Table symbols;
+
+    void Print(const char *side, uint64_t number, const trace_6502::Record &r) {
+        const char *kind = r.Kind == trace_6502::KIND_NMI ? "  NMI" : r.Kind == trace_6502::KIND_IRQ ? "  IRQ" : "";
+        std::string where = symbols.Empty() ? "" : "  " + symbols.Format(r.PC);
+        printf("%s %10llu %12llu  %04X  %02X %02X %02X  A=%02X X=%02X Y=%02X SP=%02X P=%02X  EA=%04X%s%s\n",
+               side, (unsigned long long)number, (unsigned long long)r.Cycle, r.PC,
+               r.Opcode, r.Operand[0], r.Operand[1], r.A, r.X, r.Y, r.SP, r.P, r.EA, kind, where.c_str());
+    }
+
+    bool Open(trace_6502::Reader &reader, const std::string &path) {
+        std::string error;
+        if (!reader.Open(path, &error)) {
+            std::cerr << path << ": " << error << "\n";
+            return false;
+        }
+        if (reader.Recovered)
+            std::cerr << path << ": no index, rebuilt it from the blocks\n";
+        return true;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t context = 8;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--context" && i + 1 < argc)
+            context = strtoul(argv[++i], NULL, 0);
+        else if (arg == "--labels" && i + 1 < argc) {
+            if (symbols.Load(argv[++i]) < 0) {
+                std::cerr << "Couldn't read symbols from " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg[0] != '-')
+            paths.push_back(arg);
+        else {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if (paths.size() != 2) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    trace_6502::Reader a, b;
+    if (!Open(a, paths[0]) || !Open(b, paths[1]))
+        return 2;
+
+    trace_6502::Divergence d;
+    if (!trace_6502::FirstDivergence(a, b, d)) {
+        std::cerr << "Damaged block, giving up\n";
+        return 2;
+    }
+    std::cerr << "Skipped " << d.BlocksSkipped << " identical blocks, decoded " << d.BlocksDecoded << "\n";
+    if (!d.Found) {
+        printf("Same %llu instructions\n", (unsigned long long)a.Records());
+        return 0;
+    }
+
+    uint64_t from = d.Record > context ? d.Record - context : 0;
+    std::vector<trace_6502::Record> before, left, right;
+    if (!a.Get(from, d.Record - from, before) || !a.Get(d.Record, context, left) ||
+        !b.Get(d.Record, context, right)) {
+        std::cerr << "Damaged block, giving up\n";
+        return 2;
+    }
+
+    printf("First difference at instruction %llu\n", (unsigned long long)d.Record);
+    for (size_t i = 0; i < before.size(); i++)
+        Print(" ", from + i, before[i]);
+    for (size_t i = 0; i < left.size(); i++)
+        Print("<", d.Record + i, left[i]);
+    if (left.empty())
+        printf("< (trace ends)\n");
+    for (size_t i = 0; i < right.size(); i++)
+        Print(">", d.Record + i, right[i]);
+    if (right.empty())
+        printf("> (trace ends)\n");
+    return 1;
+}